@@ -0,0 +1,356 @@
+/**
+ * An asynchronous logging sink - records are queued on a bounded lock-free ring, and formatted and written by one
+ * background thread, so that logging threads never wait on the sink's formatting or I/O
+ */
+#ifndef H_BOOST_EXT_ASYNC_LOG
+#define H_BOOST_EXT_ASYNC_LOG
+
+#include <string>
+#include "boost/noncopyable.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/bind.hpp"
+#include "boost/scoped_array.hpp"
+#include "boost/atomic.hpp"
+#include "boost/thread/thread.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/condition_variable.hpp"
+#include "boost/chrono/duration.hpp"
+#include "boost/chrono/system_clocks.hpp"
+#include "boost/log/core/record_view.hpp"
+#include "boost/log/trivial.hpp"
+#include "boost/log/sinks/basic_sink_frontend.hpp"
+#include "boost/log/detail/fake_mutex.hpp"
+
+#include "boost-ext/classes.hpp"
+#include "boost-ext/auto_lock.hpp"
+#include "boost-ext/thread_name.hpp"
+
+/** The default number of records an async sink can hold (rounded up to a power of two) */
+#if !defined(BOOST_EXT_LOG_ASYNC_CAPACITY)
+    #define BOOST_EXT_LOG_ASYNC_CAPACITY    8192
+#endif
+
+namespace boost_ext { namespace log {
+
+/**
+ * What an async sink does with a record when its ring is full - wait for the writer to make room (block), count it
+ * and throw it away (drop), or throw it away if it is less severe than a threshold and wait otherwise
+ * (drop_below_severity)
+ */
+enum async_overflow { block, drop, drop_below_severity };
+
+/**
+ * How an async sink queues its records - and how often it flushes its backend (by default whenever it runs out of
+ * records, or with a flush_interval, at most that often - flush() always flushes)
+ */
+class async_options {
+public:
+    async_options(std::size_t capacity = BOOST_EXT_LOG_ASYNC_CAPACITY, async_overflow overflow = block,
+                  boost::log::trivial::severity_level keep = boost::log::trivial::warning)
+        : m_capacity(capacity), m_overflow(overflow), m_keep(keep), m_flushInterval(0) {}
+
+    /** Drops records less severe than keep when the ring is full, and waits for room for the rest */
+    static async_options dropping_below(boost::log::trivial::severity_level keep,
+                                        std::size_t capacity = BOOST_EXT_LOG_ASYNC_CAPACITY) {
+        return async_options(capacity, drop_below_severity, keep);
+    }
+
+    M_ACCESSOR(async_options, std::size_t, capacity)
+    M_ACCESSOR(async_options, async_overflow, overflow)
+    M_ACCESSOR(async_options, boost::log::trivial::severity_level, keep)
+    ACCESSOR(async_options, boost::chrono::milliseconds, m_flushInterval, flush_interval)
+
+private:
+    std::size_t                         m_capacity;
+    async_overflow                      m_overflow;
+    boost::log::trivial::severity_level m_keep;
+    boost::chrono::milliseconds         m_flushInterval;
+};
+
+namespace detail {
+    /**
+     * A bounded multi-producer, single-consumer ring of records.  Each cell has a sequence number which says whether
+     * it is ready to be written (sequence == position) or read (sequence == position + 1), so producers only contend
+     * on a compare-and-swap of the tail, and the consumer doesn't touch it at all.
+     */
+    class record_ring : boost::noncopyable {
+    public:
+        explicit record_ring(std::size_t capacity) : m_mask(round_up(capacity) - 1), m_cells(new cell[m_mask + 1]),
+                                                     m_head(0), m_tail(0) {
+            for (std::size_t i = 0; i <= m_mask; i++) { m_cells[i].m_sequence.store(i, boost::memory_order_relaxed); }
+        }
+
+        /** Adds a record - returns false if the ring is full */
+        bool push(const boost::log::record_view& rec) {
+            std::size_t pos = m_tail.load(boost::memory_order_relaxed);
+            for (;;) {
+                cell& c = m_cells[pos & m_mask];
+                std::size_t seq = c.m_sequence.load(boost::memory_order_acquire);
+                std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+                if (diff == 0) {
+                    if (m_tail.compare_exchange_weak(pos, pos + 1, boost::memory_order_relaxed)) {
+                        c.m_record = rec;
+                        c.m_sequence.store(pos + 1, boost::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = m_tail.load(boost::memory_order_relaxed);
+                }
+            }
+        }
+
+        /** Takes the oldest record (on the consumer only) - returns false if there is none */
+        bool pop(boost::log::record_view& rec) {
+            cell& c = m_cells[m_head & m_mask];
+            if (c.m_sequence.load(boost::memory_order_acquire) != m_head + 1) { return false; }
+            rec.swap(c.m_record);
+            boost::log::record_view().swap(c.m_record);
+            c.m_sequence.store(m_head + m_mask + 1, boost::memory_order_release);
+            m_head++;
+            return true;
+        }
+
+        std::size_t capacity() const { return m_mask + 1; }
+
+    private:
+        struct cell {
+            boost::atomic<std::size_t>  m_sequence;
+            boost::log::record_view     m_record;
+        };
+
+        static std::size_t round_up(std::size_t n) {
+            std::size_t size = 2;
+            while (size < n) { size <<= 1; }
+            return size;
+        }
+
+        std::size_t                     m_mask;
+        boost::scoped_array<cell>       m_cells;
+        char                            m_pad1[BOOST_EXT_CACHE_LINE_SIZE];
+        std::size_t                     m_head;
+        char                            m_pad2[BOOST_EXT_CACHE_LINE_SIZE];
+        boost::atomic<std::size_t>      m_tail;
+    };
+}
+
+/**
+ * A sink frontend which hands records to its backend on a background thread.  Logging threads only copy the record
+ * (a reference count) into the ring - the writer thread formats them and writes them, flushing the backend whenever
+ * it runs out of records.  flush() (and core::flush()) waits until everything logged so far has been written, and
+ * destroying the sink writes whatever is still queued.
+ */
+template<typename BackendT>
+class async_sink : public boost::log::sinks::basic_formatting_sink_frontend<typename BackendT::char_type> {
+    typedef boost::log::sinks::basic_formatting_sink_frontend<typename BackendT::char_type> base_type;
+
+public:
+    typedef BackendT sink_backend_type;
+
+    explicit async_sink(const boost::shared_ptr<BackendT>& pBackend, const async_options& options = async_options())
+        : base_type(true), m_pBackend(pBackend), m_options(options), m_ring(options.capacity()), m_enqueued(0),
+          m_written(0), m_flushed(0), m_flushTarget(0), m_dropped(0), m_producing(0), m_waiters(0),
+          m_sleeping(false), m_stopping(false), m_thread(boost::bind(&async_sink::run, this)) {}
+    ~async_sink() { stop(); }
+
+    /** Queues a record (or drops it, if the ring is full and the options say so) */
+    void consume(const boost::log::record_view& rec) {
+        producing guard(m_producing);
+        if (m_stopping.load() || !enqueue(rec)) {
+            m_dropped.fetch_add(1, boost::memory_order_relaxed);
+            return;
+        }
+        enqueued();
+    }
+
+    /** Queues a record if there is room for it right now - returns false (and doesn't count it) if not */
+    bool try_consume(const boost::log::record_view& rec) {
+        producing guard(m_producing);
+        if (m_stopping.load() || !m_ring.push(rec)) { return false; }
+        enqueued();
+        return true;
+    }
+
+    /** Waits until every record queued before the call has been written, and the backend flushed */
+    void flush() {
+        boost::uint64_t target = m_enqueued.load();
+        auto_lock lock(m_mutex);
+        if (m_flushTarget.load() < target) { m_flushTarget.store(target); }
+        m_wakeup.notify_one();
+        while (m_flushed.load() < target && !m_stopping.load()) { m_progress.wait(lock); }
+    }
+
+    /**
+     * Writes whatever is queued, and stops the writer thread - later records are dropped.  Records pushed by threads
+     * which got past the check for stopping just before it was set are written here, once the writer has gone.
+     */
+    void stop() {
+        {
+            auto_lock lock(m_mutex);
+            if (m_stopping.exchange(true)) { return; }
+            m_wakeup.notify_one();
+            m_progress.notify_all();
+        }
+        m_thread.join();
+
+        while (m_producing.load() > 0) { boost::this_thread::yield(); }
+        boost::log::aux::fake_mutex unlocked;
+        write_queued(unlocked);
+        boost::uint64_t written = m_written.load();
+        if (written > m_flushed.load()) {
+            try { this->flush_backend(unlocked, *m_pBackend); } catch (...) {}
+            m_flushed.store(written);
+        }
+    }
+
+    /** The backend - it is only called on the writer thread, so take care touching it elsewhere */
+    const boost::shared_ptr<BackendT>& locked_backend() const { return m_pBackend; }
+
+    GETTER(const async_options&, m_options, options)
+
+    /** Records queued, written and dropped so far */
+    boost::uint64_t enqueued() const { return m_enqueued.load(boost::memory_order_relaxed); }
+    boost::uint64_t written() const { return m_written.load(boost::memory_order_relaxed); }
+    boost::uint64_t dropped() const { return m_dropped.load(boost::memory_order_relaxed); }
+
+private:
+    typedef boost::log::value_ref<boost::log::trivial::severity_level, boost::log::trivial::tag::severity> severity_ref;
+
+    /**
+     * Counts a thread in consume() for as long as it might push - stop() waits for these to leave (the counter and
+     * m_stopping are both sequentially consistent, so either stop() sees the producer or the producer sees it stopping)
+     */
+    struct producing : boost::noncopyable {
+        explicit producing(boost::atomic<int>& count) : m_count(count) { m_count.fetch_add(1); }
+        ~producing() { m_count.fetch_sub(1); }
+        boost::atomic<int>& m_count;
+    };
+
+    /** Counts a pushed record, and wakes the writer if it is asleep */
+    void enqueued() {
+        m_enqueued.fetch_add(1);
+        if (m_sleeping.load()) {
+            auto_lock lock(m_mutex);
+            m_wakeup.notify_one();
+        }
+    }
+
+    /** Pushes a record, waiting for room as the overflow policy says - returns false if it should be dropped */
+    bool enqueue(const boost::log::record_view& rec) {
+        if (m_ring.push(rec)) { return true; }
+        if (m_options.overflow() == drop) { return false; }
+        if (m_options.overflow() == drop_below_severity) {
+            severity_ref lvl = rec[boost::log::trivial::severity];
+            if (!lvl || lvl.get() < m_options.keep()) { return false; }
+        }
+
+        m_waiters.fetch_add(1);
+        auto_lock lock(m_mutex);
+        bool pushed;
+        while (!(pushed = m_ring.push(rec)) && !m_stopping.load()) {
+            m_wakeup.notify_one();
+            m_progress.wait(lock);
+        }
+        m_waiters.fetch_sub(1);
+        return pushed;
+    }
+
+    /** Formats and writes a record - one which fails (with no exception handler set) is counted as dropped */
+    void write(const boost::log::record_view& rec, boost::log::aux::fake_mutex& unlocked) {
+        try {
+            this->feed_record(rec, unlocked, *m_pBackend);
+        } catch (...) {
+            m_dropped.fetch_add(1, boost::memory_order_relaxed);
+        }
+    }
+
+    /** Whether the backend should be flushed now (there being records written since it last was) */
+    bool flush_due(const boost::chrono::steady_clock::time_point& lastFlush) const {
+        return m_options.flush_interval() <= boost::chrono::milliseconds::zero() || m_stopping.load() ||
+               m_flushTarget.load() > m_flushed.load() ||
+               boost::chrono::steady_clock::now() - lastFlush >= m_options.flush_interval();
+    }
+
+    /** Whether there is nothing to do but wait */
+    bool idle() const {
+        return m_written.load() >= m_enqueued.load() && !m_stopping.load() && m_flushTarget.load() <= m_flushed.load();
+    }
+
+    /** Writes every record in the ring (on the writer, or in stop() once it has gone) */
+    void write_queued(boost::log::aux::fake_mutex& unlocked) {
+        boost::log::record_view rec;
+        while (m_ring.pop(rec)) {
+            write(rec, unlocked);
+            boost::log::record_view().swap(rec);
+            m_written.fetch_add(1);
+            if (m_waiters.load() > 0) {
+                auto_lock lock(m_mutex);
+                m_progress.notify_all();
+            }
+        }
+    }
+
+    void run() {
+        set_current_thread_name("async-log");
+        boost::log::aux::fake_mutex unlocked;
+        boost::chrono::steady_clock::time_point lastFlush = boost::chrono::steady_clock::now();
+        for (;;) {
+            write_queued(unlocked);
+            boost::uint64_t written = m_written.load();
+            if (written > m_flushed.load() && flush_due(lastFlush)) {
+                try { this->flush_backend(unlocked, *m_pBackend); } catch (...) {}
+                m_flushed.store(written);
+                lastFlush = boost::chrono::steady_clock::now();
+            }
+
+            /*
+             * Sleep until there is something to write, or a flush to do (m_sleeping and m_enqueued guard lost
+             * wakeups) - with unflushed records and an interval, only until they are due
+             */
+            auto_lock lock(m_mutex);
+            m_progress.notify_all();
+            if (m_stopping.load() && m_written.load() >= m_enqueued.load() && m_flushed.load() >= m_written.load()) {
+                return;
+            }
+            m_sleeping.store(true);
+            while (idle()) {
+                if (m_written.load() > m_flushed.load()) {
+                    boost::chrono::steady_clock::duration left =
+                        lastFlush + m_options.flush_interval() - boost::chrono::steady_clock::now();
+                    if (left <= boost::chrono::steady_clock::duration::zero() ||
+                        m_wakeup.wait_for(lock, left) == boost::cv_status::timeout) {
+                        break;
+                    }
+                } else {
+                    m_wakeup.wait(lock);
+                }
+            }
+            m_sleeping.store(false);
+        }
+    }
+
+private:
+    boost::shared_ptr<BackendT>     m_pBackend;
+    async_options                   m_options;
+    detail::record_ring             m_ring;
+    boost::atomic<boost::uint64_t>  m_enqueued;
+    boost::atomic<boost::uint64_t>  m_written;
+    boost::atomic<boost::uint64_t>  m_flushed;
+    boost::atomic<boost::uint64_t>  m_flushTarget;
+    boost::atomic<boost::uint64_t>  m_dropped;
+    boost::atomic<int>              m_producing;
+    boost::atomic<int>              m_waiters;
+    boost::atomic<bool>             m_sleeping;
+    boost::atomic<bool>             m_stopping;
+
+    boost::mutex                    m_mutex;
+    boost::condition_variable       m_wakeup;
+    boost::condition_variable       m_progress;
+    boost::thread                   m_thread;
+};
+
+}}
+
+#endif /* H_BOOST_EXT_ASYNC_LOG */
@@ -0,0 +1,356 @@
+/**
+ * Micro-batching on a thread_pool - items from many producers are collected and handed to a handler in batches, so
+ * that tiny pieces of work don't each pay for a task
+ */
+#ifndef H_BOOST_EXT_BATCHER
+#define H_BOOST_EXT_BATCHER
+
+#include <new>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include "boost/noncopyable.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/make_shared.hpp"
+#include "boost/function.hpp"
+#include "boost/atomic.hpp"
+#include "boost/move/utility.hpp"
+#include "boost/system/error_code.hpp"
+
+#include "boost-ext/common.hpp"
+#include "boost-ext/classes.hpp"
+#include "boost-ext/task.hpp"
+#include "boost-ext/timing_wheel.hpp"
+#include "boost-ext/pool_metrics.hpp"
+#include "boost-ext/serial_executor.hpp"
+#include "boost-ext/thread_pool.hpp"
+
+/** The number of buffers producers are spread across (by thread) in each batcher */
+#if !defined(BOOST_EXT_BATCHER_STRIPES)
+    #define BOOST_EXT_BATCHER_STRIPES   16
+#endif
+
+namespace boost_ext {
+
+/** A point-in-time copy of a batcher's counters */
+struct batcher_stats {
+    batcher_stats() : m_items(0), m_delivered(0), m_batches(0), m_sizeFlushes(0), m_timerFlushes(0),
+                      m_largestBatch(0) {}
+
+    double mean_batch() const { return m_batches ? static_cast<double>(m_delivered) / m_batches : 0; }
+
+    TO_STRING_FX(batcher_stats) {
+        std::stringstream s;
+        s << m_items << " items, " << m_batches << " batches (mean " << mean_batch() << ", largest " << m_largestBatch
+          << "), " << m_sizeFlushes << " size flushes, " << m_timerFlushes << " timer flushes, latency p50/p99 "
+          << m_latency.percentile(50).count() / 1000 << "/" << m_latency.percentile(99).count() / 1000 << "us";
+        return s.str();
+    }
+
+    /** Items added, and items handed to the handler */
+    boost::uint64_t                 m_items;
+    boost::uint64_t                 m_delivered;
+    boost::uint64_t                 m_batches;
+    /** Flushes started because a batch filled up, and because the oldest item had waited the maximum delay */
+    boost::uint64_t                 m_sizeFlushes;
+    boost::uint64_t                 m_timerFlushes;
+    std::size_t                     m_largestBatch;
+    /** How long the first item of each flush waited before the handler got it */
+    histogram_snapshot              m_latency;
+};
+
+namespace detail {
+    /**
+     * The buffers and flush state behind a batcher.  Producers push onto one of a set of padded lock-free stacks
+     * (picked by thread, so producers on different threads rarely touch the same cache line) and count themselves
+     * in.  The push which fills a batch queues a flush, and the push which finds the batcher empty arms the delay
+     * timer.  Flushes run on a strand, so the handler is never called concurrently.
+     */
+    template<typename T>
+    class batch_state : boost::noncopyable {
+    public:
+        typedef boost::function<void(std::vector<T>&)>  handler;
+        enum flush_cause { size_flush, timer_flush, manual_flush };
+
+        batch_state(thread_pool& pool, const handler& fx, std::size_t maxBatch, boost::int64_t maxDelayNs)
+            : m_pool(pool), m_strand(pool.make_strand()), m_fx(fx), m_maxBatch(std::max<std::size_t>(maxBatch, 1)),
+              m_maxDelay(milliseconds_as<timing_wheel::duration>(std::max<boost::int64_t>(maxDelayNs / 1000000, 1))),
+              m_count(0), m_firstAt(0), m_flushQueued(false), m_timerArmed(false), m_items(0), m_delivered(0),
+              m_batches(0), m_sizeFlushes(0), m_timerFlushes(0), m_largestBatch(0) {
+            for (std::size_t i = 0; i < BOOST_EXT_BATCHER_STRIPES; i++) { m_stripes[i].m_pTop.store(NULL); }
+        }
+        ~batch_state() {
+            for (std::size_t i = 0; i < BOOST_EXT_BATCHER_STRIPES; i++) {
+                free_list(m_stripes[i].m_pTop.exchange(NULL));
+            }
+        }
+
+        /** Buffers a value, and queues a flush or arms the timer as needed */
+        void push(const T& value, const boost::shared_ptr<batch_state>& pSelf) {
+            void* p = pooled_allocate(sizeof(node));
+            node_memory memory(p);
+            push_node(new (p) node(value), pSelf);
+            memory.m_p = NULL;
+        }
+    #if !defined(BOOST_NO_CXX11_RVALUE_REFERENCES)
+        void push(T&& value, const boost::shared_ptr<batch_state>& pSelf) {
+            void* p = pooled_allocate(sizeof(node));
+            node_memory memory(p);
+            push_node(new (p) node(static_cast<T&&>(value)), pSelf);
+            memory.m_p = NULL;
+        }
+    #endif
+
+        /** Queues a flush on the strand, unless one is already queued */
+        void request_flush(const boost::shared_ptr<batch_state>& pSelf, flush_cause cause) {
+            if (m_flushQueued.load(boost::memory_order_relaxed) || m_flushQueued.exchange(true)) { return; }
+            m_strand.execute(flush_task(pSelf, cause));
+        }
+
+        /** Hands everything buffered to the handler, in batches of up to the maximum size (on the strand) */
+        void flush(const boost::shared_ptr<batch_state>& pSelf, flush_cause cause) {
+            m_flushQueued.store(false);
+            boost::int64_t firstAt = m_firstAt.load(boost::memory_order_relaxed);
+
+            /* Take every stripe, keeping each one's items in the order they were added */
+            node* pList = NULL;
+            long taken = 0;
+            for (std::size_t i = 0; i < BOOST_EXT_BATCHER_STRIPES; i++) {
+                node* pStack = m_stripes[i].m_pTop.exchange(NULL, boost::memory_order_acquire);
+                node* pStripe = NULL;
+                while (pStack) {
+                    node* pNode = pStack;
+                    pStack = pNode->m_pNext, pNode->m_pNext = pStripe, pStripe = pNode, taken++;
+                }
+                if (pStripe) {
+                    node* pLast = pStripe;
+                    while (pLast->m_pNext) { pLast = pLast->m_pNext; }
+                    pLast->m_pNext = pList, pList = pStripe;
+                }
+            }
+
+            /* Items which arrived meanwhile need the timer (the push that finds us empty arms it itself) */
+            if (m_count.fetch_sub(taken, boost::memory_order_acq_rel) - taken > 0) {
+                m_firstAt.store(pool_metrics::now(), boost::memory_order_relaxed);
+                arm(pSelf);
+            }
+            if (!pList) { return; }
+
+            if (cause == size_flush) { m_sizeFlushes.fetch_add(1, boost::memory_order_relaxed); }
+            if (cause == timer_flush) { m_timerFlushes.fetch_add(1, boost::memory_order_relaxed); }
+            m_latency.record(pool_metrics::now() - firstAt);
+
+            while (pList) {
+                m_batch.clear();
+                while (pList && m_batch.size() < m_maxBatch) {
+                    node* pNode = pList;
+                    pList = pNode->m_pNext;
+                    m_batch.push_back(boost::move(pNode->m_value));
+                    destroy(pNode);
+                }
+                std::size_t size = m_batch.size();
+                m_delivered.fetch_add(size, boost::memory_order_relaxed);
+                m_batches.fetch_add(1, boost::memory_order_relaxed);
+                std::size_t largest = m_largestBatch.load(boost::memory_order_relaxed);
+                while (size > largest &&
+                       !m_largestBatch.compare_exchange_weak(largest, size, boost::memory_order_relaxed)) {}
+
+                /* A throwing handler loses the rest of this flush (which is freed rather than leaked) */
+                node_guard guard(pList);
+                m_fx(m_batch);
+                guard.m_armed = false;
+            }
+        }
+
+        batcher_stats stats() const {
+            batcher_stats s;
+            s.m_items = m_items.load(boost::memory_order_relaxed);
+            s.m_delivered = m_delivered.load(boost::memory_order_relaxed);
+            s.m_batches = m_batches.load(boost::memory_order_relaxed);
+            s.m_sizeFlushes = m_sizeFlushes.load(boost::memory_order_relaxed);
+            s.m_timerFlushes = m_timerFlushes.load(boost::memory_order_relaxed);
+            s.m_largestBatch = m_largestBatch.load(boost::memory_order_relaxed);
+            s.m_latency = m_latency.snapshot();
+            return s;
+        }
+
+        /** The number of items waiting for a flush */
+        std::size_t pending() const { return static_cast<std::size_t>(std::max<long>(m_count.load(), 0)); }
+
+        GETTER(std::size_t, m_maxBatch, max_batch)
+
+    private:
+        struct node {
+            explicit node(const T& value) : m_value(value), m_pNext(NULL) {}
+        #if !defined(BOOST_NO_CXX11_RVALUE_REFERENCES)
+            explicit node(T&& value) : m_value(static_cast<T&&>(value)), m_pNext(NULL) {}
+        #endif
+            T       m_value;
+            node*   m_pNext;
+        };
+
+        /** A padded buffer - one of the stripes which producers are spread across */
+        struct stripe {
+            boost::atomic<node*>    m_pTop;
+            char                    m_pad[BOOST_EXT_CACHE_LINE_SIZE];
+        };
+
+        /** Runs a flush on the strand (keeping the state alive until it has) */
+        struct flush_task {
+            flush_task(const boost::shared_ptr<batch_state>& pState, flush_cause cause) : m_pState(pState),
+                                                                                          m_cause(cause) {}
+            void operator()() { m_pState->flush(m_pState, m_cause); }
+            boost::shared_ptr<batch_state>  m_pState;
+            flush_cause                     m_cause;
+        };
+
+        /** What the delay timer runs - scheduled_functor needs it to be default constructible */
+        struct timer_handler {
+            timer_handler() {}
+            explicit timer_handler(const boost::shared_ptr<batch_state>& pState) : m_pState(pState) {}
+            void operator()(const boost::system::error_code& error) {
+                if (!m_pState) { return; }
+                m_pState->m_timerArmed.store(false);
+                if (!error) { m_pState->request_flush(m_pState, timer_flush); }
+            }
+            boost::shared_ptr<batch_state>  m_pState;
+        };
+
+        /** Frees a node's memory if its value's constructor throws */
+        struct node_memory {
+            explicit node_memory(void* p) : m_p(p) {}
+            ~node_memory() {
+                if (m_p) { pooled_deallocate(m_p, sizeof(node)); }
+            }
+            void*   m_p;
+        };
+
+        /** Frees the rest of a list if the handler throws */
+        struct node_guard {
+            explicit node_guard(node*& pList) : m_pList(pList), m_armed(true) {}
+            ~node_guard() {
+                if (m_armed) { free_list(m_pList), m_pList = NULL; }
+            }
+            node*&  m_pList;
+            bool    m_armed;
+        };
+
+        void push_node(node* pNew, const boost::shared_ptr<batch_state>& pSelf) {
+            stripe& s = m_stripes[thread_stripe()];
+            node* pTop = s.m_pTop.load(boost::memory_order_relaxed);
+            do {
+                pNew->m_pNext = pTop;
+            } while (!s.m_pTop.compare_exchange_weak(pTop, pNew, boost::memory_order_release,
+                                                     boost::memory_order_relaxed));
+            m_items.fetch_add(1, boost::memory_order_relaxed);
+
+            long n = m_count.fetch_add(1, boost::memory_order_acq_rel) + 1;
+            if (n == 1) {
+                m_firstAt.store(pool_metrics::now(), boost::memory_order_relaxed);
+                arm(pSelf);
+            }
+            if (n >= static_cast<long>(m_maxBatch)) { request_flush(pSelf, size_flush); }
+        }
+
+        /** Each thread's stripe - threads are numbered as they first add to any batcher */
+        static std::size_t thread_stripe() {
+            static THREAD_LOCAL std::size_t stripe = (std::size_t) -1;
+            if (stripe == (std::size_t) -1) {
+                static boost::atomic<std::size_t> next(0);
+                stripe = next.fetch_add(1, boost::memory_order_relaxed) % BOOST_EXT_BATCHER_STRIPES;
+            }
+            return stripe;
+        }
+
+        /** Starts the delay timer on the pool's timing wheel, unless it is already running */
+        void arm(const boost::shared_ptr<batch_state>& pSelf) {
+            if (m_timerArmed.load(boost::memory_order_relaxed) || m_timerArmed.exchange(true)) { return; }
+            m_pool.schedule(boost::make_shared<scheduled_functor<timer_handler> >(timer_handler(pSelf),
+                                                                                 scheduled_task::wheel_timer),
+                            m_maxDelay);
+        }
+
+        static void destroy(node* pNode) {
+            pNode->~node();
+            pooled_deallocate(pNode, sizeof(node));
+        }
+        static void free_list(node* pNode) {
+            while (pNode) {
+                node* pNext = pNode->m_pNext;
+                destroy(pNode);
+                pNode = pNext;
+            }
+        }
+
+    private:
+        thread_pool&                    m_pool;
+        serial_executor                 m_strand;
+        handler                         m_fx;
+        std::size_t                     m_maxBatch;
+        timing_wheel::duration          m_maxDelay;
+
+        stripe                          m_stripes[BOOST_EXT_BATCHER_STRIPES];
+        boost::atomic<long>             m_count;
+        boost::atomic<boost::int64_t>   m_firstAt;
+        boost::atomic<bool>             m_flushQueued;
+        boost::atomic<bool>             m_timerArmed;
+
+        /** The batch being handed over (only touched on the strand) */
+        std::vector<T>                  m_batch;
+
+        boost::atomic<boost::uint64_t>  m_items;
+        boost::atomic<boost::uint64_t>  m_delivered;
+        boost::atomic<boost::uint64_t>  m_batches;
+        boost::atomic<boost::uint64_t>  m_sizeFlushes;
+        boost::atomic<boost::uint64_t>  m_timerFlushes;
+        boost::atomic<std::size_t>      m_largestBatch;
+        latency_histogram               m_latency;
+    };
+}
+
+/**
+ * Collects items from any number of threads and hands them to a handler in batches - when maxBatch items are
+ * waiting, or when the oldest has waited maxDelay (give or take a tick of the pool's timing wheel), whichever is
+ * first.  The handler runs on the pool, one batch at a time, and may take the items out of the vector it is given.
+ * Items added on one thread reach the handler in the order they were added - there is no order across threads.
+ *
+ *     batcher<row> writes(pool, boost::bind(&db::insert_all, &db, _1), 500, boost::chrono::milliseconds(20));
+ *     writes.add(r);
+ *
+ * Destroying a batcher queues a final flush for whatever is left.  The pool must outlive it.
+ */
+template<typename T>
+class batcher : boost::noncopyable {
+public:
+    typedef typename detail::batch_state<T>::handler handler;
+
+    template<typename D>
+    batcher(thread_pool& pool, const handler& fx, std::size_t maxBatch, D maxDelay)
+        : m_pState(boost::make_shared<detail::batch_state<T> >(boost::ref(pool), fx, maxBatch,
+                                                                pool_metrics::nanoseconds(maxDelay))) {}
+    ~batcher() { flush(); }
+
+    void add(const T& value) { m_pState->push(value, m_pState); }
+#if !defined(BOOST_NO_CXX11_RVALUE_REFERENCES)
+    void add(T&& value) { m_pState->push(static_cast<T&&>(value), m_pState); }
+#endif
+
+    /** Queues a flush of everything added so far, without waiting for a full batch or the timer */
+    void flush() { m_pState->request_flush(m_pState, detail::batch_state<T>::manual_flush); }
+
+    /** The number of items which haven't been handed over yet */
+    std::size_t pending() const { return m_pState->pending(); }
+
+    std::size_t max_batch() const { return m_pState->max_batch(); }
+
+    batcher_stats stats() const { return m_pState->stats(); }
+
+private:
+    boost::shared_ptr<detail::batch_state<T> >   m_pState;
+};
+
+}
+
+#endif /* H_BOOST_EXT_BATCHER */
@@ -0,0 +1,368 @@
+/**
+ * Blocking regions - marking the blocking calls (JNI, I/O, sleeps) that a pool worker makes, so that the pool can put
+ * another thread to work in its place until the call returns
+ */
+#ifndef H_BOOST_EXT_BLOCKING_REGION
+#define H_BOOST_EXT_BLOCKING_REGION
+
+#include <vector>
+#include "boost/noncopyable.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/make_shared.hpp"
+#include "boost/function.hpp"
+#include "boost/bind.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/atomic.hpp"
+#include "boost/thread.hpp"
+#include "boost/asio.hpp"
+#include "boost/asio/steady_timer.hpp"
+#include "boost/chrono/chrono.hpp"
+
+#include "boost-ext/common.hpp"
+#include "boost-ext/auto_lock.hpp"
+#include "boost-ext/elastic_workers.hpp"
+
+/** The most compensating threads a pool runs at once */
+#if !defined(BOOST_EXT_THREAD_POOL_MAX_COMPENSATION)
+    #define BOOST_EXT_THREAD_POOL_MAX_COMPENSATION  64
+#endif
+
+/** How long a worker must have been in a blocking region before a stand-in takes its place */
+#if !defined(BOOST_EXT_THREAD_POOL_COMPENSATE_AFTER_MS)
+    #define BOOST_EXT_THREAD_POOL_COMPENSATE_AFTER_MS   1
+#endif
+
+namespace boost_ext {
+
+namespace detail {
+    /**
+     * Stands in for a pool's blocked workers.  A blocking region on a worker (which has attach()ed) only publishes
+     * that the worker is blocked - while any region is open, the monitor thread (shared with elastic pools) checks
+     * every BOOST_EXT_THREAD_POOL_COMPENSATE_AFTER_MS, and hands each worker which has been blocked for longer than
+     * that to a stand-in thread.  The stand-in runs the pool's work in the worker's place until the region ends, then
+     * finishes the task in hand and parks until it is needed again (or exits, once it has been parked for idleMs).  So
+     * a region which returns at once costs a few atomics, and stand-in threads are reused rather than started per
+     * region.
+     */
+    class blocking_compensator : boost::noncopyable {
+    public:
+        typedef boost::function<bool()>                             predicate;
+        /** Runs the pool's work on the calling thread (as the blocked worker would) until the predicate is false */
+        typedef boost::function<void(const predicate&)>             loop;
+        /** Called on a worker when it first blocks - returns the loop for its stand-ins (or an empty loop) */
+        typedef boost::function<loop()>                             loop_factory;
+        typedef boost::function<void()>                             callback;
+        typedef boost::asio::steady_timer::clock_type::duration     duration;
+
+        /** A worker thread's regions - made on its first region, and kept (and reused) until the thread exits */
+        struct worker_slot : boost::noncopyable {
+            worker_slot(blocking_compensator* pOwner) : m_pOwner(pOwner), m_count(0), m_since(0), m_region(0),
+                                                        m_covered(0) {}
+
+            blocking_compensator*           m_pOwner;
+            /** The loop a stand-in runs for this worker (guarded by the owner's m_mutex) */
+            loop                            m_body;
+            /** The number of regions so far (only touched by the worker) */
+            boost::uint64_t                 m_count;
+            /** When the current region started, its number (zero between regions), and the region being covered */
+            boost::atomic<boost::int64_t>   m_since;
+            boost::atomic<boost::uint64_t>  m_region;
+            boost::atomic<boost::uint64_t>  m_covered;
+        };
+
+        typedef boost::shared_ptr<worker_slot>                      slot_ptr;
+
+        blocking_compensator(const loop_factory& loopFor, const callback& wake, const callback& onStart,
+                             int maxThreads = BOOST_EXT_THREAD_POOL_MAX_COMPENSATION,
+                             int idleMs = BOOST_EXT_THREAD_POOL_IDLE_TIMEOUT_MS)
+            : m_loopFor(loopFor), m_wake(wake), m_onStart(onStart), m_maxThreads(maxThreads), m_idleMs(idleMs),
+              m_blocked(0), m_regions(0), m_compensations(0), m_ticking(false), m_live(0), m_parked(0),
+              m_stopping(false), m_pMonitor(boost::make_shared<monitor>(this)) {}
+        ~blocking_compensator() { join(); }
+
+        /**
+         * Makes blocking regions on the calling thread compensate through us - until the thread exits, which releases
+         * its slot (so the thread must exit before we are destroyed, as a pool's workers do)
+         */
+        void attach() {
+            if (current() == this) { return; }
+            current() = this;
+            boost::this_thread::at_thread_exit(boost::bind(&blocking_compensator::detach, this));
+        }
+
+        /** The compensator of the calling thread's pool (if it is a worker which isn't already in a region) */
+        static blocking_compensator*& current() { static THREAD_LOCAL blocking_compensator* p = NULL; return p; }
+
+        /** Marks the calling worker as blocked - returns its slot, or NULL if it can't be compensated */
+        worker_slot* enter() {
+            m_regions.fetch_add(1, boost::memory_order_relaxed);
+            m_blocked.fetch_add(1);
+            worker_slot* pSlot = slot();
+            if (!pSlot) { return NULL; }
+
+            pSlot->m_since.store(now(), boost::memory_order_relaxed);
+            pSlot->m_region.store(++pSlot->m_count);
+            if (!m_ticking.load() && !m_ticking.exchange(true)) {
+                auto_lock lock(m_pMonitor->m_mutex);
+                schedule_tick();
+            }
+            return pSlot;
+        }
+
+        void leave(worker_slot* pSlot) {
+            m_blocked.fetch_sub(1);
+            if (!pSlot) { return; }
+            pSlot->m_region.store(0);
+            if (pSlot->m_covered.exchange(0) != 0 && m_wake) { m_wake(); }
+        }
+
+        /** Stops checking, and waits for every stand-in thread - the pool must have stopped its work first */
+        void join() {
+            {
+                auto_lock lock(m_pMonitor->m_mutex);
+                m_pMonitor->m_pCompensator = NULL;
+                m_pMonitor->m_timer.cancel();
+            }
+            std::vector<boost::thread*> threads;
+            {
+                auto_lock lock(m_mutex);
+                m_stopping = true;
+                m_jobs.clear();
+                threads.swap(m_threads);
+                m_jobReady.notify_all();
+            }
+            for (std::size_t i = 0; i < threads.size(); i++) { threads[i]->join(); delete threads[i]; }
+        }
+
+        /** The regions entered so far, the times a stand-in took a worker's place, and the workers blocked right now */
+        boost::uint64_t regions() const { return m_regions.load(boost::memory_order_relaxed); }
+        boost::uint64_t compensations() const { return m_compensations.load(boost::memory_order_relaxed); }
+        int blocked() const { return m_blocked.load(); }
+
+        /** The stand-in threads (working or parked), and the threads with a slot (which have had a region) */
+        std::size_t stand_ins() const { auto_lock lock(m_mutex); return m_threads.size() - m_exited.size(); }
+        std::size_t slots() const { auto_lock lock(m_mutex); return m_slots.size(); }
+
+    private:
+        /** A blocked worker handed to a stand-in */
+        struct job {
+            job(const slot_ptr& pSlot, boost::uint64_t region) : m_pSlot(pSlot), m_region(region),
+                                                                 m_body(pSlot->m_body) {}
+            slot_ptr        m_pSlot;
+            boost::uint64_t m_region;
+            loop            m_body;
+        };
+
+        /** The monitor's view of us - it outlives us if a tick is still queued when we are destroyed */
+        struct monitor : boost::noncopyable {
+            monitor(blocking_compensator* pCompensator) : m_pCompensator(pCompensator),
+                                                          m_timer(elastic_monitor::service()) {}
+
+            static void on_tick(boost::shared_ptr<monitor> pMonitor, const boost::system::error_code& error) {
+                auto_lock lock(pMonitor->m_mutex);
+                if (!error && pMonitor->m_pCompensator) { pMonitor->m_pCompensator->tick(); }
+            }
+
+            boost::mutex                m_mutex;
+            blocking_compensator*       m_pCompensator;
+            boost::asio::steady_timer   m_timer;
+        };
+
+        static boost::int64_t now() {
+            return boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+                boost::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        static worker_slot*& thread_slot() { static THREAD_LOCAL worker_slot* p = NULL; return p; }
+
+        /** The calling thread's slot (made on first use) - NULL if we have no loop to stand in for it */
+        worker_slot* slot() {
+            worker_slot*& pSlot = thread_slot();
+            if (!pSlot || pSlot->m_pOwner != this) {
+                loop body = m_loopFor ? m_loopFor() : loop();
+                auto_lock lock(m_mutex);
+                pSlot = add_slot();
+                pSlot->m_body = body;
+            }
+            return pSlot->m_body ? pSlot : NULL;
+        }
+
+        /** Makes a slot for the calling thread (m_mutex must be held) */
+        worker_slot* add_slot() {
+            m_slots.push_back(boost::make_shared<worker_slot>(this));
+            return m_slots.back().get();
+        }
+
+        /** Releases the calling thread's slot, if it has one of ours (m_mutex must be held) */
+        void release_slot() {
+            worker_slot*& pSlot = thread_slot();
+            if (!pSlot || pSlot->m_pOwner != this) { return; }
+            for (std::size_t i = 0; i < m_slots.size(); i++) {
+                if (m_slots[i].get() != pSlot) { continue; }
+                m_slots.erase(m_slots.begin() + i);
+                break;
+            }
+            pSlot = NULL;
+        }
+
+        /** Called as an attached thread exits - a stand-in still covering its last region keeps the slot alive */
+        void detach() {
+            if (current() == this) { current() = NULL; }
+            worker_slot* pSlot = thread_slot();
+            if (!pSlot || pSlot->m_pOwner != this) { return; }
+            auto_lock lock(m_mutex);
+            release_slot();
+        }
+
+        /** Cleans up stand-ins which have exited (m_mutex must be held) */
+        void join_exited() {
+            for (std::size_t i = 0; i < m_exited.size(); i++) {
+                for (std::size_t j = 0; j < m_threads.size(); j++) {
+                    if (m_threads[j]->get_id() != m_exited[i]) { continue; }
+                    m_threads[j]->join();
+                    delete m_threads[j];
+                    m_threads.erase(m_threads.begin() + j);
+                    break;
+                }
+            }
+            m_exited.clear();
+        }
+
+        /** Waits for the next check (the monitor's mutex must be held) */
+        void schedule_tick() {
+            m_pMonitor->m_timer.expires_from_now(milliseconds_as<duration>(BOOST_EXT_THREAD_POOL_COMPENSATE_AFTER_MS));
+            m_pMonitor->m_timer.async_wait(boost::bind(&monitor::on_tick, m_pMonitor,
+                                                       boost::asio::placeholders::error));
+        }
+
+        /** Hands workers which have been blocked for too long to stand-ins (on the monitor, with its mutex held) */
+        void tick() {
+            boost::int64_t t = now(), after = BOOST_EXT_THREAD_POOL_COMPENSATE_AFTER_MS * 1000000LL;
+            {
+                auto_lock lock(m_mutex);
+                for (std::size_t i = 0; i < m_slots.size() && m_live < m_maxThreads && !m_stopping; i++) {
+                    worker_slot& w = *m_slots[i];
+                    boost::uint64_t region = w.m_region.load(), none = 0;
+                    if (region == 0 || !w.m_body || t - w.m_since.load(boost::memory_order_relaxed) < after) {
+                        continue;
+                    }
+                    if (!w.m_covered.compare_exchange_strong(none, region)) { continue; }
+                    if (w.m_region.load() != region) {
+                        /* The region ended meanwhile (and leave() may or may not have seen our claim) */
+                        w.m_covered.compare_exchange_strong(region, 0);
+                        continue;
+                    }
+
+                    m_compensations.fetch_add(1, boost::memory_order_relaxed);
+                    m_jobs.push_back(job(m_slots[i], region));
+                    m_live++;
+                    if ((int) m_jobs.size() > m_parked) {
+                        join_exited();
+                        m_threads.push_back(new boost::thread(boost::bind(&blocking_compensator::stand_in, this)));
+                    } else {
+                        m_jobReady.notify_one();
+                    }
+                }
+            }
+
+            /* Keep checking while anyone is blocked (an enter() which raced with this will see m_ticking clear) */
+            m_ticking.store(false);
+            if (m_blocked.load() > 0 && !m_ticking.exchange(true)) { schedule_tick(); }
+        }
+
+        static bool covering(const slot_ptr& pSlot, boost::uint64_t region) {
+            return pSlot->m_covered.load() == region;
+        }
+
+        /**
+         * A stand-in thread - it runs the jobs it is given, and parks in between.  One which is parked for m_idleMs
+         * releases its slot and exits (to be joined by the next tick which starts a stand-in, or by join()).
+         */
+        void stand_in() {
+            if (m_onStart) { m_onStart(); }
+            auto_lock lock(m_mutex);
+            for (;;) {
+                m_parked++;
+                bool timedOut = false;
+                while (m_jobs.empty() && !m_stopping && !timedOut) {
+                    timedOut = m_jobReady.wait_for(lock, boost::chrono::milliseconds(m_idleMs)) ==
+                                   boost::cv_status::timeout;
+                }
+                m_parked--;
+                if (m_stopping) { return; }
+                if (m_jobs.empty()) {
+                    release_slot();
+                    m_exited.push_back(boost::this_thread::get_id());
+                    return;
+                }
+                job j = m_jobs.back();
+                m_jobs.pop_back();
+
+                /* If we block in turn, our own stand-in takes over the slot we are covering */
+                worker_slot*& pOwn = thread_slot();
+                if (!pOwn || pOwn->m_pOwner != this) { pOwn = add_slot(); }
+                pOwn->m_body = j.m_body;
+
+                lock.unlock();
+                j.m_body(boost::bind(&blocking_compensator::covering, j.m_pSlot, j.m_region));
+                lock.lock();
+                m_live--;
+            }
+        }
+
+    private:
+        loop_factory                    m_loopFor;
+        callback                        m_wake;
+        callback                        m_onStart;
+        int                             m_maxThreads;
+        int                             m_idleMs;
+        boost::atomic<int>              m_blocked;
+        boost::atomic<boost::uint64_t>  m_regions;
+        boost::atomic<boost::uint64_t>  m_compensations;
+        boost::atomic<bool>             m_ticking;
+
+        /** Guards the slots, the jobs and the stand-in threads (m_parked of which are waiting for a job) */
+        mutable boost::mutex            m_mutex;
+        boost::condition_variable       m_jobReady;
+        std::vector<slot_ptr>           m_slots;
+        std::vector<job>                m_jobs;
+        std::vector<boost::thread*>     m_threads;
+        std::vector<boost::thread::id>  m_exited;
+        int                             m_live;
+        int                             m_parked;
+        bool                            m_stopping;
+        boost::shared_ptr<monitor>      m_pMonitor;
+    };
+}
+
+/**
+ * Marks a blocking call made from a pool task - i.e.
+ *
+ *     { blocking_region region; s = env->CallObjectMethod(...); }
+ *
+ * Once the region has been open for BOOST_EXT_THREAD_POOL_COMPENSATE_AFTER_MS, the pool runs a compensating thread in
+ * the worker's place (up to BOOST_EXT_THREAD_POOL_MAX_COMPENSATION of them), so its other tasks aren't held up.
+ * Regions are free to open on threads which aren't pool workers, and nested regions are ignored.  Elastic pools don't
+ * compensate - they grow by themselves when work waits - but their regions are still counted.
+ */
+class blocking_region : boost::noncopyable {
+public:
+    blocking_region() : m_pCompensator(detail::blocking_compensator::current()), m_pSlot(NULL) {
+        if (!m_pCompensator) { return; }
+        detail::blocking_compensator::current() = NULL;
+        m_pSlot = m_pCompensator->enter();
+    }
+    ~blocking_region() {
+        if (!m_pCompensator) { return; }
+        m_pCompensator->leave(m_pSlot);
+        detail::blocking_compensator::current() = m_pCompensator;
+    }
+
+private:
+    detail::blocking_compensator*               m_pCompensator;
+    detail::blocking_compensator::worker_slot*  m_pSlot;
+};
+
+}
+
+#endif /* H_BOOST_EXT_BLOCKING_REGION */
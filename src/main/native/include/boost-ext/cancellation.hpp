@@ -0,0 +1,176 @@
+/**
+ * Cooperative cancellation - a cancellation_source, and the cancellation_tokens which tasks poll (or are skipped by)
+ */
+#ifndef H_BOOST_EXT_CANCELLATION
+#define H_BOOST_EXT_CANCELLATION
+
+#include <new>
+#include "boost/noncopyable.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/make_shared.hpp"
+#include "boost/atomic.hpp"
+#include "boost/utility/result_of.hpp"
+
+#include "boost-ext/exception.hpp"
+#include "boost-ext/task.hpp"
+
+namespace boost_ext {
+
+/** Thrown by throw_if_cancelled - and so by the futures of posted tasks which were cancelled before they started */
+struct task_cancelled : exception {
+    task_cancelled() : exception("Task cancelled") {}
+};
+
+namespace detail {
+    /**
+     * The state behind a source and its tokens - a flag, and a lock-free stack of callbacks to run on cancellation.
+     * Cancelling swaps the stack for a marker, so a callback registered afterwards runs straight away instead.
+     */
+    class cancellation_state : boost::noncopyable {
+    public:
+        cancellation_state() : m_cancelled(false), m_pCallbacks(NULL) {}
+        ~cancellation_state() {
+            node* pNode = m_pCallbacks.load();
+            if (pNode != cancelled_marker()) { free_list(pNode); }
+        }
+
+        bool is_cancelled() const { return m_cancelled.load(boost::memory_order_acquire); }
+
+        /** Returns true if this call did the cancelling */
+        bool cancel() {
+            if (m_cancelled.exchange(true, boost::memory_order_acq_rel)) { return false; }
+
+            /* Run the callbacks in the order they were registered */
+            node* pStack = m_pCallbacks.exchange(cancelled_marker(), boost::memory_order_acq_rel), *pList = NULL;
+            while (pStack) {
+                node* pNode = pStack;
+                pStack = pNode->m_pNext, pNode->m_pNext = pList, pList = pNode;
+            }
+            for (node* pNode = pList; pNode; pNode = pNode->m_pNext) { pNode->m_fx(); }
+            free_list(pList);
+            return true;
+        }
+
+        /** Runs fx on cancellation (or now, if we have been cancelled already) - t is left empty */
+        void on_cancel(task& fx) {
+            node* pNode = new (pooled_allocate(sizeof(node))) node();
+            pNode->m_fx.swap(fx);
+            node* pTop = m_pCallbacks.load(boost::memory_order_acquire);
+            do {
+                if (pTop == cancelled_marker()) {
+                    pNode->m_fx();
+                    destroy(pNode);
+                    return;
+                }
+                pNode->m_pNext = pTop;
+            } while (!m_pCallbacks.compare_exchange_weak(pTop, pNode, boost::memory_order_acq_rel,
+                                                          boost::memory_order_acquire));
+        }
+
+    private:
+        struct node {
+            node() : m_pNext(NULL) {}
+            task    m_fx;
+            node*   m_pNext;
+        };
+
+        static node* cancelled_marker() { static node marker; return &marker; }
+
+        static void destroy(node* pNode) {
+            pNode->~node();
+            pooled_deallocate(pNode, sizeof(node));
+        }
+        static void free_list(node* pNode) {
+            while (pNode) {
+                node* pNext = pNode->m_pNext;
+                destroy(pNode);
+                pNode = pNext;
+            }
+        }
+
+    private:
+        boost::atomic<bool>     m_cancelled;
+        boost::atomic<node*>    m_pCallbacks;
+    };
+}
+
+/**
+ * Says whether a cancellation_source has been cancelled - checking costs one atomic load.  A default constructed
+ * token can never be cancelled.
+ */
+class cancellation_token {
+public:
+    cancellation_token() {}
+
+    bool is_cancelled() const { return m_pState && m_pState->is_cancelled(); }
+    bool can_be_cancelled() const { return m_pState.get() != NULL; }
+
+    void throw_if_cancelled() const {
+        if (is_cancelled()) { BOOST_THROW_EXCEPTION(task_cancelled()); }
+    }
+
+    /**
+     * Runs fx (once) when the source is cancelled - straight away if it already has been.  Callbacks are kept until
+     * the source and its tokens are gone, so this is meant for a bounded number of registrations per source.
+     */
+    template<typename F>
+    void on_cancel(const F& fx) const {
+        if (!m_pState) { return; }
+        task t(fx);
+        m_pState->on_cancel(t);
+    }
+
+private:
+    friend class cancellation_source;
+    explicit cancellation_token(const boost::shared_ptr<detail::cancellation_state>& pState) : m_pState(pState) {}
+
+    boost::shared_ptr<detail::cancellation_state> m_pState;
+};
+
+/** Cancels the work holding its tokens - posted tasks which haven't started are skipped, and timers are cancelled */
+class cancellation_source {
+public:
+    cancellation_source() : m_pState(boost::make_shared<detail::cancellation_state>()) {}
+
+    cancellation_token token() const { return cancellation_token(m_pState); }
+
+    /** Cancels everything holding one of our tokens - returns false if we had already been cancelled */
+    bool cancel() { return m_pState->cancel(); }
+    bool is_cancelled() const { return m_pState->is_cancelled(); }
+
+private:
+    boost::shared_ptr<detail::cancellation_state> m_pState;
+};
+
+namespace detail {
+    /** Calls fx unless the token was cancelled first, in which case it throws task_cancelled (i.e. into a future) */
+    template<typename F>
+    struct cancellable_call {
+        typedef typename boost::result_of<F()>::type result_type;
+
+        cancellable_call(const F& fx, const cancellation_token& token) : m_fx(fx), m_token(token) {}
+        result_type operator()() {
+            m_token.throw_if_cancelled();
+            return m_fx();
+        }
+
+        F                   m_fx;
+        cancellation_token  m_token;
+    };
+
+    /** Calls fx unless the token was cancelled first */
+    template<typename F>
+    struct cancellable_run {
+        cancellable_run(const F& fx, const cancellation_token& token) : m_fx(fx), m_token(token) {}
+        void operator()() {
+            if (!m_token.is_cancelled()) { m_fx(); }
+        }
+
+        F                   m_fx;
+        cancellation_token  m_token;
+    };
+}
+
+}
+
+#endif /* H_BOOST_EXT_CANCELLATION */
@@ -1,5 +1,5 @@
 /**
- * Helper macros (unused, quote, and the NOOP function)
+ * Helper macros (unused, quote, thread-local, cache line size, and the NOOP function)
  */
 #ifndef H_BOOST_EXT_COMMON
 #define H_BOOST_EXT_COMMON
@@ -20,4 +20,18 @@
 	#define WQUOTE(x)	WQUOTE_(x)
 #endif
 
+/* THREAD_LOCAL macro (for thread-local storage of POD values) */
+#if !defined(THREAD_LOCAL)
+	#if defined(_MSC_VER)
+		#define THREAD_LOCAL	__declspec(thread)
+	#else
+		#define THREAD_LOCAL	__thread
+	#endif
+#endif
+
+/* The cache line size (for padding data which is written by different threads) */
+#if !defined(BOOST_EXT_CACHE_LINE_SIZE)
+	#define BOOST_EXT_CACHE_LINE_SIZE	64
+#endif
+
 #endif /* H_BOOST_EXT_COMMON */
@@ -0,0 +1,240 @@
+/**
+ * C++20 coroutine support - co_task<T> coroutines, and awaiting executors, timing wheel sleeps and light_futures.
+ * Everything here is only defined when BOOST_EXT_HAS_COROUTINES is (which it is by default when the compiler
+ * supports coroutines - define BOOST_EXT_NO_COROUTINES to opt out).
+ */
+#ifndef H_BOOST_EXT_COROUTINE
+#define H_BOOST_EXT_COROUTINE
+
+#if !defined(BOOST_EXT_HAS_COROUTINES) && !defined(BOOST_EXT_NO_COROUTINES) && defined(__has_include)
+    #if __has_include(<coroutine>) && defined(__cpp_impl_coroutine) && __cplusplus >= 202002L
+        #define BOOST_EXT_HAS_COROUTINES    1
+    #endif
+#endif
+
+#if defined(BOOST_EXT_HAS_COROUTINES)
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <type_traits>
+#include "boost/exception_ptr.hpp"
+#include "boost/system/error_code.hpp"
+
+#include "boost-ext/task.hpp"
+#include "boost-ext/timing_wheel.hpp"
+#include "boost-ext/light_future.hpp"
+
+namespace boost_ext {
+
+template<typename T = void> class co_task;
+
+namespace detail {
+    /** Resumes a coroutine - what awaiters queue on an executor */
+    struct resume_coroutine {
+        explicit resume_coroutine(std::coroutine_handle<> handle) : m_handle(handle) {}
+        void operator()() { m_handle.resume(); }
+        std::coroutine_handle<> m_handle;
+    };
+
+    /** co_await executor.schedule() - the coroutine carries on on one of the executor's threads */
+    template<typename Executor>
+    class schedule_awaiter {
+    public:
+        explicit schedule_awaiter(Executor& executor) : m_executor(executor) {}
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { m_executor.execute(resume_coroutine(handle)); }
+        void await_resume() const noexcept {}
+    private:
+        Executor&   m_executor;
+    };
+
+    /**
+     * co_await on a timing wheel - the coroutine is the wheel entry (living in its frame, so the wheel doesn't
+     * allocate), and is resumed by the worker which fires it.  Resuming throws if the wheel cancelled the entry.
+     */
+    class sleep_awaiter : public timing_wheel_hook {
+    public:
+        sleep_awaiter(timing_wheel& wheel, timing_wheel::duration delay) : m_wheel(wheel), m_delay(delay) {}
+        bool await_ready() const noexcept { return m_delay <= timing_wheel::duration::zero(); }
+        void await_suspend(std::coroutine_handle<> handle) {
+            m_handle = handle;
+            m_wheel.add(this, boost::shared_ptr<void>(), m_delay);
+        }
+        void await_resume() const {
+            if (m_error) { BOOST_THROW_EXCEPTION(boost::system::system_error(m_error)); }
+        }
+    private:
+        void on_expired(const boost::system::error_code& error) {
+            m_error = error;
+            m_handle.resume();
+        }
+
+        timing_wheel&               m_wheel;
+        timing_wheel::duration      m_delay;
+        std::coroutine_handle<>     m_handle;
+        boost::system::error_code   m_error;
+    };
+
+    /** co_await on a light_future - the coroutine is resumed by whichever thread makes the future ready */
+    template<typename T>
+    class light_future_awaiter {
+    public:
+        explicit light_future_awaiter(const light_future<T>& future) : m_future(future) {}
+        bool await_ready() const { return m_future.is_ready(); }
+        void await_suspend(std::coroutine_handle<> handle) {
+            /* The coroutine (and this awaiter) can be gone before on_ready returns, so hold the state ourselves */
+            light_future<T> future = m_future;
+            future.on_ready(resume_coroutine(handle));
+        }
+        T await_resume() const { return m_future.get(); }
+    private:
+        light_future<T> m_future;
+    };
+
+    /** The promise parts which don't depend on T - pooled frame allocation, laziness and the continuation */
+    class co_promise_base {
+    public:
+        /** Frames come from the same block pools as queued tasks */
+        static void* operator new(std::size_t size) { return pooled_allocate(size); }
+        static void operator delete(void* p, std::size_t size) { pooled_deallocate(p, size); }
+
+        /** Resumes whoever awaited us (by symmetric transfer, so long await chains don't grow the stack) */
+        struct final_awaiter {
+            bool await_ready() const noexcept { return false; }
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                std::coroutine_handle<> continuation = handle.promise().m_continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+            void await_resume() const noexcept {}
+        };
+
+        std::suspend_always initial_suspend() const noexcept { return std::suspend_always(); }
+        final_awaiter final_suspend() const noexcept { return final_awaiter(); }
+        void unhandled_exception() { m_error = std::current_exception(); }
+
+        std::coroutine_handle<> m_continuation;
+        std::exception_ptr      m_error;
+    };
+
+    template<typename T>
+    class co_promise : public co_promise_base {
+    public:
+        co_task<T> get_return_object();
+        template<typename U>
+        void return_value(U&& value) { m_value.emplace(std::forward<U>(value)); }
+        T result() {
+            if (m_error) { std::rethrow_exception(m_error); }
+            return std::move(*m_value);
+        }
+    private:
+        std::optional<T>    m_value;
+    };
+
+    template<>
+    class co_promise<void> : public co_promise_base {
+    public:
+        co_task<void> get_return_object();
+        void return_void() {}
+        void result() {
+            if (m_error) { std::rethrow_exception(m_error); }
+        }
+    };
+}
+
+/**
+ * A lazily started coroutine which produces a T.  It starts running when it is awaited (on the awaiting thread -
+ * co_await pool.schedule() inside it to hop onto a pool), and resumes its awaiter when it finishes.  Use co_spawn to
+ * start one from ordinary code.  Move-only.
+ */
+template<typename T>
+class co_task {
+public:
+    typedef detail::co_promise<T> promise_type;
+
+    co_task(co_task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+    co_task& operator=(co_task&& other) noexcept {
+        if (this != &other) {
+            if (m_handle) { m_handle.destroy(); }
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+    ~co_task() {
+        if (m_handle) { m_handle.destroy(); }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        m_handle.promise().m_continuation = awaiter;
+        return m_handle;
+    }
+    T await_resume() { return m_handle.promise().result(); }
+
+private:
+    friend class detail::co_promise<T>;
+    explicit co_task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+    co_task(const co_task&);
+    co_task& operator=(const co_task&);
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+namespace detail {
+    template<typename T>
+    co_task<T> co_promise<T>::get_return_object() {
+        return co_task<T>(std::coroutine_handle<co_promise<T> >::from_promise(*this));
+    }
+    inline co_task<void> co_promise<void>::get_return_object() {
+        return co_task<void>(std::coroutine_handle<co_promise<void> >::from_promise(*this));
+    }
+
+    /** A fire-and-forget coroutine, which frees its own frame when it finishes */
+    struct detached_coroutine {
+        struct promise_type : co_promise_base {
+            detached_coroutine get_return_object() const noexcept { return detached_coroutine(); }
+            std::suspend_never initial_suspend() const noexcept { return std::suspend_never(); }
+            std::suspend_never final_suspend() const noexcept { return std::suspend_never(); }
+            void return_void() const noexcept {}
+            void unhandled_exception() const noexcept { std::terminate(); }
+        };
+    };
+
+    template<typename Executor, typename T>
+    detached_coroutine run_spawned(Executor& executor, co_task<T> coroutine, light_promise<T> promise) {
+        try {
+            co_await schedule_awaiter<Executor>(executor);
+            if constexpr (std::is_void_v<T>) {
+                co_await std::move(coroutine);
+                promise.set_value();
+            } else {
+                promise.set_value(co_await std::move(coroutine));
+            }
+        } catch (...) {
+            promise.set_exception(boost::current_exception());
+        }
+    }
+}
+
+/** co_await on a light_future (i.e. from thread_pool::async) suspends until it is ready, without blocking a thread */
+template<typename T>
+detail::light_future_awaiter<T> operator co_await(const light_future<T>& future) {
+    return detail::light_future_awaiter<T>(future);
+}
+
+/** Starts a coroutine on an executor (such as a thread_pool), and returns a light_future for its result */
+template<typename Executor, typename T>
+light_future<T> co_spawn(Executor& executor, co_task<T> coroutine) {
+    light_promise<T> promise;
+    light_future<T> future = promise.get_future();
+    detail::run_spawned(executor, std::move(coroutine), promise);
+    return future;
+}
+
+}
+
+#endif /* BOOST_EXT_HAS_COROUTINES */
+
+#endif /* H_BOOST_EXT_COROUTINE */
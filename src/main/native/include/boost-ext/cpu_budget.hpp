@@ -0,0 +1,181 @@
+/**
+ * The CPU budget of this process - hardware threads, affinity mask and cgroup (v1 or v2) CPU quota
+ */
+#ifndef H_BOOST_EXT_CPU_BUDGET
+#define H_BOOST_EXT_CPU_BUDGET
+
+#include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "boost/lexical_cast.hpp"
+#include "boost/thread/thread.hpp"
+
+#include "boost-ext/platform_detect.hpp"
+#include "boost-ext/classes.hpp"
+#include "boost-ext/cpu_topology.hpp"
+
+#if _IS_OS_LINUX_
+    #include <sched.h>
+#endif
+
+/** The prefix of the environment variables which override the size of named pools (i.e. BOOST_EXT_THREAD_POOL_MY_POOL) */
+#if !defined(BOOST_EXT_THREAD_POOL_ENV_PREFIX)
+    #define BOOST_EXT_THREAD_POOL_ENV_PREFIX    "BOOST_EXT_THREAD_POOL_"
+#endif
+
+namespace boost_ext {
+
+/**
+ * How many CPUs this process can actually use - the smallest of the hardware threads, the CPUs in our affinity mask
+ * and the cgroup CPU quota (rounded up), which is what a default-sized pool should run.  Each part is -1 (and plays no
+ * part) when it couldn't be detected.
+ */
+class cpu_budget {
+public:
+    cpu_budget(int hardwareThreads, int affinityCpus, double quotaCpus)
+        : m_hardwareThreads(hardwareThreads), m_affinityCpus(affinityCpus), m_quotaCpus(quotaCpus) {}
+
+    /** The budget of this process - detected once */
+    static const cpu_budget& system() {
+        static cpu_budget me = detect();
+        return me;
+    }
+
+    GETTER(int, m_hardwareThreads, hardware_threads)
+    GETTER(int, m_affinityCpus, affinity_cpus)
+    /** The cgroup CPU quota (i.e. 1.5 for "150000 100000"), or -1 if there is no quota */
+    GETTER(double, m_quotaCpus, quota_cpus)
+
+    /** The number of threads a default-sized pool should have (at least one) */
+    int threads() const {
+        int n = -1;
+        if (m_hardwareThreads > 0) { n = m_hardwareThreads; }
+        if (m_affinityCpus > 0) { n = (n > 0) ? std::min(n, m_affinityCpus) : m_affinityCpus; }
+        if (m_quotaCpus > 0) {
+            int quota = static_cast<int>(std::ceil(m_quotaCpus));
+            n = (n > 0) ? std::min(n, quota) : quota;
+        }
+        return std::max(n, 1);
+    }
+
+    TO_STRING_FX(cpu_budget) {
+        std::stringstream s;
+        s << threads() << " threads (hardware: " << m_hardwareThreads << ", affinity: " << m_affinityCpus
+          << ", quota: " << m_quotaCpus << ")";
+        return s.str();
+    }
+
+    /**
+     * The size for a pool with the given name - the environment variable BOOST_EXT_THREAD_POOL_<NAME> (upper-cased,
+     * with anything but letters and digits turned into underscores) overrides size when it holds a positive number
+     */
+    static int pool_size(const std::string& name, int size) {
+        if (name.empty()) { return size; }
+        const char* pValue = std::getenv(env_name(name).c_str());
+        if (!pValue) { return size; }
+        try {
+            int n = boost::lexical_cast<int>(pValue);
+            return (n > 0) ? n : size;
+        } catch (const boost::bad_lexical_cast&) {
+            return size;
+        }
+    }
+
+    /** The name of the environment variable which overrides the size of the named pool */
+    static std::string env_name(const std::string& name) {
+        std::string env = BOOST_EXT_THREAD_POOL_ENV_PREFIX;
+        for (std::size_t i = 0; i < name.size(); i++) {
+            env += std::isalnum(static_cast<unsigned char>(name[i])) ? (char) std::toupper(name[i]) : '_';
+        }
+        return env;
+    }
+
+    /** Parses a cgroup v2 cpu.max ("<quota> <period>", or "max <period>") - returns -1 for no quota */
+    static double parse_cpu_max(const std::string& cpuMax) {
+        std::stringstream in(cpuMax);
+        std::string quota, period;
+        in >> quota >> period;
+        return (quota == "max") ? -1 : parse_quota(quota, period.empty() ? "100000" : period);
+    }
+
+    /** Turns a cgroup v1 cfs_quota_us and cfs_period_us into CPUs - returns -1 for no quota */
+    static double parse_quota(const std::string& quota, const std::string& period) {
+        try {
+            double q = boost::lexical_cast<double>(trim(quota)), p = boost::lexical_cast<double>(trim(period));
+            return (q > 0 && p > 0) ? q / p : -1;
+        } catch (const boost::bad_lexical_cast&) {
+            return -1;
+        }
+    }
+
+private:
+    static cpu_budget detect() {
+        int affinity = -1;
+        double quota = -1;
+    #if _IS_OS_LINUX_
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        if (sched_getaffinity(0, sizeof(mask), &mask) == 0) { affinity = CPU_COUNT(&mask); }
+        quota = detect_quota();
+    #endif
+        int hardware = static_cast<int>(boost::thread::hardware_concurrency());
+        return cpu_budget(hardware > 0 ? hardware : -1, affinity, quota);
+    }
+
+    /**
+     * Finds our cgroup's CPU quota - our own cgroup (from /proc/self/cgroup) is tried first, and then the root of the
+     * hierarchy (which is what a container with its own cgroup namespace sees)
+     */
+    static double detect_quota() {
+        std::string v2Path, v1Path;
+        std::ifstream in("/proc/self/cgroup");
+        std::string line;
+        while (std::getline(in, line)) {
+            /* Lines are "<id>:<controllers>:<path>" - v2 is "0::<path>" */
+            std::string::size_type first = line.find(':'), second = line.find(':', first + 1);
+            if (first == std::string::npos || second == std::string::npos) { continue; }
+            std::string controllers = "," + line.substr(first + 1, second - first - 1) + ",";
+            std::string path = line.substr(second + 1);
+            if (controllers == ",,") {
+                v2Path = path;
+            } else if (controllers.find(",cpu,") != std::string::npos) {
+                v1Path = path;
+            }
+        }
+
+        const char* v1Roots[] = { "/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct", "/sys/fs/cgroup/cpuacct,cpu" };
+        std::string v2Dirs[] = { v2Path, "/" }, v1Dirs[] = { v1Path, "/" };
+        for (std::size_t i = 0; i < 2; i++) {
+            if (v2Dirs[i].empty()) { continue; }
+            std::string cpuMax = detail::read_line("/sys/fs/cgroup" + v2Dirs[i] + "/cpu.max");
+            if (!cpuMax.empty()) { return parse_cpu_max(cpuMax); }
+        }
+        for (std::size_t r = 0; r < sizeof(v1Roots) / sizeof(v1Roots[0]); r++) {
+            for (std::size_t i = 0; i < 2; i++) {
+                if (v1Dirs[i].empty()) { continue; }
+                std::string dir = v1Roots[r] + v1Dirs[i];
+                std::string quota = detail::read_line(dir + "/cpu.cfs_quota_us");
+                if (!quota.empty()) { return parse_quota(quota, detail::read_line(dir + "/cpu.cfs_period_us")); }
+            }
+        }
+        return -1;
+    }
+
+    static std::string trim(const std::string& s) {
+        std::string::size_type begin = s.find_first_not_of(" \t\r\n"), end = s.find_last_not_of(" \t\r\n");
+        return (begin == std::string::npos) ? std::string() : s.substr(begin, end - begin + 1);
+    }
+
+private:
+    int     m_hardwareThreads;
+    int     m_affinityCpus;
+    double  m_quotaCpus;
+};
+
+}
+
+#endif /* H_BOOST_EXT_CPU_BUDGET */
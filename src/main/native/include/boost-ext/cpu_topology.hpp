@@ -0,0 +1,188 @@
+/**
+ * CPU and NUMA node topology (read from /sys on Linux), and pinning threads to CPUs
+ */
+#ifndef H_BOOST_EXT_CPU_TOPOLOGY
+#define H_BOOST_EXT_CPU_TOPOLOGY
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include "boost/lexical_cast.hpp"
+#include "boost/thread/thread.hpp"
+
+#include "boost-ext/platform_detect.hpp"
+
+#if _IS_OS_LINUX_
+    #include <sched.h>
+#endif
+
+namespace boost_ext {
+
+namespace detail {
+    /** The first line of a (/sys or /proc) file - empty if it can't be read */
+    inline std::string read_line(const std::string& path) {
+        std::ifstream in(path.c_str());
+        std::string line;
+        if (in) { std::getline(in, line); }
+        return line;
+    }
+}
+
+/**
+ * The CPUs of this machine, grouped by NUMA node.  On Linux this comes from /sys/devices/system/node (falling back to
+ * /sys/devices/system/cpu/online) - elsewhere, or if /sys can't be read, it is a single node of
+ * hardware_concurrency() CPUs.
+ */
+class cpu_topology {
+public:
+    typedef std::vector<int> cpu_set;
+
+    /** The topology of the machine we are running on - read once */
+    static const cpu_topology& system() {
+        static cpu_topology me = detect();
+        return me;
+    }
+
+    /**
+     * Builds a topology from explicit nodes (mostly for testing) - allowed is the CPUs that the process may run on
+     * (empty if that isn't known)
+     */
+    explicit cpu_topology(const std::vector<cpu_set>& nodes, const cpu_set& allowed = cpu_set())
+        : m_nodes(nodes), m_allowed(allowed) {
+        if (m_nodes.empty()) { m_nodes.push_back(cpu_set(1, 0)); }
+    }
+
+    /** The number of NUMA nodes (at least one) */
+    std::size_t num_nodes() const { return m_nodes.size(); }
+
+    /** The CPUs which belong to the given node */
+    const cpu_set& node_cpus(std::size_t node) const { return m_nodes[node % m_nodes.size()]; }
+
+    /** Every CPU, in node order */
+    cpu_set cpus() const {
+        cpu_set all;
+        for (std::size_t i = 0; i < m_nodes.size(); i++) {
+            all.insert(all.end(), m_nodes[i].begin(), m_nodes[i].end());
+        }
+        return all;
+    }
+
+    /**
+     * Every CPU which the process may run on (per its affinity mask when it was first read), in node order - or
+     * every CPU if the mask isn't known or doesn't overlap the topology
+     */
+    cpu_set usable_cpus() const {
+        cpu_set all = cpus(), usable;
+        for (std::size_t i = 0; i < all.size(); i++) {
+            if (std::find(m_allowed.begin(), m_allowed.end(), all[i]) != m_allowed.end()) { usable.push_back(all[i]); }
+        }
+        return usable.empty() ? all : usable;
+    }
+
+    /** The node which the given CPU belongs to (node 0 if it is unknown) */
+    std::size_t node_of(int cpu) const {
+        for (std::size_t i = 0; i < m_nodes.size(); i++) {
+            if (std::find(m_nodes[i].begin(), m_nodes[i].end(), cpu) != m_nodes[i].end()) { return i; }
+        }
+        return 0;
+    }
+
+    /** The node which the calling thread is currently running on (node 0 if it can't be told) */
+    std::size_t current_node() const { return node_of(current_cpu()); }
+
+    /** The CPU which the calling thread is currently running on, or -1 if it can't be told */
+    static int current_cpu() {
+    #if _IS_OS_LINUX_
+        return sched_getcpu();
+    #else
+        return -1;
+    #endif
+    }
+
+    /** Restricts the calling thread to the given CPUs - returns false if that isn't supported (or fails) */
+    static bool pin_current_thread(const cpu_set& cpus) {
+    #if _IS_OS_LINUX_
+        if (cpus.empty()) { return false; }
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        for (std::size_t i = 0; i < cpus.size(); i++) {
+            if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE) { CPU_SET(cpus[i], &mask); }
+        }
+        return sched_setaffinity(0, sizeof(mask), &mask) == 0;
+    #else
+        (void) cpus;
+        return false;
+    #endif
+    }
+
+    /** Parses a kernel CPU list (i.e. "0-3,8,10-11") */
+    static cpu_set parse_cpu_list(const std::string& list) {
+        cpu_set cpus;
+        std::stringstream in(list);
+        std::string range;
+        while (std::getline(in, range, ',')) {
+            range.erase(std::remove_if(range.begin(), range.end(), ::isspace), range.end());
+            if (range.empty()) { continue; }
+            try {
+                std::string::size_type dash = range.find('-');
+                int first = boost::lexical_cast<int>(range.substr(0, dash));
+                int last = (dash == std::string::npos) ? first : boost::lexical_cast<int>(range.substr(dash + 1));
+                for (int cpu = first; cpu <= last; cpu++) { cpus.push_back(cpu); }
+            } catch (const boost::bad_lexical_cast&) {
+                /* Skip anything we don't understand */
+            }
+        }
+        return cpus;
+    }
+
+private:
+    static cpu_topology detect() {
+        std::vector<cpu_set> nodes;
+    #if _IS_OS_LINUX_
+        /* Node directories are numbered, but not necessarily contiguously (i.e. after offlining a node) */
+        for (int node = 0, misses = 0; misses < 8; node++) {
+            cpu_set cpus = parse_cpu_list(detail::read_line("/sys/devices/system/node/node" +
+                                                            boost::lexical_cast<std::string>(node) + "/cpulist"));
+            if (cpus.empty()) { misses++; continue; }
+            misses = 0;
+            nodes.push_back(cpus);
+        }
+        if (nodes.empty()) {
+            cpu_set cpus = parse_cpu_list(detail::read_line("/sys/devices/system/cpu/online"));
+            if (!cpus.empty()) { nodes.push_back(cpus); }
+        }
+    #endif
+        if (nodes.empty()) {
+            cpu_set cpus;
+            for (unsigned i = 0; i < std::max(1u, boost::thread::hardware_concurrency()); i++) { cpus.push_back(i); }
+            nodes.push_back(cpus);
+        }
+        return cpu_topology(nodes, affinity_cpus());
+    }
+
+    /** The CPUs in the calling thread's affinity mask (empty if it can't be read) */
+    static cpu_set affinity_cpus() {
+        cpu_set cpus;
+    #if _IS_OS_LINUX_
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &mask)) { cpus.push_back(cpu); }
+            }
+        }
+    #endif
+        return cpus;
+    }
+
+private:
+    std::vector<cpu_set>    m_nodes;
+    cpu_set                 m_allowed;
+};
+
+}
+
+#endif /* H_BOOST_EXT_CPU_TOPOLOGY */
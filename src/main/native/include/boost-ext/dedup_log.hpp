@@ -0,0 +1,116 @@
+/**
+ * A sink stage which collapses repeated messages - a record with the same message and severity as the one before it
+ * is held back and counted, and written once (the last of the repeats, with " (repeated N times)" appended) when a
+ * different message comes along, or at most each window while the repeats go on.  Flushing doesn't write them (an
+ * async sink flushes whenever it runs out of records, which in a storm is all the time) - destroying the stage does.
+ */
+#ifndef H_BOOST_EXT_DEDUP_LOG
+#define H_BOOST_EXT_DEDUP_LOG
+
+#include <string>
+#include <sstream>
+#include "boost/cstdint.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/make_shared.hpp"
+#include "boost/type_traits/integral_constant.hpp"
+#include "boost/chrono/system_clocks.hpp"
+#include "boost/log/core/record_view.hpp"
+#include "boost/log/trivial.hpp"
+#include "boost/log/expressions/message.hpp"
+#include "boost/log/sinks/basic_sink_backend.hpp"
+#include "boost/log/sinks/frontend_requirements.hpp"
+
+#include "boost-ext/classes.hpp"
+
+/** How long (in milliseconds) repeats are held back for, by default, before they are written */
+#if !defined(BOOST_EXT_LOG_DEDUP_WINDOW_MS)
+    #define BOOST_EXT_LOG_DEDUP_WINDOW_MS   1000
+#endif
+
+namespace boost_ext { namespace log {
+
+/** Collapses repeated messages before they reach another formatted backend (see dedup) */
+template<typename BackendT>
+class dedup_backend : public boost::log::sinks::basic_formatted_sink_backend<char,
+        boost::log::sinks::combine_requirements<boost::log::sinks::synchronized_feeding,
+                                                boost::log::sinks::flushing>::type> {
+public:
+    dedup_backend(const boost::shared_ptr<BackendT>& pBackend, const boost::chrono::milliseconds& window)
+        : m_pBackend(pBackend), m_window(window), m_hasLast(false), m_level(-1), m_repeats(0) {}
+    ~dedup_backend() {
+        try { write_repeats(); } catch (...) {}
+    }
+
+    void consume(const boost::log::record_view& rec, const string_type& line) {
+        message_ref message = rec[boost::log::expressions::smessage];
+        severity_ref lvl = rec[boost::log::trivial::severity];
+        int level = lvl ? static_cast<int>(lvl.get()) : -1;
+        clock::time_point now = clock::now();
+
+        /* A repeat is held back (though a long run of them is still written each window) */
+        if (message && m_hasLast && level == m_level && message.get() == m_message) {
+            if (m_repeats > 0 && now - m_since >= m_window) {
+                write_repeats();
+                m_since = now;
+            }
+            m_repeats++;
+            m_lastRecord = rec, m_lastLine = line;
+            return;
+        }
+
+        write_repeats();
+        m_pBackend->consume(rec, line);
+        m_hasLast = !!message;
+        m_message = message ? message.get() : std::string();
+        m_level = level, m_since = now;
+    }
+
+    /** Flushes the backend (if it can be) - repeats held back stay held, and go on being counted */
+    void flush() {
+        flush_backend(*m_pBackend, boost::integral_constant<bool, boost::log::sinks::has_requirement<
+                          typename BackendT::frontend_requirements, boost::log::sinks::flushing>::value>());
+    }
+
+    GETTER(const boost::shared_ptr<BackendT>&, m_pBackend, backend)
+
+private:
+    typedef boost::chrono::steady_clock clock;
+    typedef boost::log::value_ref<std::string, boost::log::expressions::tag::smessage> message_ref;
+    typedef boost::log::value_ref<boost::log::trivial::severity_level, boost::log::trivial::tag::severity> severity_ref;
+
+    void write_repeats() {
+        if (m_repeats == 0) { return; }
+        std::stringstream line;
+        line << m_lastLine << " (repeated " << m_repeats << (m_repeats == 1 ? " time)" : " times)");
+        m_pBackend->consume(m_lastRecord, line.str());
+        m_repeats = 0, m_lastRecord = boost::log::record_view();
+    }
+
+    static void flush_backend(BackendT& backend, boost::true_type) { backend.flush(); }
+    static void flush_backend(BackendT&, boost::false_type) {}
+
+    boost::shared_ptr<BackendT>     m_pBackend;
+    boost::chrono::milliseconds     m_window;
+
+    /* The last message written (if there was one, and it had a message) */
+    bool                            m_hasLast;
+    std::string                     m_message;
+    int                             m_level;
+    clock::time_point               m_since;
+
+    /* Its repeats since, and the latest of them */
+    boost::uint64_t                 m_repeats;
+    boost::log::record_view         m_lastRecord;
+    string_type                     m_lastLine;
+};
+
+/** Puts a dedup stage in front of a formatted backend, i.e. add_async_log(dedup(pBackend), options) */
+template<typename BackendT>
+boost::shared_ptr< dedup_backend<BackendT> > dedup(const boost::shared_ptr<BackendT>& pBackend,
+        const boost::chrono::milliseconds& window = boost::chrono::milliseconds(BOOST_EXT_LOG_DEDUP_WINDOW_MS)) {
+    return boost::make_shared< dedup_backend<BackendT> >(pBackend, window);
+}
+
+}}
+
+#endif /* H_BOOST_EXT_DEDUP_LOG */
@@ -0,0 +1,329 @@
+/**
+ * Elastic worker threads for an io_service - started lazily, grown when queued work waits too long, and reaped when
+ * they sit idle
+ */
+#ifndef H_BOOST_EXT_ELASTIC_WORKERS
+#define H_BOOST_EXT_ELASTIC_WORKERS
+
+#include <vector>
+#include <algorithm>
+#include "boost/noncopyable.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/make_shared.hpp"
+#include "boost/function.hpp"
+#include "boost/bind.hpp"
+#include "boost/atomic.hpp"
+#include "boost/thread.hpp"
+#include "boost/asio.hpp"
+#include "boost/asio/steady_timer.hpp"
+#include "boost/chrono/duration.hpp"
+
+#include "boost-ext/common.hpp"
+#include "boost-ext/classes.hpp"
+#include "boost-ext/auto_lock.hpp"
+#include "boost-ext/task.hpp"
+#include "boost-ext/timing_wheel.hpp"
+
+/**
+ * The defaults for how long queued work may wait before an elastic pool adds a thread, and how long extra threads
+ * may sit idle before they are reaped (both in milliseconds)
+ */
+#if !defined(BOOST_EXT_THREAD_POOL_GROW_AFTER_MS)
+    #define BOOST_EXT_THREAD_POOL_GROW_AFTER_MS     20
+#endif
+#if !defined(BOOST_EXT_THREAD_POOL_IDLE_TIMEOUT_MS)
+    #define BOOST_EXT_THREAD_POOL_IDLE_TIMEOUT_MS   60000
+#endif
+
+namespace boost_ext {
+
+/** The bounds of an elastic pool */
+class elastic_limits {
+public:
+    typedef boost::asio::steady_timer::clock_type::duration duration;
+
+    elastic_limits(int minThreads, int maxThreads,
+                   duration growAfter = detail::milliseconds_as<duration>(BOOST_EXT_THREAD_POOL_GROW_AFTER_MS),
+                   duration idleTimeout = detail::milliseconds_as<duration>(BOOST_EXT_THREAD_POOL_IDLE_TIMEOUT_MS))
+        : m_minThreads(std::max(minThreads, 0)), m_maxThreads(std::max(maxThreads, std::max(minThreads, 1))),
+          m_growAfter(growAfter > duration::zero() ? growAfter : duration(1)), m_idleTimeout(idleTimeout) {}
+
+    /** The threads which are kept once the pool has been used - at least one, for the pool's timers */
+    GETTER(int, m_minThreads, min_threads)
+    GETTER(int, m_maxThreads, max_threads)
+    /** A thread is added once queued work has waited this long */
+    GETTER(duration, m_growAfter, grow_after)
+    /** Threads above the minimum are reaped once the pool hasn't needed them for this long */
+    GETTER(duration, m_idleTimeout, idle_timeout)
+
+private:
+    int         m_minThreads;
+    int         m_maxThreads;
+    duration    m_growAfter;
+    duration    m_idleTimeout;
+};
+
+namespace detail {
+    /**
+     * One thread (shared by every elastic pool, stall_watchdog and blocking compensator) which watches for queued
+     * work that isn't being picked up - it has to live outside of the pools, since a pool whose threads are all
+     * blocked can't notice that it needs another one.  It is never destroyed, like the block pools.
+     */
+    class elastic_monitor : boost::noncopyable {
+    public:
+        static boost::asio::io_service& service() {
+            static elastic_monitor* p = new elastic_monitor();
+            return p->m_service;
+        }
+
+    private:
+        elastic_monitor() : m_work(m_service), m_thread(boost::bind(&boost::asio::io_service::run, &m_service)) {}
+
+        boost::asio::io_service         m_service;
+        boost::asio::io_service::work   m_work;
+        boost::thread                   m_thread;
+    };
+}
+
+/**
+ * Runs an io_service on between min_threads() and max_threads() threads.  No threads exist until the first post (or
+ * start()), which brings up the minimum (at least one).  Whenever queued work has waited grow_after() - or nothing has
+ * been picked up for that long - the monitor adds a thread, and threads that haven't been needed for idle_timeout()
+ * are retired by posting exit tokens, which the next idle threads pick up.  Each thread gets the lowest number that no
+ * other running thread holds, so the numbers stay below max_threads() and a regrown thread takes over a retired one's.
+ */
+class elastic_workers : boost::noncopyable {
+public:
+    typedef boost::asio::steady_timer::clock_type   clock_type;
+    typedef clock_type::duration                    duration;
+    /** Called on each new thread (with its number) before it runs anything */
+    typedef boost::function<void(std::size_t)>      prologue;
+
+    elastic_workers(boost::asio::io_service& service, const elastic_limits& limits,
+                    const prologue& onStart = prologue()) : m_service(service), m_limits(limits), m_onStart(onStart),
+                                                            m_live(0), m_retiring(0), m_numbered(0), m_busy(0),
+                                                            m_peakBusy(0), m_queued(0), m_lastStart(now()),
+                                                            m_lastLatency(0), m_lastReap(now()),
+                                                            m_pMonitor(boost::make_shared<monitor>(this)) {}
+    ~elastic_workers() { stop(); }
+
+    /** Queues a task (which is left empty) on the io_service, starting threads if needed */
+    void post(task& t) {
+        m_queued.fetch_add(1);
+        m_service.post(handler(this, t));
+        start();
+        arm();
+    }
+
+    /** Brings up the minimum number of threads (at least one), if they aren't already running */
+    void start() {
+        if (m_live.load() >= floor()) { return; }
+        auto_lock lock(m_mutex);
+        while (m_live.load() < floor()) { start_thread(); }
+    }
+
+    /** Stops watching, and waits for our threads - the io_service must have been stopped first */
+    void stop() {
+        {
+            auto_lock lock(m_pMonitor->m_mutex);
+            m_pMonitor->m_pWorkers = NULL;
+            m_pMonitor->m_timer.cancel();
+        }
+        std::vector<boost::thread*> threads;
+        {
+            auto_lock lock(m_mutex);
+            threads.swap(m_threads);
+        }
+        for (std::size_t i = 0; i < threads.size(); i++) { threads[i]->join(); delete threads[i]; }
+    }
+
+    /** The number of running threads, and how many of those are running a task */
+    int live() const { return m_live.load(); }
+    int busy() const { return m_busy.load(); }
+
+    /** The number of tasks waiting for a thread */
+    long queued() const { return m_queued.load(); }
+
+    const elastic_limits& limits() const { return m_limits; }
+
+private:
+    /** Counts the task in and out of the busy threads, and notes how long it waited */
+    class handler {
+    public:
+        handler(elastic_workers* pWorkers, task& t) : m_pWorkers(pWorkers), m_task(t), m_enqueued(now()) {}
+
+        void operator()() {
+            m_pWorkers->started(m_enqueued);
+            busy_guard guard(m_pWorkers);
+            m_task();
+        }
+
+        friend void* asio_handler_allocate(std::size_t size, handler*) { return pooled_allocate(size); }
+        friend void asio_handler_deallocate(void* p, std::size_t size, handler*) { pooled_deallocate(p, size); }
+
+    private:
+        struct busy_guard {
+            busy_guard(elastic_workers* pWorkers) : m_pWorkers(pWorkers) {}
+            ~busy_guard() { m_pWorkers->m_busy.fetch_sub(1); }
+            elastic_workers* m_pWorkers;
+        };
+
+        elastic_workers*                m_pWorkers;
+        detail::pooled_task_handler     m_task;
+        duration::rep                   m_enqueued;
+    };
+
+    /** Tells the thread which runs it to exit */
+    struct retire_token {
+        void operator()() { retiring() = true; }
+    };
+
+    /** The monitor's view of us - it outlives us if a tick is still queued when we are destroyed */
+    struct monitor : boost::noncopyable {
+        monitor(elastic_workers* pWorkers) : m_pWorkers(pWorkers), m_timer(detail::elastic_monitor::service()),
+                                             m_armed(false) {}
+
+        static void on_tick(boost::shared_ptr<monitor> pMonitor, const boost::system::error_code& error) {
+            auto_lock lock(pMonitor->m_mutex);
+            if (!error && pMonitor->m_pWorkers) { pMonitor->m_pWorkers->tick(); }
+        }
+
+        boost::mutex                m_mutex;
+        elastic_workers*            m_pWorkers;
+        boost::asio::steady_timer   m_timer;
+        boost::atomic<bool>         m_armed;
+    };
+
+    static duration::rep now() { return clock_type::now().time_since_epoch().count(); }
+    static bool& retiring() { static THREAD_LOCAL bool b = false; return b; }
+
+    int floor() const { return std::max(m_limits.min_threads(), 1); }
+
+    void started(duration::rep enqueued) {
+        duration::rep t = now();
+        m_queued.fetch_sub(1);
+        m_lastStart.store(t, boost::memory_order_relaxed);
+        m_lastLatency.store(t - enqueued, boost::memory_order_relaxed);
+
+        int busy = m_busy.fetch_add(1) + 1;
+        int peak = m_peakBusy.load(boost::memory_order_relaxed);
+        while (busy > peak && !m_peakBusy.compare_exchange_weak(peak, busy, boost::memory_order_relaxed)) {}
+    }
+
+    /** Starts one thread, with the lowest free number (m_mutex must be held) */
+    void start_thread() {
+        join_exited();
+        std::size_t n = m_numbered;
+        if (m_free.empty()) {
+            m_numbered++;
+        } else {
+            std::vector<std::size_t>::iterator lowest = std::min_element(m_free.begin(), m_free.end());
+            n = *lowest;
+            m_free.erase(lowest);
+        }
+        m_live.fetch_add(1);
+        m_threads.push_back(new boost::thread(boost::bind(&elastic_workers::run, this, n)));
+    }
+
+    /** Cleans up threads which have retired (m_mutex must be held) */
+    void join_exited() {
+        for (std::size_t i = 0; i < m_exited.size(); i++) {
+            for (std::size_t j = 0; j < m_threads.size(); j++) {
+                if (m_threads[j]->get_id() != m_exited[i]) { continue; }
+                m_threads[j]->join();
+                delete m_threads[j];
+                m_threads.erase(m_threads.begin() + j);
+                break;
+            }
+        }
+        m_exited.clear();
+    }
+
+    void run(std::size_t n) {
+        if (m_onStart) { m_onStart(n); }
+        bool retired = false;
+        while (m_service.run_one() > 0) {
+            if (retiring()) { retired = true; break; }
+        }
+
+        auto_lock lock(m_mutex);
+        m_live.fetch_sub(1);
+        m_free.push_back(n);
+        if (retired) { m_retiring.fetch_sub(1); m_exited.push_back(boost::this_thread::get_id()); }
+    }
+
+    /** Starts the monitor's timer, if it isn't already running */
+    void arm() {
+        if (m_pMonitor->m_armed.load() || m_pMonitor->m_armed.exchange(true)) { return; }
+        auto_lock lock(m_pMonitor->m_mutex);
+        if (!m_pMonitor->m_pWorkers) { return; }
+        m_lastReap.store(now()), m_peakBusy.store(m_busy.load());
+        schedule_tick();
+    }
+
+    /** Waits for the next tick (the monitor's mutex must be held) */
+    void schedule_tick() {
+        m_pMonitor->m_timer.expires_from_now(m_limits.grow_after());
+        m_pMonitor->m_timer.async_wait(boost::bind(&monitor::on_tick, m_pMonitor, boost::asio::placeholders::error));
+    }
+
+    /** Grows when queued work isn't being picked up, and retires threads that haven't been needed (on the monitor) */
+    void tick() {
+        duration::rep t = now();
+        duration::rep growAfter = m_limits.grow_after().count();
+        int active = m_live.load() - m_retiring.load();
+
+        /* Retiring threads still hold their numbers, so they count towards the maximum until they exit */
+        if (m_queued.load() > 0 && m_live.load() < m_limits.max_threads() &&
+            (t - m_lastStart.load() >= growAfter || m_lastLatency.load() >= growAfter)) {
+            auto_lock lock(m_mutex);
+            if (m_live.load() < m_limits.max_threads()) { start_thread(); }
+            m_lastLatency.store(0);
+        }
+
+        if (t - m_lastReap.load() >= m_limits.idle_timeout().count()) {
+            int needed = std::max(floor(), m_peakBusy.exchange(m_busy.load()) + (m_queued.load() > 0 ? 1 : 0));
+            for (int i = needed; i < active; i++) {
+                m_retiring.fetch_add(1);
+                m_service.post(retire_token());
+            }
+            m_lastReap.store(t);
+        }
+
+        /* Keep ticking while there is work waiting or threads to retire */
+        active = m_live.load() - m_retiring.load();
+        if (m_queued.load() > 0 || active > floor()) {
+            schedule_tick();
+        } else {
+            m_pMonitor->m_armed.store(false);
+            if (m_queued.load() > 0 && !m_pMonitor->m_armed.exchange(true)) { schedule_tick(); }
+        }
+    }
+
+private:
+    boost::asio::io_service&            m_service;
+    elastic_limits                      m_limits;
+    prologue                            m_onStart;
+
+    boost::atomic<int>                  m_live;
+    boost::atomic<int>                  m_retiring;
+    std::size_t                         m_numbered;
+    boost::atomic<int>                  m_busy;
+    boost::atomic<int>                  m_peakBusy;
+    boost::atomic<long>                 m_queued;
+    boost::atomic<duration::rep>        m_lastStart;
+    boost::atomic<duration::rep>        m_lastLatency;
+    boost::atomic<duration::rep>        m_lastReap;
+
+    boost::mutex                        m_mutex;
+    std::vector<boost::thread*>         m_threads;
+    std::vector<boost::thread::id>      m_exited;
+    /** The numbers of threads which have exited, for the next ones to reuse (below m_numbered) */
+    std::vector<std::size_t>            m_free;
+    boost::shared_ptr<monitor>          m_pMonitor;
+};
+
+}
+
+#endif /* H_BOOST_EXT_ELASTIC_WORKERS */
@@ -0,0 +1,651 @@
+/**
+ * Deferred ("fast") logging - LOG_FAST(lvl, "fmt {} {}", a, b) only copies the call site, the format pointer and the
+ * raw argument bytes into a buffer owned by the calling thread.  The formatting is done later on a background thread,
+ * either into ordinary Boost.Log records (which come out of the usual sinks, in the standard format), or into a compact
+ * binary file which fast_log_decoder turns back into text offline.
+ */
+#ifndef H_BOOST_EXT_FAST_LOG
+#define H_BOOST_EXT_FAST_LOG
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <iomanip>
+#include <istream>
+#include <ostream>
+#include <fstream>
+#include "boost/noncopyable.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/make_shared.hpp"
+#include "boost/scoped_array.hpp"
+#include "boost/bind.hpp"
+#include "boost/atomic.hpp"
+#include "boost/utility/enable_if.hpp"
+#include "boost/type_traits/is_integral.hpp"
+#include "boost/type_traits/is_signed.hpp"
+#include "boost/type_traits/is_floating_point.hpp"
+#include "boost/type_traits/is_enum.hpp"
+#include "boost/preprocessor/arithmetic/inc.hpp"
+#include "boost/preprocessor/repetition.hpp"
+#include "boost/thread/thread.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/tss.hpp"
+#include "boost/thread/condition_variable.hpp"
+#include "boost/chrono/system_clocks.hpp"
+#include "boost/date_time/posix_time/posix_time_types.hpp"
+#include "boost/date_time/posix_time/conversion.hpp"
+#include "boost/date_time/c_local_time_adjustor.hpp"
+#include "boost/log/core.hpp"
+#include "boost/log/trivial.hpp"
+#include "boost/log/attributes/constant.hpp"
+#include "boost/log/attributes/attribute_set.hpp"
+#include "boost/log/sources/record_ostream.hpp"
+#include "boost/log/detail/thread_id.hpp"
+
+#include "boost-ext/common.hpp"
+#include "boost-ext/classes.hpp"
+#include "boost-ext/auto_lock.hpp"
+#include "boost-ext/exception.hpp"
+#include "boost-ext/thread_name.hpp"
+#include "boost-ext/log_level.hpp"
+
+/** The bytes of log entries each thread can hold before the writer catches up (rounded up to a power of two) */
+#if !defined(BOOST_EXT_LOG_FAST_BUFFER)
+    #define BOOST_EXT_LOG_FAST_BUFFER       (256 * 1024)
+#endif
+
+/** The most arguments a LOG_FAST call can take */
+#if !defined(BOOST_EXT_LOG_FAST_MAX_ARGS)
+    #define BOOST_EXT_LOG_FAST_MAX_ARGS     8
+#endif
+
+/** How often (in milliseconds) the writer looks for entries when nobody has woken it */
+#if !defined(BOOST_EXT_LOG_FAST_POLL_MS)
+    #define BOOST_EXT_LOG_FAST_POLL_MS      10
+#endif
+
+/**
+ * Logs a message whose "{}"s are replaced by the arguments, i.e. LOG_FAST(info, "took {}us for {}", us, name).  The
+ * format must be a string literal (only its pointer is kept), and the arguments integers, floating point values, bools,
+ * chars, strings or pointers.  Entries which don't fit in the thread's buffer are dropped (and counted).  It is
+ * checked against the level like LOG is.
+ */
+#define LOG_FAST(lvl, ...)                                                                                          \
+    do {                                                                                                            \
+        BOOST_EXT_LOG_IF(lvl, boost_ext::log::log_enabled(boost::log::trivial::lvl)) {                              \
+            static const boost_ext::log::fast_site _fastSite = { boost::log::trivial::lvl, __FILE__, __LINE__ };    \
+            boost_ext::log::fast_logger::get().log(_fastSite, __VA_ARGS__);                                         \
+        }                                                                                                           \
+    } while (0)
+
+/** Writes LOG_FAST entries to a binary file (for fast_log_decoder) instead of as records, and back again */
+#define ENABLE_FAST_BINARY_LOGGING(fileName)    boost_ext::log::fast_logger::get().write_binary(fileName)
+#define DISABLE_FAST_BINARY_LOGGING()           boost_ext::log::fast_logger::get().write_records()
+
+namespace boost_ext { namespace log {
+
+/** Where a LOG_FAST call is (one static instance per call) */
+struct fast_site {
+    boost::log::trivial::severity_level m_level;
+    const char*                         m_file;
+    int                                 m_line;
+};
+
+namespace detail {
+    /** The type of each captured argument (the first byte of it) */
+    enum fast_arg_tag { fast_int = 1, fast_uint, fast_double, fast_bool, fast_char, fast_string, fast_pointer };
+
+    /** Writes and reads values at (possibly unaligned) positions */
+    template<typename T> inline void fast_put(char*& p, const T& value) {
+        std::memcpy(p, &value, sizeof(T));
+        p += sizeof(T);
+    }
+    template<typename T> inline T fast_get(const char*& p) {
+        T value;
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+    inline void fast_put_string(char*& p, const char* s, boost::uint32_t length) {
+        fast_put<boost::uint8_t>(p, fast_string), fast_put(p, length);
+        std::memcpy(p, s, length);
+        p += length;
+    }
+
+    /** How each type of argument is captured - size() is the bytes it needs, and put() writes them */
+    template<typename T, typename Enable = void> struct fast_arg;
+
+    template<typename T>
+    struct fast_arg<T, typename boost::enable_if_c<(boost::is_integral<T>::value && boost::is_signed<T>::value) ||
+                                                   boost::is_enum<T>::value>::type> {
+        static std::size_t size(const T&) { return 1 + sizeof(boost::int64_t); }
+        static void put(char*& p, const T& v) { fast_put<boost::uint8_t>(p, fast_int), fast_put<boost::int64_t>(p, v); }
+    };
+    template<typename T>
+    struct fast_arg<T, typename boost::enable_if_c<boost::is_integral<T>::value && !boost::is_signed<T>::value>::type> {
+        static std::size_t size(const T&) { return 1 + sizeof(boost::uint64_t); }
+        static void put(char*& p, const T& v) {
+            fast_put<boost::uint8_t>(p, fast_uint), fast_put<boost::uint64_t>(p, v);
+        }
+    };
+    template<typename T>
+    struct fast_arg<T, typename boost::enable_if_c<boost::is_floating_point<T>::value>::type> {
+        static std::size_t size(const T&) { return 1 + sizeof(double); }
+        static void put(char*& p, const T& v) { fast_put<boost::uint8_t>(p, fast_double), fast_put<double>(p, v); }
+    };
+    template<> struct fast_arg<bool> {
+        static std::size_t size(bool) { return 2; }
+        static void put(char*& p, bool v) { fast_put<boost::uint8_t>(p, fast_bool), fast_put<boost::uint8_t>(p, v); }
+    };
+    template<> struct fast_arg<char> {
+        static std::size_t size(char) { return 2; }
+        static void put(char*& p, char v) { fast_put<boost::uint8_t>(p, fast_char), fast_put(p, v); }
+    };
+    template<> struct fast_arg<const char*> {
+        static std::size_t size(const char* s) { return 1 + sizeof(boost::uint32_t) + (s ? std::strlen(s) : 0); }
+        static void put(char*& p, const char* s) {
+            fast_put_string(p, s, static_cast<boost::uint32_t>(s ? std::strlen(s) : 0));
+        }
+    };
+    template<> struct fast_arg<char*> : fast_arg<const char*> {};
+    template<std::size_t N> struct fast_arg<char[N]> : fast_arg<const char*> {};
+    template<> struct fast_arg<std::string> {
+        static std::size_t size(const std::string& s) { return 1 + sizeof(boost::uint32_t) + s.size(); }
+        static void put(char*& p, const std::string& s) {
+            fast_put_string(p, s.data(), static_cast<boost::uint32_t>(s.size()));
+        }
+    };
+    template<typename T> struct fast_arg<T*> {
+        static std::size_t size(const T*) { return 1 + sizeof(boost::uint64_t); }
+        static void put(char*& p, const T* v) {
+            fast_put<boost::uint8_t>(p, fast_pointer), fast_put<boost::uint64_t>(p, reinterpret_cast<std::size_t>(v));
+        }
+    };
+
+    /** Prints one captured argument (and moves past it) */
+    inline void fast_print_arg(std::ostream& out, const char*& p) {
+        switch (fast_get<boost::uint8_t>(p)) {
+            case fast_int:      out << fast_get<boost::int64_t>(p); break;
+            case fast_uint:     out << fast_get<boost::uint64_t>(p); break;
+            case fast_double:   out << fast_get<double>(p); break;
+            case fast_bool:     out << (fast_get<boost::uint8_t>(p) ? "true" : "false"); break;
+            case fast_char:     out << fast_get<char>(p); break;
+            case fast_pointer:  out << "0x" << std::hex << fast_get<boost::uint64_t>(p) << std::dec; break;
+            case fast_string: {
+                boost::uint32_t length = fast_get<boost::uint32_t>(p);
+                out.write(p, length);
+                p += length;
+                break;
+            }
+            default:
+                BOOST_THROW_EXCEPTION(boost_ext::exception("Corrupt fast log argument"));
+        }
+    }
+
+    /** Prints a format, replacing each "{}" with the next argument (missing arguments leave the "{}") */
+    inline void fast_format(std::ostream& out, const char* format, const char* args, boost::uint32_t count) {
+        const char* start = format;
+        for (const char* p = format; *p; ) {
+            if (p[0] == '{' && p[1] == '}' && count > 0) {
+                out.write(start, p - start);
+                fast_print_arg(out, args);
+                count--, p += 2, start = p;
+            } else {
+                p++;
+            }
+        }
+        out << start;
+    }
+
+    /** The local time of a number of nanoseconds since the epoch */
+    inline boost::posix_time::ptime fast_local_time(boost::int64_t ns) {
+        boost::posix_time::ptime utc = boost::posix_time::from_time_t(static_cast<std::time_t>(ns / 1000000000)) +
+                                       boost::posix_time::microseconds((ns % 1000000000) / 1000);
+        return boost::date_time::c_local_adjustor<boost::posix_time::ptime>::utc_to_local(utc);
+    }
+
+    /** Prints "[timestamp] [thread] [severity] " for a decoded entry, as STD_LOG_FORMAT does */
+    inline void print_std_prefix(std::ostream& out, boost::int64_t time, const boost::log::aux::thread::id& thread,
+                                 boost::log::trivial::severity_level lvl) {
+        boost::posix_time::ptime t = fast_local_time(time);
+        boost::posix_time::time_duration tod = t.time_of_day();
+        char fill = out.fill('0');
+        out << "[" << std::setw(4) << static_cast<int>(t.date().year()) << "-" << std::setw(2)
+            << static_cast<int>(t.date().month()) << "-" << std::setw(2) << static_cast<int>(t.date().day()) << " "
+            << std::setw(2) << tod.hours() << ":" << std::setw(2) << tod.minutes() << ":" << std::setw(2)
+            << tod.seconds() << "." << std::setw(6) << tod.total_microseconds() % 1000000;
+        out.fill(fill);
+        out << "] [" << thread << "] [" << std::setw(7) << boost::log::trivial::to_string(lvl) << "] ";
+    }
+
+    /** The start of each entry in a fast_buffer - its arguments follow it */
+    struct fast_header {
+        boost::uint32_t     m_size;     /* The whole entry, including padding to 8 bytes (0 means skip to the start) */
+        boost::uint32_t     m_args;
+        const fast_site*    m_pSite;
+        const char*         m_format;
+        boost::int64_t      m_time;     /* Nanoseconds since the epoch */
+    };
+
+    /**
+     * A single-producer, single-consumer ring of entries - written by the thread which owns it, and drained by the
+     * writer.  Entries are contiguous, so one which doesn't fit before the end of the ring skips to the start.
+     */
+    class fast_buffer : boost::noncopyable {
+    public:
+        fast_buffer(std::size_t capacity, const boost::log::aux::thread::id& thread)
+            : m_thread(thread), m_mask(round_up(capacity) - 1), m_data(new char[m_mask + 1]), m_reserved(0), m_tail(0),
+              m_dropped(0), m_retired(false), m_head(0) {}
+
+        /** Starts an entry (on the owner only) - returns where its arguments go, or NULL if there is no room */
+        char* open(const fast_site& site, const char* format, boost::uint32_t args, std::size_t argBytes) {
+            std::size_t size = (sizeof(fast_header) + argBytes + 7) & ~static_cast<std::size_t>(7);
+            std::size_t tail = m_tail.load(boost::memory_order_relaxed);
+            std::size_t pos = tail & m_mask, skip = (m_mask + 1 - pos < size) ? m_mask + 1 - pos : 0;
+            if (size > m_mask + 1 || tail + skip + size - m_head.load(boost::memory_order_acquire) > m_mask + 1) {
+                m_dropped.fetch_add(1, boost::memory_order_relaxed);
+                return NULL;
+            }
+            if (skip) {
+                reinterpret_cast<fast_header*>(&m_data[pos])->m_size = 0;
+                pos = 0;
+            }
+            m_reserved = tail + skip + size;
+
+            fast_header* pHeader = reinterpret_cast<fast_header*>(&m_data[pos]);
+            pHeader->m_size = static_cast<boost::uint32_t>(size), pHeader->m_args = args;
+            pHeader->m_pSite = &site, pHeader->m_format = format;
+            pHeader->m_time = boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+                                    boost::chrono::system_clock::now().time_since_epoch()).count();
+            return &m_data[pos + sizeof(fast_header)];
+        }
+
+        /** Publishes the opened entry - returns true once the ring is over half full */
+        bool commit() {
+            m_tail.store(m_reserved, boost::memory_order_release);
+            return m_reserved - m_head.load(boost::memory_order_relaxed) > (m_mask + 1) / 2;
+        }
+
+        /** The oldest entry (on the writer only) - or NULL if there is none */
+        const fast_header* front() {
+            for (;;) {
+                std::size_t head = m_head.load(boost::memory_order_relaxed);
+                if (head == m_tail.load(boost::memory_order_acquire)) { return NULL; }
+                const fast_header* pHeader = reinterpret_cast<const fast_header*>(&m_data[head & m_mask]);
+                if (pHeader->m_size) { return pHeader; }
+                m_head.store(head + m_mask + 1 - (head & m_mask), boost::memory_order_release);
+            }
+        }
+
+        /** Releases the oldest entry (on the writer only) */
+        void pop() {
+            std::size_t head = m_head.load(boost::memory_order_relaxed);
+            m_head.store(head + reinterpret_cast<const fast_header*>(&m_data[head & m_mask])->m_size,
+                         boost::memory_order_release);
+        }
+
+        /** Marks the buffer as done with (when its thread exits) - the writer drops it once it's empty */
+        void retire() { m_retired.store(true, boost::memory_order_release); }
+        bool retired() const { return m_retired.load(boost::memory_order_acquire); }
+
+        boost::uint64_t dropped() const { return m_dropped.load(boost::memory_order_relaxed); }
+        GETTER(const boost::log::aux::thread::id&, m_thread, thread)
+
+    private:
+        static std::size_t round_up(std::size_t n) {
+            std::size_t size = 64;
+            while (size < n) { size <<= 1; }
+            return size;
+        }
+
+        boost::log::aux::thread::id     m_thread;
+        std::size_t                     m_mask;
+        boost::scoped_array<char>       m_data;
+
+        /* The owner's side */
+        std::size_t                     m_reserved;
+        boost::atomic<std::size_t>      m_tail;
+        boost::atomic<boost::uint64_t>  m_dropped;
+        boost::atomic<bool>             m_retired;
+        char                            m_pad[BOOST_EXT_CACHE_LINE_SIZE];
+
+        /* The writer's side */
+        boost::atomic<std::size_t>      m_head;
+    };
+
+    /** Retires a thread's buffer when the thread exits */
+    struct fast_buffer_owner : boost::noncopyable {
+        fast_buffer_owner(const boost::shared_ptr<fast_buffer>& pBuffer) : m_pBuffer(pBuffer) {}
+        ~fast_buffer_owner() { m_pBuffer->retire(); }
+        boost::shared_ptr<fast_buffer> m_pBuffer;
+    };
+
+    /**
+     * Writes entries to a binary file - a magic string and version, then a site record (kind 1) the first time each
+     * call site and format is seen, and an entry record (kind 2) for each entry.  Values are in the writer's native
+     * byte order.
+     */
+    class fast_binary_writer : boost::noncopyable {
+    public:
+        static const char* magic() { return "BXFASTLG"; }
+        static boost::uint32_t version() { return 1; }
+        enum kind { site_record = 1, entry_record = 2 };
+
+        explicit fast_binary_writer(const std::string& fileName)
+            : m_file(fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc) {
+            if (!m_file.is_open()) {
+                BOOST_THROW_EXCEPTION(boost_ext::exception("Could not open fast log file " + fileName));
+            }
+            m_file.write(magic(), std::strlen(magic()));
+            put(version());
+        }
+
+        void write(const fast_header& header, const boost::log::aux::thread::id& thread) {
+            site_map::iterator i = m_sites.find(std::make_pair(header.m_pSite, header.m_format));
+            if (i == m_sites.end()) {
+                i = m_sites.insert(std::make_pair(std::make_pair(header.m_pSite, header.m_format),
+                                                  static_cast<boost::uint32_t>(m_sites.size()))).first;
+                put<boost::uint8_t>(site_record), put(i->second);
+                put<boost::int32_t>(header.m_pSite->m_level), put<boost::int32_t>(header.m_pSite->m_line);
+                put_string(header.m_pSite->m_file), put_string(header.m_format);
+            }
+            boost::uint32_t argBytes = header.m_size - static_cast<boost::uint32_t>(sizeof(fast_header));
+            put<boost::uint8_t>(entry_record), put(i->second), put(header.m_time);
+            put<boost::uint64_t>(thread.native_id()), put(header.m_args), put(argBytes);
+            m_file.write(reinterpret_cast<const char*>(&header + 1), argBytes);
+        }
+
+        void flush() { m_file.flush(); }
+
+    private:
+        typedef std::map<std::pair<const fast_site*, const char*>, boost::uint32_t> site_map;
+
+        template<typename T> void put(const T& value) {
+            m_file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+        void put_string(const char* s) {
+            put(static_cast<boost::uint32_t>(std::strlen(s)));
+            m_file.write(s, std::strlen(s));
+        }
+
+        std::ofstream   m_file;
+        site_map        m_sites;
+    };
+}
+
+/**
+ * Owns the per-thread buffers, and the thread which drains them.  The writer wakes every BOOST_EXT_LOG_FAST_POLL_MS,
+ * or sooner when a buffer gets half full, so logging threads never wait on it (or on a lock) - a call costs a clock
+ * read and a copy of its arguments.
+ */
+class fast_logger : boost::noncopyable {
+public:
+    SINGLETON(fast_logger, get);
+
+    /** Captures an entry (use LOG_FAST rather than calling these) */
+    void log(const fast_site& site, const char* format) {
+        detail::fast_buffer& buffer = local_buffer();
+        if (buffer.open(site, format, 0, 0) && buffer.commit()) { nudge(); }
+    }
+    #define BOOST_EXT_LOG_FAST_SIZE(z, n, _)        + detail::fast_arg<A##n>::size(a##n)
+    #define BOOST_EXT_LOG_FAST_PUT(z, n, _)         detail::fast_arg<A##n>::put(p, a##n);
+    #define BOOST_EXT_LOG_FAST_OVERLOAD(z, n, _)                                                                    \
+        template<BOOST_PP_ENUM_PARAMS(n, typename A)>                                                               \
+        void log(const fast_site& site, const char* format, BOOST_PP_ENUM_BINARY_PARAMS(n, const A, &a)) {         \
+            detail::fast_buffer& buffer = local_buffer();                                                           \
+            char* p = buffer.open(site, format, n, 0 BOOST_PP_REPEAT(n, BOOST_EXT_LOG_FAST_SIZE, _));               \
+            if (!p) { return; }                                                                                     \
+            BOOST_PP_REPEAT(n, BOOST_EXT_LOG_FAST_PUT, _)                                                           \
+            if (buffer.commit()) { nudge(); }                                                                       \
+        }
+    BOOST_PP_REPEAT_FROM_TO(1, BOOST_PP_INC(BOOST_EXT_LOG_FAST_MAX_ARGS), BOOST_EXT_LOG_FAST_OVERLOAD, _)
+    #undef BOOST_EXT_LOG_FAST_OVERLOAD
+    #undef BOOST_EXT_LOG_FAST_PUT
+    #undef BOOST_EXT_LOG_FAST_SIZE
+
+    /** Waits until everything captured before the call has been written (and, for records, flushed by the sinks) */
+    void flush() {
+        {
+            auto_lock lock(m_mutex);
+            boost::uint64_t pass = ++m_requested;
+            m_wakeup.notify_one();
+            while (m_completed < pass && !m_stopping) { m_progress.wait(lock); }
+        }
+        boost::log::core::get()->flush();
+    }
+
+    /** Writes entries to a binary file from now on (throws if it can't be opened) */
+    void write_binary(const std::string& fileName) {
+        boost::shared_ptr<detail::fast_binary_writer> pWriter(new detail::fast_binary_writer(fileName));
+        flush();
+        auto_lock lock(m_mutex);
+        m_pBinary = pWriter;
+    }
+
+    /** Writes entries as Boost.Log records from now on (closing any binary file) */
+    void write_records() {
+        flush();
+        auto_lock lock(m_mutex);
+        m_pBinary.reset();
+    }
+
+    /** Entries written so far, and dropped because a buffer was full */
+    boost::uint64_t written() const { return m_written.load(boost::memory_order_relaxed); }
+    boost::uint64_t dropped() const {
+        auto_lock lock(m_mutex);
+        boost::uint64_t n = m_retiredDrops;
+        for (std::size_t i = 0; i < m_buffers.size(); i++) { n += m_buffers[i]->dropped(); }
+        return n;
+    }
+
+private:
+    typedef std::vector< boost::shared_ptr<detail::fast_buffer> > buffer_list;
+
+    fast_logger() : m_written(0), m_retiredDrops(0), m_requested(0), m_completed(0), m_sleeping(false),
+                    m_stopping(false), m_thread(boost::bind(&fast_logger::run, this)) {}
+    ~fast_logger() {
+        {
+            auto_lock lock(m_mutex);
+            m_stopping = true;
+            m_wakeup.notify_one();
+        }
+        m_thread.join();
+    }
+
+    static detail::fast_buffer*& current() { static THREAD_LOCAL detail::fast_buffer* p = NULL; return p; }
+
+    /** The calling thread's buffer - created on its first entry */
+    detail::fast_buffer& local_buffer() {
+        detail::fast_buffer*& pBuffer = current();
+        if (!pBuffer) {
+            boost::shared_ptr<detail::fast_buffer> p(
+                new detail::fast_buffer(BOOST_EXT_LOG_FAST_BUFFER, boost::log::aux::this_thread::get_id()));
+            m_owner.reset(new detail::fast_buffer_owner(p));
+            auto_lock lock(m_mutex);
+            m_buffers.push_back(p);
+            pBuffer = p.get();
+        }
+        return *pBuffer;
+    }
+
+    /** Wakes the writer early, if it's sleeping */
+    void nudge() {
+        if (m_sleeping.load(boost::memory_order_relaxed)) {
+            auto_lock lock(m_mutex);
+            m_wakeup.notify_one();
+        }
+    }
+
+    /** Formats an entry as a record, and hands it to the core */
+    void write_record(const detail::fast_header& header, const boost::log::aux::thread::id& thread) {
+        namespace attrs = boost::log::attributes;
+        boost::shared_ptr<boost::log::core> pCore = boost::log::core::get();
+        boost::log::attribute_set source;
+        source.insert("Severity", attrs::constant<boost::log::trivial::severity_level>(header.m_pSite->m_level));
+        source.insert("TimeStamp", attrs::constant<boost::posix_time::ptime>(detail::fast_local_time(header.m_time)));
+        source.insert("ThreadID", attrs::constant<boost::log::aux::thread::id>(thread));
+        boost::log::record rec = pCore->open_record(source);
+        if (!rec) { return; }
+        {
+            boost::log::record_ostream strm(rec);
+            detail::fast_format(strm.stream(), header.m_format, reinterpret_cast<const char*>(&header + 1),
+                                header.m_args);
+            strm.flush();
+        }
+        pCore->push_record(boost::move(rec));
+    }
+
+    /** Writes everything in a buffer - returns whether there was anything */
+    bool drain(detail::fast_buffer& buffer, detail::fast_binary_writer* pBinary) {
+        bool wrote = false;
+        for (const detail::fast_header* pHeader; (pHeader = buffer.front()) != NULL; buffer.pop()) {
+            try {
+                if (pBinary) {
+                    pBinary->write(*pHeader, buffer.thread());
+                } else {
+                    write_record(*pHeader, buffer.thread());
+                }
+            } catch (...) {}
+            m_written.fetch_add(1, boost::memory_order_relaxed);
+            wrote = true;
+        }
+        return wrote;
+    }
+
+    void run() {
+        set_current_thread_name("fast-log");
+
+        /* Kept across passes, so that an idle poll doesn't allocate */
+        buffer_list buffers, empty;
+        for (;;) {
+            boost::shared_ptr<detail::fast_binary_writer> pBinary;
+            boost::uint64_t pass;
+            bool stopping;
+            {
+                auto_lock lock(m_mutex);
+                buffers = m_buffers, pBinary = m_pBinary, pass = m_requested, stopping = m_stopping;
+            }
+
+            /* Drain every buffer - a retired one which is empty afterwards can go */
+            empty.clear();
+            for (std::size_t i = 0; i < buffers.size(); i++) {
+                bool retired = buffers[i]->retired();
+                drain(*buffers[i], pBinary.get());
+                if (retired) { empty.push_back(buffers[i]); }
+            }
+            if (pBinary) { pBinary->flush(); }
+
+            auto_lock lock(m_mutex);
+            for (std::size_t i = 0; i < empty.size(); i++) {
+                m_retiredDrops += empty[i]->dropped();
+                m_buffers.erase(std::find(m_buffers.begin(), m_buffers.end(), empty[i]));
+            }
+            buffers.clear(), empty.clear();
+            m_completed = pass;
+            m_progress.notify_all();
+            if (stopping) { return; }
+            if (m_requested == pass && !m_stopping) {
+                m_sleeping.store(true);
+                m_wakeup.wait_for(lock, boost::chrono::milliseconds(BOOST_EXT_LOG_FAST_POLL_MS));
+                m_sleeping.store(false);
+            }
+        }
+    }
+
+private:
+    boost::atomic<boost::uint64_t>                      m_written;
+    boost::thread_specific_ptr<detail::fast_buffer_owner> m_owner;
+
+    mutable boost::mutex                                m_mutex;
+    buffer_list                                         m_buffers;
+    boost::shared_ptr<detail::fast_binary_writer>       m_pBinary;
+    boost::uint64_t                                     m_retiredDrops;
+    boost::uint64_t                                     m_requested;
+    boost::uint64_t                                     m_completed;
+    boost::atomic<bool>                                 m_sleeping;
+    bool                                                m_stopping;
+    boost::condition_variable                           m_wakeup;
+    boost::condition_variable                           m_progress;
+    boost::thread                                       m_thread;
+};
+
+/** Turns a binary fast log back into text - one line per entry, in the standard format */
+class fast_log_decoder {
+public:
+    /** Decodes a stream - returns the number of entries (and throws if it isn't a fast log, or is corrupt) */
+    static std::size_t decode(std::istream& in, std::ostream& out) {
+        typedef detail::fast_binary_writer writer;
+        std::string magic(std::strlen(writer::magic()), '\0');
+        in.read(&magic[0], magic.size());
+        if (!in || magic != writer::magic() || get<boost::uint32_t>(in) != writer::version()) {
+            BOOST_THROW_EXCEPTION(boost_ext::exception("Not a fast log"));
+        }
+
+        std::map<boost::uint32_t, site> sites;
+        std::size_t entries = 0;
+        for (int kind; (kind = in.get()) != std::char_traits<char>::eof(); ) {
+            if (kind == writer::site_record) {
+                site& s = sites[get<boost::uint32_t>(in)];
+                s.m_level = static_cast<boost::log::trivial::severity_level>(get<boost::int32_t>(in));
+                s.m_line = get<boost::int32_t>(in);
+                s.m_file = get_string(in), s.m_format = get_string(in);
+            } else if (kind == writer::entry_record) {
+                std::map<boost::uint32_t, site>::const_iterator i = sites.find(get<boost::uint32_t>(in));
+                boost::int64_t time = get<boost::int64_t>(in);
+                boost::log::aux::thread::id thread(
+                    static_cast<boost::log::aux::thread::native_type>(get<boost::uint64_t>(in)));
+                boost::uint32_t args = get<boost::uint32_t>(in);
+                std::string bytes = get_bytes(in, get<boost::uint32_t>(in));
+                if (i == sites.end()) { BOOST_THROW_EXCEPTION(boost_ext::exception("Corrupt fast log")); }
+                print_line(out, i->second, time, thread, args, bytes);
+                entries++;
+            } else {
+                BOOST_THROW_EXCEPTION(boost_ext::exception("Corrupt fast log"));
+            }
+        }
+        return entries;
+    }
+
+    /** Decodes a file */
+    static std::size_t decode(const std::string& fileName, std::ostream& out) {
+        std::ifstream in(fileName.c_str(), std::ios::in | std::ios::binary);
+        if (!in.is_open()) { BOOST_THROW_EXCEPTION(boost_ext::exception("Could not open fast log file " + fileName)); }
+        return decode(in, out);
+    }
+
+private:
+    struct site {
+        boost::log::trivial::severity_level m_level;
+        int                                 m_line;
+        std::string                         m_file;
+        std::string                         m_format;
+    };
+
+    template<typename T> static T get(std::istream& in) {
+        std::string bytes = get_bytes(in, sizeof(T));
+        const char* p = bytes.data();
+        return detail::fast_get<T>(p);
+    }
+    static std::string get_bytes(std::istream& in, std::size_t n) {
+        std::string bytes(n, '\0');
+        if (n) { in.read(&bytes[0], n); }
+        if (!in) { BOOST_THROW_EXCEPTION(boost_ext::exception("Truncated fast log")); }
+        return bytes;
+    }
+    static std::string get_string(std::istream& in) { return get_bytes(in, get<boost::uint32_t>(in)); }
+
+    /** Prints an entry as STD_LOG_FORMAT does - "[timestamp] [thread] [severity] message" */
+    static void print_line(std::ostream& out, const site& s, boost::int64_t time,
+                           const boost::log::aux::thread::id& thread, boost::uint32_t args, const std::string& bytes) {
+        detail::print_std_prefix(out, time, thread, s.m_level);
+        detail::fast_format(out, s.m_format.c_str(), bytes.data(), args);
+        out << std::endl;
+    }
+};
+
+}}
+
+#endif /* H_BOOST_EXT_FAST_LOG */
@@ -0,0 +1,305 @@
+/**
+ * A log file backend - lines are appended to a large buffer (or straight into a memory-mapped segment of the file) and
+ * written in batches, and the file is rotated by size or by age.  It is meant to sit behind an async_sink, so that the
+ * batching, flushing and rotating all happen on the sink's writer thread, and logging threads never wait for them.
+ */
+#ifndef H_BOOST_EXT_FILE_LOG
+#define H_BOOST_EXT_FILE_LOG
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include "boost/cstdint.hpp"
+#include "boost/chrono/system_clocks.hpp"
+#include "boost/log/sinks/basic_sink_backend.hpp"
+#include "boost/log/sinks/frontend_requirements.hpp"
+
+#include "boost-ext/platform_detect.hpp"
+#include "boost-ext/classes.hpp"
+#include "boost-ext/exception.hpp"
+
+#if !(_IS_OS_WINDOWS_)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #define BOOST_EXT_LOG_FILE_HAS_MMAP     1
+#endif
+
+/** The bytes buffered before they are written (for files which aren't mapped) */
+#if !defined(BOOST_EXT_LOG_FILE_BUFFER)
+    #define BOOST_EXT_LOG_FILE_BUFFER       (1024 * 1024)
+#endif
+
+/** The bytes mapped at a time (for files which are) */
+#if !defined(BOOST_EXT_LOG_FILE_SEGMENT)
+    #define BOOST_EXT_LOG_FILE_SEGMENT      (16 * 1024 * 1024)
+#endif
+
+/** How often (in milliseconds) a file's async sink writes out what it has buffered, by default */
+#if !defined(BOOST_EXT_LOG_FILE_FLUSH_MS)
+    #define BOOST_EXT_LOG_FILE_FLUSH_MS     1000
+#endif
+
+namespace boost_ext { namespace log {
+
+/** Where a log file is, how it is written, and when it is rotated */
+class file_options {
+public:
+    explicit file_options(const std::string& fileName)
+        : m_fileName(fileName), m_rotateSize(0), m_rotateInterval(0), m_maxFiles(5),
+          m_bufferSize(BOOST_EXT_LOG_FILE_BUFFER), m_mapped(false), m_segmentSize(BOOST_EXT_LOG_FILE_SEGMENT) {}
+
+    /** The file - rotated files have ".1", ".2" and so on appended (".1" being the newest) */
+    ACCESSOR(file_options, const std::string&, m_fileName, file_name)
+
+    /** Rotate once the file holds this many bytes (0 for never) */
+    ACCESSOR(file_options, boost::uint64_t, m_rotateSize, rotate_size)
+
+    /** Rotate with the first line after the file has been open this long (0 for never) */
+    ACCESSOR(file_options, boost::chrono::seconds, m_rotateInterval, rotate_interval)
+
+    /** The number of rotated files to keep (0 to keep none) */
+    ACCESSOR(file_options, unsigned int, m_maxFiles, max_files)
+
+    /** The bytes buffered before they are written */
+    ACCESSOR(file_options, std::size_t, m_bufferSize, buffer_size)
+
+    /**
+     * Whether to write straight into memory-mapped segments of the file (segment_size bytes at a time) - there is no
+     * copy or system call per batch, but until the file is closed it is padded with zeros to the end of the segment.
+     * This is ignored where mapping isn't supported.
+     */
+    ACCESSOR(file_options, bool, m_mapped, mapped)
+    ACCESSOR(file_options, std::size_t, m_segmentSize, segment_size)
+
+private:
+    std::string             m_fileName;
+    boost::uint64_t         m_rotateSize;
+    boost::chrono::seconds  m_rotateInterval;
+    unsigned int            m_maxFiles;
+    std::size_t             m_bufferSize;
+    bool                    m_mapped;
+    std::size_t             m_segmentSize;
+};
+
+/**
+ * Writes formatted lines to a file, rotating it as its options say.  It isn't thread-safe (an async_sink only calls
+ * it from its writer thread) - flush() writes out the buffer, and errors are thrown as boost_ext::exceptions.
+ */
+class rotating_file_backend : public boost::log::sinks::basic_formatted_sink_backend<char,
+        boost::log::sinks::combine_requirements<boost::log::sinks::synchronized_feeding,
+                                                boost::log::sinks::flushing>::type> {
+public:
+    explicit rotating_file_backend(const file_options& options)
+        : m_options(options), m_size(0), m_rotations(0), m_pFile(NULL), m_fd(-1), m_pSegment(NULL), m_segmentStart(0),
+          m_segmentSize(0) {
+        m_buffer.reserve(options.buffer_size());
+        open();
+    }
+    ~rotating_file_backend() {
+        try { close(); } catch (...) {}
+    }
+
+    void consume(const boost::log::record_view&, const string_type& message) {
+        if (!opened()) {
+            open();
+        } else if (rotation_due()) {
+            rotate();
+        }
+        append(message.data(), message.size());
+        append("\n", 1);
+    }
+
+    /** Writes out whatever is buffered (a mapped file has nothing to write - its pages are already the file's) */
+    void flush() {
+        if (m_pFile) {
+            write_buffer();
+            std::fflush(m_pFile);
+        }
+    }
+
+    /** Closes the file, shifts the rotated files along, and starts a new one */
+    void rotate() {
+        close();
+        std::remove(numbered(m_options.max_files()).c_str());
+        for (unsigned int i = m_options.max_files(); i > 1; i--) {
+            std::rename(numbered(i - 1).c_str(), numbered(i).c_str());
+        }
+        if (m_options.max_files() > 0) {
+            std::rename(m_options.file_name().c_str(), numbered(1).c_str());
+        } else {
+            std::remove(m_options.file_name().c_str());
+        }
+        open();
+        m_rotations++;
+    }
+
+    GETTER(const file_options&, m_options, options)
+
+    /** The bytes in the current file (including any buffered), and the rotations so far */
+    boost::uint64_t size() const { return m_size; }
+    boost::uint64_t rotations() const { return m_rotations; }
+
+private:
+    typedef boost::chrono::system_clock clock;
+
+    std::string numbered(unsigned int i) const {
+        std::stringstream s;
+        s << m_options.file_name() << "." << i;
+        return s.str();
+    }
+
+    /** Whether there is a file to append to (there isn't if a rotation failed to open the new one - it is retried) */
+    bool opened() const {
+        #if (BOOST_EXT_LOG_FILE_HAS_MMAP)
+            if (m_pSegment) { return true; }
+        #endif
+        return m_pFile != NULL;
+    }
+
+    bool rotation_due() const {
+        return (m_options.rotate_size() > 0 && m_size >= m_options.rotate_size()) ||
+               (m_options.rotate_interval() > boost::chrono::seconds::zero() && clock::now() >= m_rotateAt);
+    }
+
+    void open() {
+        const std::string& name = m_options.file_name();
+        #if (BOOST_EXT_LOG_FILE_HAS_MMAP)
+            if (m_options.mapped()) {
+                struct stat st;
+                if ((m_fd = ::open(name.c_str(), O_RDWR | O_CREAT, 0644)) < 0 || ::fstat(m_fd, &st) != 0) {
+                    if (m_fd >= 0) { ::close(m_fd); }
+                    m_fd = -1;
+                    BOOST_THROW_EXCEPTION(boost_ext::exception("Could not open log file " + name));
+                }
+                std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+                m_segmentSize = std::max(page, (m_options.segment_size() + page - 1) / page * page);
+                m_size = unpadded_size(static_cast<boost::uint64_t>(st.st_size));
+                map_segment(m_size - m_size % page);
+                m_rotateAt = clock::now() + m_options.rotate_interval();
+                return;
+            }
+        #endif
+        if (!(m_pFile = std::fopen(name.c_str(), "ab"))) {
+            BOOST_THROW_EXCEPTION(boost_ext::exception("Could not open log file " + name));
+        }
+        std::setvbuf(m_pFile, NULL, _IONBF, 0);
+        std::fseek(m_pFile, 0, SEEK_END);
+        m_size = static_cast<boost::uint64_t>(std::ftell(m_pFile));
+        m_rotateAt = clock::now() + m_options.rotate_interval();
+    }
+
+    void close() {
+        if (m_pFile) {
+            std::FILE* pFile = m_pFile;
+            m_pFile = NULL;
+            write_buffer(pFile);
+            std::fclose(pFile);
+        }
+        #if (BOOST_EXT_LOG_FILE_HAS_MMAP)
+            if (m_fd >= 0) {
+                if (m_pSegment) { ::munmap(m_pSegment, m_segmentSize); }
+                m_pSegment = NULL;
+                int ok = ::ftruncate(m_fd, static_cast<off_t>(m_size));
+                ::close(m_fd);
+                m_fd = -1;
+                if (ok != 0) { BOOST_THROW_EXCEPTION(boost_ext::exception("Could not trim log file")); }
+            }
+        #endif
+    }
+
+    void append(const char* p, std::size_t n) {
+        #if (BOOST_EXT_LOG_FILE_HAS_MMAP)
+            if (m_pSegment) {
+                while (n > 0) {
+                    if (m_size - m_segmentStart == m_segmentSize) { map_segment(m_segmentStart + m_segmentSize); }
+                    std::size_t chunk = std::min<std::size_t>(n, m_segmentSize - (m_size - m_segmentStart));
+                    std::memcpy(m_pSegment + (m_size - m_segmentStart), p, chunk);
+                    p += chunk, n -= chunk, m_size += chunk;
+                }
+                return;
+            }
+        #endif
+        if (m_buffer.size() + n > m_options.buffer_size()) { write_buffer(); }
+        if (n >= m_options.buffer_size()) {
+            write(m_pFile, p, n);
+        } else {
+            m_buffer.insert(m_buffer.end(), p, p + n);
+        }
+        m_size += n;
+    }
+
+    void write_buffer(std::FILE* pFile = NULL) {
+        if (m_buffer.empty()) { return; }
+        write(pFile ? pFile : m_pFile, &m_buffer[0], m_buffer.size());
+        m_buffer.clear();
+    }
+
+    void write(std::FILE* pFile, const char* p, std::size_t n) {
+        if (std::fwrite(p, 1, n, pFile) != n) {
+            BOOST_THROW_EXCEPTION(boost_ext::exception("Could not write log file " + m_options.file_name()));
+        }
+    }
+
+    #if (BOOST_EXT_LOG_FILE_HAS_MMAP)
+        /**
+         * The size of the file without the zeros past its last line - a process which crashed with the file mapped
+         * leaves the rest of its segment zeroed, and lines never hold a zero
+         */
+        boost::uint64_t unpadded_size(boost::uint64_t size) const {
+            char buf[4096];
+            while (size > 0) {
+                std::size_t n = static_cast<std::size_t>(std::min<boost::uint64_t>(size, sizeof(buf)));
+                if (::pread(m_fd, buf, n, static_cast<off_t>(size - n)) != static_cast<ssize_t>(n)) { break; }
+                for (std::size_t i = n; i > 0; i--, size--) {
+                    if (buf[i - 1] != 0) { return size; }
+                }
+            }
+            return size;
+        }
+
+        /**
+         * Maps the segment of the file starting at start (growing the file to hold it) - if that fails, the file is
+         * trimmed to the m_size bytes written so far and closed, so that the next record opens it afresh
+         */
+        void map_segment(boost::uint64_t start) {
+            if (m_pSegment) { ::munmap(m_pSegment, m_segmentSize); }
+            m_pSegment = NULL;
+            void* p = MAP_FAILED;
+            if (::ftruncate(m_fd, static_cast<off_t>(start + m_segmentSize)) == 0) {
+                p = ::mmap(NULL, m_segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, static_cast<off_t>(start));
+            }
+            if (p == MAP_FAILED) {
+                if (::ftruncate(m_fd, static_cast<off_t>(m_size)) != 0) { /* It is closed regardless */ }
+                ::close(m_fd);
+                m_fd = -1;
+                BOOST_THROW_EXCEPTION(boost_ext::exception("Could not map log file " + m_options.file_name()));
+            }
+            m_pSegment = static_cast<char*>(p), m_segmentStart = start;
+        }
+    #endif
+
+private:
+    file_options        m_options;
+    boost::uint64_t     m_size;
+    boost::uint64_t     m_rotations;
+    clock::time_point   m_rotateAt;
+
+    /* A buffered file */
+    std::FILE*          m_pFile;
+    std::vector<char>   m_buffer;
+
+    /* A mapped file */
+    int                 m_fd;
+    char*               m_pSegment;
+    boost::uint64_t     m_segmentStart;
+    std::size_t         m_segmentSize;
+};
+
+}}
+
+#endif /* H_BOOST_EXT_FILE_LOG */
@@ -0,0 +1,617 @@
+/**
+ * A flight recorder - every log statement down to its level (trace, by default) is kept in a fixed-size ring owned by
+ * the calling thread, however the other sinks are filtered.  The rings live in a memory-mapped file, so recording is
+ * a copy into memory (with no I/O or lock), and what was recorded survives the process crashing.  flight_log_decoder
+ * turns the file back into text afterwards, and flight_recorder::dump does the same for the live rings on demand.
+ */
+#ifndef H_BOOST_EXT_FLIGHT_LOG
+#define H_BOOST_EXT_FLIGHT_LOG
+
+#include <cstring>
+#include <csignal>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <fstream>
+#include <sstream>
+#include "boost/noncopyable.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/static_assert.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/scoped_array.hpp"
+#include "boost/atomic.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/tss.hpp"
+#include "boost/chrono/system_clocks.hpp"
+#include "boost/log/core.hpp"
+#include "boost/log/trivial.hpp"
+#include "boost/log/expressions/message.hpp"
+#include "boost/log/sources/record_ostream.hpp"
+#include "boost/log/sinks/basic_sink_backend.hpp"
+#include "boost/log/utility/formatting_ostream.hpp"
+#include "boost/log/detail/thread_id.hpp"
+
+#include "boost-ext/platform_detect.hpp"
+#include "boost-ext/common.hpp"
+#include "boost-ext/classes.hpp"
+#include "boost-ext/auto_lock.hpp"
+#include "boost-ext/exception.hpp"
+#include "boost-ext/log_level.hpp"
+#include "boost-ext/fast_log.hpp"
+
+#if !(_IS_OS_WINDOWS_)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #define BOOST_EXT_LOG_FLIGHT_HAS_MMAP   1
+#endif
+
+/** The bytes each thread's ring holds (rounded up to a multiple of 8) - older lines are overwritten by newer ones */
+#if !defined(BOOST_EXT_LOG_FLIGHT_BUFFER)
+    #define BOOST_EXT_LOG_FLIGHT_BUFFER     (64 * 1024)
+#endif
+
+/** The number of rings in a recording - threads beyond that many (at once) aren't recorded */
+#if !defined(BOOST_EXT_LOG_FLIGHT_THREADS)
+    #define BOOST_EXT_LOG_FLIGHT_THREADS    64
+#endif
+
+namespace boost_ext { namespace log {
+
+namespace detail {
+    /**
+     * A recording is a flight_file_header, then m_slots of (a flight_slot_header, then m_ringBytes of entries).  Each
+     * entry is a flight_entry and its message, padded to 8 bytes, and may wrap around the end of its ring.  Values
+     * are in the recorder's native byte order.
+     */
+    struct flight_file_header {
+        char                            m_magic[8];
+        boost::uint32_t                 m_version;
+        boost::uint32_t                 m_slots;
+        boost::uint64_t                 m_ringBytes;
+        char                            m_pad[40];
+    };
+
+    /** A ring's state - its entries are the bytes from m_head to m_tail (counted from when it was claimed) */
+    enum flight_slot_state { flight_free = 0, flight_owned, flight_finished };
+    struct flight_slot_header {
+        boost::atomic<boost::uint64_t>  m_head;
+        boost::atomic<boost::uint64_t>  m_tail;
+        boost::uint64_t                 m_thread;
+        boost::atomic<boost::uint32_t>  m_state;
+        char                            m_pad[36];
+    };
+
+    /** The same, as plain values (to read from a file) */
+    struct flight_slot_image {
+        boost::uint64_t                 m_head;
+        boost::uint64_t                 m_tail;
+        boost::uint64_t                 m_thread;
+        boost::uint32_t                 m_state;
+        char                            m_pad[36];
+    };
+
+    struct flight_entry {
+        boost::uint32_t                 m_size;     /* The whole entry, including padding to 8 bytes */
+        boost::uint32_t                 m_length;   /* The message's */
+        boost::int64_t                  m_time;     /* Nanoseconds since the epoch */
+        boost::int32_t                  m_level;
+        boost::uint32_t                 m_pad;
+    };
+
+    BOOST_STATIC_ASSERT(sizeof(flight_file_header) == 64 && sizeof(flight_slot_header) == 64 &&
+                        sizeof(flight_slot_image) == 64);
+    BOOST_STATIC_ASSERT(sizeof(flight_entry) == 24 && sizeof(boost::atomic<boost::uint64_t>) == 8);
+
+    /** A line read back out of a ring */
+    struct flight_line {
+        boost::int64_t                  m_time;
+        boost::uint64_t                 m_thread;
+        boost::log::trivial::severity_level m_level;
+        std::string                     m_message;
+
+        bool operator<(const flight_line& that) const { return m_time < that.m_time; }
+    };
+
+    /** Copies bytes into and out of a ring at a position which may wrap around its end */
+    inline void flight_copy_in(char* ring, boost::uint64_t capacity, boost::uint64_t pos, const void* p,
+                               std::size_t n) {
+        std::size_t offset = static_cast<std::size_t>(pos % capacity);
+        std::size_t first = std::min<std::size_t>(n, static_cast<std::size_t>(capacity - offset));
+        std::memcpy(ring + offset, p, first);
+        std::memcpy(ring, static_cast<const char*>(p) + first, n - first);
+    }
+    inline void flight_copy_out(const char* ring, boost::uint64_t capacity, boost::uint64_t pos, void* p,
+                                std::size_t n) {
+        std::size_t offset = static_cast<std::size_t>(pos % capacity);
+        std::size_t first = std::min<std::size_t>(n, static_cast<std::size_t>(capacity - offset));
+        std::memcpy(p, ring + offset, first);
+        std::memcpy(static_cast<char*>(p) + first, ring, n - first);
+    }
+
+    /**
+     * Reads the entries from head to tail of a copy of a ring - stopping at the first which doesn't make sense (a
+     * ring read from a crashed process may end with one which was never finished)
+     */
+    inline void flight_read(const char* ring, boost::uint64_t capacity, boost::uint64_t head, boost::uint64_t tail,
+                            boost::uint64_t thread, std::vector<flight_line>& lines) {
+        if (tail < head || tail - head > capacity) { return; }
+        while (tail - head >= sizeof(flight_entry)) {
+            flight_entry entry;
+            flight_copy_out(ring, capacity, head, &entry, sizeof(entry));
+            if (entry.m_size < sizeof(entry) || entry.m_size > tail - head ||
+                entry.m_length > entry.m_size - sizeof(entry) || entry.m_level < boost::log::trivial::trace ||
+                entry.m_level > boost::log::trivial::fatal) {
+                return;
+            }
+            flight_line line;
+            line.m_time = entry.m_time, line.m_thread = thread;
+            line.m_level = static_cast<boost::log::trivial::severity_level>(entry.m_level);
+            line.m_message.resize(entry.m_length);
+            if (entry.m_length) {
+                flight_copy_out(ring, capacity, head + sizeof(entry), &line.m_message[0], entry.m_length);
+            }
+            lines.push_back(line);
+            head += entry.m_size;
+        }
+    }
+
+    /** Prints lines (oldest first, across threads) in the standard format - returns how many */
+    inline std::size_t flight_print(std::vector<flight_line>& lines, std::ostream& out) {
+        std::stable_sort(lines.begin(), lines.end());
+        for (std::size_t i = 0; i < lines.size(); i++) {
+            print_std_prefix(out, lines[i].m_time, boost::log::aux::thread::id(
+                static_cast<boost::log::aux::thread::native_type>(lines[i].m_thread)), lines[i].m_level);
+            out << lines[i].m_message << std::endl;
+        }
+        return lines.size();
+    }
+
+    /** One thread's ring, in a recording */
+    class flight_ring {
+    public:
+        flight_ring() : m_pHeader(NULL), m_data(NULL), m_capacity(0) {}
+        flight_ring(flight_slot_header* pHeader, boost::uint64_t capacity)
+            : m_pHeader(pHeader), m_data(reinterpret_cast<char*>(pHeader + 1)), m_capacity(capacity) {}
+
+        bool valid() const { return m_pHeader != NULL; }
+        flight_slot_header* header() const { return m_pHeader; }
+
+        /** Appends a line (on the owner only), overwriting the oldest ones to make room - a long one is cut short */
+        void write(int lvl, boost::int64_t time, const char* message, std::size_t length) {
+            length = std::min<std::size_t>(length, static_cast<std::size_t>(m_capacity - sizeof(flight_entry)));
+            flight_entry entry;
+            entry.m_size = static_cast<boost::uint32_t>((sizeof(entry) + length + 7) & ~static_cast<std::size_t>(7));
+            entry.m_length = static_cast<boost::uint32_t>(length);
+            entry.m_time = time, entry.m_level = lvl, entry.m_pad = 0;
+
+            /* The head moves past what is overwritten first, so a reader (or a crash) never sees half an entry */
+            boost::uint64_t tail = m_pHeader->m_tail.load(boost::memory_order_relaxed);
+            boost::uint64_t head = m_pHeader->m_head.load(boost::memory_order_relaxed);
+            while (tail + entry.m_size - head > m_capacity) {
+                flight_entry oldest;
+                flight_copy_out(m_data, m_capacity, head, &oldest, sizeof(oldest));
+                head = (oldest.m_size >= sizeof(flight_entry)) ? head + oldest.m_size : tail;
+            }
+            m_pHeader->m_head.store(head, boost::memory_order_release);
+            flight_copy_in(m_data, m_capacity, tail, &entry, sizeof(entry));
+            flight_copy_in(m_data, m_capacity, tail + sizeof(entry), message, length);
+            m_pHeader->m_tail.store(tail + entry.m_size, boost::memory_order_release);
+        }
+
+        /** Reads the lines in the ring (from any thread) - those overwritten while it is read are left out */
+        void read(std::vector<flight_line>& lines) const {
+            boost::uint64_t tail = m_pHeader->m_tail.load(boost::memory_order_acquire);
+            boost::scoped_array<char> copy(new char[static_cast<std::size_t>(m_capacity)]);
+            std::memcpy(copy.get(), m_data, static_cast<std::size_t>(m_capacity));
+            boost::atomic_thread_fence(boost::memory_order_acquire);
+            boost::uint64_t head = m_pHeader->m_head.load(boost::memory_order_acquire);
+            flight_read(copy.get(), m_capacity, head, tail, m_pHeader->m_thread, lines);
+        }
+
+    private:
+        flight_slot_header* m_pHeader;
+        char*               m_data;
+        boost::uint64_t     m_capacity;
+    };
+
+    /** The memory of a recording - a shared mapping of its file where we can, and plain memory where we can't */
+    class flight_mapping : boost::noncopyable {
+    public:
+        static const char* magic() { return "BXFLIGHT"; }
+        static boost::uint32_t version() { return 1; }
+
+        flight_mapping(const std::string& fileName, boost::uint32_t slots, boost::uint64_t ringBytes)
+            : m_fileName(fileName), m_ringBytes((ringBytes + 7) & ~static_cast<boost::uint64_t>(7)),
+              m_size(static_cast<std::size_t>(sizeof(flight_file_header) +
+                                               slots * (sizeof(flight_slot_header) + m_ringBytes))),
+              m_data(NULL) {
+            #if (BOOST_EXT_LOG_FLIGHT_HAS_MMAP)
+                /* A new file, so that an older recording (which may still be mapped) is never written over */
+                ::unlink(fileName.c_str());
+                int fd = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+                void* p = MAP_FAILED;
+                if (fd >= 0 && ::ftruncate(fd, static_cast<off_t>(m_size)) == 0) {
+                    p = ::mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                }
+                if (fd >= 0) { ::close(fd); }
+                if (p == MAP_FAILED) {
+                    BOOST_THROW_EXCEPTION(boost_ext::exception("Could not map flight log file " + fileName));
+                }
+                m_data = static_cast<char*>(p);
+            #else
+                m_data = new char[m_size];
+                std::memset(m_data, 0, m_size);
+            #endif
+
+            flight_file_header* pHeader = reinterpret_cast<flight_file_header*>(m_data);
+            std::memcpy(pHeader->m_magic, magic(), sizeof(pHeader->m_magic));
+            pHeader->m_version = version(), pHeader->m_slots = slots, pHeader->m_ringBytes = m_ringBytes;
+            for (boost::uint32_t i = 0; i < slots; i++) { new (slot(i)) flight_slot_header(); }
+        }
+        ~flight_mapping() {
+            #if (BOOST_EXT_LOG_FLIGHT_HAS_MMAP)
+                ::munmap(m_data, m_size);
+            #else
+                delete[] m_data;
+            #endif
+        }
+
+        /** Claims a ring for a thread - a free one if there is one, or else one whose thread has finished */
+        flight_ring claim(boost::uint64_t thread) {
+            boost::uint32_t states[] = { flight_free, flight_finished };
+            for (int pass = 0; pass < 2; pass++) {
+                for (boost::uint32_t i = 0; i < slots(); i++) {
+                    boost::uint32_t state = states[pass];
+                    if (slot(i)->m_state.compare_exchange_strong(state, flight_owned)) {
+                        slot(i)->m_head.store(0), slot(i)->m_tail.store(0);
+                        slot(i)->m_thread = thread;
+                        return flight_ring(slot(i), m_ringBytes);
+                    }
+                }
+            }
+            return flight_ring();
+        }
+
+        /** Gives a ring up (its lines are kept until another thread claims it) */
+        static void release(const flight_ring& ring) {
+            if (ring.valid()) { ring.header()->m_state.store(flight_finished); }
+        }
+
+        /** Reads every ring */
+        void read(std::vector<flight_line>& lines) {
+            for (boost::uint32_t i = 0; i < slots(); i++) {
+                if (slot(i)->m_state.load() != flight_free) { flight_ring(slot(i), m_ringBytes).read(lines); }
+            }
+        }
+
+        /** Writes the recording out to its file now (the system would anyway, even if we crash - but not if it does) */
+        void sync() {
+            #if (BOOST_EXT_LOG_FLIGHT_HAS_MMAP)
+                ::msync(m_data, m_size, MS_SYNC);
+            #else
+                std::ofstream file(m_fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+                file.write(m_data, static_cast<std::streamsize>(m_size));
+            #endif
+        }
+
+        flight_slot_header* slot(boost::uint32_t i) {
+            return reinterpret_cast<flight_slot_header*>(m_data + sizeof(flight_file_header) +
+                                                         i * (sizeof(flight_slot_header) + m_ringBytes));
+        }
+        boost::uint32_t slots() const { return reinterpret_cast<const flight_file_header*>(m_data)->m_slots; }
+
+        GETTER(const std::string&, m_fileName, file_name)
+        const char* data() const { return m_data; }
+        std::size_t size() const { return m_size; }
+
+    private:
+        std::string         m_fileName;
+        boost::uint64_t     m_ringBytes;
+        std::size_t         m_size;
+        char*               m_data;
+    };
+
+    /** A thread's ring in the current recording - given up when the thread exits */
+    struct flight_thread : boost::noncopyable {
+        flight_thread() : m_pMapping(NULL) {}
+        ~flight_thread() { release(); }
+
+        void release() {
+            flight_mapping::release(m_ring);
+            m_ring = flight_ring(), m_pMapping = NULL;
+        }
+
+        flight_mapping*     m_pMapping;
+        flight_ring         m_ring;
+    };
+
+    /** A stream a thread formats lines for the recorder into (kept between lines) */
+    struct flight_stream : boost::noncopyable {
+        flight_stream() : m_stream(m_text), m_busy(false) {}
+        std::string                     m_text;
+        boost::log::formatting_ostream  m_stream;
+        bool                            m_busy;
+    };
+}
+
+/**
+ * Owns the recording (if there is one), and hands out the threads' rings.  A recording is started and stopped by its
+ * sink (see add_flight_log) - once stopped, it stays mapped until we are destroyed, so a thread which is still writing
+ * a line to it never faults.
+ */
+class flight_recorder : boost::noncopyable {
+public:
+    SINGLETON(flight_recorder, get);
+
+    /** Starts a new recording of statements at lvl and above (throws if the file can't be mapped) */
+    boost::shared_ptr<detail::flight_mapping> start(const std::string& fileName, int lvl) {
+        boost::shared_ptr<detail::flight_mapping> pMapping(
+            new detail::flight_mapping(fileName, BOOST_EXT_LOG_FLIGHT_THREADS, BOOST_EXT_LOG_FLIGHT_BUFFER));
+        auto_lock lock(m_mutex);
+        m_mappings.push_back(pMapping);
+        m_pCurrent.store(pMapping.get(), boost::memory_order_release);
+        flight_log_level().store(lvl);
+        return pMapping;
+    }
+
+    /** Stops a recording (if it is still the current one), and writes it out */
+    void stop(const boost::shared_ptr<detail::flight_mapping>& pMapping) {
+        {
+            auto_lock lock(m_mutex);
+            if (m_pCurrent.load() != pMapping.get()) { return; }
+            flight_log_level().store(boost::log::trivial::fatal + 1);
+            m_pCurrent.store(NULL);
+        }
+        pMapping->sync();
+    }
+
+    /** Records a line on the calling thread's ring */
+    void record(int lvl, const char* message, std::size_t length) {
+        detail::flight_mapping* pMapping = m_pCurrent.load(boost::memory_order_acquire);
+        if (!pMapping) { return; }
+        detail::flight_ring* pRing = local_ring(pMapping);
+        if (!pRing) {
+            m_dropped.fetch_add(1, boost::memory_order_relaxed);
+            return;
+        }
+        pRing->write(lvl, boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+                              boost::chrono::system_clock::now().time_since_epoch()).count(), message, length);
+    }
+
+    /** Prints what the current recording holds, oldest first, in the standard format - returns the number of lines */
+    std::size_t dump(std::ostream& out) {
+        std::vector<detail::flight_line> lines;
+        boost::shared_ptr<detail::flight_mapping> pMapping = current();
+        if (pMapping) { pMapping->read(lines); }
+        return detail::flight_print(lines, out);
+    }
+
+    /**
+     * Has SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT write the current recording out to its file, before whatever
+     * handled them before does (the recording is in the file after a crash anyway - this also keeps it if the system
+     * goes down soon after).  Signals already handled by the recorder are left alone, so calling this again doesn't
+     * chain the handler to itself.  The handler runs on the alternate signal stack, where the thread has one (so a
+     * stack overflow still gets synced).  It does nothing where there is no mapping.
+     */
+    void sync_on_fatal_signals() {
+        #if (BOOST_EXT_LOG_FLIGHT_HAS_MMAP)
+            auto_lock lock(m_mutex);
+            for (int i = 0; i < fatal_signal_count; i++) {
+                struct sigaction current;
+                if (::sigaction(fatal_signals()[i], NULL, &current) == 0 && !(current.sa_flags & SA_SIGINFO) &&
+                    current.sa_handler == &flight_recorder::on_fatal_signal) {
+                    continue;
+                }
+                struct sigaction action;
+                std::memset(&action, 0, sizeof(action));
+                action.sa_handler = &flight_recorder::on_fatal_signal;
+                action.sa_flags = SA_ONSTACK;
+                sigemptyset(&action.sa_mask);
+                ::sigaction(fatal_signals()[i], &action, &previous_actions()[i]);
+            }
+        #endif
+    }
+
+    /** The lines not recorded because every ring was taken */
+    boost::uint64_t dropped() const { return m_dropped.load(boost::memory_order_relaxed); }
+
+    /** Opens a line on the calling thread (use LOG rather than calling this) - returns NULL if it can't be recorded */
+    detail::flight_stream* open_line() {
+        detail::flight_stream* pStream = m_streams.get();
+        if (!pStream) { m_streams.reset(pStream = new detail::flight_stream()); }
+        if (pStream->m_busy) { return NULL; }
+        pStream->m_busy = true;
+        return pStream;
+    }
+    void close_line(detail::flight_stream* pStream, int lvl, bool commit) {
+        if (commit) {
+            pStream->m_stream.flush();
+            record(lvl, pStream->m_text.data(), pStream->m_text.size());
+        }
+        pStream->m_text.clear();
+        pStream->m_busy = false;
+    }
+
+private:
+    flight_recorder() : m_pCurrent(NULL), m_dropped(0) {}
+
+    enum { fatal_signal_count = 5 };
+    static const int* fatal_signals() {
+        static const int signals[fatal_signal_count] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+        return signals;
+    }
+
+    #if (BOOST_EXT_LOG_FLIGHT_HAS_MMAP)
+        static struct sigaction* previous_actions() {
+            static struct sigaction actions[fatal_signal_count];
+            return actions;
+        }
+
+        /** Syncs the recording, then puts back the previous handler and raises the signal again */
+        static void on_fatal_signal(int sig) {
+            detail::flight_mapping* pMapping = get().m_pCurrent.load(boost::memory_order_acquire);
+            if (pMapping) { ::msync(const_cast<char*>(pMapping->data()), pMapping->size(), MS_SYNC); }
+            for (int i = 0; i < fatal_signal_count; i++) {
+                if (fatal_signals()[i] == sig) { ::sigaction(sig, &previous_actions()[i], NULL); }
+            }
+            ::raise(sig);
+        }
+    #endif
+
+    boost::shared_ptr<detail::flight_mapping> current() {
+        auto_lock lock(m_mutex);
+        detail::flight_mapping* p = m_pCurrent.load();
+        for (std::size_t i = 0; i < m_mappings.size(); i++) {
+            if (m_mappings[i].get() == p) { return m_mappings[i]; }
+        }
+        return boost::shared_ptr<detail::flight_mapping>();
+    }
+
+    /** The calling thread's ring in a recording - claimed on its first line (NULL if every ring is taken) */
+    detail::flight_ring* local_ring(detail::flight_mapping* pMapping) {
+        detail::flight_thread* pThread = m_threads.get();
+        if (!pThread) { m_threads.reset(pThread = new detail::flight_thread()); }
+        if (pThread->m_pMapping != pMapping) {
+            pThread->release();
+            pThread->m_pMapping = pMapping;
+            pThread->m_ring = pMapping->claim(boost::log::aux::this_thread::get_id().native_id());
+        }
+        return pThread->m_ring.valid() ? &pThread->m_ring : NULL;
+    }
+
+private:
+    boost::atomic<detail::flight_mapping*>                  m_pCurrent;
+    boost::atomic<boost::uint64_t>                          m_dropped;
+    boost::mutex                                            m_mutex;
+    std::vector< boost::shared_ptr<detail::flight_mapping> > m_mappings;
+
+    /* After the mappings, so that the destroying thread gives its ring up before they are unmapped */
+    boost::thread_specific_ptr<detail::flight_thread>       m_threads;
+    boost::thread_specific_ptr<detail::flight_stream>       m_streams;
+};
+
+/**
+ * A sink backend which records every record it is given on the calling thread's ring (so it needs no locking) - it
+ * starts a recording when it is created, and stops it when it is destroyed
+ */
+class flight_backend : public boost::log::sinks::basic_sink_backend<boost::log::sinks::concurrent_feeding> {
+public:
+    flight_backend(const std::string& fileName, int lvl) : m_pMapping(flight_recorder::get().start(fileName, lvl)) {}
+    ~flight_backend() { flight_recorder::get().stop(m_pMapping); }
+
+    void consume(const boost::log::record_view& rec) {
+        boost::log::value_ref<std::string, boost::log::expressions::tag::smessage> message =
+            rec[boost::log::expressions::smessage];
+        boost::log::value_ref<boost::log::trivial::severity_level, boost::log::trivial::tag::severity> lvl =
+            rec[boost::log::trivial::severity];
+        if (message) {
+            flight_recorder::get().record(lvl ? lvl.get() : boost::log::trivial::info, message.get().data(),
+                                          message.get().size());
+        }
+    }
+
+private:
+    boost::shared_ptr<detail::flight_mapping> m_pMapping;
+};
+
+/**
+ * A LOG statement - a record for the core if the statement is enabled, or else a line for the flight recorder alone
+ * (which is formatted into a per-thread stream, and never reaches the core).  A LOG_CHANNEL statement's record is
+ * opened in its channel.  Use LOG rather than this.
+ */
+class log_line : boost::noncopyable {
+public:
+    log_line(boost::log::trivial::severity_level lvl, bool enabled, log_channel* pChannel = NULL)
+        : m_level(lvl), m_pCompound(NULL), m_pFlight(NULL) {
+        if (enabled) {
+            m_record = pChannel ? pChannel->open_record(lvl)
+                                : boost::log::trivial::logger::get().open_record(boost::log::keywords::severity = lvl);
+            if (m_record) { m_pCompound = stream_provider::allocate_compound(m_record); }
+        } else {
+            m_pFlight = flight_recorder::get().open_line();
+        }
+    }
+    ~log_line() {
+        if (m_pCompound) { stream_provider::release_compound(m_pCompound); }
+        if (m_pFlight) { flight_recorder::get().close_line(m_pFlight, m_level, false); }
+    }
+
+    /** Whether there is a line to write (until it's committed) */
+    bool pending() const { return m_pCompound || m_pFlight; }
+
+    boost::log::formatting_ostream& stream() {
+        return m_pCompound ? static_cast<boost::log::formatting_ostream&>(m_pCompound->stream) : m_pFlight->m_stream;
+    }
+
+    /** Pushes the record to the core, or records the line */
+    void commit() {
+        if (m_pCompound) {
+            m_pCompound->stream.flush();
+            boost::log::core::get()->push_record(boost::move(m_pCompound->stream.get_record()));
+            stream_provider::release_compound(m_pCompound);
+            m_pCompound = NULL;
+        } else if (m_pFlight) {
+            flight_recorder::get().close_line(m_pFlight, m_level, true);
+            m_pFlight = NULL;
+        }
+    }
+
+private:
+    typedef boost::log::aux::stream_provider<char> stream_provider;
+
+    boost::log::trivial::severity_level     m_level;
+    boost::log::record                      m_record;
+    stream_provider::stream_compound*       m_pCompound;
+    detail::flight_stream*                  m_pFlight;
+};
+
+/** Turns a flight recording (from a live or a crashed process) into text - a line per entry, in the standard format */
+class flight_log_decoder {
+public:
+    /** Decodes a stream - returns the number of lines (and throws if it isn't a flight recording) */
+    static std::size_t decode(std::istream& in, std::ostream& out) {
+        std::stringstream contents;
+        contents << in.rdbuf();
+        std::string bytes = contents.str();
+
+        detail::flight_file_header header;
+        if (bytes.size() < sizeof(header)) { BOOST_THROW_EXCEPTION(boost_ext::exception("Not a flight log")); }
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        std::size_t slotBytes = static_cast<std::size_t>(sizeof(detail::flight_slot_header) + header.m_ringBytes);
+        if (std::memcmp(header.m_magic, detail::flight_mapping::magic(), sizeof(header.m_magic)) != 0 ||
+            header.m_version != detail::flight_mapping::version() || header.m_ringBytes == 0) {
+            BOOST_THROW_EXCEPTION(boost_ext::exception("Not a flight log"));
+        }
+        if (bytes.size() < sizeof(header) + header.m_slots * slotBytes) {
+            BOOST_THROW_EXCEPTION(boost_ext::exception("Truncated flight log"));
+        }
+
+        std::vector<detail::flight_line> lines;
+        for (boost::uint32_t i = 0; i < header.m_slots; i++) {
+            const char* pSlot = bytes.data() + sizeof(header) + i * slotBytes;
+            detail::flight_slot_image slot;
+            std::memcpy(&slot, pSlot, sizeof(slot));
+            if (slot.m_state != detail::flight_free) {
+                detail::flight_read(pSlot + sizeof(slot), header.m_ringBytes, slot.m_head, slot.m_tail, slot.m_thread,
+                                    lines);
+            }
+        }
+        return detail::flight_print(lines, out);
+    }
+
+    /** Decodes a file */
+    static std::size_t decode(const std::string& fileName, std::ostream& out) {
+        std::ifstream in(fileName.c_str(), std::ios::in | std::ios::binary);
+        if (!in.is_open()) {
+            BOOST_THROW_EXCEPTION(boost_ext::exception("Could not open flight log file " + fileName));
+        }
+        return decode(in, out);
+    }
+};
+
+}}
+
+#endif /* H_BOOST_EXT_FLIGHT_LOG */
@@ -0,0 +1,482 @@
+/**
+ * A lightweight single-shot future and promise, with continuations (then) and the when_all / when_any combinators
+ */
+#ifndef H_BOOST_EXT_LIGHT_FUTURE
+#define H_BOOST_EXT_LIGHT_FUTURE
+
+#include <vector>
+#include <iterator>
+#include "boost/noncopyable.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/make_shared.hpp"
+#include "boost/optional.hpp"
+#include "boost/atomic.hpp"
+#include "boost/exception_ptr.hpp"
+#include "boost/functional/hash.hpp"
+#include "boost/utility/result_of.hpp"
+#include "boost/type_traits/remove_const.hpp"
+#include "boost/move/move.hpp"
+#include "boost/thread/future.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/condition_variable.hpp"
+
+#include "boost-ext/auto_lock.hpp"
+#include "boost-ext/exception.hpp"
+#include "boost-ext/task.hpp"
+
+namespace boost_ext {
+
+template<typename T> class light_future;
+template<typename T> class light_promise;
+
+namespace detail {
+    /**
+     * Where threads wait for futures to become ready - a fixed set of mutexes and condition variables, picked by the
+     * address of the future's state, so that a future doesn't carry (or construct) any of its own
+     */
+    class future_parking_lot : boost::noncopyable {
+    public:
+        enum { num_slots = 64 };
+
+        struct slot {
+            boost::mutex                m_mutex;
+            boost::condition_variable   m_ready;
+        };
+
+        static slot& slot_for(const void* pState) {
+            static future_parking_lot* pLot = new future_parking_lot();    /* Leaked - it outlives any waiter */
+            return pLot->m_slots[boost::hash<const void*>()(pState) % num_slots];
+        }
+
+    private:
+        slot    m_slots[num_slots];
+    };
+
+    /** Holds a future's value (nothing, for void) */
+    template<typename T>
+    struct future_value {
+        void set(const T& value) { m_value = value; }
+        T get() const { return *m_value; }
+        boost::optional<typename boost::remove_const<T>::type>  m_value;
+    };
+    template<>
+    struct future_value<void> {
+        void set() {}
+        void get() const {}
+    };
+
+    /**
+     * The state shared by a light_future and its light_promise.  The fast path is a few atomics - setting the value
+     * exchanges m_state to ready, and runs a continuation if one was attached first.  Only a thread which has to wait
+     * for the value touches a mutex (one from the parking lot).
+     */
+    template<typename T>
+    class future_state : boost::noncopyable {
+    public:
+        enum { pending = 0, attached, ready };
+
+        future_state() : m_state(pending), m_attached(false), m_waiters(0), m_promises(0),
+                         m_satisfied(false) {}
+
+        bool is_ready() const { return m_state.load(boost::memory_order_acquire) == ready; }
+
+        /**
+         * Marks the result (already in m_value or m_error) ready, wakes any waiters and then runs the continuation -
+         * waiters don't wait for a continuation, and one which throws (only an on_ready callback can) has its
+         * exception propagate to the caller, with the result already set and the waiters already woken
+         */
+        void complete() {
+            /* Sequentially consistent, so that either we see a waiter or it sees us ready */
+            bool attachedFirst = m_state.exchange(ready) == attached;
+            if (m_waiters.load() > 0) {
+                future_parking_lot::slot& s = future_parking_lot::slot_for(this);
+                auto_lock lock(s.m_mutex);
+                s.m_ready.notify_all();
+            }
+            if (attachedFirst) {
+                task continuation;
+                continuation.swap(m_continuation);
+                continuation();
+            }
+        }
+
+        /** Attaches the one continuation this future can have - it runs here and now if we are already ready */
+        void attach(task& continuation) {
+            if (m_attached.exchange(true)) {
+                BOOST_THROW_EXCEPTION(exception("A light_future can only have one continuation"));
+            }
+            m_continuation.swap(continuation);
+            int expected = pending;
+            if (!m_state.compare_exchange_strong(expected, attached, boost::memory_order_acq_rel)) {
+                task now;
+                now.swap(m_continuation);
+                now();
+            }
+        }
+
+        void wait() {
+            if (is_ready()) { return; }
+            future_parking_lot::slot& s = future_parking_lot::slot_for(this);
+            m_waiters.fetch_add(1);
+            {
+                boost::unique_lock<boost::mutex> lock(s.m_mutex);
+                while (m_state.load() != ready) { s.m_ready.wait(lock); }
+            }
+            m_waiters.fetch_sub(1);
+        }
+
+        /** Tracks the promises which can still set the result - when the last one goes, the promise is broken */
+        void add_promise() { m_promises.fetch_add(1, boost::memory_order_relaxed); }
+        void release_promise() {
+            if (m_promises.fetch_sub(1, boost::memory_order_acq_rel) == 1 && !m_satisfied.load()) {
+                set_exception(boost::copy_exception(boost::broken_promise()));
+            }
+        }
+
+        /** Claims the right to set the result - throws if it was already set */
+        void satisfy() {
+            if (m_satisfied.exchange(true)) {
+                BOOST_THROW_EXCEPTION(boost::promise_already_satisfied());
+            }
+        }
+
+        void set_exception(boost::exception_ptr error) {
+            satisfy();
+            m_error = error;
+            complete();
+        }
+
+        void rethrow() const {
+            if (m_error) { boost::rethrow_exception(m_error); }
+        }
+
+    public:
+        future_value<T>         m_value;
+        boost::exception_ptr    m_error;
+
+    private:
+        boost::atomic<int>      m_state;
+        boost::atomic<bool>     m_attached;
+        boost::atomic<int>      m_waiters;
+        boost::atomic<int>      m_promises;
+        boost::atomic<bool>     m_satisfied;
+        task                    m_continuation;
+    };
+
+    /** Creates a future's state - it and its reference count share one block of pooled memory */
+    template<typename T>
+    boost::shared_ptr<future_state<T> > make_future_state() {
+        return boost::allocate_shared<future_state<T> >(pool_allocator<future_state<T> >());
+    }
+
+    /** Runs fx (with an optional argument) and sets its result (or exception) on a promise */
+    template<typename R>
+    struct promise_invoker {
+        template<typename F>
+        static void run(light_promise<R>& promise, F& fx) {
+            try { promise.set_value(fx()); } catch (...) { promise.set_exception(boost::current_exception()); }
+        }
+        template<typename F, typename A>
+        static void run(light_promise<R>& promise, F& fx, A& arg) {
+            try { promise.set_value(fx(arg)); } catch (...) { promise.set_exception(boost::current_exception()); }
+        }
+    };
+    template<>
+    struct promise_invoker<void> {
+        template<typename F>
+        static void run(light_promise<void>& promise, F& fx);
+        template<typename F, typename A>
+        static void run(light_promise<void>& promise, F& fx, A& arg);
+    };
+
+    /** Runs a callable into a promise - what thread_pool::post queues */
+    template<typename F, typename R>
+    struct promised_task {
+        template<typename G>
+        promised_task(BOOST_FWD_REF(G) fx, const light_promise<R>& promise) : m_fx(boost::forward<G>(fx)),
+                                                                               m_promise(promise) {}
+        void operator()() { promise_invoker<R>::run(m_promise, m_fx); }
+        F                   m_fx;
+        light_promise<R>    m_promise;
+    };
+
+    /** Calls fx with a ready future, and sets the result on the promise behind the future that then() returned */
+    template<typename T, typename F, typename R>
+    struct continuation {
+        continuation(const light_future<T>& future, const F& fx, const light_promise<R>& promise)
+            : m_future(future), m_fx(fx), m_promise(promise) {}
+        void operator()() { promise_invoker<R>::run(m_promise, m_fx, m_future); }
+        light_future<T>     m_future;
+        F                   m_fx;
+        light_promise<R>    m_promise;
+    };
+
+    /** Hands a continuation to an executor (anything with execute(fx)), failing its promise if the executor refuses */
+    template<typename Executor, typename T, typename F, typename R>
+    struct executor_continuation {
+        executor_continuation(Executor& executor, const continuation<T, F, R>& c) : m_pExecutor(&executor),
+                                                                                     m_continuation(c) {}
+        void operator()() {
+            try {
+                m_pExecutor->execute(m_continuation);
+            } catch (...) {
+                m_continuation.m_promise.set_exception(boost::current_exception());
+            }
+        }
+        Executor*                   m_pExecutor;
+        continuation<T, F, R>       m_continuation;
+    };
+}
+
+/**
+ * The producing side of a light_future.  Copies share the same result, and if the last copy goes away without setting
+ * it the future gets a boost::broken_promise.
+ */
+template<typename T>
+class light_promise {
+public:
+    light_promise() : m_pState(detail::make_future_state<T>()) { m_pState->add_promise(); }
+    light_promise(const light_promise& other) : m_pState(other.m_pState) { m_pState->add_promise(); }
+    ~light_promise() { m_pState->release_promise(); }
+
+    light_promise& operator=(const light_promise& other) {
+        other.m_pState->add_promise();
+        m_pState->release_promise();
+        m_pState = other.m_pState;
+        return *this;
+    }
+
+    light_future<T> get_future() const { return light_future<T>(m_pState); }
+
+    /** Sets the value - if copying it throws, that exception is the future's result instead (so waiters still wake) */
+    void set_value(const T& value) {
+        m_pState->satisfy();
+        try { m_pState->m_value.set(value); } catch (...) { m_pState->m_error = boost::current_exception(); }
+        m_pState->complete();
+    }
+    void set_exception(boost::exception_ptr error) { m_pState->set_exception(error); }
+
+private:
+    boost::shared_ptr<detail::future_state<T> > m_pState;
+};
+
+template<>
+class light_promise<void> {
+public:
+    light_promise() : m_pState(detail::make_future_state<void>()) { m_pState->add_promise(); }
+    light_promise(const light_promise& other) : m_pState(other.m_pState) { m_pState->add_promise(); }
+    ~light_promise() { m_pState->release_promise(); }
+
+    light_promise& operator=(const light_promise& other) {
+        other.m_pState->add_promise();
+        m_pState->release_promise();
+        m_pState = other.m_pState;
+        return *this;
+    }
+
+    inline light_future<void> get_future() const;
+
+    void set_value() {
+        m_pState->satisfy();
+        m_pState->complete();
+    }
+    void set_exception(boost::exception_ptr error) { m_pState->set_exception(error); }
+
+private:
+    boost::shared_ptr<detail::future_state<void> > m_pState;
+};
+
+/**
+ * A single-shot future which can be copied (copies share the result), waited on, or given one continuation.  Unlike
+ * boost::future, becoming ready costs no lock unless a thread is actually blocked in wait() or get(), and the state
+ * comes from pooled memory (so that a warmed-up thread_pool::post doesn't call operator new).
+ */
+template<typename T>
+class light_future {
+public:
+    typedef T value_type;
+
+    light_future() {}
+
+    /** Whether this future has a state (a default constructed one doesn't) */
+    bool valid() const { return m_pState.get() != NULL; }
+    bool is_ready() const { return m_pState->is_ready(); }
+    bool has_exception() const { return is_ready() && !!m_pState->m_error; }
+
+    /** Blocks until the result is ready */
+    void wait() const { m_pState->wait(); }
+
+    /** Waits for the result and returns it (or throws its exception) */
+    T get() const {
+        m_pState->wait();
+        m_pState->rethrow();
+        return m_pState->m_value.get();
+    }
+
+    /**
+     * Runs fx(ready future) inline on whichever thread makes this future ready (or right here, if it already is),
+     * and returns a future for its result.  A future can only have one continuation (or on_ready callback).
+     */
+    template<typename F>
+    light_future<typename boost::result_of<F(light_future<T>)>::type> then(const F& fx) const {
+        typedef typename boost::result_of<F(light_future<T>)>::type R;
+        light_promise<R> promise;
+        task t(detail::continuation<T, F, R>(*this, fx, promise));
+        m_pState->attach(t);
+        return promise.get_future();
+    }
+
+    /** Like then(fx), but fx is run by executor.execute() - so on a thread_pool, no thread waits for this future */
+    template<typename Executor, typename F>
+    light_future<typename boost::result_of<F(light_future<T>)>::type> then(Executor& executor, const F& fx) const {
+        typedef typename boost::result_of<F(light_future<T>)>::type R;
+        light_promise<R> promise;
+        detail::continuation<T, F, R> c(*this, fx, promise);
+        task t(detail::executor_continuation<Executor, T, F, R>(executor, c));
+        m_pState->attach(t);
+        return promise.get_future();
+    }
+
+    /**
+     * Runs fx() inline once this future is ready - a cheaper then(), for callbacks with no result.  If fx throws, the
+     * exception escapes from whichever call ran it (set_value / set_exception, or on_ready itself if the future was
+     * already ready) - the result is still set, and threads waiting for it are still woken.
+     */
+    template<typename F>
+    void on_ready(const F& fx) const {
+        task t(fx);
+        m_pState->attach(t);
+    }
+
+private:
+    template<typename> friend class light_promise;
+    explicit light_future(const boost::shared_ptr<detail::future_state<T> >& pState) : m_pState(pState) {}
+
+    boost::shared_ptr<detail::future_state<T> > m_pState;
+};
+
+inline light_future<void> light_promise<void>::get_future() const { return light_future<void>(m_pState); }
+
+namespace detail {
+    template<typename F>
+    void promise_invoker<void>::run(light_promise<void>& promise, F& fx) {
+        try { fx(); promise.set_value(); } catch (...) { promise.set_exception(boost::current_exception()); }
+    }
+    template<typename F, typename A>
+    void promise_invoker<void>::run(light_promise<void>& promise, F& fx, A& arg) {
+        try { fx(arg); promise.set_value(); } catch (...) { promise.set_exception(boost::current_exception()); }
+    }
+}
+
+/** A future which is already ready with the given value */
+template<typename T>
+light_future<T> make_ready_light_future(const T& value) {
+    light_promise<T> promise;
+    promise.set_value(value);
+    return promise.get_future();
+}
+inline light_future<void> make_ready_light_future() {
+    light_promise<void> promise;
+    promise.set_value();
+    return promise.get_future();
+}
+
+/** The result of when_any - which future became ready first, and all of the futures */
+template<typename T>
+struct when_any_result {
+    std::size_t                     m_index;
+    std::vector<light_future<T> >   m_futures;
+};
+
+namespace detail {
+    /** Counts down the futures given to when_all, and completes its promise when the last one is ready */
+    template<typename T>
+    struct when_all_state : boost::noncopyable {
+        when_all_state(std::size_t n) : m_remaining(n) {}
+        boost::atomic<std::size_t>                          m_remaining;
+        std::vector<light_future<T> >                       m_futures;
+        light_promise<std::vector<light_future<T> > >       m_promise;
+    };
+
+    template<typename T>
+    struct when_all_callback {
+        when_all_callback(const boost::shared_ptr<when_all_state<T> >& pState) : m_pState(pState) {}
+        void operator()() {
+            if (m_pState->m_remaining.fetch_sub(1, boost::memory_order_acq_rel) == 1) {
+                m_pState->m_promise.set_value(m_pState->m_futures);
+            }
+        }
+        boost::shared_ptr<when_all_state<T> > m_pState;
+    };
+
+    /** Completes when_any's promise with the first future to be ready */
+    template<typename T>
+    struct when_any_state : boost::noncopyable {
+        when_any_state() : m_done(false) {}
+        boost::atomic<bool>                     m_done;
+        std::vector<light_future<T> >           m_futures;
+        light_promise<when_any_result<T> >      m_promise;
+    };
+
+    template<typename T>
+    struct when_any_callback {
+        when_any_callback(const boost::shared_ptr<when_any_state<T> >& pState, std::size_t index)
+            : m_pState(pState), m_index(index) {}
+        void operator()() {
+            if (!m_pState->m_done.exchange(true)) {
+                when_any_result<T> result;
+                result.m_index = m_index, result.m_futures = m_pState->m_futures;
+                m_pState->m_promise.set_value(result);
+            }
+        }
+        boost::shared_ptr<when_any_state<T> >   m_pState;
+        std::size_t                             m_index;
+    };
+}
+
+/**
+ * A future which becomes ready (with all of the futures, which are then ready too) once every future in [begin, end)
+ * is ready - it uses each future's continuation, so none of them can have another
+ */
+template<typename Iterator>
+light_future<std::vector<typename std::iterator_traits<Iterator>::value_type> > when_all(Iterator begin,
+                                                                                          Iterator end) {
+    typedef typename std::iterator_traits<Iterator>::value_type future_type;
+    std::vector<future_type> futures(begin, end);
+    boost::shared_ptr<detail::when_all_state<typename future_type::value_type> > pState =
+        boost::make_shared<detail::when_all_state<typename future_type::value_type> >(futures.size() + 1);
+    pState->m_futures = futures;
+    light_future<std::vector<future_type> > result = pState->m_promise.get_future();
+    for (std::size_t i = 0; i < futures.size(); i++) {
+        futures[i].on_ready(detail::when_all_callback<typename future_type::value_type>(pState));
+    }
+    /* Our own count, so that the promise isn't set while we are still attaching */
+    detail::when_all_callback<typename future_type::value_type> ours(pState);
+    ours();
+    return result;
+}
+
+/**
+ * A future which becomes ready as soon as any future in [begin, end) is ready, with its index (the other futures
+ * can't be given continuations of their own).  An empty range gives an index of -1.
+ */
+template<typename Iterator>
+light_future<when_any_result<typename std::iterator_traits<Iterator>::value_type::value_type> >
+when_any(Iterator begin, Iterator end) {
+    typedef typename std::iterator_traits<Iterator>::value_type::value_type T;
+    boost::shared_ptr<detail::when_any_state<T> > pState = boost::make_shared<detail::when_any_state<T> >();
+    pState->m_futures.assign(begin, end);
+    light_future<when_any_result<T> > result = pState->m_promise.get_future();
+    if (pState->m_futures.empty()) {
+        detail::when_any_callback<T> none(pState, static_cast<std::size_t>(-1));
+        none();
+    }
+    for (std::size_t i = 0; i < pState->m_futures.size(); i++) {
+        pState->m_futures[i].on_ready(detail::when_any_callback<T>(pState, i));
+    }
+    return result;
+}
+
+}
+
+#endif /* H_BOOST_EXT_LIGHT_FUTURE */
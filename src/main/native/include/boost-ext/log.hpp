@@ -5,6 +5,9 @@
 #define H_BOOST_EXT_LOG
 
 #include "boost/noncopyable.hpp"
+#include "boost/make_shared.hpp"
+#include "boost/core/null_deleter.hpp"
+#include "boost/thread/mutex.hpp"
 #include "boost/date_time/posix_time/posix_time_types.hpp"
 #include "boost/log/core.hpp"
 #include "boost/log/trivial.hpp"
@@ -12,9 +15,20 @@
 #include "boost/log/support/date_time.hpp"
 #include "boost/log/utility/setup/console.hpp"
 #include "boost/log/utility/setup/common_attributes.hpp"
+#include "boost/log/sinks/text_ostream_backend.hpp"
+#include "boost/log/sinks/unlocked_frontend.hpp"
 
 #include "boost-ext/platform_detect.hpp"
 #include "boost-ext/classes.hpp"
+#include "boost-ext/exception.hpp"
+#include "boost-ext/auto_lock.hpp"
+#include "boost-ext/log_level.hpp"
+#include "boost-ext/log_formatter.hpp"
+#include "boost-ext/async_log.hpp"
+#include "boost-ext/file_log.hpp"
+#include "boost-ext/fast_log.hpp"
+#include "boost-ext/flight_log.hpp"
+#include "boost-ext/dedup_log.hpp"
 
 #if (_IS_OS_ANDROID_)
     /* Include our android-specific implementation */
@@ -24,8 +38,58 @@
 
 namespace boost_ext {
 
-/** Call this to generate log messages - basically it is just BOOST_LOG_TRIVIAL for now */
-#define LOG(lvl)                BOOST_LOG_TRIVIAL(lvl)
+/**
+ * Call this to generate log messages - it is BOOST_LOG_TRIVIAL, but checked against our own levels first, so that a
+ * disabled statement doesn't open a record (or evaluate its stream).  A statement which is only enabled for the
+ * flight recorder is formatted straight into its ring, without a record.
+ */
+#define LOG(lvl)                BOOST_EXT_LOG_LINE(lvl, boost_ext::log::log_enabled(LOG_LEVEL(lvl)), NULL)
+
+/**
+ * A statement which is enabled for the core if enabled is true (and for the flight recorder by its own level) - its
+ * record is opened in pChannel, if that isn't NULL
+ */
+#define BOOST_EXT_LOG_LINE(lvl, enabled, pChannel)                                                          \
+    BOOST_EXT_LOG_IF(lvl, (enabled) || boost_ext::log::flight_enabled(LOG_LEVEL(lvl)))                      \
+        for (boost_ext::log::log_line _logLine(LOG_LEVEL(lvl), enabled, pChannel);                          \
+             _logLine.pending(); _logLine.commit())                                                         \
+            _logLine.stream()
+
+/**
+ * Declares a channel (at namespace scope) - LOG_CHANNEL(name, lvl) statements are checked against its level, which
+ * follows the global level until SET_CHANNEL_LOG_LEVEL gives it its own
+ */
+#define DEFINE_LOG_CHANNEL(name)                                                                            \
+    inline boost_ext::log::log_channel& name##_log_channel() {                                              \
+        static boost_ext::log::log_channel& c = boost_ext::log::Logger::get().channel(#name);               \
+        return c;                                                                                           \
+    }
+#define LOG_CHANNEL(name, lvl)                                                                              \
+    BOOST_EXT_LOG_LINE(lvl, name##_log_channel().enabled(LOG_LEVEL(lvl)), &name##_log_channel())
+
+/**
+ * LOG statements which only log some of the times they are reached - each call site keeps its own count or clock (a
+ * log_limit), which is only consulted once the statement is enabled.  LOG_EVERY_N logs the 1st, (n+1)th and so on,
+ * LOG_FIRST_N the first n, LOG_EVERY_MS at most once each ms milliseconds, and LOG_RATE_LIMITED at perSecond on
+ * average, in bursts of up to burst (a token bucket).
+ */
+#define LOG_EVERY_N(lvl, n)     BOOST_EXT_LOG_LIMITED(lvl, every_n(n))
+#define LOG_FIRST_N(lvl, n)     BOOST_EXT_LOG_LIMITED(lvl, first_n(n))
+#define LOG_EVERY_MS(lvl, ms)   BOOST_EXT_LOG_LIMITED(lvl, every_ms(ms))
+#define LOG_RATE_LIMITED(lvl, perSecond, burst)                                                             \
+                                BOOST_EXT_LOG_LIMITED(lvl, rate(perSecond, burst))
+
+/**
+ * The call site's log_limit is a static local of the function the statement is in, declared by a loop which runs
+ * once - so a statement in an inline function, or a template, has the one limit wherever it is expanded
+ */
+#define BOOST_EXT_LOG_LIMITED(lvl, check)                                                                   \
+    BOOST_EXT_LOG_IF(lvl, boost_ext::log::log_enabled(LOG_LEVEL(lvl)) ||                                    \
+                          boost_ext::log::flight_enabled(LOG_LEVEL(lvl)))                                   \
+        for (bool _logOnce = true; _logOnce; _logOnce = false)                                              \
+            for (static boost_ext::log::log_limit _logLimit; _logOnce; _logOnce = false)                    \
+                if (!_logLimit.check) {} else                                                               \
+                    BOOST_EXT_LOG_LINE(lvl, boost_ext::log::log_enabled(LOG_LEVEL(lvl)), NULL)
 
 /** Returns the integer value of the given log level */
 #define LOG_LEVEL(lvl)          boost::log::trivial::lvl
@@ -33,6 +97,8 @@ namespace boost_ext {
 /** Call this to set the log level */
 #define SET_LOG_LEVEL_VAL(i)    boost_ext::log::Logger::get().setLevel(i)
 #define SET_LOG_LEVEL(lvl)      SET_LOG_LEVEL_VAL(LOG_LEVEL(lvl))
+#define SET_CHANNEL_LOG_LEVEL(name, lvl)                                                                    \
+                                boost_ext::log::Logger::get().setChannelLevel(#name, LOG_LEVEL(lvl))
 
 /** Call this macro to not log during the given calls */
 #define LOG_DISABLE(S)  {                                                                                   \
@@ -40,12 +106,35 @@ namespace boost_ext {
                             S;                                                                              \
                         }
 
+/** Call this macro to not log during the given calls on this thread (the core, and other threads, log as normal) */
+#define LOG_DISABLE_THREAD(S)   {                                                                           \
+                                    boost_ext::log::AutoThreadLogPause _autoThreadPause;                    \
+                                    S;                                                                      \
+                                }
+
 #define ENABLE_LOGGING(t, c, ...)   boost_ext::log::Logger::get().enable(t, c(__VA_ARGS__))
 #define DISABLE_LOGGING(t)          boost_ext::log::Logger::get().disable(t)
                         
 #define ENABLE_CONSOLE_LOGGING(...) ENABLE_LOGGING("console", boost_ext::log::add_console_log, __VA_ARGS__)
 #define DISABLE_CONSOLE_LOGGING()   DISABLE_LOGGING("console")
 
+/** Logging which is formatted and written on a background thread (these take an optional async_options) */
+#define ENABLE_ASYNC_CONSOLE_LOGGING(...)                                                                   \
+                            ENABLE_LOGGING("console", boost_ext::log::add_async_console_log, __VA_ARGS__)
+#define ENABLE_ASYNC_FILE_LOGGING(...)                                                                      \
+                            ENABLE_LOGGING("file", boost_ext::log::add_async_file_log, __VA_ARGS__)
+
+/**
+ * The flight recorder - ENABLE_FLIGHT_LOGGING(fileName[, lvl]) records every statement at lvl (trace, by default) and
+ * above in the file's per-thread rings, alongside the other sinks (see flight_log.hpp)
+ */
+#define ENABLE_FLIGHT_LOGGING(...)  ENABLE_LOGGING("flight", boost_ext::log::add_flight_log, __VA_ARGS__)
+#define DISABLE_FLIGHT_LOGGING()    DISABLE_LOGGING("flight")
+
+/** Logging to a file which may be rotated (these take a file name or file_options, and an optional async_options) */
+#define ENABLE_FILE_LOGGING(...)    ENABLE_LOGGING("file", boost_ext::log::add_file_log, __VA_ARGS__)
+#define DISABLE_FILE_LOGGING()      DISABLE_LOGGING("file")
+
 #ifdef SYSTEM_LOGGER
     #define ENABLE_SYSTEM_LOGGING(...)  ENABLE_LOGGING("system", SYSTEM_LOGGER, __VA_ARGS__)
     #define DISABLE_SYSTEM_LOGGING()    DISABLE_LOGGING("system")
@@ -68,12 +157,30 @@ namespace log {
     
     class Logger : noncopyable {
     public:
-        typedef shared_ptr<sinks::sink> sink_ptr;
+        typedef boost::shared_ptr<sinks::sink> sink_ptr;
         
         SINGLETON(Logger, get);
         
         void setLevel(int lvl) {
-            core::get()->set_filter(boost::log::trivial::severity >= lvl);
+            global_log_level().store(lvl);
+            refreshFilter();
+        }
+        int level() const { return global_log_level().load(); }
+
+        /** Finds (or creates) a channel - the reference stays valid for as long as we do */
+        log_channel& channel(const string& name) {
+            auto_lock lock(m_mutex);
+            channel_map::iterator i = m_channels.find(name);
+            if (i == m_channels.end()) {
+                i = m_channels.insert(make_pair(name, boost::make_shared<log_channel>(name))).first;
+            }
+            return *i->second;
+        }
+
+        /** Gives a channel its own level (or -1 to have it follow the global level again) */
+        void setChannelLevel(const string& name, int lvl) {
+            channel(name).set_level(lvl);
+            refreshFilter();
         }
         
         void enable(const string& key, sink_ptr sink) {
@@ -81,35 +188,41 @@ namespace log {
             m_sinks[key] = sink;
         }
         
+        /** Removes a sink, once it has written what it has (for an async sink, that includes its queue) */
         void disable(const string& key) {
-            sink_ptr p = m_sinks[key];
+            sink_map::iterator i = m_sinks.find(key);
+            if (i == m_sinks.end()) { return; }
+            sink_ptr p = i->second;
+            m_sinks.erase(i);
             if (p) {
                 core::get()->remove_sink(p);
-                p.reset();
+                p->flush();
             }
         }
 
     private:
-        Logger() : m_sinks() { boost::log::add_common_attributes(); }
-        ~Logger() {}
+        Logger() : m_sinks(), m_channels() { boost::log::add_common_attributes(); }
+        ~Logger() {
+            while (!m_sinks.empty()) { disable(m_sinks.begin()->first); }
+        }
         
-        typedef map<string, sink_ptr>   sink_map;
+        /** The core checks each record against its own channel's level, or the global one (see log_filter) */
+        void refreshFilter() { core::get()->set_filter(log_filter()); }
+
+        typedef map<string, sink_ptr>                           sink_map;
+        typedef map<string, boost::shared_ptr<log_channel> >    channel_map;
         sink_map                        m_sinks;
+        boost::mutex                    m_mutex;
+        channel_map                     m_channels;
     };
 
 
-    /** This is our definition of a "standard" format */
-    #define STD_LOG_FORMAT boost::log::keywords::format = (                                                         \
-        boost::log::expressions::stream                                                                             \
-            << "[" <<                                                                                               \
-                boost::log::expressions::format_date_time<boost::posix_time::ptime>("TimeStamp",                    \
-                                                                                    "%Y-%m-%d %H:%M:%S.%f")         \
-            << "] ["                                                                                                \
-                << boost::log::expressions::attr<boost::log::attributes::current_thread_id::value_type>("ThreadID") \
-            << "] ["                                                                                                \
-                << std::setw(7) << boost::log::trivial::severity                                                    \
-            << "] " << boost::log::expressions::smessage                                                            \
-    )
+    /**
+     * This is our definition of a "standard" format (as a formatter, and as a keyword for the add_*_log functions) -
+     * see STD_LOG_EXPRESSION for what it writes
+     */
+    #define STD_LOG_FORMATTER boost_ext::log::std_log_formatter()
+    #define STD_LOG_FORMAT boost::log::keywords::format = STD_LOG_FORMATTER
     #define STD_LOG_STREAM std::clog
 
     template<typename CharT, typename ArgsT> 
@@ -126,6 +239,60 @@ namespace log {
         return boost::log::add_console_log(STD_LOG_STREAM, STD_LOG_FORMAT); 
     }
 
+    /** Adds an async sink (in the standard format) writing to a backend */
+    template<typename BackendT>
+    boost::shared_ptr< async_sink<BackendT> > add_async_log(const boost::shared_ptr<BackendT>& pBackend,
+                                                            const async_options& options) {
+        boost::shared_ptr< async_sink<BackendT> > pSink = boost::make_shared< async_sink<BackendT> >(pBackend, options);
+        pSink->set_formatter(STD_LOG_FORMATTER);
+        core::get()->add_sink(pSink);
+        return pSink;
+    }
+
+    /** Console logging which is formatted and written on a background thread */
+    template<typename CharT>
+    boost::shared_ptr< async_sink< sinks::basic_text_ostream_backend<CharT> > >
+    add_async_console_log(basic_ostream<CharT>& strm, const async_options& options = async_options()) {
+        typedef sinks::basic_text_ostream_backend<CharT> backend_t;
+        boost::shared_ptr<backend_t> pBackend = boost::make_shared<backend_t>();
+        pBackend->add_stream(boost::shared_ptr< basic_ostream<CharT> >(&strm, boost::null_deleter()));
+        return add_async_log(pBackend, options);
+    }
+    inline boost::shared_ptr< async_sink<sinks::text_ostream_backend> >
+    add_async_console_log(const async_options& options = async_options()) {
+        return add_async_console_log(STD_LOG_STREAM, options);
+    }
+
+    /**
+     * Writes to a file (batching the writes, and rotating it as the options say) on a background thread - by default
+     * the writes are flushed every BOOST_EXT_LOG_FILE_FLUSH_MS, rather than each time the queue is drained
+     */
+    inline boost::shared_ptr< async_sink<rotating_file_backend> >
+    add_file_log(const file_options& fileOptions, const async_options& options =
+                    async_options().flush_interval(boost::chrono::milliseconds(BOOST_EXT_LOG_FILE_FLUSH_MS))) {
+        return add_async_log(boost::make_shared<rotating_file_backend>(fileOptions), options);
+    }
+    inline boost::shared_ptr< async_sink<rotating_file_backend> >
+    add_file_log(const string& fileName, const async_options& options =
+                    async_options().flush_interval(boost::chrono::milliseconds(BOOST_EXT_LOG_FILE_FLUSH_MS))) {
+        return add_file_log(file_options(fileName), options);
+    }
+
+    /** Appends to a file, formatting and writing on a background thread (flushing each time the queue is drained) */
+    inline boost::shared_ptr< async_sink<rotating_file_backend> >
+    add_async_file_log(const string& fileName, const async_options& options = async_options()) {
+        return add_file_log(file_options(fileName), options);
+    }
+
+    /** Starts a flight recording of statements at lvl and above (whatever the other sinks are filtered at) */
+    inline boost::shared_ptr< sinks::unlocked_sink<flight_backend> >
+    add_flight_log(const string& fileName, int lvl = boost::log::trivial::trace) {
+        typedef sinks::unlocked_sink<flight_backend> sink_t;
+        boost::shared_ptr<sink_t> pSink = boost::make_shared<sink_t>(boost::make_shared<flight_backend>(fileName, lvl));
+        core::get()->add_sink(pSink);
+        return pSink;
+    }
+
 } /* namespace log */
 
 } /* namespace boost_ext */
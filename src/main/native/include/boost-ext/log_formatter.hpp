@@ -0,0 +1,161 @@
+/**
+ * A formatter for our standard log format which avoids the per-record work of the expression version - the date and
+ * time up to the second are cached, and severity and thread id strings are rendered once
+ */
+#ifndef H_BOOST_EXT_LOG_FORMATTER
+#define H_BOOST_EXT_LOG_FORMATTER
+
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <sstream>
+#include "boost/cstdint.hpp"
+#include "boost/date_time/posix_time/posix_time_types.hpp"
+#include "boost/log/core/record_view.hpp"
+#include "boost/log/trivial.hpp"
+#include "boost/log/expressions.hpp"
+#include "boost/log/support/date_time.hpp"
+#include "boost/log/attributes/current_thread_id.hpp"
+#include "boost/log/utility/formatting_ostream.hpp"
+
+#include "boost-ext/common.hpp"
+
+/** The standard format, as a Boost.Log expression (std_log_formatter writes exactly the same, faster) */
+#define STD_LOG_EXPRESSION (                                                                                        \
+    boost::log::expressions::stream                                                                                 \
+        << "[" <<                                                                                                   \
+            boost::log::expressions::format_date_time<boost::posix_time::ptime>("TimeStamp",                        \
+                                                                                "%Y-%m-%d %H:%M:%S.%f")             \
+        << "] ["                                                                                                    \
+            << boost::log::expressions::attr<boost::log::attributes::current_thread_id::value_type>("ThreadID")     \
+        << "] ["                                                                                                    \
+            << std::setw(7) << boost::log::trivial::severity                                                        \
+        << "] " << boost::log::expressions::smessage                                                                \
+)
+
+namespace boost_ext { namespace log {
+
+namespace detail {
+    /** What a formatting thread remembers between records - zero-initialized, so it can be thread-local */
+    struct std_format_cache {
+        /** "[YYYY-MM-DD HH:MM:SS." for the second m_second (when m_valid) */
+        bool                m_valid;
+        boost::int64_t      m_second;
+        char                m_prefix[24];
+
+        /** Rendered thread ids, direct-mapped by their native ids */
+        struct thread_slot {
+            bool            m_valid;
+            boost::uintmax_t m_id;
+            std::size_t     m_length;
+            char            m_text[40];
+        };
+        thread_slot         m_threads[16];
+    };
+
+    inline char* put_digits(char* p, unsigned int value, int digits) {
+        for (int i = digits - 1; i >= 0; i--, value /= 10) { p[i] = static_cast<char>('0' + value % 10); }
+        return p + digits;
+    }
+}
+
+/**
+ * Writes "[timestamp] [thread id] [severity] message", byte-for-byte as STD_LOG_EXPRESSION does.  The prefix is
+ * built up in a buffer on the stack (from the thread-local cache) and written in one go.  Records which are at all
+ * unusual (a missing attribute, a time outside of 1970-9999 or an unknown severity) go through the expression.
+ */
+class std_log_formatter {
+public:
+    typedef void result_type;
+    typedef boost::log::formatting_ostream stream_type;
+
+    std_log_formatter() : m_timeStamp("TimeStamp"), m_threadId("ThreadID"),
+                          m_severity(boost::log::trivial::severity.get_name()), m_fallback(STD_LOG_EXPRESSION) {}
+
+    void operator()(const boost::log::record_view& rec, stream_type& strm) const {
+        typedef boost::log::attributes::current_thread_id::value_type thread_id;
+        boost::log::value_ref<boost::posix_time::ptime> time =
+            boost::log::extract<boost::posix_time::ptime>(m_timeStamp, rec);
+        boost::log::value_ref<thread_id> thread = boost::log::extract<thread_id>(m_threadId, rec);
+        boost::log::value_ref<boost::log::trivial::severity_level> lvl =
+            boost::log::extract<boost::log::trivial::severity_level>(m_severity, rec);
+        boost::log::value_ref<std::string, boost::log::expressions::tag::smessage> message =
+            rec[boost::log::expressions::smessage];
+
+        char buffer[128];
+        char* p = buffer;
+        if (!time || !thread || !lvl || !message || lvl.get() < boost::log::trivial::trace ||
+            lvl.get() > boost::log::trivial::fatal || !(p = put_time(p, time.get()))) {
+            m_fallback(rec, strm);
+            return;
+        }
+        p = put_thread(p, thread.get());
+        std::memcpy(p, severity_text(lvl.get()), 12);
+        p += 12;
+        strm.write(buffer, p - buffer);
+        strm.write(message.get().data(), static_cast<std::streamsize>(message.get().size()));
+    }
+
+private:
+    static detail::std_format_cache& cache() { static THREAD_LOCAL detail::std_format_cache c; return c; }
+
+    /** "] [  error] " and so on (the severities setw(7) gives) */
+    static const char* severity_text(boost::log::trivial::severity_level lvl) {
+        static const char* text[] = { "] [  trace] ", "] [  debug] ", "] [   info] ", "] [warning] ", "] [  error] ",
+                                      "] [  fatal] " };
+        return text[lvl];
+    }
+
+    /** Writes "[YYYY-MM-DD HH:MM:SS.ffffff" - or returns NULL for times the cache doesn't handle */
+    static char* put_time(char* p, const boost::posix_time::ptime& t) {
+        typedef boost::posix_time::time_duration duration;
+        static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+        static const boost::posix_time::ptime last(boost::gregorian::date(9999, 12, 31), boost::posix_time::hours(23));
+        static const boost::int64_t ticksPerSecond = duration::ticks_per_second();
+        if (t.is_special() || t < epoch || t > last) { return NULL; }
+
+        boost::int64_t ticks = (t - epoch).ticks();
+        boost::int64_t second = ticks / ticksPerSecond;
+        detail::std_format_cache& c = cache();
+        if (!c.m_valid || c.m_second != second) {
+            boost::gregorian::date::ymd_type ymd = t.date().year_month_day();
+            duration tod = t.time_of_day();
+            char* q = c.m_prefix;
+            *q++ = '[';
+            q = detail::put_digits(q, ymd.year, 4), *q++ = '-';
+            q = detail::put_digits(q, ymd.month, 2), *q++ = '-';
+            q = detail::put_digits(q, ymd.day, 2), *q++ = ' ';
+            q = detail::put_digits(q, static_cast<unsigned int>(tod.hours()), 2), *q++ = ':';
+            q = detail::put_digits(q, static_cast<unsigned int>(tod.minutes()), 2), *q++ = ':';
+            q = detail::put_digits(q, static_cast<unsigned int>(tod.seconds()), 2), *q++ = '.';
+            c.m_second = second, c.m_valid = true;
+        }
+        std::memcpy(p, c.m_prefix, 21);
+        return detail::put_digits(p + 21, static_cast<unsigned int>(ticks % ticksPerSecond),
+                                  duration::num_fractional_digits());
+    }
+
+    /** Writes "] [<thread id>" */
+    static char* put_thread(char* p, const boost::log::attributes::current_thread_id::value_type& thread) {
+        detail::std_format_cache::thread_slot& slot = cache().m_threads[(thread.native_id() >> 4) % 16];
+        if (!slot.m_valid || slot.m_id != thread.native_id()) {
+            std::ostringstream s;
+            s << "] [" << thread;
+            std::string text = s.str();
+            slot.m_length = std::min(text.size(), sizeof(slot.m_text));
+            std::memcpy(slot.m_text, text.data(), slot.m_length);
+            slot.m_id = thread.native_id(), slot.m_valid = true;
+        }
+        std::memcpy(p, slot.m_text, slot.m_length);
+        return p + slot.m_length;
+    }
+
+    boost::log::attribute_name  m_timeStamp;
+    boost::log::attribute_name  m_threadId;
+    boost::log::attribute_name  m_severity;
+    boost::log::formatter       m_fallback;
+};
+
+}}
+
+#endif /* H_BOOST_EXT_LOG_FORMATTER */
@@ -0,0 +1,180 @@
+/**
+ * The checks our logging macros make before a record is opened - a compile-time minimum level, the runtime level (for
+ * everything, or for a named channel), whether logging is paused on the calling thread, and a call site's rate limit
+ */
+#ifndef H_BOOST_EXT_LOG_LEVEL
+#define H_BOOST_EXT_LOG_LEVEL
+
+#include <string>
+#include <algorithm>
+#include "boost/noncopyable.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/atomic.hpp"
+#include "boost/chrono/system_clocks.hpp"
+#include "boost/log/trivial.hpp"
+#include "boost/log/attributes/value_extraction.hpp"
+#include "boost/log/sources/severity_channel_logger.hpp"
+
+#include "boost-ext/common.hpp"
+#include "boost-ext/classes.hpp"
+
+/**
+ * Log statements below this level are compiled out altogether (i.e. -DBOOST_EXT_LOG_MIN_LEVEL=2 removes trace and
+ * debug statements) - it is a boost::log::trivial::severity_level value
+ */
+#if !defined(BOOST_EXT_LOG_MIN_LEVEL)
+    #define BOOST_EXT_LOG_MIN_LEVEL     0
+#endif
+
+/** Whether a statement at a level is compiled in - and if so, whether it's enabled (cond being the runtime check) */
+#define BOOST_EXT_LOG_IF(lvl, cond)                                                                                 \
+    if (!(boost::log::trivial::lvl >= BOOST_EXT_LOG_MIN_LEVEL && (cond))) {} else
+
+namespace boost_ext { namespace log {
+
+/** The level set for everything which isn't in a channel with its own level */
+inline boost::atomic<int>& global_log_level() {
+    static boost::atomic<int> lvl(boost::log::trivial::trace);
+    return lvl;
+}
+
+namespace detail {
+    /** How many pauses the calling thread is in */
+    inline int& thread_log_pauses() { static THREAD_LOCAL int n = 0; return n; }
+}
+
+/** Whether the calling thread logs at all (it doesn't inside an AutoThreadLogPause) */
+inline bool thread_logging_enabled() { return detail::thread_log_pauses() == 0; }
+
+/** Whether statements at a level are enabled (for the calling thread) - one relaxed load, and a thread-local read */
+inline bool log_enabled(int lvl) {
+    return lvl >= global_log_level().load(boost::memory_order_relaxed) && thread_logging_enabled();
+}
+
+/** The lowest level the flight recorder captures (above fatal while there isn't one) */
+inline boost::atomic<int>& flight_log_level() {
+    static boost::atomic<int> lvl(boost::log::trivial::fatal + 1);
+    return lvl;
+}
+
+/** Whether statements at a level go to the flight recorder (for the calling thread), whatever the other levels are */
+inline bool flight_enabled(int lvl) {
+    return lvl >= flight_log_level().load(boost::memory_order_relaxed) && thread_logging_enabled();
+}
+
+/**
+ * A named group of log statements, with its own level (until one is set, it follows the global level).  Channels are
+ * declared with DEFINE_LOG_CHANNEL, and found by name through the Logger.  Their records carry the channel in a
+ * "Channel" attribute, which the core's filter (log_filter) checks them against.
+ */
+class log_channel : boost::noncopyable {
+public:
+    typedef boost::log::sources::severity_channel_logger_mt<boost::log::trivial::severity_level, const log_channel*>
+        logger_type;
+
+    explicit log_channel(const std::string& name)
+        : m_name(name), m_level(-1), m_logger(boost::log::keywords::channel = this) {}
+
+    /** The name of the attribute holding a record's channel */
+    static const char* attribute_name() { return "Channel"; }
+
+    /** Whether statements at a level are enabled in this channel (for the calling thread) */
+    bool enabled(int lvl) const {
+        return lvl >= effective_level() && thread_logging_enabled();
+    }
+
+    /** This channel's level - or -1 if it follows the global level */
+    int level() const { return m_level.load(boost::memory_order_relaxed); }
+    void set_level(int lvl) { m_level.store(lvl, boost::memory_order_relaxed); }
+
+    /** The level this channel's statements are checked against - its own, or the global one */
+    int effective_level() const {
+        int min = m_level.load(boost::memory_order_relaxed);
+        return min < 0 ? global_log_level().load(boost::memory_order_relaxed) : min;
+    }
+
+    GETTER(const std::string&, m_name, name)
+
+    /** Opens a record at a level, in this channel */
+    boost::log::record open_record(boost::log::trivial::severity_level lvl) {
+        return m_logger.open_record(boost::log::keywords::severity = lvl);
+    }
+
+private:
+    std::string         m_name;
+    boost::atomic<int>  m_level;
+    logger_type         m_logger;
+};
+
+/**
+ * The core's filter - a record from a channel passes at that channel's level, and any other record (from our macros
+ * or straight from BOOST_LOG_TRIVIAL) at the global level, so a verbose channel doesn't make anything else verbose
+ */
+struct log_filter {
+    bool operator()(const boost::log::attribute_value_set& attrs) const {
+        boost::log::value_ref<boost::log::trivial::severity_level> lvl =
+            boost::log::extract<boost::log::trivial::severity_level>(boost::log::trivial::severity.get_name(), attrs);
+        if (!lvl) { return false; }
+        boost::log::value_ref<const log_channel*> pChannel =
+            boost::log::extract<const log_channel*>(log_channel::attribute_name(), attrs);
+        int min = pChannel ? (*pChannel)->effective_level() : global_log_level().load(boost::memory_order_relaxed);
+        return *lvl >= min;
+    }
+};
+
+/**
+ * How often a call site logs (see LOG_EVERY_N and friends) - each check is a load and at most one atomic update, and
+ * is only made once the statement is known to be enabled
+ */
+class log_limit : boost::noncopyable {
+public:
+    log_limit() : m_count(0), m_next(0) {}
+
+    /** The 1st, (n+1)th, (2n+1)th and so on */
+    bool every_n(boost::uint64_t n) { return n <= 1 || m_count.fetch_add(1, boost::memory_order_relaxed) % n == 0; }
+
+    /** The first n */
+    bool first_n(boost::uint64_t n) {
+        return m_count.load(boost::memory_order_relaxed) < n && m_count.fetch_add(1, boost::memory_order_relaxed) < n;
+    }
+
+    /** At most one each ms milliseconds */
+    bool every_ms(boost::int64_t ms) {
+        boost::int64_t now = now_ns(), next = m_next.load(boost::memory_order_relaxed);
+        return now >= next && m_next.compare_exchange_strong(next, now + ms * 1000000, boost::memory_order_relaxed);
+    }
+
+    /**
+     * A token bucket holding burst tokens, refilled at perSecond - kept as the time the bucket would be full again
+     * (the "generic cell rate algorithm"), so that it is a single atomic
+     */
+    bool rate(double perSecond, boost::int64_t burst) {
+        if (perSecond <= 0) { return false; }
+        boost::int64_t interval = static_cast<boost::int64_t>(1e9 / perSecond);
+        boost::int64_t tolerance = interval * (burst > 1 ? burst - 1 : 0);
+        boost::int64_t now = now_ns(), full = m_next.load(boost::memory_order_relaxed);
+        do {
+            if (now < full - tolerance) { return false; }
+        } while (!m_next.compare_exchange_weak(full, std::max(full, now) + interval, boost::memory_order_relaxed));
+        return true;
+    }
+
+private:
+    static boost::int64_t now_ns() {
+        return boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+            boost::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    boost::atomic<boost::uint64_t>  m_count;
+    boost::atomic<boost::int64_t>   m_next;     /* Nanoseconds (of the steady clock) */
+};
+
+/** Pauses our logging macros on the calling thread only (other threads, and the core, are left alone) */
+struct AutoThreadLogPause : boost::noncopyable {
+    AutoThreadLogPause()  { detail::thread_log_pauses()++; }
+    ~AutoThreadLogPause() { detail::thread_log_pauses()--; }
+};
+
+}}
+
+#endif /* H_BOOST_EXT_LOG_LEVEL */
@@ -0,0 +1,258 @@
+/**
+ * Data-parallel algorithms (parallel_for, parallel_transform_reduce, parallel_sort) which run on a thread_pool
+ */
+#ifndef H_BOOST_EXT_PARALLEL
+#define H_BOOST_EXT_PARALLEL
+
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include "boost/noncopyable.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/make_shared.hpp"
+#include "boost/atomic.hpp"
+#include "boost/exception_ptr.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/condition_variable.hpp"
+
+#include "boost-ext/common.hpp"
+#include "boost-ext/auto_lock.hpp"
+#include "boost-ext/thread_pool.hpp"
+
+namespace boost_ext {
+
+namespace detail {
+    /**
+     * The shared state of one parallel loop over [0, size).  Participants claim chunks off of an atomic cursor -
+     * each claim takes a share of what is left (but at least grain), so chunks start large and shrink towards the
+     * end, which keeps everyone busy without a per-element handoff.  Helpers hold this by shared_ptr, so a helper
+     * that only starts once the loop is over just finds nothing left to claim - and never touches the body, which
+     * may be gone by then.
+     */
+    class parallel_loop : boost::noncopyable {
+    public:
+        parallel_loop(std::size_t size, std::size_t grain, std::size_t participants)
+            : m_size(size), m_grain(grain > 0 ? grain : 1), m_participants(participants), m_next(0), m_done(0),
+              m_failed(false) {}
+
+        /** Runs chunks through (*pBody)(begin, end, slot) until there are none left (pBody is only used for a chunk) */
+        template<typename Body>
+        void run(Body* pBody, std::size_t slot) {
+            std::size_t begin, end;
+            while (claim(begin, end)) {
+                if (!m_failed.load(boost::memory_order_relaxed)) {
+                    try {
+                        (*pBody)(begin, end, slot);
+                    } catch (...) {
+                        auto_lock lock(m_mutex);
+                        if (!m_failed.exchange(true)) { m_error = boost::current_exception(); }
+                    }
+                }
+                finished(end - begin);
+            }
+        }
+
+        /** Waits for every chunk to finish, and rethrows the first exception (if any) */
+        void wait() {
+            auto_lock lock(m_mutex);
+            while (m_done.load() < m_size) { m_finished.wait(lock); }
+            if (m_error) { boost::rethrow_exception(m_error); }
+        }
+
+    private:
+        bool claim(std::size_t& begin, std::size_t& end) {
+            std::size_t next = m_next.load(boost::memory_order_relaxed);
+            do {
+                if (next >= m_size) { return false; }
+                end = next + std::max(m_grain, (m_size - next) / (2 * m_participants));
+                if (end > m_size) { end = m_size; }
+            } while (!m_next.compare_exchange_weak(next, end));
+            begin = next;
+            return true;
+        }
+
+        void finished(std::size_t n) {
+            if (m_done.fetch_add(n) + n == m_size) {
+                auto_lock lock(m_mutex);
+                m_finished.notify_all();
+            }
+        }
+
+    private:
+        const std::size_t           m_size;
+        const std::size_t           m_grain;
+        const std::size_t           m_participants;
+        boost::atomic<std::size_t>  m_next;
+        char                        m_pad[BOOST_EXT_CACHE_LINE_SIZE];
+        boost::atomic<std::size_t>  m_done;
+        boost::atomic<bool>         m_failed;
+        boost::exception_ptr        m_error;
+        boost::mutex                m_mutex;
+        boost::condition_variable   m_finished;
+    };
+
+    /** A helper task - it runs the loop as participant m_slot */
+    template<typename Body>
+    struct parallel_helper {
+        parallel_helper(boost::shared_ptr<parallel_loop> pLoop, Body* pBody, std::size_t slot)
+            : m_pLoop(pLoop), m_pBody(pBody), m_slot(slot) {}
+        void operator()() { m_pLoop->run(m_pBody, m_slot); }
+
+        boost::shared_ptr<parallel_loop>    m_pLoop;
+        Body*                               m_pBody;
+        std::size_t                         m_slot;
+    };
+
+    /** The number of participants (the calling thread plus helpers) to use for size elements */
+    inline std::size_t parallel_participants(thread_pool& pool, std::size_t size, std::size_t grain) {
+        std::size_t chunks = (size + (grain > 0 ? grain : 1) - 1) / (grain > 0 ? grain : 1);
+        return std::max<std::size_t>(1, std::min<std::size_t>(pool.size() + 1, chunks));
+    }
+
+    /**
+     * Runs body(begin, end, slot) over [0, size) on the calling thread (slot 0) plus participants - 1 helpers
+     * (slots 1 and up) on the pool.  The calling thread works rather than blocks, and only waits at the end for
+     * chunks which helpers are still running.  If a bounded queue turns a helper away, the calling thread just does
+     * that helper's share (helpers point at body, so we must never leave before the loop is done).
+     */
+    template<typename Body>
+    void parallel_run(thread_pool& pool, std::size_t size, std::size_t grain, std::size_t participants, Body& body) {
+        if (size == 0) { return; }
+        if (participants <= 1) { body(0, size, 0); return; }
+
+        boost::shared_ptr<parallel_loop> pLoop = boost::make_shared<parallel_loop>(size, grain, participants);
+        for (std::size_t slot = 1; slot < participants; slot++) {
+            if (!pool.try_execute(parallel_helper<Body>(pLoop, &body, slot))) { break; }
+        }
+        pLoop->run(&body, 0);
+        pLoop->wait();
+    }
+
+    /** Calls fx(first + i) for each i in a chunk */
+    template<typename Index, typename F>
+    struct for_body {
+        for_body(Index first, const F& fx) : m_first(first), m_fx(fx) {}
+        void operator()(std::size_t begin, std::size_t end, std::size_t) {
+            for (std::size_t i = begin; i < end; i++) { m_fx(m_first + i); }
+        }
+        Index       m_first;
+        const F&    m_fx;
+    };
+
+    /** One participant's partial result - padded so that participants don't share cache lines */
+    template<typename T>
+    struct padded_partial {
+        padded_partial(const T& value) : m_value(value), m_set(false) {}
+        T       m_value;
+        bool    m_set;
+        char    m_pad[BOOST_EXT_CACHE_LINE_SIZE];
+    };
+
+    /** Transforms and reduces a chunk locally, and then folds it into the participant's partial result */
+    template<typename Index, typename T, typename Reduce, typename Transform>
+    struct transform_reduce_body {
+        transform_reduce_body(Index first, std::vector<padded_partial<T> >& partials, const Reduce& reduce,
+                              const Transform& transform) : m_first(first), m_partials(partials), m_reduce(reduce),
+                                                            m_transform(transform) {}
+        void operator()(std::size_t begin, std::size_t end, std::size_t slot) {
+            T acc = m_transform(m_first + begin);
+            for (std::size_t i = begin + 1; i < end; i++) { acc = m_reduce(acc, m_transform(m_first + i)); }
+
+            padded_partial<T>& partial = m_partials[slot];
+            partial.m_value = partial.m_set ? m_reduce(partial.m_value, acc) : acc;
+            partial.m_set = true;
+        }
+        Index                               m_first;
+        std::vector<padded_partial<T> >&    m_partials;
+        const Reduce&                       m_reduce;
+        const Transform&                    m_transform;
+    };
+
+    /** Sorts one run, and merges pairs of neighbouring runs, for parallel_sort */
+    template<typename RandomIt, typename Compare>
+    struct sort_runs {
+        sort_runs(RandomIt first, const std::vector<std::size_t>& bounds, Compare comp)
+            : m_first(first), m_bounds(bounds), m_comp(comp), m_width(0) {}
+        void operator()(std::size_t i) const {
+            std::size_t runs = m_bounds.size() - 1;
+            if (m_width == 0) {
+                std::sort(m_first + m_bounds[i], m_first + m_bounds[i + 1], m_comp);
+            } else {
+                std::size_t lo = 2 * i * m_width;
+                std::size_t mid = std::min(lo + m_width, runs), hi = std::min(lo + 2 * m_width, runs);
+                if (mid < hi) {
+                    std::inplace_merge(m_first + m_bounds[lo], m_first + m_bounds[mid], m_first + m_bounds[hi], m_comp);
+                }
+            }
+        }
+        RandomIt                            m_first;
+        const std::vector<std::size_t>&     m_bounds;
+        Compare                             m_comp;
+        std::size_t                         m_width;
+    };
+}
+
+/**
+ * Calls fx(i) for each i in [first, last) - i is an integer index or a random-access iterator - spread across the
+ * pool and the calling thread.  No chunk is smaller than grain (unless it is the last one).  The first exception
+ * thrown by fx is rethrown here once everything has stopped.
+ */
+template<typename Index, typename F>
+void parallel_for(thread_pool& pool, Index first, Index last, const F& fx, std::size_t grain = 1) {
+    if (!(first < last)) { return; }
+    std::size_t size = static_cast<std::size_t>(last - first);
+    detail::for_body<Index, F> body(first, fx);
+    detail::parallel_run(pool, size, grain, detail::parallel_participants(pool, size, grain), body);
+}
+
+/**
+ * Returns init reduced with transform(i) for each i in [first, last).  Each participant reduces into its own
+ * (cache-line padded) partial result, and the partials are combined on the calling thread - reduce must be
+ * associative and commutative, since the order in which chunks are combined is not fixed.
+ */
+template<typename Index, typename T, typename Reduce, typename Transform>
+T parallel_transform_reduce(thread_pool& pool, Index first, Index last, T init, const Reduce& reduce,
+                            const Transform& transform, std::size_t grain = 1) {
+    if (!(first < last)) { return init; }
+    std::size_t size = static_cast<std::size_t>(last - first);
+    std::size_t participants = detail::parallel_participants(pool, size, grain);
+
+    std::vector<detail::padded_partial<T> > partials(participants, detail::padded_partial<T>(init));
+    detail::transform_reduce_body<Index, T, Reduce, Transform> body(first, partials, reduce, transform);
+    detail::parallel_run(pool, size, grain, participants, body);
+
+    T result = init;
+    for (std::size_t i = 0; i < partials.size(); i++) {
+        if (partials[i].m_set) { result = reduce(result, partials[i].m_value); }
+    }
+    return result;
+}
+
+/**
+ * Sorts [first, last): one run per participant is sorted in parallel, and then neighbouring runs are merged in
+ * parallel rounds.  Ranges which are smaller than two grains are just sorted on the calling thread.
+ */
+template<typename RandomIt, typename Compare>
+void parallel_sort(thread_pool& pool, RandomIt first, RandomIt last, Compare comp, std::size_t grain = 4096) {
+    std::size_t size = static_cast<std::size_t>(std::distance(first, last));
+    std::size_t runs = detail::parallel_participants(pool, size, grain);
+    if (runs < 2) { std::sort(first, last, comp); return; }
+
+    std::vector<std::size_t> bounds;
+    for (std::size_t i = 0; i <= runs; i++) { bounds.push_back(size * i / runs); }
+
+    detail::sort_runs<RandomIt, Compare> sorter(first, bounds, comp);
+    parallel_for(pool, (std::size_t) 0, runs, sorter);
+    for (sorter.m_width = 1; sorter.m_width < runs; sorter.m_width *= 2) {
+        parallel_for(pool, (std::size_t) 0, (runs + 2 * sorter.m_width - 1) / (2 * sorter.m_width), sorter);
+    }
+}
+
+template<typename RandomIt>
+void parallel_sort(thread_pool& pool, RandomIt first, RandomIt last) {
+    parallel_sort(pool, first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+}
+
+}
+
+#endif /* H_BOOST_EXT_PARALLEL */
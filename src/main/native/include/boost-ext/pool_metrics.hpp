@@ -0,0 +1,409 @@
+/**
+ * Runtime metrics for a thread_pool - task counts, queue wait and run time histograms, per-worker busy time, timer
+ * lateness and the task each worker is running
+ */
+#ifndef H_BOOST_EXT_POOL_METRICS
+#define H_BOOST_EXT_POOL_METRICS
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include "boost/noncopyable.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/atomic.hpp"
+#include "boost/chrono/chrono.hpp"
+#include "boost/current_function.hpp"
+#include "boost/utility/result_of.hpp"
+
+#include "boost-ext/common.hpp"
+#include "boost-ext/classes.hpp"
+#include "boost-ext/task.hpp"
+
+namespace boost_ext {
+
+/** A point-in-time copy of a latency_histogram */
+struct histogram_snapshot {
+    /** Bucket 0 counts samples under 1us, and bucket i (for i > 0) counts samples in [2^(i-1), 2^i) microseconds */
+    enum { num_buckets = 32 };
+
+    histogram_snapshot() : m_buckets(num_buckets, 0), m_count(0), m_total(0), m_max(0) {}
+
+    boost::uint64_t count() const { return m_count; }
+    boost::chrono::nanoseconds total() const { return boost::chrono::nanoseconds(m_total); }
+    boost::chrono::nanoseconds max() const { return boost::chrono::nanoseconds(m_max); }
+    boost::chrono::nanoseconds mean() const { return boost::chrono::nanoseconds(m_count ? m_total / m_count : 0); }
+
+    /** An upper bound for the given percentile (0 - 100) - the top of the bucket it falls in */
+    boost::chrono::nanoseconds percentile(double p) const {
+        boost::uint64_t rank = static_cast<boost::uint64_t>(m_count * p / 100.0 + 0.5), seen = 0;
+        for (std::size_t i = 0; i < num_buckets; i++) {
+            seen += m_buckets[i];
+            if (seen >= rank && seen > 0) {
+                return std::min(boost::chrono::nanoseconds(bucket_limit(i)), max());
+            }
+        }
+        return max();
+    }
+
+    /** The (exclusive) upper limit of bucket i in nanoseconds */
+    static boost::int64_t bucket_limit(std::size_t i) { return 1000LL << i; }
+
+    std::vector<boost::uint64_t>    m_buckets;
+    boost::uint64_t                 m_count;
+    boost::int64_t                  m_total;
+    boost::int64_t                  m_max;
+};
+
+/** A lock-free log2 histogram of durations */
+class latency_histogram : boost::noncopyable {
+public:
+    latency_histogram() : m_total(0), m_max(0) {
+        for (std::size_t i = 0; i < histogram_snapshot::num_buckets; i++) { m_buckets[i].store(0); }
+    }
+
+    void record(boost::int64_t ns) {
+        if (ns < 0) { ns = 0; }
+        std::size_t bucket = 0;
+        for (boost::int64_t us = ns / 1000; us > 0 && bucket < histogram_snapshot::num_buckets - 1; us >>= 1) {
+            bucket++;
+        }
+        m_buckets[bucket].fetch_add(1, boost::memory_order_relaxed);
+        m_total.fetch_add(ns, boost::memory_order_relaxed);
+        boost::int64_t max = m_max.load(boost::memory_order_relaxed);
+        while (ns > max && !m_max.compare_exchange_weak(max, ns, boost::memory_order_relaxed)) {}
+    }
+
+    histogram_snapshot snapshot() const {
+        histogram_snapshot s;
+        add_to(s);
+        return s;
+    }
+
+    /** Adds this histogram's samples to s */
+    void add_to(histogram_snapshot& s) const {
+        for (std::size_t i = 0; i < histogram_snapshot::num_buckets; i++) {
+            boost::uint64_t n = m_buckets[i].load(boost::memory_order_relaxed);
+            s.m_buckets[i] += n, s.m_count += n;
+        }
+        s.m_total += m_total.load(boost::memory_order_relaxed);
+        s.m_max = std::max(s.m_max, m_max.load(boost::memory_order_relaxed));
+    }
+
+private:
+    boost::atomic<boost::uint64_t>  m_buckets[histogram_snapshot::num_buckets];
+    boost::atomic<boost::int64_t>   m_total;
+    boost::atomic<boost::int64_t>   m_max;
+};
+
+/**
+ * Where a task was submitted from - BOOST_EXT_TASK_SITE captures the current file, line and function.  The strings
+ * must be literals (or otherwise live forever), since workers publish them as plain pointers.
+ */
+struct task_site {
+    task_site() : m_file(NULL), m_line(0), m_function(NULL) {}
+    task_site(const char* file, int line, const char* function) : m_file(file), m_line(line), m_function(function) {}
+
+    bool known() const { return m_file != NULL; }
+
+    TO_STRING_FX(task_site) {
+        if (!known()) { return "an unknown site"; }
+        std::stringstream s;
+        s << m_file << ":" << m_line;
+        if (m_function) { s << " (" << m_function << ")"; }
+        return s.str();
+    }
+
+    const char*     m_file;
+    int             m_line;
+    const char*     m_function;
+};
+
+#define BOOST_EXT_TASK_SITE     boost_ext::task_site(__FILE__, __LINE__, BOOST_CURRENT_FUNCTION)
+
+/** A task which a worker is running right now - m_started is in pool_metrics::now() nanoseconds */
+struct running_task {
+    running_task() : m_worker(0), m_started(0) {}
+
+    std::size_t         m_worker;
+    boost::int64_t      m_started;
+    task_site           m_site;
+};
+
+/** A point-in-time copy of one worker's counters */
+struct worker_snapshot {
+    worker_snapshot() : m_tasks(0), m_busy(0), m_idle(0) {}
+
+    /** The fraction of its lifetime that the worker has spent running tasks */
+    double busy_ratio() const {
+        return (m_busy + m_idle > 0) ? static_cast<double>(m_busy) / static_cast<double>(m_busy + m_idle) : 0;
+    }
+
+    boost::uint64_t     m_tasks;
+    boost::int64_t      m_busy;
+    boost::int64_t      m_idle;
+};
+
+/** A point-in-time copy of a pool's metrics */
+struct pool_stats {
+    pool_stats() : m_threads(0), m_liveThreads(0), m_submitted(0), m_completed(0), m_queued(0), m_rejected(0),
+                   m_dropped(0), m_queueHighWater(0), m_blockingRegions(0), m_compensations(0), m_blocked(0),
+                   m_stalls(0) {}
+
+    /** The fraction of the workers' combined lifetime spent running tasks */
+    double busy_ratio() const {
+        boost::int64_t busy = 0, total = 0;
+        for (std::size_t i = 0; i < m_workers.size(); i++) {
+            busy += m_workers[i].m_busy, total += m_workers[i].m_busy + m_workers[i].m_idle;
+        }
+        return (total > 0) ? static_cast<double>(busy) / static_cast<double>(total) : 0;
+    }
+
+    TO_STRING_FX(pool_stats) {
+        std::stringstream s;
+        s << (m_name.empty() ? "thread_pool" : m_name) << ": " << m_liveThreads << "/" << m_threads << " threads, "
+          << m_submitted << " submitted, " << m_completed << " completed, " << m_queued << " queued, " << m_rejected
+          << " rejected, " << m_dropped << " dropped, wait p50/p99 "
+          << m_wait.percentile(50).count() / 1000 << "/" << m_wait.percentile(99).count() / 1000 << "us, run p50/p99 "
+          << m_run.percentile(50).count() / 1000 << "/" << m_run.percentile(99).count() / 1000 << "us, busy "
+          << static_cast<int>(busy_ratio() * 100 + 0.5) << "%";
+        return s.str();
+    }
+
+    std::string                     m_name;
+    int                             m_threads;
+    int                             m_liveThreads;
+    boost::uint64_t                 m_submitted;
+    boost::uint64_t                 m_completed;
+    boost::int64_t                  m_queued;
+    /** Tasks turned away or dropped by a bounded queue, and the deepest it has been (filled in by the pool) */
+    boost::uint64_t                 m_rejected;
+    boost::uint64_t                 m_dropped;
+    boost::uint64_t                 m_queueHighWater;
+    /** Blocking regions entered, stand-in threads started for them, and workers in a region right now */
+    boost::uint64_t                 m_blockingRegions;
+    boost::uint64_t                 m_compensations;
+    int                             m_blocked;
+    /** Tasks the pool's watchdog has flagged for running over budget (zero without a watchdog) */
+    boost::uint64_t                 m_stalls;
+    /** How long tasks waited to start, how long they ran, and how late scheduled tasks' timers fired */
+    histogram_snapshot              m_wait;
+    histogram_snapshot              m_run;
+    histogram_snapshot              m_timerLateness;
+    std::vector<worker_snapshot>    m_workers;
+};
+
+/**
+ * The live metrics of a pool.  Everything is an atomic (updated with relaxed ordering), and each worker updates its
+ * own padded slot (counters and histograms), which is found through a thread-local pointer - so workers never contend
+ * on a lock or a cache line, and a snapshot just adds everything up.  Threads which aren't workers of the pool (i.e.
+ * when they submit work) share one more slot.
+ */
+class pool_metrics : boost::noncopyable {
+public:
+    typedef boost::chrono::steady_clock clock_type;
+
+    pool_metrics(std::size_t numWorkers) {
+        for (std::size_t i = 0; i < numWorkers; i++) {
+            m_workers.push_back(new worker());
+            m_workers.back()->m_pOwner = this;
+        }
+    }
+    ~pool_metrics() {
+        for (std::size_t i = 0; i < m_workers.size(); i++) { delete m_workers[i]; }
+    }
+
+    /** Nanoseconds on the steady clock */
+    static boost::int64_t now() {
+        return boost::chrono::duration_cast<boost::chrono::nanoseconds>(clock_type::now().time_since_epoch()).count();
+    }
+
+    /** Converts any chrono duration (boost or std) to nanoseconds */
+    template<typename Duration>
+    static boost::int64_t nanoseconds(const Duration& d) {
+        return static_cast<boost::int64_t>(d.count() * (1e9 * Duration::period::num / Duration::period::den));
+    }
+
+    /** Marks the calling thread as worker slot i (slots are shared round-robin if there are more threads) */
+    void attach_worker(std::size_t i) {
+        if (m_workers.empty()) { return; }
+        worker* pWorker = m_workers[i % m_workers.size()];
+        boost::int64_t zero = 0;
+        pWorker->m_attached.compare_exchange_strong(zero, now());
+        current() = pWorker;
+    }
+
+    void submitted() { slot().m_submitted.fetch_add(1, boost::memory_order_relaxed); }
+    void started(boost::int64_t waitNs, boost::int64_t start) {
+        worker* pWorker = own_worker();
+        worker& w = pWorker ? *pWorker : m_external;
+        w.m_started.fetch_add(1, boost::memory_order_relaxed);
+        w.m_wait.record(waitNs);
+        if (pWorker) {
+            pWorker->m_file.store(NULL, boost::memory_order_relaxed);
+            pWorker->m_taskStart.store(start, boost::memory_order_release);
+        }
+    }
+    void completed(boost::int64_t runNs) {
+        worker* pWorker = own_worker();
+        worker& w = pWorker ? *pWorker : m_external;
+        w.m_run.record(runNs);
+        w.m_tasks.fetch_add(1, boost::memory_order_relaxed);
+        if (pWorker) {
+            pWorker->m_taskStart.store(0, boost::memory_order_relaxed);
+            pWorker->m_busy.fetch_add(runNs, boost::memory_order_relaxed);
+        }
+    }
+
+    /** Records where the calling worker's current task was submitted from */
+    static void at_site(const task_site& site) {
+        if (worker* pWorker = current()) {
+            pWorker->m_function.store(site.m_function, boost::memory_order_relaxed);
+            pWorker->m_line.store(site.m_line, boost::memory_order_relaxed);
+            pWorker->m_file.store(site.m_file, boost::memory_order_release);
+        }
+    }
+
+    /**
+     * Appends the tasks which workers are running right now.  A slot whose task changes while it is being read is
+     * skipped, so a site is never paired with another task's start time.
+     */
+    void running(std::vector<running_task>& tasks) const {
+        for (std::size_t i = 0; i < m_workers.size(); i++) {
+            const worker& w = *m_workers[i];
+            running_task r;
+            r.m_worker = i, r.m_started = w.m_taskStart.load(boost::memory_order_acquire);
+            if (r.m_started == 0) { continue; }
+            r.m_site.m_file = w.m_file.load(boost::memory_order_acquire);
+            r.m_site.m_line = w.m_line.load(boost::memory_order_relaxed);
+            r.m_site.m_function = w.m_function.load(boost::memory_order_relaxed);
+            if (w.m_taskStart.load(boost::memory_order_acquire) == r.m_started) { tasks.push_back(r); }
+        }
+    }
+    void timer_fired(boost::int64_t latenessNs) { m_timerLateness.record(latenessNs); }
+
+    /** Adds everything up (the name and thread counts are left for the pool to fill in) */
+    pool_stats snapshot() const {
+        pool_stats s;
+        boost::uint64_t started = 0;
+        add_to(s, started, m_external);
+        s.m_timerLateness = m_timerLateness.snapshot();
+
+        boost::int64_t t = now();
+        for (std::size_t i = 0; i < m_workers.size(); i++) {
+            const worker& slot = *m_workers[i];
+            add_to(s, started, slot);
+            worker_snapshot w;
+            boost::int64_t attached = slot.m_attached.load(boost::memory_order_relaxed);
+            w.m_tasks = slot.m_tasks.load(boost::memory_order_relaxed);
+            w.m_busy = slot.m_busy.load(boost::memory_order_relaxed);
+            w.m_idle = (attached > 0) ? std::max<boost::int64_t>(0, t - attached - w.m_busy) : 0;
+            s.m_workers.push_back(w);
+        }
+        s.m_queued = static_cast<boost::int64_t>(s.m_submitted - started);
+        return s;
+    }
+
+private:
+    struct worker : boost::noncopyable {
+        worker() : m_pOwner(NULL), m_attached(0), m_submitted(0), m_started(0), m_tasks(0), m_busy(0), m_taskStart(0),
+                   m_file(NULL), m_line(0), m_function(NULL) {}
+        const pool_metrics*             m_pOwner;
+        /** When the worker's thread attached, the tasks it submitted, started and completed, and its busy time */
+        boost::atomic<boost::int64_t>   m_attached;
+        boost::atomic<boost::uint64_t>  m_submitted;
+        boost::atomic<boost::uint64_t>  m_started;
+        boost::atomic<boost::uint64_t>  m_tasks;
+        boost::atomic<boost::int64_t>   m_busy;
+        /** How long the tasks it started had waited, and how long they ran */
+        latency_histogram               m_wait;
+        latency_histogram               m_run;
+        /** When the current task started (zero while idle), and its site (if it has one) */
+        boost::atomic<boost::int64_t>   m_taskStart;
+        boost::atomic<const char*>      m_file;
+        boost::atomic<int>              m_line;
+        boost::atomic<const char*>      m_function;
+        char                            m_pad[BOOST_EXT_CACHE_LINE_SIZE];
+    };
+
+    static worker*& current() { static THREAD_LOCAL worker* p = NULL; return p; }
+
+    /** The calling thread's slot, if it is one of our workers */
+    worker* own_worker() const {
+        worker* pWorker = current();
+        return (pWorker && pWorker->m_pOwner == this) ? pWorker : NULL;
+    }
+    worker& slot() {
+        worker* pWorker = own_worker();
+        return pWorker ? *pWorker : m_external;
+    }
+
+    static void add_to(pool_stats& s, boost::uint64_t& started, const worker& w) {
+        s.m_submitted += w.m_submitted.load(boost::memory_order_relaxed);
+        s.m_completed += w.m_tasks.load(boost::memory_order_relaxed);
+        started += w.m_started.load(boost::memory_order_relaxed);
+        w.m_wait.add_to(s.m_wait), w.m_run.add_to(s.m_run);
+    }
+
+private:
+    worker                          m_external;
+    latency_histogram               m_timerLateness;
+    std::vector<worker*>            m_workers;
+};
+
+namespace detail {
+    /**
+     * Wraps a task to time how long it waited and ran.  Copying passes the task along (like auto_ptr), so that the
+     * wrapper can itself be held by a task.
+     */
+    class timed_task {
+    public:
+        timed_task(task& t, pool_metrics* pMetrics) : m_pMetrics(pMetrics), m_enqueued(pool_metrics::now()) {
+            m_task.swap(t);
+        }
+        timed_task(const timed_task& other) : m_pMetrics(other.m_pMetrics), m_enqueued(other.m_enqueued) {
+            m_task.swap(other.m_task);
+        }
+
+        void operator()() {
+            boost::int64_t start = pool_metrics::now();
+            m_pMetrics->started(start - m_enqueued, start);
+            completion c(m_pMetrics, start);
+            m_task();
+        }
+
+    private:
+        timed_task& operator=(const timed_task&);
+
+        /** Records the run time, even if the task throws */
+        struct completion {
+            completion(pool_metrics* pMetrics, boost::int64_t start) : m_pMetrics(pMetrics), m_start(start) {}
+            ~completion() { m_pMetrics->completed(pool_metrics::now() - m_start); }
+            pool_metrics*   m_pMetrics;
+            boost::int64_t  m_start;
+        };
+
+        pool_metrics*   m_pMetrics;
+        boost::int64_t  m_enqueued;
+        mutable task    m_task;
+    };
+
+    /** Calls fx, having told the worker's metrics where it was submitted from */
+    template<typename F>
+    struct sited_call {
+        typedef typename boost::result_of<F()>::type result_type;
+
+        sited_call(const F& fx, const task_site& site) : m_fx(fx), m_site(site) {}
+        result_type operator()() {
+            pool_metrics::at_site(m_site);
+            return m_fx();
+        }
+
+        F           m_fx;
+        task_site   m_site;
+    };
+}
+
+}
+
+#endif /* H_BOOST_EXT_POOL_METRICS */
@@ -0,0 +1,139 @@
+/**
+ * Priority lanes for queued tasks (with starvation protection for the lower lanes)
+ */
+#ifndef H_BOOST_EXT_PRIORITY_LANES
+#define H_BOOST_EXT_PRIORITY_LANES
+
+#include "boost/noncopyable.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/atomic.hpp"
+#include "boost/thread/mutex.hpp"
+
+#include "boost-ext/common.hpp"
+#include "boost-ext/auto_lock.hpp"
+#include "boost-ext/task.hpp"
+
+/**
+ * A non-empty lane is served after this many tasks have been taken from higher lanes ahead of it, no matter what
+ * else is waiting
+ */
+#if !defined(BOOST_EXT_PRIORITY_STARVATION_LIMIT)
+    #define BOOST_EXT_PRIORITY_STARVATION_LIMIT     32
+#endif
+
+namespace boost_ext {
+
+/** The priority of a task - lower values are more urgent */
+enum task_priority { priority_high = 0, priority_normal, priority_low, num_priorities };
+
+/**
+ * A queue per priority.  pop() takes from the most urgent non-empty lane - unless a lower lane has been passed over
+ * BOOST_EXT_PRIORITY_STARVATION_LIMIT times, in which case that lane goes first.  Each lane has its own lock, and
+ * its depth is kept in an atomic so that picking a lane doesn't take any locks.
+ */
+class priority_lanes : boost::noncopyable {
+public:
+    priority_lanes() {}
+
+    /** Queues (and empties) t */
+    void push(task& t, task_priority priority) {
+        lane& l = m_lanes[clamp(priority)];
+        boost::uint64_t depth;
+        {
+            auto_lock lock(l.m_mutex);
+            l.m_tasks.push_back(t);
+            depth = l.m_depth.fetch_add(1) + 1;
+        }
+        l.m_submitted.fetch_add(1, boost::memory_order_relaxed);
+        boost::uint64_t high = l.m_highWater.load(boost::memory_order_relaxed);
+        while (depth > high && !l.m_highWater.compare_exchange_weak(high, depth, boost::memory_order_relaxed)) {}
+    }
+
+    /** Pops the next task to run into t - returns false if every lane is empty */
+    bool pop(task& t) {
+        for (;;) {
+            int chosen = -1;
+            for (int i = num_priorities - 1; i > 0 && chosen < 0; i--) {
+                if (m_lanes[i].m_depth.load() > 0 &&
+                    m_lanes[i].m_skipped.load(boost::memory_order_relaxed) >= BOOST_EXT_PRIORITY_STARVATION_LIMIT) {
+                    chosen = i;
+                }
+            }
+            for (int i = 0; i < num_priorities && chosen < 0; i++) {
+                if (m_lanes[i].m_depth.load() > 0) { chosen = i; }
+            }
+            if (chosen < 0) { return false; }
+
+            lane& l = m_lanes[chosen];
+            {
+                auto_lock lock(l.m_mutex);
+                if (l.m_tasks.empty()) { continue; }
+                l.m_tasks.pop_front(t);
+                l.m_depth.fetch_sub(1);
+            }
+            l.m_skipped.store(0, boost::memory_order_relaxed);
+
+            /* Every non-empty lane below the one we took from has now been passed over once more */
+            for (int i = chosen + 1; i < num_priorities; i++) {
+                if (m_lanes[i].m_depth.load(boost::memory_order_relaxed) > 0) {
+                    m_lanes[i].m_skipped.fetch_add(1, boost::memory_order_relaxed);
+                }
+            }
+            return true;
+        }
+    }
+
+    /** Pops the oldest task from the least urgent non-empty lane into t (to shed it) - returns false if all are empty */
+    bool pop_least_urgent(task& t) {
+        for (int i = num_priorities - 1; i >= 0; i--) {
+            lane& l = m_lanes[i];
+            if (l.m_depth.load() == 0) { continue; }
+            auto_lock lock(l.m_mutex);
+            if (l.m_tasks.empty()) { continue; }
+            l.m_tasks.pop_front(t);
+            l.m_depth.fetch_sub(1);
+            return true;
+        }
+        return false;
+    }
+
+    /** The number of tasks currently queued across all lanes */
+    boost::uint64_t size() const {
+        boost::uint64_t n = 0;
+        for (int i = 0; i < num_priorities; i++) { n += m_lanes[i].m_depth.load(); }
+        return n;
+    }
+
+    /** The number of tasks currently queued in the given lane, and the most that have ever been queued at once */
+    boost::uint64_t depth(task_priority priority) const { return m_lanes[clamp(priority)].m_depth.load(); }
+    boost::uint64_t high_water(task_priority priority) const {
+        return m_lanes[clamp(priority)].m_highWater.load(boost::memory_order_relaxed);
+    }
+    /** The total number of tasks which have been queued in the given lane */
+    boost::uint64_t submitted(task_priority priority) const {
+        return m_lanes[clamp(priority)].m_submitted.load(boost::memory_order_relaxed);
+    }
+
+private:
+    static int clamp(task_priority priority) {
+        return (priority < priority_high) ? priority_high : (priority >= num_priorities ? priority_low : priority);
+    }
+
+    struct lane : boost::noncopyable {
+        lane() : m_depth(0), m_highWater(0), m_submitted(0), m_skipped(0) {}
+
+        boost::mutex                    m_mutex;
+        task_queue                      m_tasks;
+        boost::atomic<boost::uint64_t>  m_depth;
+        boost::atomic<boost::uint64_t>  m_highWater;
+        boost::atomic<boost::uint64_t>  m_submitted;
+        boost::atomic<boost::uint64_t>  m_skipped;
+        char                            m_pad[BOOST_EXT_CACHE_LINE_SIZE];
+    };
+
+    lane    m_lanes[num_priorities];
+};
+
+}
+
+#endif /* H_BOOST_EXT_PRIORITY_LANES */
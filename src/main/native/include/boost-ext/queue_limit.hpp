@@ -0,0 +1,159 @@
+/**
+ * Bounded task queues - a capacity, and what to do with a task that arrives when the queue is full
+ */
+#ifndef H_BOOST_EXT_QUEUE_LIMIT
+#define H_BOOST_EXT_QUEUE_LIMIT
+
+#include "boost/noncopyable.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/atomic.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/condition_variable.hpp"
+#include "boost/chrono/chrono.hpp"
+
+#include "boost-ext/classes.hpp"
+#include "boost-ext/exception.hpp"
+#include "boost-ext/auto_lock.hpp"
+#include "boost-ext/task.hpp"
+#include "boost-ext/priority_lanes.hpp"
+
+namespace boost_ext {
+
+/**
+ * What happens to a task which arrives at a full queue - its submitter blocks until there is room (or a timeout
+ * passes), it is rejected straight away, or the oldest of the least urgent queued tasks is dropped to make room.  A
+ * submitter which may not block (such as one of the pool's own workers) gets admission_full from overflow_block.
+ */
+enum overflow_policy { overflow_block, overflow_reject, overflow_drop_oldest };
+
+/** What became of a task offered to a queue - queued, rejected, or left with a submitter which may not block */
+enum admission_result { admission_queued, admission_rejected, admission_full };
+
+/** Thrown when a task is rejected by a full queue */
+struct queue_full : exception {
+    queue_full(const std::string& message) : exception(message) {}
+};
+
+/** The capacity of a queue (zero for no limit) and its overflow policy */
+class queue_limit {
+public:
+    typedef boost::chrono::steady_clock::duration duration;
+
+    queue_limit(std::size_t capacity = 0, overflow_policy policy = overflow_block,
+                duration blockTimeout = duration::max()) : m_capacity(capacity), m_policy(policy),
+                                                           m_blockTimeout(blockTimeout) {}
+
+    GETTER(std::size_t, m_capacity, capacity)
+    GETTER(overflow_policy, m_policy, policy)
+    /**
+     * How long overflow_block waits for room before the task is rejected (by default, for as long as it takes).  A
+     * thread_pool's own threads never wait, since the room may only come from them - see thread_pool::set_queue_limit.
+     */
+    GETTER(duration, m_blockTimeout, block_timeout)
+
+private:
+    std::size_t         m_capacity;
+    overflow_policy     m_policy;
+    duration            m_blockTimeout;
+};
+
+/**
+ * Admits tasks into a set of priority_lanes under a queue_limit.  Submitters are serialized on a mutex only while
+ * the queue is bounded - an unbounded queue is just a push.  Whoever pops from the lanes must call popped(), so
+ * that blocked submitters wake up.
+ */
+class admission_control : boost::noncopyable {
+public:
+    admission_control(priority_lanes& lanes) : m_lanes(lanes), m_bounded(false), m_waiters(0), m_rejected(0),
+                                               m_dropped(0), m_highWater(0) {}
+
+    /** Changes the limit - this affects tasks submitted from now on */
+    void set_limit(const queue_limit& limit) {
+        auto_lock lock(m_mutex);
+        m_limit = limit;
+        m_bounded.store(limit.capacity() > 0);
+        m_space.notify_all();
+    }
+    queue_limit limit() const { auto_lock lock(m_mutex); return m_limit; }
+    bool bounded() const { return m_bounded.load(); }
+
+    /**
+     * Queues (and empties) t, making room first as the policy says.  If t is rejected - or the queue is full under
+     * overflow_block and mayBlock is false - t is left as it was.
+     */
+    admission_result push(task& t, task_priority priority, bool mayBlock = true) {
+        if (!m_bounded.load()) {
+            m_lanes.push(t, priority);
+            note_depth(m_lanes.size());
+            return admission_queued;
+        }
+
+        task dropped;
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex);
+            boost::chrono::steady_clock::time_point deadline = timeout_at(m_limit.block_timeout());
+            while (m_limit.capacity() > 0 && m_lanes.size() >= m_limit.capacity()) {
+                if (m_limit.policy() == overflow_drop_oldest && m_lanes.pop_least_urgent(dropped)) {
+                    m_dropped.fetch_add(1, boost::memory_order_relaxed);
+                    break;
+                } else if (m_limit.policy() != overflow_block) {
+                    m_rejected.fetch_add(1, boost::memory_order_relaxed);
+                    return admission_rejected;
+                } else if (!mayBlock) {
+                    return admission_full;
+                }
+
+                m_waiters++;
+                bool timedOut = (m_space.wait_until(lock, deadline) == boost::cv_status::timeout);
+                m_waiters--;
+                if (timedOut && m_lanes.size() >= m_limit.capacity()) {
+                    m_rejected.fetch_add(1, boost::memory_order_relaxed);
+                    return admission_rejected;
+                }
+            }
+            m_lanes.push(t, priority);
+            note_depth(m_lanes.size());
+        }
+        /* The dropped task is destroyed here, outside of our lock (breaking its promise, if it has one) */
+        return admission_queued;
+    }
+
+    /** Tells us a task has left the lanes */
+    void popped() {
+        if (!m_bounded.load()) { return; }
+        auto_lock lock(m_mutex);
+        if (m_waiters > 0) { m_space.notify_one(); }
+    }
+
+    /** The number of tasks rejected, the number dropped to make room, and the deepest the queue has been */
+    boost::uint64_t rejected() const { return m_rejected.load(boost::memory_order_relaxed); }
+    boost::uint64_t dropped() const { return m_dropped.load(boost::memory_order_relaxed); }
+    boost::uint64_t high_water() const { return m_highWater.load(boost::memory_order_relaxed); }
+
+private:
+    static boost::chrono::steady_clock::time_point timeout_at(queue_limit::duration timeout) {
+        boost::chrono::steady_clock::time_point now = boost::chrono::steady_clock::now();
+        return (timeout >= boost::chrono::steady_clock::time_point::max() - now)
+                    ? boost::chrono::steady_clock::time_point::max() : now + timeout;
+    }
+
+    void note_depth(boost::uint64_t depth) {
+        boost::uint64_t high = m_highWater.load(boost::memory_order_relaxed);
+        while (depth > high && !m_highWater.compare_exchange_weak(high, depth, boost::memory_order_relaxed)) {}
+    }
+
+private:
+    priority_lanes&                 m_lanes;
+    queue_limit                     m_limit;
+    boost::atomic<bool>             m_bounded;
+    int                             m_waiters;
+    boost::atomic<boost::uint64_t>  m_rejected;
+    boost::atomic<boost::uint64_t>  m_dropped;
+    boost::atomic<boost::uint64_t>  m_highWater;
+    mutable boost::mutex            m_mutex;
+    boost::condition_variable       m_space;
+};
+
+}
+
+#endif /* H_BOOST_EXT_QUEUE_LIMIT */
@@ -0,0 +1,155 @@
+/**
+ * Recurring (fixed-rate and fixed-delay) tasks which reuse a single timer
+ */
+#ifndef H_BOOST_EXT_RECURRING_TASK
+#define H_BOOST_EXT_RECURRING_TASK
+
+#include "boost/noncopyable.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/enable_shared_from_this.hpp"
+#include "boost/bind.hpp"
+#include "boost/function.hpp"
+#include "boost/atomic.hpp"
+#include "boost/asio.hpp"
+#include "boost/asio/steady_timer.hpp"
+
+#include "boost-ext/auto_lock.hpp"
+#include "boost-ext/task.hpp"
+#include "boost-ext/pool_metrics.hpp"
+
+namespace boost_ext {
+
+/**
+ * A function which is run repeatedly off of one asio timer.  A fixed_rate task computes each deadline from the
+ * previous deadline (so the period doesn't drift by however long the function takes), and a fixed_delay task waits
+ * the given delay after each run finishes.  A run never overlaps the previous one - when a fixed_rate task falls
+ * behind, missed ticks are either coalesced into one run or caught up in a burst.
+ */
+class recurring_task : boost::noncopyable, public boost::enable_shared_from_this<recurring_task> {
+public:
+    typedef boost::asio::steady_timer::clock_type   clock_type;
+    typedef clock_type::duration                    duration;
+
+    enum schedule_mode { fixed_rate, fixed_delay };
+    enum missed_tick_policy { coalesce, catch_up };
+
+    /** Hands a run to whichever thread should execute it (leaving the task empty) */
+    typedef boost::function<void(task&)> dispatcher;
+
+    /**
+     * Each run is handed to dispatch (so that a slow function doesn't hold up the timer thread), or is run in the
+     * timer handler if there is no dispatcher.  pMetrics (if any) is told how late each run starts.
+     */
+    template<typename F>
+    recurring_task(boost::asio::io_service& service, const F& fx, schedule_mode mode, duration period,
+                   missed_tick_policy policy = coalesce, pool_metrics* pMetrics = NULL,
+                   const dispatcher& dispatch = dispatcher())
+                        : m_timer(service), m_fx(fx), m_dispatch(dispatch), m_mode(mode),
+                          m_period(period > duration::zero() ? period : duration(1)), m_policy(policy),
+                          m_pMetrics(pMetrics), m_cancelled(false), m_runs(0), m_missed(0) {}
+
+    /** Starts running - the first run is after initialDelay */
+    void start(duration initialDelay) {
+        auto_lock lock(m_mutex);
+        m_deadline = clock_type::now() + initialDelay;
+        arm();
+    }
+
+    /** Stops any further runs (a run which is already in progress finishes) - this is safe from any thread */
+    void cancel() {
+        if (m_cancelled.exchange(true)) { return; }
+        auto_lock lock(m_mutex);
+        m_timer.cancel();
+    }
+
+    bool cancelled() const { return m_cancelled.load(); }
+
+    /** The number of times the function has run, and (for coalesce) the number of ticks which were skipped */
+    boost::uint64_t runs() const { return m_runs.load(boost::memory_order_relaxed); }
+    boost::uint64_t missed() const { return m_missed.load(boost::memory_order_relaxed); }
+
+private:
+    /** Waits for m_deadline (m_mutex must be held) */
+    void arm() {
+        m_timer.expires_at(m_deadline);
+        m_timer.async_wait(boost::bind(&recurring_task::handler, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void handler(const boost::system::error_code& error) {
+        if (error || m_cancelled.load()) { return; }
+        if (m_pMetrics) { m_pMetrics->timer_fired(pool_metrics::nanoseconds(clock_type::now() - m_deadline)); }
+        if (m_dispatch) {
+            task t(boost::bind(&recurring_task::run, shared_from_this()));
+            m_dispatch(t);
+        } else {
+            run();
+        }
+    }
+
+    /** Runs the function, then waits for the next deadline (even if the function throws) */
+    void run() {
+        rearm_guard guard(this);
+        m_fx();
+        m_runs.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    struct rearm_guard {
+        rearm_guard(recurring_task* pTask) : m_pTask(pTask) {}
+        ~rearm_guard() { m_pTask->rearm(); }
+        recurring_task* m_pTask;
+    };
+
+    /** Arms the timer for the run after the one which just finished */
+    void rearm() {
+        auto_lock lock(m_mutex);
+        if (m_cancelled.load()) { return; }
+
+        clock_type::time_point now = clock_type::now();
+        if (m_mode == fixed_delay) {
+            m_deadline = now + m_period;
+        } else {
+            m_deadline += m_period;
+            if (m_policy == coalesce && m_deadline <= now) {
+                /* Skip straight to the first deadline that is still in the future */
+                duration::rep n = (now - m_deadline).count() / m_period.count() + 1;
+                m_deadline += m_period * n;
+                m_missed.fetch_add(n, boost::memory_order_relaxed);
+            }
+        }
+        arm();
+    }
+
+private:
+    boost::asio::steady_timer       m_timer;
+    task                            m_fx;
+    dispatcher                      m_dispatch;
+    schedule_mode                   m_mode;
+    duration                        m_period;
+    missed_tick_policy              m_policy;
+    pool_metrics*                   m_pMetrics;
+    clock_type::time_point          m_deadline;
+    boost::atomic<bool>             m_cancelled;
+    boost::atomic<boost::uint64_t>  m_runs;
+    boost::atomic<boost::uint64_t>  m_missed;
+    boost::mutex                    m_mutex;
+};
+
+/** A handle to a recurring_task - copy it freely.  Dropping the handle does *not* cancel the task. */
+class recurring_handle {
+public:
+    recurring_handle() : m_pTask() {}
+    recurring_handle(boost::shared_ptr<recurring_task> pTask) : m_pTask(pTask) {}
+
+    void cancel() const { if (m_pTask) { m_pTask->cancel(); } }
+    bool cancelled() const { return !m_pTask || m_pTask->cancelled(); }
+    boost::uint64_t runs() const { return m_pTask ? m_pTask->runs() : 0; }
+    boost::uint64_t missed() const { return m_pTask ? m_pTask->missed() : 0; }
+
+private:
+    boost::shared_ptr<recurring_task>   m_pTask;
+};
+
+}
+
+#endif /* H_BOOST_EXT_RECURRING_TASK */
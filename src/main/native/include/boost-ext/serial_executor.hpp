@@ -0,0 +1,195 @@
+/**
+ * Strands - executors which run their tasks one at a time, in order, on top of another executor's threads
+ */
+#ifndef H_BOOST_EXT_SERIAL_EXECUTOR
+#define H_BOOST_EXT_SERIAL_EXECUTOR
+
+#include <new>
+#include "boost/noncopyable.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/make_shared.hpp"
+#include "boost/function.hpp"
+#include "boost/atomic.hpp"
+
+#include "boost-ext/common.hpp"
+#include "boost-ext/task.hpp"
+
+/** How many tasks a strand runs in one go before it gives its worker back (and queues itself again) */
+#if !defined(BOOST_EXT_STRAND_BATCH)
+    #define BOOST_EXT_STRAND_BATCH      64
+#endif
+
+namespace boost_ext {
+
+namespace detail {
+    /**
+     * The queue and run state of one strand.  Submitters push onto a lock-free stack, and count themselves in - the
+     * one which takes the count from zero queues a drain on the underlying executor, so an idle strand is taken over
+     * with a single atomic add and no lock.  The drain takes the whole stack at once (reversing it into submission
+     * order), and runs tasks until the count drops back to zero.
+     */
+    class strand_state : boost::noncopyable {
+    public:
+        typedef boost::function<void(task&)> dispatcher;
+
+        explicit strand_state(const dispatcher& dispatch) : m_dispatch(dispatch), m_pTop(NULL), m_count(0),
+                                                            m_pNext(NULL) {}
+        ~strand_state() {
+            free_list(m_pNext);
+            free_list(m_pTop.exchange(NULL));
+        }
+
+        /** Queues t (leaving it empty) - and this strand's drain, if the strand was idle */
+        void push(task& t, const boost::shared_ptr<strand_state>& pSelf) {
+            node* pNode = new (pooled_allocate(sizeof(node))) node();
+            pNode->m_task.swap(t);
+            node* pTop = m_pTop.load(boost::memory_order_relaxed);
+            do {
+                pNode->m_pNext = pTop;
+            } while (!m_pTop.compare_exchange_weak(pTop, pNode, boost::memory_order_release,
+                                                    boost::memory_order_relaxed));
+            if (m_count.fetch_add(1, boost::memory_order_acq_rel) == 0) { schedule(pSelf); }
+        }
+
+        /** Runs queued tasks (up to a batch) - only ever called by one thread at a time */
+        void drain(const boost::shared_ptr<strand_state>& pSelf) {
+            current_guard current(this);
+            for (int ran = 0; ; ) {
+                {
+                    task t;
+                    take_next(t);
+
+                    /* If the task throws, the strand still moves on to whatever is queued behind it */
+                    unwind_guard guard(this, pSelf);
+                    t();
+                    guard.m_armed = false;
+                }
+                if (m_count.fetch_sub(1, boost::memory_order_acq_rel) == 1) { return; }
+                if (++ran >= BOOST_EXT_STRAND_BATCH) {
+                    schedule(pSelf);
+                    return;
+                }
+            }
+        }
+
+        /** Whether the calling thread is running one of this strand's tasks */
+        bool is_current() const { return current() == this; }
+
+    private:
+        struct node {
+            node() : m_pNext(NULL) {}
+            task    m_task;
+            node*   m_pNext;
+        };
+
+        /** Queued on the underlying executor to drain a strand (which it keeps alive) */
+        struct drain_task {
+            explicit drain_task(const boost::shared_ptr<strand_state>& pState) : m_pState(pState) {}
+            void operator()() { m_pState->drain(m_pState); }
+            boost::shared_ptr<strand_state> m_pState;
+        };
+
+        struct current_guard {
+            explicit current_guard(strand_state* pState) : m_pPrevious(current()) { current() = pState; }
+            ~current_guard() { current() = m_pPrevious; }
+            strand_state*   m_pPrevious;
+        };
+
+        struct unwind_guard {
+            unwind_guard(strand_state* pState, const boost::shared_ptr<strand_state>& pSelf) : m_pState(pState),
+                                                                                               m_pSelf(pSelf),
+                                                                                               m_armed(true) {}
+            ~unwind_guard() {
+                if (m_armed && m_pState->m_count.fetch_sub(1, boost::memory_order_acq_rel) != 1) {
+                    m_pState->schedule(m_pSelf);
+                }
+            }
+            strand_state*                           m_pState;
+            const boost::shared_ptr<strand_state>&  m_pSelf;
+            bool                                    m_armed;
+        };
+
+        static strand_state*& current() { static THREAD_LOCAL strand_state* p = NULL; return p; }
+
+        void schedule(const boost::shared_ptr<strand_state>& pSelf) {
+            task t((drain_task(pSelf)));
+            m_dispatch(t);
+        }
+
+        /** Takes the oldest queued task (the count says there is one) */
+        void take_next(task& t) {
+            if (!m_pNext) {
+                node* pStack = m_pTop.exchange(NULL, boost::memory_order_acquire);
+                while (pStack) {
+                    node* pNode = pStack;
+                    pStack = pNode->m_pNext;
+                    pNode->m_pNext = m_pNext, m_pNext = pNode;
+                }
+            }
+            node* pNode = m_pNext;
+            m_pNext = pNode->m_pNext;
+            t.swap(pNode->m_task);
+            destroy(pNode);
+        }
+
+        static void destroy(node* pNode) {
+            pNode->~node();
+            pooled_deallocate(pNode, sizeof(node));
+        }
+        static void free_list(node* pNode) {
+            while (pNode) {
+                node* pNext = pNode->m_pNext;
+                destroy(pNode);
+                pNode = pNext;
+            }
+        }
+
+    private:
+        dispatcher              m_dispatch;
+        boost::atomic<node*>    m_pTop;
+        boost::atomic<int>      m_count;
+        /** The drain's own FIFO list (taken from m_pTop) */
+        node*                   m_pNext;
+    };
+}
+
+/**
+ * Runs tasks one at a time, in the order they were submitted, on the threads of an underlying executor - without
+ * tying up one of its threads while there is nothing to do.  Tasks on one strand never run concurrently, so they
+ * can share state without a lock.  Copies are handles to the same strand.  The strand hands its drains to a
+ * dispatcher (i.e. thread_pool's), which must outlive it.
+ */
+class serial_executor {
+public:
+    typedef detail::strand_state::dispatcher dispatcher;
+
+    explicit serial_executor(const dispatcher& dispatch)
+        : m_pState(boost::make_shared<detail::strand_state>(dispatch)) {}
+
+#if defined(BOOST_NO_CXX11_RVALUE_REFERENCES)
+    template<typename F>
+    void execute(const F& fx) {
+        task t(fx);
+        m_pState->push(t, m_pState);
+    }
+#else
+    template<typename F>
+    void execute(F&& fx) {
+        task t(static_cast<F&&>(fx));
+        m_pState->push(t, m_pState);
+    }
+#endif
+
+    /** Whether the calling thread is running one of this strand's tasks */
+    bool running_in_this_thread() const { return m_pState->is_current(); }
+
+    bool operator==(const serial_executor& other) const { return m_pState == other.m_pState; }
+    bool operator!=(const serial_executor& other) const { return m_pState != other.m_pState; }
+
+private:
+    boost::shared_ptr<detail::strand_state> m_pState;
+};
+
+}
+
+#endif /* H_BOOST_EXT_SERIAL_EXECUTOR */
@@ -0,0 +1,235 @@
+/**
+ * A watchdog for a thread_pool - flags tasks which have been running for longer than a budget (and so the workers
+ * stuck in them), and keeps a summary of the call sites they came from
+ */
+#ifndef H_BOOST_EXT_STALL_WATCHDOG
+#define H_BOOST_EXT_STALL_WATCHDOG
+
+#include <map>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include "boost/noncopyable.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/make_shared.hpp"
+#include "boost/function.hpp"
+#include "boost/bind.hpp"
+#include "boost/atomic.hpp"
+#include "boost/thread.hpp"
+#include "boost/asio.hpp"
+#include "boost/asio/steady_timer.hpp"
+#include "boost/chrono/chrono.hpp"
+
+#include "boost-ext/classes.hpp"
+#include "boost-ext/auto_lock.hpp"
+#include "boost-ext/timing_wheel.hpp"
+#include "boost-ext/elastic_workers.hpp"
+#include "boost-ext/pool_metrics.hpp"
+
+namespace boost_ext {
+
+/** A task which has run over budget - reported once, when it is first noticed */
+struct stall_report {
+    stall_report() : m_worker(0) {}
+
+    TO_STRING_FX(stall_report) {
+        std::stringstream s;
+        s << "Task from " << (std::string) m_site << " has been running for "
+          << boost::chrono::duration_cast<boost::chrono::milliseconds>(m_elapsed).count() << "ms on worker "
+          << m_worker << " of " << (m_pool.empty() ? std::string("thread_pool") : m_pool);
+        return s.str();
+    }
+
+    std::string                 m_pool;
+    std::size_t                 m_worker;
+    task_site                   m_site;
+    boost::chrono::nanoseconds  m_elapsed;
+};
+
+/** The over-budget tasks seen from one call site, and the longest that one of them was seen running */
+struct site_summary {
+    site_summary() : m_stalls(0), m_longest(0) {}
+
+    TO_STRING_FX(site_summary) {
+        std::stringstream s;
+        s << (std::string) m_site << ": " << m_stalls << " stalls, longest "
+          << boost::chrono::duration_cast<boost::chrono::milliseconds>(m_longest).count() << "ms";
+        return s.str();
+    }
+
+    task_site                   m_site;
+    boost::uint64_t             m_stalls;
+    boost::chrono::nanoseconds  m_longest;
+};
+
+/**
+ * Checks a pool's workers every quarter of the budget, on the same monitor thread as elastic pools (a pool whose
+ * workers are all stuck can't watch itself).  Stall handlers are called on a thread of their own, so a slow handler
+ * doesn't hold up the monitor, and a handler may disable the watchdog (or destroy the pool).  The workers only
+ * publish a start time and a site per task, with relaxed stores into their own metrics slots, so watching costs the
+ * dispatch path next to nothing - and nothing is watched when the pool is built with BOOST_EXT_THREAD_POOL_NO_METRICS.
+ * Tasks only have a known site when they are posted with one (i.e. pool.execute(fx, BOOST_EXT_TASK_SITE)).
+ */
+class stall_watchdog : boost::noncopyable {
+public:
+    typedef boost::asio::steady_timer::clock_type::duration duration;
+    typedef boost::function<void(const stall_report&)>      handler;
+
+    stall_watchdog(const std::string& pool, const pool_metrics& metrics, boost::chrono::nanoseconds budget,
+                   const handler& onStall) : m_pool(pool), m_metrics(metrics), m_budget(budget), m_onStall(onStall),
+                                             m_stalls(0), m_pMonitor(boost::make_shared<monitor>(this)) {
+        auto_lock lock(m_pMonitor->m_mutex);
+        schedule_tick();
+    }
+    ~stall_watchdog() { stop(); }
+
+    /** Stops watching - once this returns, the handler won't be called again (unless this is called from it) */
+    void stop() {
+        auto_lock lock(m_pMonitor->m_mutex);
+        m_pMonitor->m_pWatchdog = NULL;
+        m_pMonitor->m_timer.cancel();
+        while (m_pMonitor->m_calling && m_pMonitor->m_caller != boost::this_thread::get_id()) {
+            m_pMonitor->m_called.wait(lock);
+        }
+    }
+
+    GETTER(boost::chrono::nanoseconds, m_budget, budget)
+
+    /** The number of tasks flagged so far */
+    boost::uint64_t stalls() const { return m_stalls.load(boost::memory_order_relaxed); }
+
+    /** The call sites which have had over-budget tasks - the slowest first */
+    std::vector<site_summary> summary() const {
+        std::vector<site_summary> sites;
+        {
+            auto_lock lock(m_mutex);
+            for (site_map::const_iterator i = m_sites.begin(); i != m_sites.end(); ++i) { sites.push_back(i->second); }
+        }
+        std::sort(sites.begin(), sites.end(), slower);
+        return sites;
+    }
+
+private:
+    typedef std::map<std::pair<std::string, int>, site_summary> site_map;
+
+    /** The thread which stall handlers are called on (shared by every watchdog, and never destroyed) */
+    class notifier : boost::noncopyable {
+    public:
+        static boost::asio::io_service& service() {
+            static notifier* p = new notifier();
+            return p->m_service;
+        }
+
+    private:
+        notifier() : m_work(m_service), m_thread(boost::bind(&boost::asio::io_service::run, &m_service)) {}
+
+        boost::asio::io_service         m_service;
+        boost::asio::io_service::work   m_work;
+        boost::thread                   m_thread;
+    };
+
+    /** The monitor's view of us - it outlives us if a tick (or a report) is still queued when we are destroyed */
+    struct monitor : boost::noncopyable {
+        monitor(stall_watchdog* pWatchdog) : m_pWatchdog(pWatchdog), m_timer(detail::elastic_monitor::service()),
+                                             m_calling(false) {}
+
+        static void on_tick(boost::shared_ptr<monitor> pMonitor, const boost::system::error_code& error) {
+            boost::shared_ptr<std::vector<stall_report> > pReports = boost::make_shared<std::vector<stall_report> >();
+            {
+                auto_lock lock(pMonitor->m_mutex);
+                if (error || !pMonitor->m_pWatchdog) { return; }
+                pMonitor->m_pWatchdog->tick(*pReports);
+            }
+            if (!pReports->empty()) { notifier::service().post(boost::bind(&monitor::report, pMonitor, pReports)); }
+        }
+
+        /** Calls the handler for each report (on the notifier) - unless the watchdog has stopped meanwhile */
+        static void report(boost::shared_ptr<monitor> pMonitor,
+                           boost::shared_ptr<std::vector<stall_report> > pReports) {
+            for (std::size_t i = 0; i < pReports->size(); i++) {
+                handler onStall;
+                {
+                    auto_lock lock(pMonitor->m_mutex);
+                    if (!pMonitor->m_pWatchdog) { return; }
+                    onStall = pMonitor->m_pWatchdog->m_onStall;
+                    pMonitor->m_calling = true, pMonitor->m_caller = boost::this_thread::get_id();
+                }
+                if (onStall) { onStall((*pReports)[i]); }
+                auto_lock lock(pMonitor->m_mutex);
+                pMonitor->m_calling = false;
+                pMonitor->m_called.notify_all();
+            }
+        }
+
+        boost::mutex                m_mutex;
+        stall_watchdog*             m_pWatchdog;
+        boost::asio::steady_timer   m_timer;
+        /** Whether a handler is being called right now, and from which thread */
+        bool                        m_calling;
+        boost::thread::id           m_caller;
+        boost::condition_variable   m_called;
+    };
+
+    static bool slower(const site_summary& a, const site_summary& b) { return a.m_longest > b.m_longest; }
+
+    /** Waits for the next check (the monitor's mutex must be held) */
+    void schedule_tick() {
+        boost::int64_t ms = boost::chrono::duration_cast<boost::chrono::milliseconds>(m_budget).count() / 4;
+        m_pMonitor->m_timer.expires_from_now(detail::milliseconds_as<duration>(std::max<boost::int64_t>(ms, 1)));
+        m_pMonitor->m_timer.async_wait(boost::bind(&monitor::on_tick, m_pMonitor, boost::asio::placeholders::error));
+    }
+
+    /**
+     * Flags tasks which have newly gone over budget (adding reports for them), and notes how long flagged ones have
+     * run - on the monitor, with its mutex held
+     */
+    void tick(std::vector<stall_report>& reports) {
+        std::vector<running_task> tasks;
+        m_metrics.running(tasks);
+        boost::int64_t t = pool_metrics::now();
+        for (std::size_t i = 0; i < tasks.size(); i++) {
+            boost::chrono::nanoseconds elapsed(t - tasks[i].m_started);
+            if (elapsed < m_budget) { continue; }
+
+            bool first = (m_flagged[tasks[i].m_worker] != tasks[i].m_started);
+            {
+                auto_lock lock(m_mutex);
+                const task_site& site = tasks[i].m_site;
+                site_summary& summary = m_sites[std::make_pair(std::string(site.known() ? site.m_file : ""),
+                                                               site.m_line)];
+                summary.m_site = site;
+                summary.m_longest = std::max(summary.m_longest, elapsed);
+                if (first) { summary.m_stalls++; }
+            }
+            if (!first) { continue; }
+
+            m_flagged[tasks[i].m_worker] = tasks[i].m_started;
+            m_stalls.fetch_add(1, boost::memory_order_relaxed);
+            stall_report report;
+            report.m_pool = m_pool, report.m_worker = tasks[i].m_worker, report.m_site = tasks[i].m_site;
+            report.m_elapsed = elapsed;
+            reports.push_back(report);
+        }
+        schedule_tick();
+    }
+
+private:
+    std::string                                 m_pool;
+    const pool_metrics&                         m_metrics;
+    boost::chrono::nanoseconds                  m_budget;
+    handler                                     m_onStall;
+    boost::atomic<boost::uint64_t>              m_stalls;
+
+    /** The start time of the task last flagged on each worker (only touched on the monitor) */
+    std::map<std::size_t, boost::int64_t>       m_flagged;
+
+    mutable boost::mutex                        m_mutex;
+    site_map                                    m_sites;
+    boost::shared_ptr<monitor>                  m_pMonitor;
+};
+
+}
+
+#endif /* H_BOOST_EXT_STALL_WATCHDOG */
@@ -0,0 +1,303 @@
+/**
+ * A move-only, small-buffer callable (for queuing work without heap allocations) and the pooled memory behind it
+ */
+#ifndef H_BOOST_EXT_TASK
+#define H_BOOST_EXT_TASK
+
+#include <new>
+#include <memory>
+#include "boost/noncopyable.hpp"
+#include "boost/move/move.hpp"
+#include "boost/atomic.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/utility/enable_if.hpp"
+#include "boost/type_traits/alignment_of.hpp"
+#include "boost/type_traits/is_same.hpp"
+#include "boost/type_traits/decay.hpp"
+#include "boost/thread/thread_only.hpp"
+
+#if !defined(BOOST_EXT_TASK_BUFFER_SIZE)
+    #define BOOST_EXT_TASK_BUFFER_SIZE      48
+#endif
+
+#if defined(BOOST_NO_CXX11_RVALUE_REFERENCES)
+    #define BOOST_EXT_TASK_FORWARD(S, s)    s
+#else
+    #define BOOST_EXT_TASK_FORWARD(S, s)    static_cast<S&&>(s)
+#endif
+
+namespace boost_ext {
+
+namespace detail {
+    inline boost::atomic<boost::uint64_t>& pooled_heap_counter() {
+        static boost::atomic<boost::uint64_t> count(0);
+        return count;
+    }
+
+    /** Falls back to operator new (counted, so that tests can check that a path doesn't allocate) */
+    inline void* pooled_heap_allocate(std::size_t size) {
+        pooled_heap_counter().fetch_add(1, boost::memory_order_relaxed);
+        return ::operator new(size);
+    }
+}
+
+/** The number of times that pooled memory (and task queues) have had to go to operator new */
+inline boost::uint64_t pooled_heap_allocations() {
+    return detail::pooled_heap_counter().load(boost::memory_order_relaxed);
+}
+
+/**
+ * A pool of fixed-size memory blocks.  Freed blocks are kept on an intrusive free list (each free block holds the
+ * pointer to the next) and handed back out, so once a workload has warmed up there are no more calls to operator new.
+ * The list is guarded by a spin lock, which is only ever held for a couple of pointer writes.  Pools are never
+ * destroyed (they may still be in use by handlers that are destroyed during static destruction).
+ */
+template<std::size_t Size>
+class block_pool : boost::noncopyable {
+public:
+    static block_pool& get() { static block_pool* p = new block_pool(); return *p; }
+
+    void* allocate() {
+        lock();
+        free_block* p = m_pFree;
+        if (p) { m_pFree = p->m_pNext; }
+        unlock();
+        return p ? p : detail::pooled_heap_allocate(Size);
+    }
+    void deallocate(void* p) {
+        free_block* pBlock = static_cast<free_block*>(p);
+        lock();
+        pBlock->m_pNext = m_pFree, m_pFree = pBlock;
+        unlock();
+    }
+
+private:
+    struct free_block { free_block* m_pNext; };
+
+    block_pool() : m_locked(false), m_pFree(NULL) {}
+
+    void lock() {
+        while (m_locked.exchange(true, boost::memory_order_acquire)) {
+            while (m_locked.load(boost::memory_order_relaxed)) { boost::this_thread::yield(); }
+        }
+    }
+    void unlock() { m_locked.store(false, boost::memory_order_release); }
+
+    boost::atomic<bool>     m_locked;
+    free_block*             m_pFree;
+};
+
+/** Allocates from the smallest block pool that fits - larger sizes go straight to operator new */
+inline void* pooled_allocate(std::size_t size) {
+    if (size <= 64)     { return block_pool<64>::get().allocate(); }
+    if (size <= 128)    { return block_pool<128>::get().allocate(); }
+    if (size <= 256)    { return block_pool<256>::get().allocate(); }
+    if (size <= 512)    { return block_pool<512>::get().allocate(); }
+    return detail::pooled_heap_allocate(size);
+}
+inline void pooled_deallocate(void* p, std::size_t size) {
+    if (size <= 64)     { block_pool<64>::get().deallocate(p); }
+    else if (size <= 128)   { block_pool<128>::get().deallocate(p); }
+    else if (size <= 256)   { block_pool<256>::get().deallocate(p); }
+    else if (size <= 512)   { block_pool<512>::get().deallocate(p); }
+    else                    { ::operator delete(p); }
+}
+
+/** A standard allocator on top of pooled_allocate (single-object allocations are pooled) */
+template<typename T>
+class pool_allocator : public std::allocator<T> {
+public:
+    template<typename U> struct rebind { typedef pool_allocator<U> other; };
+
+    pool_allocator() {}
+    pool_allocator(const pool_allocator&) : std::allocator<T>() {}
+    template<typename U> pool_allocator(const pool_allocator<U>&) {}
+
+    T* allocate(std::size_t n, const void* = 0) { return static_cast<T*>(pooled_allocate(n * sizeof(T))); }
+    void deallocate(T* p, std::size_t n) { pooled_deallocate(p, n * sizeof(T)); }
+};
+
+/**
+ * A type-erased, move-only void() callable.  Callables which fit in BOOST_EXT_TASK_BUFFER_SIZE bytes are stored
+ * inline; larger ones go into pooled memory.  In C++03 tasks are transferred with swap() (or by constructing from
+ * boost::move() of a movable-only callable, such as a packaged_task).
+ */
+class task {
+public:
+    task() : m_pOps(NULL) {}
+    ~task() { reset(); }
+
+#if defined(BOOST_NO_CXX11_RVALUE_REFERENCES)
+    template<typename F>
+    explicit task(const F& fx) : m_pOps(NULL) { assign<F, const F>(fx); }
+    template<typename F>
+    explicit task(boost::rv<F>& fx) : m_pOps(NULL) { assign<F, boost::rv<F> >(fx); }
+#else
+    template<typename F>
+    explicit task(F&& fx, typename boost::disable_if<boost::is_same<typename boost::decay<F>::type, task> >::type* = 0)
+        : m_pOps(NULL) { assign<typename boost::decay<F>::type, F>(fx); }
+    task(task&& other) : m_pOps(NULL) { swap(other); }
+    task& operator=(task&& other) { reset(); swap(other); return *this; }
+#endif
+
+    void operator()() { m_pOps->invoke(m_storage.m_buffer); }
+
+    bool empty() const { return m_pOps == NULL; }
+
+    /** Destroys the stored callable (leaving this task empty) */
+    void reset() {
+        if (m_pOps) { m_pOps->destroy(m_storage.m_buffer), m_pOps = NULL; }
+    }
+
+    void swap(task& other) {
+        if (this == &other) { return; }
+        task tmp;
+        tmp.take(*this);
+        take(other);
+        other.take(tmp);
+    }
+
+private:
+    task(const task&);
+    task& operator=(const task&);
+
+    /** The operations for a stored callable - invoke, relocate (move into other storage), and destroy */
+    struct ops {
+        void (*invoke)(void*);
+        void (*relocate)(void*, void*);
+        void (*destroy)(void*);
+    };
+
+    /** Inline storage for the callable (or for a pointer to its pooled copy) */
+    union storage {
+        char        m_buffer[BOOST_EXT_TASK_BUFFER_SIZE];
+        void*       m_alignPtr;
+        long double m_alignDouble;
+        long long   m_alignLong;
+    };
+
+    /** Stores the callable inline */
+    template<typename F>
+    struct inline_ops {
+        static void invoke(void* p) { (*static_cast<F*>(p))(); }
+        static void relocate(void* dst, void* src) {
+            new (dst) F(boost::move(*static_cast<F*>(src)));
+            static_cast<F*>(src)->~F();
+        }
+        static void destroy(void* p) { static_cast<F*>(p)->~F(); }
+        static const ops* get() { static const ops o = { &invoke, &relocate, &destroy }; return &o; }
+    };
+
+    /** Stores a pointer to a pooled copy of the callable */
+    template<typename F>
+    struct pooled_ops {
+        static F*& ptr(void* p) { return *static_cast<F**>(p); }
+        static void invoke(void* p) { (*ptr(p))(); }
+        static void relocate(void* dst, void* src) { ptr(dst) = ptr(src); }
+        static void destroy(void* p) { ptr(p)->~F(); pooled_deallocate(ptr(p), sizeof(F)); }
+        static const ops* get() { static const ops o = { &invoke, &relocate, &destroy }; return &o; }
+    };
+
+    template<typename F>
+    struct fits_inline {
+        static const bool value = sizeof(F) <= BOOST_EXT_TASK_BUFFER_SIZE &&
+                                  boost::alignment_of<F>::value <= boost::alignment_of<storage>::value;
+    };
+
+    /** Constructs an F from src (a const F to copy, or an rvalue/boost::rv<F> to move from) */
+    template<typename F, typename S>
+    void assign(S& src) {
+        if (fits_inline<F>::value) {
+            new (m_storage.m_buffer) F(BOOST_EXT_TASK_FORWARD(S, src));
+            m_pOps = inline_ops<F>::get();
+        } else {
+            void* p = pooled_allocate(sizeof(F));
+            try { pooled_ops<F>::ptr(m_storage.m_buffer) = new (p) F(BOOST_EXT_TASK_FORWARD(S, src)); }
+            catch (...) { pooled_deallocate(p, sizeof(F)); throw; }
+            m_pOps = pooled_ops<F>::get();
+        }
+    }
+
+    /** Moves the callable out of other (which must not be this) - this must be empty */
+    void take(task& other) {
+        if (other.m_pOps) {
+            other.m_pOps->relocate(m_storage.m_buffer, other.m_storage.m_buffer);
+            m_pOps = other.m_pOps, other.m_pOps = NULL;
+        }
+    }
+
+private:
+    const ops*  m_pOps;
+    storage     m_storage;
+};
+
+/** A grow-only ring buffer of tasks (not thread-safe) - once it has grown to its working size, it doesn't allocate */
+class task_queue : boost::noncopyable {
+public:
+    task_queue(std::size_t capacity = 32) : m_pTasks(new task[capacity > 0 ? capacity : 1]),
+                                            m_capacity(capacity > 0 ? capacity : 1), m_head(0), m_size(0) {}
+    ~task_queue() { delete[] m_pTasks; }
+
+    bool empty() const { return m_size == 0; }
+    std::size_t size() const { return m_size; }
+
+    /** Pushes (and empties) t */
+    void push_back(task& t) {
+        if (m_size == m_capacity) { grow(); }
+        m_pTasks[(m_head + m_size++) % m_capacity].swap(t);
+    }
+    /** Pops into t, which must be empty - the queue must not be */
+    void pop_back(task& t) {
+        t.swap(m_pTasks[(m_head + --m_size) % m_capacity]);
+    }
+    void pop_front(task& t) {
+        t.swap(m_pTasks[m_head]);
+        m_head = (m_head + 1) % m_capacity, m_size--;
+    }
+
+private:
+    void grow() {
+        detail::pooled_heap_counter().fetch_add(1, boost::memory_order_relaxed);
+        task* pTasks = new task[m_capacity * 2];
+        for (std::size_t i = 0; i < m_size; i++) { pTasks[i].swap(m_pTasks[(m_head + i) % m_capacity]); }
+        delete[] m_pTasks;
+        m_pTasks = pTasks, m_capacity *= 2, m_head = 0;
+    }
+
+    task*           m_pTasks;
+    std::size_t     m_capacity;
+    std::size_t     m_head;
+    std::size_t     m_size;
+};
+
+namespace detail {
+    /**
+     * Hands a task to asio.  Asio handlers must be copyable, so the task is kept in pooled memory and ownership is
+     * passed along on copy (like auto_ptr).  Asio's own per-handler memory comes from the block pools too.
+     */
+    class pooled_task_handler {
+    public:
+        explicit pooled_task_handler(task& t) : m_pTask(new (pooled_allocate(sizeof(task))) task()) { m_pTask->swap(t); }
+        pooled_task_handler(const pooled_task_handler& other) : m_pTask(other.m_pTask) { other.m_pTask = NULL; }
+        ~pooled_task_handler() {
+            if (m_pTask) { m_pTask->~task(); pooled_deallocate(m_pTask, sizeof(task)); }
+        }
+
+        void operator()() { (*m_pTask)(); }
+
+        friend void* asio_handler_allocate(std::size_t size, pooled_task_handler*) {
+            return pooled_allocate(size);
+        }
+        friend void asio_handler_deallocate(void* p, std::size_t size, pooled_task_handler*) {
+            pooled_deallocate(p, size);
+        }
+
+    private:
+        pooled_task_handler& operator=(const pooled_task_handler&);
+        mutable task* m_pTask;
+    };
+}
+
+}
+
+#endif /* H_BOOST_EXT_TASK */
@@ -0,0 +1,35 @@
+/**
+ * Naming OS threads, so that tools like perf and top -H can tell them apart
+ */
+#ifndef H_BOOST_EXT_THREAD_NAME
+#define H_BOOST_EXT_THREAD_NAME
+
+#include <string>
+
+#include "boost-ext/platform_detect.hpp"
+
+#if _IS_OS_LINUX_ || _IS_OS_ANDROID_ || _IS_OS_APPLE_
+    #include <pthread.h>
+#endif
+
+namespace boost_ext {
+
+/** The longest thread name (not counting the terminator) which every platform accepts */
+static const std::size_t max_thread_name = 15;
+
+/** Names the calling thread (truncated to max_thread_name) - returns false if that isn't supported */
+inline bool set_current_thread_name(const std::string& name) {
+    std::string truncated = name.substr(0, max_thread_name);
+#if _IS_OS_LINUX_ || _IS_OS_ANDROID_
+    return pthread_setname_np(pthread_self(), truncated.c_str()) == 0;
+#elif _IS_OS_APPLE_
+    return pthread_setname_np(truncated.c_str()) == 0;
+#else
+    (void) truncated;
+    return false;
+#endif
+}
+
+}
+
+#endif /* H_BOOST_EXT_THREAD_NAME */
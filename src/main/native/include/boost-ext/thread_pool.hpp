@@ -5,60 +5,153 @@
 #define H_BOOST_EXT_THREAD_POOL
 
 #include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
 #include "boost/noncopyable.hpp"
+#include "boost/scoped_ptr.hpp"
 #include "boost/make_shared.hpp"
 #include "boost/asio.hpp"
 #include "boost/asio/steady_timer.hpp"
 #include "boost/thread.hpp"
 #include "boost/chrono/duration.hpp"
 #include "boost/chrono/time_point.hpp"
+#include "boost/utility/result_of.hpp"
+#include "boost/functional/hash.hpp"
 
 #include "boost-ext/classes.hpp"
 #include "boost-ext/log.hpp"
+#include "boost-ext/task.hpp"
+#include "boost-ext/work_stealing_executor.hpp"
+#include "boost-ext/timing_wheel.hpp"
+#include "boost-ext/recurring_task.hpp"
+#include "boost-ext/priority_lanes.hpp"
+#include "boost-ext/queue_limit.hpp"
+#include "boost-ext/light_future.hpp"
+#include "boost-ext/coroutine.hpp"
+#include "boost-ext/serial_executor.hpp"
+#include "boost-ext/cancellation.hpp"
+#include "boost-ext/blocking_region.hpp"
+#include "boost-ext/cpu_topology.hpp"
+#include "boost-ext/elastic_workers.hpp"
+#include "boost-ext/cpu_budget.hpp"
+#include "boost-ext/pool_metrics.hpp"
+#include "boost-ext/stall_watchdog.hpp"
+#include "boost-ext/thread_name.hpp"
 
+/** The default pool size (see thread_pool::budget_size for a pool sized to the process's CPU budget) */
 #if !defined(BOOST_EXT_THREAD_POOL_DEFAULT_SIZE)
     #define BOOST_EXT_THREAD_POOL_DEFAULT_SIZE   5
 #endif
 
+/** The number of keyed strands in each pool (see thread_pool::strand) */
+#if !defined(BOOST_EXT_THREAD_POOL_STRANDS)
+    #define BOOST_EXT_THREAD_POOL_STRANDS   64
+#endif
+
 #if defined(BOOST_EXT_THREAD_POOL_NO_LOGGING)
     #include "boost/test/utils/nullstream.hpp"
     namespace boost_ext { static boost::onullstream _thread_pool_nullstream; }
     #define BOOST_EXT_THREAD_POOL_LOG(lvl)  boost_ext::_thread_pool_nullstream
 #else
-    #include "boost/log/trivial.hpp"
-    #define BOOST_EXT_THREAD_POOL_LOG(lvl) BOOST_LOG_TRIVIAL(lvl)
+    #define BOOST_EXT_THREAD_POOL_LOG(lvl) LOG(lvl)
 #endif
 
 namespace boost_ext {
 
-class scheduled_task : boost::noncopyable, public boost::enable_shared_from_this<scheduled_task> {
+class scheduled_task : boost::noncopyable, public boost::enable_shared_from_this<scheduled_task>,
+                       public timing_wheel_hook {
 public:
-    scheduled_task() : m_ptimer() {}
+    /**
+     * How a task waits when it is scheduled on a thread_pool - on its own asio timer (precise_timer), or on the
+     * pool's timing wheel (wheel_timer), which is much cheaper for large numbers of timeouts but only fires at tick
+     * granularity.
+     */
+    enum timer_mode { precise_timer, wheel_timer };
+
+    typedef boost::asio::steady_timer::clock_type clock_type;
+
+    scheduled_task(timer_mode mode = precise_timer) : m_ptimer(), m_mode(mode), m_pService(NULL), m_pWheel(NULL),
+                                                      m_pMetrics(NULL), m_state(waiting) {}
     virtual void operator()() =0;
     virtual void on_error(const boost::system::error_code& code) =0;
 
     template<typename D>
     void schedule(boost::asio::io_service& service, D duration) {
+        m_pService = &service;
+        m_state.store(waiting);
         m_ptimer.reset(new boost::asio::steady_timer(service, duration));
         m_ptimer->async_wait(boost::bind(&scheduled_task::handler, shared_from_this(), _1));
     }
 
+    /** Schedules on a timing wheel instead of our own timer */
+    template<typename D>
+    void schedule(timing_wheel& wheel, D duration) {
+        m_pWheel = &wheel;
+        m_state.store(waiting);
+        wheel.add(this, shared_from_this(), duration);
+    }
+
+    /**
+     * Cancels the timer, if it hasn't fired yet - on_error is then called with operation_aborted, and the task won't
+     * run once this returns (even if its timer expires before it is cancelled).  A wheel timer is taken off the wheel
+     * right here, and a precise timer is cancelled on its io_service.
+     */
+    void cancel() {
+        int expected = waiting;
+        m_state.compare_exchange_strong(expected, cancelled);
+        if (m_pWheel) {
+            m_pWheel->cancel(this);
+        } else if (m_pService) {
+            m_pService->post(boost::bind(&scheduled_task::cancel_timer, shared_from_this()));
+        }
+    }
+
 
+    /** Runs the task when its timer expires - unless it was cancelled first, when on_error has operation_aborted */
     void handler(const boost::system::error_code& error) {
+        int expected = waiting;
+        if (!error && !m_state.compare_exchange_strong(expected, fired)) {
+            this->on_error(boost::asio::error::operation_aborted);
+            return;
+        }
+        if (!error && m_pMetrics) {
+            m_pMetrics->timer_fired(pool_metrics::nanoseconds(clock_type::now() - m_deadline));
+        }
         if (error) {
             this->on_error(error);
         } else {
             (*this)();
         }
     }
+
+    GETTER(timer_mode, m_mode, mode)
+
+    /** Has the lateness of the timer (against deadline) reported to pMetrics - thread_pool::schedule sets this */
+    void watch(pool_metrics* pMetrics, clock_type::time_point deadline) {
+        m_pMetrics = pMetrics, m_deadline = deadline;
+    }
+
 private:
+    /** Whether the timer is still to fire, or it fired or was cancelled first - whichever comes first wins */
+    enum fire_state { waiting, fired, cancelled };
+
+    void on_expired(const boost::system::error_code& error) { handler(error); }
+    void cancel_timer() { m_ptimer->cancel(); }
+
     boost::shared_ptr<boost::asio::steady_timer> m_ptimer;
+    timer_mode                                   m_mode;
+    boost::asio::io_service*                     m_pService;
+    timing_wheel*                                m_pWheel;
+    pool_metrics*                                m_pMetrics;
+    clock_type::time_point                       m_deadline;
+    boost::atomic<int>                           m_state;
 };
 
 template<typename F>
 class scheduled_functor : public scheduled_task {
 public:
-    scheduled_functor(F functor) {
+    scheduled_functor(F functor, timer_mode mode = precise_timer) : scheduled_task(mode) {
         m_functor = functor;
     }
 
@@ -74,67 +167,779 @@ private:
     F m_functor;
 };
 
+namespace detail {
+    /** Cancels a scheduled_task (if it is still around) - what a cancellation_token runs for thread_pool::schedule */
+    struct cancel_scheduled {
+        explicit cancel_scheduled(const boost::shared_ptr<scheduled_task>& pTask) : m_pTask(pTask) {}
+        void operator()() {
+            if (boost::shared_ptr<scheduled_task> pTask = m_pTask.lock()) { pTask->cancel(); }
+        }
+        boost::weak_ptr<scheduled_task> m_pTask;
+    };
+
+    /**
+     * Stands in for one prioritized task on the underlying queue - whichever worker runs it takes the most urgent
+     * task waiting in the lanes, which isn't necessarily the one it was queued for
+     */
+    struct lane_token {
+        lane_token(priority_lanes* pLanes, admission_control* pAdmission) : m_pLanes(pLanes),
+                                                                            m_pAdmission(pAdmission) {}
+        void operator()() {
+            task t;
+            if (m_pLanes->pop(t)) {
+                m_pAdmission->popped();
+                t();
+            }
+        }
+        priority_lanes*     m_pLanes;
+        admission_control*  m_pAdmission;
+    };
+
+    /**
+     * A task without a priority which went straight onto the underlying queue (because the lanes were empty) - if
+     * urgent work has been queued since, whichever worker runs this serves the lanes first, so that the urgent work
+     * doesn't wait behind a backlog of unprioritized work
+     */
+    class bypassed_task {
+    public:
+        bypassed_task(task& t, priority_lanes* pLanes, admission_control* pAdmission) : m_token(pLanes, pAdmission) {
+            m_task.swap(t);
+        }
+        bypassed_task(const bypassed_task& other) : m_token(other.m_token) { m_task.swap(other.m_task); }
+
+        void operator()() {
+            if (m_token.m_pLanes->depth(priority_high) > 0) { m_token(); }
+            m_task();
+        }
+
+    private:
+        bypassed_task& operator=(const bypassed_task&);
+
+        lane_token      m_token;
+        mutable task    m_task;
+    };
+}
+
+/**
+ * Where a thread_pool's workers run.  Workers can be left to the OS (unpinned), pinned one per core (cores), or
+ * restricted to a set of CPUs (cpuset).  numa_nodes splits the pool into one sub-pool per NUMA node - each with its
+ * own task queues and with its workers restricted to that node's CPUs.  Each sub-pool is work-stealing (stealing only
+ * happens within a node), whatever the pool's queue_policy.
+ */
+class thread_placement {
+public:
+    enum mode { unpinned, cores, cpuset, numa_nodes };
+
+    thread_placement(mode m = unpinned, const cpu_topology::cpu_set& cpus = cpu_topology::cpu_set())
+        : m_mode(m), m_cpus(cpus) {}
+
+    static thread_placement pin_cores() { return thread_placement(cores); }
+    static thread_placement pin_cpuset(const cpu_topology::cpu_set& cpus) { return thread_placement(cpuset, cpus); }
+    static thread_placement per_numa_node() { return thread_placement(numa_nodes); }
+
+    GETTER(mode, m_mode, placement_mode)
+    GETTER(const cpu_topology::cpu_set&, m_cpus, cpus)
+
+private:
+    mode                    m_mode;
+    cpu_topology::cpu_set   m_cpus;
+};
+
+/** Where a task should run on a numa_nodes pool - anywhere, or on the node of the thread which submits it */
+enum node_hint { any_node, submitter_node };
+
 class thread_pool : public boost::noncopyable {
 
 public:
     typedef boost::function<void(const boost::system::error_code&)> fx_handler;
-    thread_pool(std::string name = "", int numThreads = BOOST_EXT_THREAD_POOL_DEFAULT_SIZE) : m_name(name),
-                                                                                              m_work(m_service) {
+
+    /**
+     * How tasks are queued.  A shared_queue pool runs all of its workers on one asio io_service (one locked queue for
+     * every post and completion).  A work_stealing pool gives each worker its own deque - tasks posted from a worker
+     * stay on that worker, and idle workers steal - while m_service is run by one extra thread for timers.
+     */
+    enum queue_policy { shared_queue, work_stealing };
+
+    /**
+     * Creates an elastic shared_queue pool - it has no threads until it is first used, and then runs between
+     * limits.min_threads() (at least one) and limits.max_threads() threads.  A numa_nodes placement isn't supported
+     * here (workers are left unpinned).
+     */
+    thread_pool(std::string name, const elastic_limits& limits, const thread_placement& placement = thread_placement())
+                    : m_name(name), m_policy(shared_queue), m_placement(placement),
+                      m_size(cpu_budget::pool_size(name, limits.max_threads())), m_work(m_service),
+                      m_wheel(m_service, boost::bind(&thread_pool::dispatch, this, _1)), m_admission(m_lanes),
+                      m_next(0), m_metrics(std::max(m_size, 1)),
+                      m_compensator(boost::bind(&thread_pool::compensation_loop, this),
+                                    boost::bind(&thread_pool::wake_workers, this),
+                                    boost::bind(&thread_pool::init_worker, this, compensating_thread(),
+                                                cpu_topology::cpu_set())) {
         if (name.size() > 0) { m_qualifier = " (" + name + ")"; }
+        create_strands();
 
-        /* Create our threads */
-        BOOST_EXT_THREAD_POOL_LOG(info) << "Creating " << numThreads << " threads" << m_qualifier;
-        for (int i = 0; i < numThreads; i++) {
-            m_threads.create_thread(boost::bind(&boost::asio::io_service::run, &m_service));
+        /* The environment can override our maximum size */
+        elastic_limits actual(limits.min_threads(), m_size, limits.grow_after(), limits.idle_timeout());
+        m_size = actual.max_threads();
+        BOOST_EXT_THREAD_POOL_LOG(info) << "Creating elastic pool of " << actual.min_threads() << " to " << m_size
+                                        << " threads" << m_qualifier;
+        m_pElastic.reset(new elastic_workers(m_service, actual, boost::bind(&thread_pool::init_worker, this, _1,
+                                                                            cpu_topology::cpu_set())));
+    }
+
+    thread_pool(std::string name = "", int numThreads = BOOST_EXT_THREAD_POOL_DEFAULT_SIZE,
+                queue_policy policy = shared_queue, const thread_placement& placement = thread_placement())
+                    : m_name(name), m_policy(policy), m_placement(placement),
+                      m_size(std::max(cpu_budget::pool_size(name, numThreads), 0)), m_work(m_service),
+                      m_wheel(m_service, boost::bind(&thread_pool::dispatch, this, _1)), m_admission(m_lanes),
+                      m_next(0), m_metrics(std::max(m_size, 1)),
+                      m_compensator(boost::bind(&thread_pool::compensation_loop, this),
+                                    boost::bind(&thread_pool::wake_workers, this),
+                                    boost::bind(&thread_pool::init_worker, this, compensating_thread(),
+                                                cpu_topology::cpu_set())) {
+        if (name.size() > 0) { m_qualifier = " (" + name + ")"; }
+        create_strands();
+
+        /* Create our threads (the environment can override how many) */
+        BOOST_EXT_THREAD_POOL_LOG(info) << "Creating " << m_size << " threads" << m_qualifier;
+        const cpu_topology& topology = cpu_topology::system();
+        if (m_placement.placement_mode() == thread_placement::numa_nodes) {
+            /* One work-stealing sub-pool per node (for as many nodes as we have threads), and a timer thread */
+            std::size_t numWorkers = std::max<std::size_t>(1, m_size);
+            std::size_t numNodes = std::min<std::size_t>(topology.num_nodes(), numWorkers);
+            for (std::size_t node = 0, worker = 0; node < numNodes; node++) {
+                std::size_t nodeSize = numWorkers / numNodes + (node < numWorkers % numNodes ? 1 : 0);
+                m_executors.push_back(new work_stealing_executor((int) nodeSize));
+                for (std::size_t i = 0; i < nodeSize; i++, worker++) {
+                    m_threads.create_thread(boost::bind(&thread_pool::run_worker, this, m_executors.back(), i, worker,
+                                                        topology.node_cpus(node)));
+                }
+                BOOST_EXT_THREAD_POOL_LOG(debug) << "Node " << node << " has " << nodeSize << " threads" << m_qualifier;
+            }
+            m_size = (int) numWorkers;
+            m_threads.create_thread(boost::bind(&thread_pool::run_service, this, timer_thread(),
+                                                cpu_topology::cpu_set()));
+        } else if (m_policy == work_stealing) {
+            m_executors.push_back(new work_stealing_executor(m_size));
+            m_size = (int) m_executors.back()->size();
+            for (std::size_t i = 0; i < m_executors.back()->size(); i++) {
+                m_threads.create_thread(boost::bind(&thread_pool::run_worker, this, m_executors.back(), i, i,
+                                                    worker_cpus(topology, i)));
+            }
+            m_threads.create_thread(boost::bind(&thread_pool::run_service, this, timer_thread(),
+                                                cpu_topology::cpu_set()));
+        } else {
+            for (int i = 0; i < m_size; i++) {
+                m_threads.create_thread(boost::bind(&thread_pool::run_service, this, (std::size_t) i,
+                                                    worker_cpus(topology, (std::size_t) i)));
+            }
         }
     }
     ~thread_pool() {
         /* Clean up and wait for our threads */
         BOOST_EXT_THREAD_POOL_LOG(info) << "Cleaning up threads" << m_qualifier << "...";
+        m_pWatchdog.reset();
         m_service.stop();
+        for (std::size_t i = 0; i < m_executors.size(); i++) { m_executors[i]->stop(); }
+        if (m_pElastic) { m_pElastic->stop(); }
         m_threads.join_all();
+        m_compensator.join();
+        for (std::size_t i = 0; i < m_executors.size(); i++) { delete m_executors[i]; }
         BOOST_EXT_THREAD_POOL_LOG(debug) << "Done cleaning up threads" << m_qualifier;
     }
 
-    /** Posts work to the pool, and returns the associated future */
-    template<typename T>
-    boost::future<T> post(boost::function<T()>& asyncFx) {
-        BOOST_EXT_THREAD_POOL_LOG(trace) << "Posting task" << m_qualifier;
+#if defined(BOOST_NO_CXX11_RVALUE_REFERENCES)
+    /**
+     * Posts work to the pool, and returns the associated future - its shared state comes from pooled memory (where
+     * Boost.Thread supports allocators), but Boost.Thread still allocates its reference count; use async for a
+     * light_future, which doesn't allocate at all once the pool is warmed up
+     */
+    template<typename F>
+    boost::future<typename boost::result_of<F()>::type> post(const F& asyncFx) {
+        task t;
+        boost::future<typename boost::result_of<F()>::type> future = package(asyncFx, t);
+        submit(t, any_node);
+        return boost::move(future);
+    }
 
-        /* Create a packaged task */
-        typedef boost::packaged_task<T>   task_t;
-        boost::shared_ptr<task_t>         task = boost::make_shared<task_t>(asyncFx);
-        boost::future<T>                  future = task->get_future();
+    /** Posts work to the pool without creating a future - exceptions escape the worker, as with io_service::run */
+    template<typename F>
+    void execute(const F& fx) {
+        task t(fx);
+        submit(t, any_node);
+    }
+
+    /**
+     * Posts work in a priority lane - the pool's workers always take the most urgent work first (with the lower
+     * lanes protected from starvation).  Work posted without a priority counts as normal, apart from work which a
+     * work-stealing worker posts itself (which stays on that worker's deque).
+     */
+    template<typename F>
+    boost::future<typename boost::result_of<F()>::type> post(const F& asyncFx, task_priority priority) {
+        task t;
+        boost::future<typename boost::result_of<F()>::type> future = package(asyncFx, t);
+        submit(t, priority);
+        return boost::move(future);
+    }
+
+    template<typename F>
+    void execute(const F& fx, task_priority priority) {
+        task t(fx);
+        submit(t, priority);
+    }
+
+    /** Like execute, but returns false (rather than throwing queue_full) if a bounded queue rejects the task */
+    template<typename F>
+    bool try_execute(const F& fx) {
+        task t(fx);
+        return admit(t, any_node);
+    }
+
+    template<typename F>
+    bool try_execute(const F& fx, task_priority priority) {
+        task t(fx);
+        return admit(t, priority);
+    }
+
+    /** Posts work with a node hint - submitter_node keeps it on the caller's NUMA node (on a numa_nodes pool) */
+    template<typename F>
+    boost::future<typename boost::result_of<F()>::type> post(const F& asyncFx, node_hint hint) {
+        task t;
+        boost::future<typename boost::result_of<F()>::type> future = package(asyncFx, t);
+        submit(t, hint);
+        return boost::move(future);
+    }
+
+    template<typename F>
+    void execute(const F& fx, node_hint hint) {
+        task t(fx);
+        submit(t, hint);
+    }
+#else
+    template<typename F>
+    boost::future<typename boost::result_of<typename boost::decay<F>::type()>::type> post(F&& asyncFx) {
+        task t;
+        boost::future<typename boost::result_of<typename boost::decay<F>::type()>::type> future =
+                                                                                package(static_cast<F&&>(asyncFx), t);
+        submit(t, any_node);
+        return boost::move(future);
+    }
+
+    template<typename F>
+    void execute(F&& fx) {
+        task t(static_cast<F&&>(fx));
+        submit(t, any_node);
+    }
+
+    template<typename F>
+    boost::future<typename boost::result_of<typename boost::decay<F>::type()>::type> post(F&& asyncFx,
+                                                                                          task_priority priority) {
+        task t;
+        boost::future<typename boost::result_of<typename boost::decay<F>::type()>::type> future =
+                                                                                package(static_cast<F&&>(asyncFx), t);
+        submit(t, priority);
+        return boost::move(future);
+    }
+
+    template<typename F>
+    void execute(F&& fx, task_priority priority) {
+        task t(static_cast<F&&>(fx));
+        submit(t, priority);
+    }
+
+    template<typename F>
+    bool try_execute(F&& fx) {
+        task t(static_cast<F&&>(fx));
+        return admit(t, any_node);
+    }
 
-        /* Post to our service and return the future */
-        m_service.post(boost::bind(&task_t::operator(), task));
+    template<typename F>
+    bool try_execute(F&& fx, task_priority priority) {
+        task t(static_cast<F&&>(fx));
+        return admit(t, priority);
+    }
+
+    template<typename F>
+    boost::future<typename boost::result_of<typename boost::decay<F>::type()>::type> post(F&& asyncFx,
+                                                                                          node_hint hint) {
+        task t;
+        boost::future<typename boost::result_of<typename boost::decay<F>::type()>::type> future =
+                                                                                package(static_cast<F&&>(asyncFx), t);
+        submit(t, hint);
         return boost::move(future);
     }
 
+    template<typename F>
+    void execute(F&& fx, node_hint hint) {
+        task t(static_cast<F&&>(fx));
+        submit(t, hint);
+    }
+#endif
+
+    /**
+     * Posts work which is skipped if token is cancelled before it starts - its future then throws task_cancelled.
+     * Once it is running, the work can poll the token itself.
+     */
+    template<typename F>
+    boost::future<typename boost::result_of<F()>::type> post(const F& asyncFx, const cancellation_token& token) {
+        return post(detail::cancellable_call<F>(asyncFx, token));
+    }
+
+    template<typename F>
+    void execute(const F& fx, const cancellation_token& token) {
+        execute(detail::cancellable_run<F>(fx, token));
+    }
+
+    /**
+     * Posts work tagged with where it was submitted from (pass BOOST_EXT_TASK_SITE) - so that the watchdog can say
+     * where a stalled task came from
+     */
+    template<typename F>
+    boost::future<typename boost::result_of<F()>::type> post(const F& asyncFx, const task_site& site) {
+        return post(detail::sited_call<F>(asyncFx, site));
+    }
+
+    template<typename F>
+    void execute(const F& fx, const task_site& site) {
+        execute(detail::sited_call<F>(fx, site));
+    }
+
+    /**
+     * Posts work to the pool, and returns a light_future for its result - which can be given a continuation with
+     * then(pool, fx), or combined with others with when_all / when_any, without any thread waiting for it.  The task
+     * and the future's state come from pooled memory, so a warmed-up pool doesn't call operator new.
+     */
+    template<typename F>
+    light_future<typename boost::result_of<F()>::type> async(const F& asyncFx) {
+        typedef typename boost::result_of<F()>::type T;
+        light_promise<T> promise;
+        task t(detail::promised_task<F, T>(asyncFx, promise));
+        submit(t, any_node);
+        return promise.get_future();
+    }
+
+    template<typename F>
+    light_future<typename boost::result_of<F()>::type> async(const F& asyncFx, task_priority priority) {
+        typedef typename boost::result_of<F()>::type T;
+        light_promise<T> promise;
+        task t(detail::promised_task<F, T>(asyncFx, promise));
+        submit(t, priority);
+        return promise.get_future();
+    }
+
+    template<typename F>
+    light_future<typename boost::result_of<F()>::type> async(const F& asyncFx, const task_site& site) {
+        return async(detail::sited_call<F>(asyncFx, site));
+    }
+
+    /** Schedules a task - on the pool's timing wheel if the task was created with wheel_timer */
     template<typename D>
     void schedule(boost::shared_ptr<scheduled_task> task, D duration) {
-        task->schedule(m_service, duration);
+        if (m_pElastic) { m_pElastic->start(); }
+        task->watch(&m_metrics, scheduled_task::clock_type::now() + duration);
+        if (task->mode() == scheduled_task::wheel_timer) {
+            task->schedule(m_wheel, duration);
+        } else {
+            task->schedule(m_service, duration);
+        }
+    }
+
+    /** Schedules a task which is cancelled (with on_error getting operation_aborted) if token is */
+    template<typename D>
+    void schedule(boost::shared_ptr<scheduled_task> task, D duration, const cancellation_token& token) {
+        schedule(task, duration);
+        token.on_cancel(detail::cancel_scheduled(task));
+    }
+
+#if defined(BOOST_EXT_HAS_COROUTINES)
+    /** co_await pool.schedule() moves a coroutine onto one of the pool's workers */
+    detail::schedule_awaiter<thread_pool> schedule() { return detail::schedule_awaiter<thread_pool>(*this); }
+
+    /**
+     * co_await pool.sleep_for(d) resumes a coroutine on one of the pool's workers after d - the coroutine waits on
+     * the pool's timing wheel (without allocating), so this is only as precise as the wheel's tick
+     */
+    template<typename D>
+    detail::sleep_awaiter sleep_for(D duration) {
+        if (m_pElastic) { m_pElastic->start(); }
+        return detail::sleep_awaiter(m_wheel, std::chrono::duration_cast<timing_wheel::duration>(duration));
+    }
+#endif
+
+    /**
+     * Runs fx every period (after initialDelay), with each deadline computed from the previous one.  If a run
+     * overruns one or more deadlines, the missed ticks are either coalesced into one run or run back-to-back.
+     */
+    template<typename F, typename D1, typename D2>
+    recurring_handle schedule_at_fixed_rate(const F& fx, D1 initialDelay, D2 period,
+                                            recurring_task::missed_tick_policy policy = recurring_task::coalesce) {
+        return schedule_recurring(fx, initialDelay, period, recurring_task::fixed_rate, policy);
+    }
+
+    /** Runs fx (after initialDelay) and then again each time delay has passed since the previous run finished */
+    template<typename F, typename D1, typename D2>
+    recurring_handle schedule_with_fixed_delay(const F& fx, D1 initialDelay, D2 delay) {
+        return schedule_recurring(fx, initialDelay, delay, recurring_task::fixed_delay, recurring_task::coalesce);
+    }
+
+    /** The timing wheel used by wheel_timer tasks (use this to change its tick before scheduling anything) */
+    timing_wheel& wheel() { return m_wheel; }
+
+    /**
+     * A new strand on this pool - its tasks run one at a time and in order, on whichever workers are free, so work
+     * on one entity can be serialized without a lock (and without holding a worker while the strand is idle)
+     */
+    serial_executor make_strand() { return serial_executor(boost::bind(&thread_pool::dispatch, this, _1)); }
+
+    /**
+     * The strand for a key - keys are hashed onto a fixed set of BOOST_EXT_THREAD_POOL_STRANDS strands, so work for
+     * the same key is always serialized (and work for different keys occasionally is too)
+     */
+    template<typename K>
+    serial_executor& strand(const K& key) { return m_strands[boost::hash<K>()(key) % m_strands.size()]; }
+
+    /**
+     * Bounds the queue - once capacity tasks are waiting, further posts block, are rejected (post and execute throw
+     * queue_full, and try_execute returns false) or push out the oldest of the least urgent tasks, as the policy says.
+     * Under overflow_block, a post from one of the pool's own threads (outside of a blocking_region) runs the task
+     * right there instead of waiting, since every worker waiting for room would deadlock.  A bounded pool queues
+     * everything through its priority lanes, so node hints are ignored.  A capacity of zero removes the bound.
+     *
+     * Only post, execute and try_execute are bounded - the work which strands, the timing wheel and recurring tasks
+     * hand to the pool once it is due goes straight to the workers, and isn't counted against the capacity.
+     */
+    void set_queue_limit(const queue_limit& limit) { m_admission.set_limit(limit); }
+    queue_limit get_queue_limit() const { return m_admission.limit(); }
+
+    /**
+     * Starts watching for tasks which run for longer than budget - each one is logged as a warning (with its site,
+     * if it was posted with one) and passed to onStall, once.  Replaces any earlier watchdog.
+     */
+    template<typename D>
+    void enable_watchdog(D budget, const stall_watchdog::handler& onStall = stall_watchdog::handler()) {
+        boost::chrono::nanoseconds ns(pool_metrics::nanoseconds(budget));
+        m_pWatchdog.reset();
+        m_pWatchdog.reset(new stall_watchdog(m_name, m_metrics, ns, boost::bind(&thread_pool::on_stall, this, _1,
+                                                                                onStall)));
+    }
+    void disable_watchdog() { m_pWatchdog.reset(); }
+
+    /** The call sites of the tasks the watchdog has flagged, slowest first (empty without a watchdog) */
+    std::vector<site_summary> slowest_sites() const {
+        return m_pWatchdog ? m_pWatchdog->summary() : std::vector<site_summary>();
+    }
+
+    /** The priority lanes - their depth, high-water and submitted counters show how prioritized work is queueing */
+    const priority_lanes& lanes() const { return m_lanes; }
+
+    GETTER(queue_policy, m_policy, policy)
+    GETTER(const thread_placement&, m_placement, placement)
+
+    /** The number of sub-pools - one per NUMA node for a numa_nodes pool, and one otherwise */
+    std::size_t num_nodes() const { return std::max<std::size_t>(1, m_executors.size()); }
+
+    /** The number of worker threads (not counting the timer thread of a work_stealing pool) - the most for elastic */
+    GETTER(int, m_size, size)
+
+    /**
+     * The size which fits the process's CPU budget (its hardware threads, affinity mask and cgroup CPU quota) - pass
+     * this as the size of a pool which shouldn't oversubscribe a container
+     */
+    static int budget_size() { return cpu_budget::system().threads(); }
+
+    /** A snapshot of the pool's metrics (which are all zero when built with BOOST_EXT_THREAD_POOL_NO_METRICS) */
+    pool_stats stats() const {
+        pool_stats s = m_metrics.snapshot();
+        s.m_name = m_name, s.m_threads = m_size, s.m_liveThreads = live_size();
+        s.m_rejected = m_admission.rejected(), s.m_dropped = m_admission.dropped();
+        s.m_queueHighWater = m_admission.high_water();
+        s.m_blockingRegions = m_compensator.regions(), s.m_compensations = m_compensator.compensations();
+        s.m_blocked = m_compensator.blocked();
+        s.m_stalls = m_pWatchdog ? m_pWatchdog->stalls() : 0;
+        return s;
+    }
+
+    /** The number of worker threads which are running right now (which only differs from size() for elastic pools) */
+    int live_size() const { return m_pElastic ? m_pElastic->live() : m_size; }
+
+private:
+    /** Wraps asyncFx in a packaged task (moved into t), and returns its future */
+    template<typename F>
+    boost::future<typename boost::result_of<typename boost::decay<F>::type()>::type> package(BOOST_FWD_REF(F) asyncFx,
+                                                                                             task& t) {
+        BOOST_EXT_THREAD_POOL_LOG(trace) << "Posting task" << m_qualifier;
+
+        /* Create a packaged task - with its shared state in pooled memory, where Boost.Thread supports it */
+        typedef typename boost::result_of<typename boost::decay<F>::type()>::type T;
+        typedef boost::packaged_task<T>   task_t;
+    #if defined(BOOST_THREAD_PROVIDES_FUTURE_CTOR_ALLOCATORS)
+        task_t                            pt(boost::allocator_arg, pool_allocator<task_t>(), boost::forward<F>(asyncFx));
+    #else
+        task_t                            pt(boost::forward<F>(asyncFx));
+    #endif
+        boost::future<T>                  future = pt.get_future();
+
+        task packaged(boost::move(pt));
+        t.swap(packaged);
+        return boost::move(future);
+    }
+
+
+    template<typename F, typename D1, typename D2>
+    recurring_handle schedule_recurring(const F& fx, D1 initialDelay, D2 period, recurring_task::schedule_mode mode,
+                                        recurring_task::missed_tick_policy policy) {
+        BOOST_EXT_THREAD_POOL_LOG(trace) << "Scheduling recurring task" << m_qualifier;
+        boost::shared_ptr<recurring_task> pTask = boost::make_shared<recurring_task>(
+            boost::ref(m_service), fx, mode, period, policy, &m_metrics,
+            recurring_task::dispatcher(boost::bind(&thread_pool::dispatch, this, _1)));
+        if (m_pElastic) { m_pElastic->start(); }
+        pTask->start(initialDelay);
+        return recurring_handle(pTask);
+    }
+
+    /**
+     * Hands a ready-to-run task (which is left empty) to whichever queue this pool uses - this bypasses the lanes and
+     * any queue limit, for work which has already been admitted (or was never subject to it): strand drains, the
+     * timing wheel's batches and recurring tasks' runs
+     */
+    void dispatch(task& t) { dispatch_on_node(t, any_node); }
+
+    void dispatch_on_node(task& t, node_hint hint) {
+    #if !defined(BOOST_EXT_THREAD_POOL_NO_METRICS)
+        m_metrics.submitted();
+        task timed((detail::timed_task(t, &m_metrics)));
+        t.swap(timed);
+    #endif
+        if (m_pElastic) {
+            m_pElastic->post(t);
+        } else if (m_executors.empty()) {
+            m_service.post(detail::pooled_task_handler(t));
+        } else {
+            m_executors[pick_node(hint)]->post(t);
+        }
+    }
+
+    /**
+     * Picks the sub-pool for a task - a worker's own sub-pool (to keep its children local), the submitter's node for
+     * submitter_node, or else round-robin
+     */
+    std::size_t pick_node(node_hint hint) {
+        if (m_executors.size() == 1) { return 0; }
+        for (std::size_t i = 0; i < m_executors.size(); i++) {
+            if (m_executors[i]->is_current()) { return i; }
+        }
+        if (hint == submitter_node) {
+            std::size_t node = cpu_topology::system().current_node();
+            if (node < m_executors.size()) { return node; }
+        }
+        return m_next.fetch_add(1, boost::memory_order_relaxed) % m_executors.size();
+    }
+
+    /** The CPUs for worker i under a cores or cpuset placement (empty for unpinned) */
+    cpu_topology::cpu_set worker_cpus(const cpu_topology& topology, std::size_t i) const {
+        switch (m_placement.placement_mode()) {
+            case thread_placement::cores: {
+                cpu_topology::cpu_set cpus = topology.usable_cpus();
+                return cpu_topology::cpu_set(1, cpus[i % cpus.size()]);
+            }
+            case thread_placement::cpuset:
+                return m_placement.cpus();
+            default:
+                return cpu_topology::cpu_set();
+        }
+    }
+
+    void pin(const cpu_topology::cpu_set& cpus) {
+        if (!cpus.empty() && !cpu_topology::pin_current_thread(cpus)) {
+            BOOST_EXT_THREAD_POOL_LOG(warning) << "Could not set thread affinity" << m_qualifier;
+        }
+    }
+
+    /** The worker numbers passed for the timer thread of a work_stealing or numa_nodes pool, and for stand-ins */
+    static std::size_t timer_thread() { return (std::size_t) -1; }
+    static std::size_t compensating_thread() { return (std::size_t) -2; }
+
+    /** Pins, names and (for metrics) attaches a new thread - elastic workers are pinned per worker_cpus */
+    void init_worker(std::size_t worker, const cpu_topology::cpu_set& cpus) {
+        pin(m_pElastic ? worker_cpus(cpu_topology::system(), worker) : cpus);
+
+        /* Names are limited to 15 characters - i.e. "MyThreadPo-12" */
+        std::stringstream s;
+        s << (m_name.empty() ? std::string("pool") : m_name).substr(0, 10) << "-";
+        if (worker == timer_thread()) {
+            s << "timer";
+        } else if (worker == compensating_thread()) {
+            s << "standin";
+        } else {
+            s << worker;
+        }
+        set_current_thread_name(s.str());
+        if (worker != timer_thread() && worker != compensating_thread()) { m_metrics.attach_worker(worker); }
+        m_compensator.attach();
+    }
+    void run_worker(work_stealing_executor* pExecutor, std::size_t index, std::size_t worker,
+                    const cpu_topology::cpu_set& cpus) {
+        init_worker(worker, cpus);
+        pExecutor->run(index);
+    }
+    void run_service(std::size_t worker, const cpu_topology::cpu_set& cpus) {
+        init_worker(worker, cpus);
+        m_service.run();
+    }
+
+    /**
+     * The loop for a stand-in for the calling worker - it takes over the worker's slot on a work_stealing or
+     * numa_nodes pool, and otherwise runs the io_service (which a work_stealing pool's timer thread runs too).
+     * Elastic pools get no stand-ins.
+     */
+    detail::blocking_compensator::loop compensation_loop() {
+        if (m_pElastic) { return detail::blocking_compensator::loop(); }
+        for (std::size_t i = 0; i < m_executors.size(); i++) {
+            if (m_executors[i]->is_current()) {
+                return boost::bind(&work_stealing_executor::run_while, m_executors[i],
+                                   m_executors[i]->current_slot(), _1);
+            }
+        }
+        return boost::bind(&thread_pool::run_service_while, this, _1);
+    }
+    void run_service_while(const detail::blocking_compensator::predicate& keepGoing) {
+        while (keepGoing() && m_service.run_one() > 0) {}
+    }
+
+    /** Wakes idle workers, so that a stand-in whose region has ended notices */
+    void wake_workers() {
+        for (std::size_t i = 0; i < m_executors.size(); i++) { m_executors[i]->wake_all(); }
+        m_service.post(&thread_pool::nothing);
+    }
+    static void nothing() {}
+
+    void on_stall(const stall_report& report, const stall_watchdog::handler& onStall) {
+        BOOST_EXT_THREAD_POOL_LOG(warning) << (std::string) report;
+        if (onStall) { onStall(report); }
+    }
+
+    void create_strands() {
+        m_strands.reserve(BOOST_EXT_THREAD_POOL_STRANDS);
+        for (int i = 0; i < BOOST_EXT_THREAD_POOL_STRANDS; i++) { m_strands.push_back(make_strand()); }
+    }
+
+    /**
+     * Queues a task from post or execute in its lane, along with a token for it on the underlying queue.  Work
+     * without a priority only goes in the normal lane while other work is waiting in the lanes (or the queue is
+     * bounded) - otherwise it goes straight onto the underlying queue, so that the common case takes no lane locks,
+     * and it lets urgent work queued behind it go first.  Work which one of a work-stealing pool's own workers posts
+     * stays on that worker's deque for locality.  Returns false if a bounded queue rejected it (t is left as it was).
+     * One of our own threads which finds a blocking queue full runs the task itself (see set_queue_limit).
+     */
+    bool admit(task& t, task_priority priority, node_hint hint = any_node) {
+        switch (m_admission.push(t, priority, !(m_admission.bounded() && on_own_thread()))) {
+            case admission_rejected:
+                return false;
+            case admission_full: {
+                BOOST_EXT_THREAD_POOL_LOG(debug) << "Queue full, so running a task in its submitter" << m_qualifier;
+                task here;
+                here.swap(t);
+                here();
+                return true;
+            }
+            default:
+                break;
+        }
+        task token((detail::lane_token(&m_lanes, &m_admission)));
+        dispatch_on_node(token, hint);
+        return true;
+    }
+    bool admit(task& t, node_hint hint) {
+        bool local = on_stealing_worker();
+        if (m_admission.bounded() || (!local && m_lanes.size() > 0)) { return admit(t, priority_normal, hint); }
+        if (local) {
+            dispatch_on_node(t, hint);
+        } else {
+            task bypassed((detail::bypassed_task(t, &m_lanes, &m_admission)));
+            dispatch_on_node(bypassed, hint);
+        }
+        return true;
+    }
+
+    /** Whether this is one of our threads (a worker, timer thread or stand-in) - and not in a blocking region */
+    bool on_own_thread() const { return detail::blocking_compensator::current() == &m_compensator; }
+
+    /** Whether this is one of our work-stealing (or NUMA sub-pool) workers */
+    bool on_stealing_worker() const {
+        for (std::size_t i = 0; i < m_executors.size(); i++) {
+            if (m_executors[i]->is_current()) { return true; }
+        }
+        return false;
+    }
+
+    /** Admits a task, throwing queue_full if it is rejected */
+    template<typename How>
+    void submit(task& t, How how) {
+        if (!admit(t, how)) {
+            BOOST_EXT_THREAD_POOL_LOG(debug) << "Rejected a task" << m_qualifier;
+            BOOST_THROW_EXCEPTION(queue_full("Task rejected by a full queue" + m_qualifier));
+        }
     }
 
 public:
     std::string                     m_name;
     std::string                     m_qualifier;
+    queue_policy                    m_policy;
+    thread_placement                m_placement;
+    int                             m_size;
     boost::asio::io_service         m_service;
     boost::thread_group             m_threads;
     boost::asio::io_service::work   m_work;
+    std::vector<work_stealing_executor*> m_executors;
+    boost::scoped_ptr<elastic_workers> m_pElastic;
+    timing_wheel                    m_wheel;
+    priority_lanes                  m_lanes;
+    admission_control               m_admission;
+    boost::atomic<std::size_t>      m_next;
+    std::vector<serial_executor>    m_strands;
+    pool_metrics                    m_metrics;
+    detail::blocking_compensator    m_compensator;
+    boost::scoped_ptr<stall_watchdog> m_pWatchdog;
 };
 
 /** Creates a singleton thread pool instance that is lazily initialized and will be cleaned up on exit */
-#define BOOST_EXT_THREAD_POOL_WITH_SIZE(n, s)                      \
-struct n : public boost::noncopyable {                                \
-    static boost_ext::thread_pool& inst() {                        \
-        static boost_ext::thread_pool me(BOOST_STRINGIZE(n), s);   \
-        return me;                                                    \
-    }                                                                 \
+#define BOOST_EXT_THREAD_POOL_WITH_PLACEMENT(n, s, p, pl)                 \
+struct n : public boost::noncopyable {                                    \
+    static boost_ext::thread_pool& inst() {                               \
+        static boost_ext::thread_pool me(BOOST_STRINGIZE(n), s, p, pl);   \
+        return me;                                                        \
+    }                                                                     \
+}
+
+#define BOOST_EXT_THREAD_POOL_WITH_POLICY(n, s, p)                                                                \
+                            BOOST_EXT_THREAD_POOL_WITH_PLACEMENT(n, s, p, boost_ext::thread_placement())
+
+/** An elastic singleton pool - no threads until it is first used, and then between min and max threads */
+#define BOOST_EXT_ELASTIC_THREAD_POOL(n, min, max)                                                \
+struct n : public boost::noncopyable {                                                            \
+    static boost_ext::thread_pool& inst() {                                                       \
+        static boost_ext::thread_pool me(BOOST_STRINGIZE(n), boost_ext::elastic_limits(min, max)); \
+        return me;                                                                                \
+    }                                                                                             \
 }
 
+/** Define BOOST_EXT_THREAD_POOL_ELASTIC to make the plain singleton pools elastic (up to their given size) */
+#if defined(BOOST_EXT_THREAD_POOL_ELASTIC)
+    #define BOOST_EXT_THREAD_POOL_WITH_SIZE(n, s)   BOOST_EXT_ELASTIC_THREAD_POOL(n, 0, s)
+#else
+    #define BOOST_EXT_THREAD_POOL_WITH_SIZE(n, s)                                                                 \
+                            BOOST_EXT_THREAD_POOL_WITH_POLICY(n, s, boost_ext::thread_pool::shared_queue)
+#endif
 #define BOOST_EXT_THREAD_POOL(n) BOOST_EXT_THREAD_POOL_WITH_SIZE(n, BOOST_EXT_THREAD_POOL_DEFAULT_SIZE)
 
+/** A work-stealing singleton pool - use this for fan-out workloads with many small tasks */
+#define BOOST_EXT_STEALING_THREAD_POOL_WITH_SIZE(n, s)                                                            \
+                            BOOST_EXT_THREAD_POOL_WITH_POLICY(n, s, boost_ext::thread_pool::work_stealing)
+
+/** A singleton pool with one sub-pool per NUMA node */
+#define BOOST_EXT_NUMA_THREAD_POOL_WITH_SIZE(n, s)                                                                \
+                            BOOST_EXT_THREAD_POOL_WITH_PLACEMENT(n, s, boost_ext::thread_pool::work_stealing,     \
+                                                                 boost_ext::thread_placement::per_numa_node())
+
 }
 
 #endif /* H_BOOST_EXT_THREAD_POOL */
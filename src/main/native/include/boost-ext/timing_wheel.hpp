@@ -0,0 +1,239 @@
+/**
+ * A hashed timing wheel - O(1) insert and cancel for large numbers of coarse-grained timers
+ */
+#ifndef H_BOOST_EXT_TIMING_WHEEL
+#define H_BOOST_EXT_TIMING_WHEEL
+
+#include <vector>
+#include "boost/noncopyable.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/function.hpp"
+#include "boost/bind.hpp"
+#include "boost/asio.hpp"
+#include "boost/asio/steady_timer.hpp"
+#include "boost/chrono/duration.hpp"
+
+#include "boost-ext/auto_lock.hpp"
+#include "boost-ext/task.hpp"
+
+/** The default tick granularity (in milliseconds) and number of slots for a timing wheel */
+#if !defined(BOOST_EXT_TIMING_WHEEL_TICK_MS)
+    #define BOOST_EXT_TIMING_WHEEL_TICK_MS  10
+#endif
+#if !defined(BOOST_EXT_TIMING_WHEEL_SLOTS)
+    #define BOOST_EXT_TIMING_WHEEL_SLOTS    512
+#endif
+
+namespace boost_ext {
+
+class timing_wheel;
+
+namespace detail {
+    /** Milliseconds as a Duration - asio's steady_timer uses std::chrono (rather than boost::chrono) when it can */
+    template<typename Duration>
+    Duration milliseconds_as(boost::int64_t ms) {
+        return Duration(ms * Duration::period::den / (1000 * Duration::period::num));
+    }
+}
+
+/** An intrusive hook - derive from this to be able to go on a timing_wheel */
+class timing_wheel_hook {
+public:
+    timing_wheel_hook() : m_pWheel(NULL), m_pPrev(NULL), m_pNext(NULL), m_tick(0), m_rounds(0) {}
+    virtual ~timing_wheel_hook() {}
+
+    /** Called on a pool thread once the entry expires (or with operation_aborted if it is cancelled) */
+    virtual void on_expired(const boost::system::error_code& error) =0;
+
+private:
+    friend class timing_wheel;
+
+    timing_wheel*               m_pWheel;
+    timing_wheel_hook*          m_pPrev;
+    timing_wheel_hook*          m_pNext;
+    boost::uint64_t             m_tick;
+    boost::uint64_t             m_rounds;
+    boost::shared_ptr<void>     m_pKeepAlive;
+};
+
+/**
+ * A hashed timing wheel.  Each entry lands in slot (due tick % number of slots) along with the number of full turns
+ * of the wheel it still has to wait, so inserting and cancelling are both O(1) no matter how many timers are
+ * pending.  One asio timer drives the wheel (only while it has entries), and all the entries which expire on the
+ * same tick are handed to the dispatcher as a single batch.
+ */
+class timing_wheel : public boost::noncopyable {
+public:
+    typedef boost::asio::steady_timer::clock_type   clock_type;
+    typedef clock_type::duration                    duration;
+    typedef boost::function<void(task&)>            dispatcher;
+
+    timing_wheel(boost::asio::io_service& service, const dispatcher& dispatch,
+                 duration tick = detail::milliseconds_as<duration>(BOOST_EXT_TIMING_WHEEL_TICK_MS),
+                 std::size_t numSlots = BOOST_EXT_TIMING_WHEEL_SLOTS) : m_timer(service), m_dispatch(dispatch),
+                                                                         m_slots(numSlots > 0 ? numSlots : 1),
+                                                                         m_tickSize(tick), m_start(clock_type::now()),
+                                                                         m_tick(0), m_size(0), m_armed(false) {}
+    ~timing_wheel() {
+        /* Drop anything that is still pending (without calling it - just like a destroyed io_service) */
+        for (std::size_t i = 0; i < m_slots.size(); i++) {
+            while (m_slots[i]) {
+                timing_wheel_hook* p = m_slots[i];
+                unlink(p);
+                p->m_pKeepAlive.reset();
+            }
+        }
+    }
+
+    /** The tick granularity - entries expire on the first tick at or after their deadline */
+    duration tick() const { return m_tickSize; }
+
+    /** Changes the tick granularity - this only has an effect while the wheel is empty */
+    timing_wheel& set_tick(duration tick) {
+        auto_lock lock(m_mutex);
+        if (m_size == 0 && tick > duration::zero()) { m_tickSize = tick, m_start = clock_type::now(), m_tick = 0; }
+        return *this;
+    }
+
+    /** The number of pending entries */
+    std::size_t size() const { auto_lock lock(m_mutex); return m_size; }
+
+    /**
+     * Adds an entry which expires after delay - keepAlive is held until it fires or is cancelled.  Returns false
+     * (and does nothing) if the entry is already on a wheel.
+     */
+    bool add(timing_wheel_hook* p, boost::shared_ptr<void> keepAlive, duration delay) {
+        auto_lock lock(m_mutex);
+        if (p->m_pWheel) { return false; }
+
+        /* An empty wheel isn't ticking, so catch the cursor up to now */
+        clock_type::time_point now = clock_type::now();
+        if (m_size == 0) { m_tick = ticks_at(now, false); }
+
+        boost::uint64_t due = ticks_at(now + delay, true);
+        if (due <= m_tick) { due = m_tick + 1; }
+        p->m_tick = due, p->m_rounds = (due - m_tick - 1) / m_slots.size();
+        p->m_pKeepAlive = keepAlive;
+        link(p, m_slots[due % m_slots.size()]);
+
+        if (!m_armed) { arm(); }
+        return true;
+    }
+
+    /** Cancels an entry - its on_expired is called with operation_aborted.  Returns false if it wasn't pending. */
+    bool cancel(timing_wheel_hook* p) {
+        {
+            auto_lock lock(m_mutex);
+            if (p->m_pWheel != this) { return false; }
+            unlink(p);
+        }
+        task t(fire_batch(p, boost::asio::error::operation_aborted));
+        m_dispatch(t);
+        return true;
+    }
+
+private:
+    /**
+     * Calls on_expired for a chain of entries (linked through m_pNext), releasing each one's keep-alive.  Copying
+     * passes the chain along (like auto_ptr), so that an unrun batch still releases its entries.
+     */
+    class fire_batch {
+    public:
+        fire_batch(timing_wheel_hook* pHead, const boost::system::error_code& error) : m_pHead(pHead),
+                                                                                        m_error(error) {}
+        fire_batch(const fire_batch& other) : m_pHead(other.m_pHead), m_error(other.m_error) { other.m_pHead = NULL; }
+        ~fire_batch() { run(false); }
+
+        void operator()() { run(true); }
+
+    private:
+        fire_batch& operator=(const fire_batch&);
+        void run(bool invoke) {
+            while (m_pHead) {
+                timing_wheel_hook* p = m_pHead;
+                m_pHead = p->m_pNext, p->m_pNext = NULL;
+                boost::shared_ptr<void> pKeepAlive;
+                pKeepAlive.swap(p->m_pKeepAlive);
+                if (invoke) { p->on_expired(m_error); }
+            }
+        }
+
+        mutable timing_wheel_hook*  m_pHead;
+        boost::system::error_code   m_error;
+    };
+
+    /** The number of whole ticks between our start and t (rounded up or down) */
+    boost::uint64_t ticks_at(clock_type::time_point t, bool roundUp) const {
+        duration d = t - m_start;
+        if (d <= duration::zero()) { return 0; }
+        return (d.count() + (roundUp ? m_tickSize.count() - 1 : 0)) / m_tickSize.count();
+    }
+
+    void link(timing_wheel_hook* p, timing_wheel_hook*& pHead) {
+        p->m_pWheel = this, p->m_pPrev = NULL, p->m_pNext = pHead;
+        if (pHead) { pHead->m_pPrev = p; }
+        pHead = p;
+        m_size++;
+    }
+    void unlink(timing_wheel_hook* p) {
+        if (p->m_pPrev) {
+            p->m_pPrev->m_pNext = p->m_pNext;
+        } else {
+            m_slots[p->m_tick % m_slots.size()] = p->m_pNext;
+        }
+        if (p->m_pNext) { p->m_pNext->m_pPrev = p->m_pPrev; }
+        p->m_pWheel = NULL, p->m_pPrev = NULL, p->m_pNext = NULL;
+        m_size--;
+    }
+
+    /** Arms our timer for the next tick (m_mutex must be held) */
+    void arm() {
+        m_armed = true;
+        m_timer.expires_at(m_start + m_tickSize * static_cast<duration::rep>(m_tick + 1));
+        m_timer.async_wait(boost::bind(&timing_wheel::on_tick, this, boost::asio::placeholders::error));
+    }
+
+    /** Advances the wheel up to now, collecting everything which has expired into one batch */
+    void on_tick(const boost::system::error_code& error) {
+        timing_wheel_hook* pBatch = NULL;
+        {
+            auto_lock lock(m_mutex);
+            if (error) { m_armed = false; return; }
+            boost::uint64_t now = ticks_at(clock_type::now(), false);
+            while (m_tick < now && m_size > 0) {
+                timing_wheel_hook* p = m_slots[++m_tick % m_slots.size()];
+                while (p) {
+                    timing_wheel_hook* pNext = p->m_pNext;
+                    if (p->m_rounds == 0) {
+                        unlink(p);
+                        p->m_pNext = pBatch, pBatch = p;
+                    } else {
+                        p->m_rounds--;
+                    }
+                    p = pNext;
+                }
+            }
+            if (m_size > 0) { arm(); } else { m_armed = false; }
+        }
+        if (pBatch) {
+            task t(fire_batch(pBatch, boost::system::error_code()));
+            m_dispatch(t);
+        }
+    }
+
+private:
+    boost::asio::steady_timer           m_timer;
+    dispatcher                          m_dispatch;
+    std::vector<timing_wheel_hook*>     m_slots;
+    duration                            m_tickSize;
+    clock_type::time_point              m_start;
+    boost::uint64_t                     m_tick;
+    std::size_t                         m_size;
+    bool                                m_armed;
+    mutable boost::mutex                m_mutex;
+};
+
+}
+
+#endif /* H_BOOST_EXT_TIMING_WHEEL */
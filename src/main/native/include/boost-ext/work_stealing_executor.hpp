@@ -0,0 +1,145 @@
+/**
+ * A work-stealing executor - each worker owns a task deque, and idle workers steal from the others
+ */
+#ifndef H_BOOST_EXT_WORK_STEALING_EXECUTOR
+#define H_BOOST_EXT_WORK_STEALING_EXECUTOR
+
+#include <vector>
+#include "boost/noncopyable.hpp"
+#include "boost/function.hpp"
+#include "boost/atomic.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/condition_variable.hpp"
+
+#include "boost-ext/common.hpp"
+#include "boost-ext/auto_lock.hpp"
+#include "boost-ext/task.hpp"
+
+namespace boost_ext {
+
+class work_stealing_executor : public boost::noncopyable {
+public:
+    typedef boost_ext::task task_type;
+
+    work_stealing_executor(int numWorkers) : m_queues(), m_next(0), m_pending(0), m_sleepers(0), m_stopped(false) {
+        for (int i = 0; i < (numWorkers > 0 ? numWorkers : 1); i++) { m_queues.push_back(new worker_queue()); }
+    }
+    ~work_stealing_executor() {
+        stop();
+        for (std::size_t i = 0; i < m_queues.size(); i++) { delete m_queues[i]; }
+    }
+
+    /** The number of worker slots (one run() call per slot) */
+    std::size_t size() const { return m_queues.size(); }
+
+    /** Whether the calling thread is one of our workers */
+    bool is_current() const { return current() == this; }
+
+    /**
+     * Queues a task (taking its callable - task is left empty).  When called from one of our own workers, the task
+     * goes on that worker's deque (and will be run LIFO by it, unless stolen) - otherwise it is spread round-robin
+     * across the workers.
+     */
+    void post(task_type& task) {
+        std::size_t index = (current() == this) ? current_index()
+                                                : m_next.fetch_add(1, boost::memory_order_relaxed) % m_queues.size();
+        {
+            auto_lock lock(m_queues[index]->m_mutex);
+            m_queues[index]->m_tasks.push_back(task);
+        }
+        m_pending.fetch_add(1);
+        if (m_sleepers.load() > 0) {
+            auto_lock lock(m_sleepMutex);
+            m_wakeup.notify_one();
+        }
+    }
+
+    /** Runs the worker loop for the given slot - returns once stop() has been called */
+    void run(std::size_t index) { run_while(index, boost::function<bool()>()); }
+
+    /**
+     * Runs the worker loop for the given slot until keepGoing() returns false (checked between tasks, and whenever
+     * wake_all() is called) - so that another thread can stand in for a slot's worker for a while
+     */
+    void run_while(std::size_t index, const boost::function<bool()>& keepGoing) {
+        current() = this, current_index() = index;
+        task_type task;
+        while (!m_stopped.load(boost::memory_order_acquire) && (!keepGoing || keepGoing())) {
+            if (pop(index, task) || steal(index, task)) {
+                m_pending.fetch_sub(1, boost::memory_order_relaxed);
+                task();
+                task.reset();
+                continue;
+            }
+
+            /* Nothing to do - sleep until something is posted (m_pending and m_sleepers guard lost wakeups) */
+            auto_lock lock(m_sleepMutex);
+            m_sleepers.fetch_add(1);
+            while (m_pending.load() == 0 && !m_stopped.load() && (!keepGoing || keepGoing())) { m_wakeup.wait(lock); }
+            m_sleepers.fetch_sub(1);
+        }
+        current() = NULL;
+    }
+
+    /** The slot of the calling worker thread (only meaningful when is_current()) */
+    std::size_t current_slot() const { return current_index(); }
+
+    /** Wakes every sleeping worker, so that they check their run_while conditions */
+    void wake_all() {
+        auto_lock lock(m_sleepMutex);
+        m_wakeup.notify_all();
+    }
+
+    /** Stops all workers - queued tasks which have not started are dropped */
+    void stop() {
+        auto_lock lock(m_sleepMutex);
+        m_stopped.store(true);
+        m_wakeup.notify_all();
+    }
+
+private:
+    /** A worker-owned deque, padded so that neighbouring queues don't share a cache line */
+    struct worker_queue : boost::noncopyable {
+        boost::mutex    m_mutex;
+        task_queue      m_tasks;
+        char            m_pad[BOOST_EXT_CACHE_LINE_SIZE];
+    };
+
+    /** Pops from the back of our own deque */
+    bool pop(std::size_t index, task_type& task) {
+        worker_queue& q = *m_queues[index];
+        auto_lock lock(q.m_mutex);
+        if (q.m_tasks.empty()) { return false; }
+        q.m_tasks.pop_back(task);
+        return true;
+    }
+
+    /** Steals from the front of another worker's deque */
+    bool steal(std::size_t index, task_type& task) {
+        for (std::size_t i = 1; i < m_queues.size(); i++) {
+            worker_queue& q = *m_queues[(index + i) % m_queues.size()];
+            boost::unique_lock<boost::mutex> lock(q.m_mutex, boost::try_to_lock);
+            if (!lock.owns_lock() || q.m_tasks.empty()) { continue; }
+            q.m_tasks.pop_front(task);
+            return true;
+        }
+        return false;
+    }
+
+    /** The executor (and slot) that the calling thread is a worker for, if any */
+    static work_stealing_executor*& current() { static THREAD_LOCAL work_stealing_executor* p = NULL; return p; }
+    static std::size_t& current_index() { static THREAD_LOCAL std::size_t i = 0; return i; }
+
+private:
+    std::vector<worker_queue*>  m_queues;
+    boost::atomic<std::size_t>  m_next;
+    boost::atomic<long>         m_pending;
+    boost::atomic<int>          m_sleepers;
+    boost::atomic<bool>         m_stopped;
+    boost::mutex                m_sleepMutex;
+    boost::condition_variable   m_wakeup;
+};
+
+}
+
+#endif /* H_BOOST_EXT_WORK_STEALING_EXECUTOR */
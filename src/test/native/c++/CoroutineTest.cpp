@@ -0,0 +1,91 @@
+/*
+ * Unit test for coroutines on a thread_pool (only built when the compiler supports C++20 coroutines)
+ */
+
+#include "boost-ext/test/unit_test.hpp"
+#include "boost-ext/thread_pool.hpp"
+
+#if defined(BOOST_EXT_HAS_COROUTINES)
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+/* Create setup and teardown functions */
+struct CoroutineFixture {
+    CoroutineFixture() { }
+    ~CoroutineFixture() { }
+};
+
+BOOST_FIXTURE_TEST_SUITE(CoroutineTest, CoroutineFixture);
+
+namespace CoroutineTestFx {
+    using boost_ext::co_task;
+    using boost_ext::thread_pool;
+
+    static int square(int i) { return i * i; }
+
+    /* Awaits async work, and then another coroutine */
+    static co_task<int> squareOnPool(thread_pool& pool, int i) {
+        co_return co_await pool.async(boost::bind(square, i));
+    }
+    static co_task<int> sumOfSquares(thread_pool& pool, int n) {
+        int sum = 0;
+        for (int i = 0; i < n; i++) { sum += co_await squareOnPool(pool, i); }
+        co_return sum;
+    }
+
+    /* Hops between pools */
+    static co_task<bool> hop(thread_pool& from, thread_pool& to, std::thread::id* pFirst, std::thread::id* pSecond) {
+        co_await from.schedule();
+        *pFirst = std::this_thread::get_id();
+        co_await to.schedule();
+        *pSecond = std::this_thread::get_id();
+        co_return *pFirst != *pSecond;
+    }
+
+    static co_task<std::chrono::steady_clock::duration> sleeper(thread_pool& pool, std::chrono::milliseconds d) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        co_await pool.sleep_for(d);
+        co_return std::chrono::steady_clock::now() - start;
+    }
+
+    static co_task<void> failing(thread_pool& pool) {
+        co_await pool.schedule();
+        BOOST_THROW_EXCEPTION(boost_ext::exception("failed"));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(testAwaitFutures) {
+    using namespace CoroutineTestFx;
+    thread_pool pool("coPool", 2);
+    BOOST_CHECK_EQUAL(boost_ext::co_spawn(pool, sumOfSquares(pool, 10)).get(), 285);
+}
+
+BOOST_AUTO_TEST_CASE(testSchedule) {
+    using namespace CoroutineTestFx;
+    thread_pool first("coFirst", 1), second("coSecond", 1);
+    std::thread::id id1, id2;
+    BOOST_CHECK(boost_ext::co_spawn(first, hop(first, second, &id1, &id2)).get());
+    BOOST_CHECK(id1 != std::this_thread::get_id());
+    BOOST_CHECK(id2 != std::this_thread::get_id());
+}
+
+BOOST_AUTO_TEST_CASE(testSleepFor) {
+    using namespace CoroutineTestFx;
+    thread_pool pool("coSleepPool", 2);
+    boost_ext::light_future<std::chrono::steady_clock::duration> slept =
+        boost_ext::co_spawn(pool, sleeper(pool, std::chrono::milliseconds(30)));
+    BOOST_CHECK(slept.get() >= std::chrono::milliseconds(20));
+}
+
+BOOST_AUTO_TEST_CASE(testExceptions) {
+    using namespace CoroutineTestFx;
+    thread_pool pool("coFailPool", 1);
+    BOOST_CHECK_THROW(boost_ext::co_spawn(pool, failing(pool)).get(), boost_ext::exception);
+}
+
+/* Make sure you end the test suite last thing in the file. */
+BOOST_AUTO_TEST_SUITE_END ();
+
+#endif /* BOOST_EXT_HAS_COROUTINES */
@@ -0,0 +1,126 @@
+/*
+ * Benchmarks for logging - these are registered in the "benchmark" group, so they can be skipped by setting
+ * BOOST_TEST_EXCLUDE_GROUPS=benchmark
+ */
+
+#include <vector>
+#include "boost-ext/test/unit_test.hpp"
+#include "boost/log/sinks/sync_frontend.hpp"
+#include "boost-ext/log.hpp"
+#include "boost-ext/stopwatch.hpp"
+
+using namespace std;
+using namespace boost;
+using namespace boost_ext;
+
+/* Create setup and teardown functions */
+struct LogBenchmarkFixture {
+    LogBenchmarkFixture() { }
+    ~LogBenchmarkFixture() { }
+};
+
+BOOST_FIXTURE_TEST_SUITE(LogBenchmarkTest, LogBenchmarkFixture);
+
+namespace LogBenchmarkFx {
+    static const int NUM_RECORDS    = 1000;
+    static const int NUM_PASSES     = 200;
+
+    /* A backend which keeps every record it is given */
+    class capture_backend : public boost::log::sinks::basic_sink_backend<boost::log::sinks::synchronized_feeding> {
+    public:
+        void consume(const boost::log::record_view& rec) { m_records.push_back(rec); }
+        vector<boost::log::record_view> m_records;
+    };
+
+    /* Captures NUM_RECORDS ordinary records */
+    static vector<boost::log::record_view> capture() {
+        typedef boost::log::sinks::synchronous_sink<capture_backend> capture_sink;
+        boost::shared_ptr<capture_backend> pBackend = boost::make_shared<capture_backend>();
+        boost::shared_ptr<capture_sink> pSink = boost::make_shared<capture_sink>(pBackend);
+        boost::log::core::get()->add_sink(pSink);
+
+        /* The Logger adds the standard attributes (TimeStamp and ThreadID) */
+        boost_ext::log::Logger::get();
+        for (int i = 0; i < NUM_RECORDS; i++) { BOOST_LOG_TRIVIAL(error) << "benchmark record " << i; }
+        boost::log::core::get()->remove_sink(pSink);
+        return pBackend->m_records;
+    }
+
+    /* Formats every record NUM_PASSES times into a reused buffer, and returns the time per record */
+    static chrono::nanoseconds format(const boost::log::formatter& fx, const vector<boost::log::record_view>& records,
+                                      size_t& bytes) {
+        string s;
+        boost::log::formatting_ostream strm(s);
+        stopwatch sw;
+        sw.reset().start();
+        for (int pass = 0; pass < NUM_PASSES; pass++) {
+            for (size_t i = 0; i < records.size(); i++) {
+                fx(records[i], strm);
+                strm.flush();
+                bytes += s.size();
+                s.clear();
+            }
+        }
+        return sw.stop().elapsed() / (NUM_PASSES * records.size());
+    }
+}
+
+BOOST_AUTO_GRP_TEST_CASE("benchmark", testStdLogFormatter) {
+    vector<boost::log::record_view> records = LogBenchmarkFx::capture();
+    size_t expressionBytes = 0, fastBytes = 0;
+    chrono::nanoseconds expression = LogBenchmarkFx::format(STD_LOG_EXPRESSION, records, expressionBytes);
+    chrono::nanoseconds fast = LogBenchmarkFx::format(STD_LOG_FORMATTER, records, fastBytes);
+    BOOST_MESSAGE("Formatting " << records.size() << " records: STD_LOG_EXPRESSION " << expression.count()
+                  << "ns per record, std_log_formatter " << fast.count() << "ns per record");
+    BOOST_CHECK_EQUAL(fastBytes, expressionBytes);
+}
+
+BOOST_AUTO_GRP_TEST_CASE("benchmark", testFlightLog) {
+    using namespace boost_ext::log;
+    int level = Logger::get().level();
+    SET_LOG_LEVEL(warning);
+    ENABLE_FLIGHT_LOGGING("LogBenchmarkTest.flight");
+
+    /* Statements below the level, which only the flight recorder takes */
+    stopwatch sw;
+    sw.reset().start();
+    for (int i = 0; i < LogBenchmarkFx::NUM_RECORDS * LogBenchmarkFx::NUM_PASSES; i++) {
+        LOG(debug) << "benchmark record " << i;
+    }
+    chrono::nanoseconds recorded = sw.stop().elapsed() / (LogBenchmarkFx::NUM_RECORDS * LogBenchmarkFx::NUM_PASSES);
+    DISABLE_FLIGHT_LOGGING();
+    BOOST_MESSAGE("Flight recording " << LogBenchmarkFx::NUM_RECORDS * LogBenchmarkFx::NUM_PASSES << " lines: "
+                  << recorded.count() << "ns per line");
+    BOOST_CHECK_EQUAL(flight_recorder::get().dropped(), 0u);
+
+    SET_LOG_LEVEL_VAL(level);
+    remove("LogBenchmarkTest.flight");
+}
+
+BOOST_AUTO_GRP_TEST_CASE("benchmark", testFastLog) {
+    using namespace boost_ext::log;
+    ENABLE_FAST_BINARY_LOGGING("LogBenchmarkTest.fast");
+    fast_logger& logger = fast_logger::get();
+    boost::uint64_t written = logger.written(), dropped = logger.dropped();
+
+    /* The caller's cost only - each pass fits in the thread's buffer, and the writer catches up between passes */
+    chrono::nanoseconds elapsed(0);
+    stopwatch sw;
+    for (int pass = 0; pass < LogBenchmarkFx::NUM_PASSES; pass++) {
+        sw.reset().start();
+        for (int i = 0; i < LogBenchmarkFx::NUM_RECORDS; i++) { LOG_FAST(error, "benchmark record {} of {}", i, pass); }
+        elapsed += sw.stop().elapsed();
+        logger.flush();
+    }
+    chrono::nanoseconds logged = elapsed / (LogBenchmarkFx::NUM_RECORDS * LogBenchmarkFx::NUM_PASSES);
+    DISABLE_FAST_BINARY_LOGGING();
+    BOOST_MESSAGE("Fast logging " << LogBenchmarkFx::NUM_RECORDS * LogBenchmarkFx::NUM_PASSES << " lines: "
+                  << logged.count() << "ns per line");
+    BOOST_CHECK_EQUAL(logger.written() - written,
+                      (boost::uint64_t) (LogBenchmarkFx::NUM_RECORDS * LogBenchmarkFx::NUM_PASSES));
+    BOOST_CHECK_EQUAL(logger.dropped(), dropped);
+
+    remove("LogBenchmarkTest.fast");
+}
+
+BOOST_AUTO_TEST_SUITE_END ();
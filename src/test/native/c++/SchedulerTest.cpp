@@ -51,4 +51,129 @@ BOOST_AUTO_TEST_CASE(testScheduler) {
     BOOST_CHECK_EQUAL(ex->counter, 1);
 }
 
+/* a scheduled_task which waits on the pool's timing wheel */
+class WheelExecutor : public scheduled_task {
+public:
+    WheelExecutor(boost::atomic<int>* pCounter) : scheduled_task(wheel_timer), pCounter(pCounter) { }
+
+    void operator()() {
+        (*pCounter)++;
+    }
+    void on_error(const boost::system::error_code& error) {
+        LOG(error) << "got error code: " << error;
+    }
+
+    boost::atomic<int>* pCounter;
+};
+
+/* ensure that lots of wheel timers all fire, and not before their deadline */
+BOOST_AUTO_TEST_CASE(testWheelScheduler) {
+    boost::atomic<int> counter(0);
+    for (int i = 0; i < 10000; i++) {
+        MyThreadPool::inst().schedule(boost::make_shared<WheelExecutor>(&counter),
+                                      boost::chrono::milliseconds(200 + (i % 300)));
+    }
+    BOOST_CHECK_EQUAL(MyThreadPool::inst().wheel().size(), 10000);
+    this_thread::sleep(posix_time::milliseconds(100));
+    BOOST_CHECK_EQUAL(counter.load(), 0);
+    this_thread::sleep(posix_time::seconds(1));
+    BOOST_CHECK_EQUAL(counter.load(), 10000);
+    BOOST_CHECK_EQUAL(MyThreadPool::inst().wheel().size(), 0);
+}
+
+/* ensure that a wheel timer can be cancelled (and is told so) */
+BOOST_AUTO_TEST_CASE(testWheelCancel) {
+    boost::atomic<int> counter(0);
+    boost::shared_ptr<WheelExecutor> ex = boost::make_shared<WheelExecutor>(&counter);
+    MyThreadPool::inst().schedule(ex, boost::chrono::milliseconds(200));
+    BOOST_CHECK(MyThreadPool::inst().wheel().cancel(ex.get()));
+    BOOST_CHECK(!MyThreadPool::inst().wheel().cancel(ex.get()));
+    this_thread::sleep(posix_time::milliseconds(400));
+    BOOST_CHECK_EQUAL(counter.load(), 0);
+}
+
+/* holds a worker until open is set */
+static void waitUntilOpen(boost::atomic<bool>* pOpen) {
+    while (!pOpen->load()) { this_thread::sleep(posix_time::milliseconds(1)); }
+}
+
+/* ensure that a precise timer which has expired, but hasn't run yet, doesn't run once it has been cancelled */
+BOOST_AUTO_TEST_CASE(testPreciseCancel) {
+    thread_pool pool("cancelPool", 1);
+    boost::atomic<bool> open(false);
+    pool.execute(boost::bind(waitUntilOpen, &open));
+    boost::shared_ptr<SchedulerExecutor> ex(new SchedulerExecutor());
+    pool.schedule(ex, boost::chrono::milliseconds(1));
+    this_thread::sleep(posix_time::milliseconds(50));
+    ex->cancel();
+    open.store(true);
+    this_thread::sleep(posix_time::milliseconds(100));
+    BOOST_CHECK_EQUAL(ex->counter, 0);
+}
+
+/* a recurring function which takes a while to run */
+static void slowIncrement(boost::atomic<int>* pCounter, int sleepMs) {
+    (*pCounter)++;
+    this_thread::sleep(posix_time::milliseconds(sleepMs));
+}
+
+/* ensure that a fixed-rate task keeps its rate (even though each run takes a while) and can be cancelled */
+BOOST_AUTO_TEST_CASE(testFixedRate) {
+    boost::atomic<int> counter(0);
+    boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+    recurring_handle h = MyThreadPool::inst().schedule_at_fixed_rate(boost::bind(slowIncrement, &counter, 30),
+                                                                     boost::chrono::milliseconds(0),
+                                                                     boost::chrono::milliseconds(50));
+    this_thread::sleep(posix_time::milliseconds(520));
+    h.cancel();
+    int runs = counter.load();
+
+    /* At most one run per period of the time that actually passed, and most of them (even on a loaded machine) */
+    boost::int64_t elapsedMs = boost::chrono::duration_cast<boost::chrono::milliseconds>(
+        boost::chrono::steady_clock::now() - start).count();
+    BOOST_CHECK_GE(runs, 5);
+    BOOST_CHECK_LE(runs, elapsedMs / 50 + 1);
+    BOOST_CHECK(h.cancelled());
+    this_thread::sleep(posix_time::milliseconds(200));
+    BOOST_CHECK_EQUAL(counter.load(), runs);
+}
+
+/* ensure that a fixed-rate task coalesces ticks which are missed because a run overran */
+BOOST_AUTO_TEST_CASE(testFixedRateCoalesce) {
+    boost::atomic<int> counter(0);
+    recurring_handle h = MyThreadPool::inst().schedule_at_fixed_rate(boost::bind(slowIncrement, &counter, 120),
+                                                                     boost::chrono::milliseconds(0),
+                                                                     boost::chrono::milliseconds(50));
+    this_thread::sleep(posix_time::milliseconds(500));
+    h.cancel();
+    BOOST_CHECK_LE(counter.load(), 5);
+    BOOST_CHECK_GT(h.missed(), 0);
+}
+
+/* ensure that a fixed-delay task waits for the delay after each run */
+BOOST_AUTO_TEST_CASE(testFixedDelay) {
+    boost::atomic<int> counter(0);
+    recurring_handle h = MyThreadPool::inst().schedule_with_fixed_delay(boost::bind(slowIncrement, &counter, 50),
+                                                                        boost::chrono::milliseconds(0),
+                                                                        boost::chrono::milliseconds(50));
+    this_thread::sleep(posix_time::milliseconds(520));
+    h.cancel();
+    BOOST_CHECK_GE(counter.load(), 4);
+    BOOST_CHECK_LE(counter.load(), 6);
+}
+
+/* ensure that a slow recurring function runs on the workers, and doesn't hold up the timer thread */
+BOOST_AUTO_TEST_CASE(testSlowRecurringOffTimerThread) {
+    thread_pool pool("stealing", 2, thread_pool::work_stealing);
+    boost::atomic<int> counter(0);
+    recurring_handle h = pool.schedule_with_fixed_delay(boost::bind(slowIncrement, &counter, 400),
+                                                        boost::chrono::milliseconds(0),
+                                                        boost::chrono::milliseconds(50));
+    boost::shared_ptr<SchedulerExecutor> ex(new SchedulerExecutor());
+    pool.schedule(ex, boost::chrono::milliseconds(50));
+    this_thread::sleep(posix_time::milliseconds(200));
+    BOOST_CHECK_EQUAL(ex->counter, 1);
+    h.cancel();
+}
+
 BOOST_AUTO_TEST_SUITE_END ();
@@ -0,0 +1,124 @@
+/*
+ * Benchmarks for thread_pool - these are registered in the "benchmark" group, so they can be skipped by setting
+ * BOOST_TEST_EXCLUDE_GROUPS=benchmark
+ */
+
+#include <cmath>
+#include "boost-ext/test/unit_test.hpp"
+#include "boost-ext/thread_pool.hpp"
+#include "boost-ext/parallel.hpp"
+#include "boost-ext/stopwatch.hpp"
+
+using namespace std;
+using namespace boost;
+using namespace boost_ext;
+
+/* Create setup and teardown functions */
+struct ThreadPoolBenchmarkFixture {
+    ThreadPoolBenchmarkFixture() { }
+    ~ThreadPoolBenchmarkFixture() { }
+};
+
+BOOST_FIXTURE_TEST_SUITE(ThreadPoolBenchmarkTest, ThreadPoolBenchmarkFixture);
+
+namespace ThreadPoolBenchmarkFx {
+    static const int NUM_ROOTS  = 64;
+    static const int NUM_LEAVES = 2000;
+
+    static void leaf(atomic<int>* pDone) { pDone->fetch_add(1, memory_order_relaxed); }
+
+    /* Each root fans out into NUM_LEAVES tiny tasks, posted from inside the pool */
+    static void root(thread_pool* pPool, atomic<int>* pDone) {
+        boost::function<void()> fx = boost::bind(leaf, pDone);
+        for (int i = 0; i < NUM_LEAVES; i++) { pPool->post(fx); }
+    }
+
+    /* Runs the fan-out on the given pool, and returns the elapsed time */
+    static chrono::nanoseconds fanOut(thread_pool& pool) {
+        atomic<int> done(0);
+        stopwatch sw;
+        sw.reset().start();
+        boost::function<void()> fx = boost::bind(root, &pool, &done);
+        for (int i = 0; i < NUM_ROOTS; i++) { pool.post(fx); }
+        while (done.load() < NUM_ROOTS * NUM_LEAVES) { this_thread::yield(); }
+        return sw.stop().elapsed();
+    }
+
+    static const int NUM_SUBMITTERS         = 4;
+    static const int TASKS_PER_SUBMITTER    = 50000;
+
+    static void count(atomic<int>* pDone) { pDone->fetch_add(1, memory_order_relaxed); }
+
+    /* Executes TASKS_PER_SUBMITTER tiny tasks from outside of the pool */
+    static void submit(thread_pool* pPool, atomic<int>* pDone) {
+        for (int i = 0; i < TASKS_PER_SUBMITTER; i++) { pPool->execute(boost::bind(count, pDone)); }
+    }
+
+    /* Has NUM_SUBMITTERS threads submit to the pool at once, and returns the time until every task has run */
+    static chrono::nanoseconds externalSubmit(thread_pool& pool) {
+        atomic<int> done(0);
+        stopwatch sw;
+        sw.reset().start();
+        thread_group submitters;
+        for (int i = 0; i < NUM_SUBMITTERS; i++) { submitters.create_thread(boost::bind(submit, &pool, &done)); }
+        submitters.join_all();
+        while (done.load() < NUM_SUBMITTERS * TASKS_PER_SUBMITTER) { this_thread::yield(); }
+        return sw.stop().elapsed();
+    }
+
+    static double work(int i) { return std::sqrt((double) i) * std::sin((double) i); }
+    static double add(double a, double b) { return a + b; }
+}
+
+BOOST_AUTO_GRP_TEST_CASE("benchmark", testFanOutSharedVsStealing) {
+    int numThreads = std::max(2, (int) thread::hardware_concurrency());
+    chrono::nanoseconds shared, stealing;
+    {
+        thread_pool pool("shared", numThreads, thread_pool::shared_queue);
+        shared = ThreadPoolBenchmarkFx::fanOut(pool);
+    }
+    {
+        thread_pool pool("stealing", numThreads, thread_pool::work_stealing);
+        stealing = ThreadPoolBenchmarkFx::fanOut(pool);
+    }
+    BOOST_MESSAGE("Fan-out of " << ThreadPoolBenchmarkFx::NUM_ROOTS * ThreadPoolBenchmarkFx::NUM_LEAVES
+                  << " tasks on " << numThreads << " threads: shared_queue "
+                  << chrono::duration_cast<chrono::milliseconds>(shared).count() << "ms, work_stealing "
+                  << chrono::duration_cast<chrono::milliseconds>(stealing).count() << "ms");
+}
+
+BOOST_AUTO_GRP_TEST_CASE("benchmark", testExternalSubmission) {
+    int numThreads = std::max(2, (int) thread::hardware_concurrency());
+    chrono::nanoseconds shared, stealing;
+    {
+        thread_pool pool("shared", numThreads, thread_pool::shared_queue);
+        shared = ThreadPoolBenchmarkFx::externalSubmit(pool);
+    }
+    {
+        thread_pool pool("stealing", numThreads, thread_pool::work_stealing);
+        stealing = ThreadPoolBenchmarkFx::externalSubmit(pool);
+    }
+    BOOST_MESSAGE(ThreadPoolBenchmarkFx::NUM_SUBMITTERS * ThreadPoolBenchmarkFx::TASKS_PER_SUBMITTER
+                  << " tasks from " << ThreadPoolBenchmarkFx::NUM_SUBMITTERS << " outside threads on " << numThreads
+                  << " threads: shared_queue " << chrono::duration_cast<chrono::milliseconds>(shared).count()
+                  << "ms, work_stealing " << chrono::duration_cast<chrono::milliseconds>(stealing).count() << "ms");
+}
+
+BOOST_AUTO_GRP_TEST_CASE("benchmark", testParallelScaling) {
+    /* The calling thread takes part too, so a pool of n - 1 threads runs on n cores */
+    int numCores = std::max(2, (int) thread::hardware_concurrency());
+    double expected = 0;
+    for (int cores = 1; cores <= numCores; cores++) {
+        thread_pool pool("parallel", cores - 1);
+        stopwatch sw;
+        sw.reset().start();
+        double sum = parallel_transform_reduce(pool, 0, 20000000, 0.0, ThreadPoolBenchmarkFx::add,
+                                               ThreadPoolBenchmarkFx::work, 4096);
+        BOOST_MESSAGE("parallel_transform_reduce on " << cores << " core(s): "
+                      << chrono::duration_cast<chrono::milliseconds>(sw.stop().elapsed()).count() << "ms");
+        if (cores == 1) { expected = sum; }
+        BOOST_CHECK_CLOSE(sum, expected, 0.0001);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END ();
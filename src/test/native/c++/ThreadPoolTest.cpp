@@ -0,0 +1,941 @@
+/*
+ * Unit test for thread_pool
+ */
+
+#include "boost-ext/test/unit_test.hpp"
+#include "boost-ext/thread_pool.hpp"
+#include "boost-ext/parallel.hpp"
+#include "boost-ext/batcher.hpp"
+
+using namespace std;
+using namespace boost;
+using namespace boost_ext;
+
+/*
+ * Count every call to the global operator new, so that we can check the allocation-free paths.  Only the counting is
+ * ours - the memory still comes from malloc, so the rest of the test binary is unaffected.  The deletes are kept out
+ * of line, so that the compiler doesn't see free() inlined against operator new.
+ */
+#if __cplusplus < 201103L
+    #define THREAD_POOL_TEST_THROWS_BAD_ALLOC  throw(std::bad_alloc)
+#else
+    #define THREAD_POOL_TEST_THROWS_BAD_ALLOC
+#endif
+static boost::atomic<long> g_numAllocations(0);
+static void* countedAllocate(std::size_t size) {
+    g_numAllocations.fetch_add(1, boost::memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+void* operator new(std::size_t size) THREAD_POOL_TEST_THROWS_BAD_ALLOC {
+    void* p = countedAllocate(size);
+    if (!p) { throw std::bad_alloc(); }
+    return p;
+}
+void* operator new[](std::size_t size) THREAD_POOL_TEST_THROWS_BAD_ALLOC {
+    void* p = countedAllocate(size);
+    if (!p) { throw std::bad_alloc(); }
+    return p;
+}
+void* operator new(std::size_t size, const std::nothrow_t&) BOOST_NOEXCEPT_OR_NOTHROW { return countedAllocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) BOOST_NOEXCEPT_OR_NOTHROW { return countedAllocate(size); }
+BOOST_NOINLINE void operator delete(void* p) BOOST_NOEXCEPT_OR_NOTHROW { free(p); }
+BOOST_NOINLINE void operator delete[](void* p) BOOST_NOEXCEPT_OR_NOTHROW { free(p); }
+
+/* Create setup and teardown functions */
+struct ThreadPoolFixture {
+    ThreadPoolFixture() { }
+    ~ThreadPoolFixture() { }
+};
+
+BOOST_FIXTURE_TEST_SUITE(ThreadPoolTest, ThreadPoolFixture);
+BOOST_EXT_STEALING_THREAD_POOL_WITH_SIZE(MyStealingPool, 4);
+
+namespace ThreadPoolTestFx {
+    static int square(int i) { return i * i; }
+
+    /* A tiny task which just counts that it ran */
+    struct counting_task {
+        counting_task(atomic<int>* pCounter) : m_pCounter(pCounter) {}
+        void operator()() { m_pCounter->fetch_add(1, memory_order_relaxed); }
+        atomic<int>* m_pCounter;
+    };
+
+    /* Executes n counting tasks on the pool and waits for them all to run - returns the number of allocations */
+    static long executeAndWait(thread_pool& pool, int n) {
+        atomic<int> counter(0);
+        long before = g_numAllocations.load();
+        for (int i = 0; i < n; i++) { pool.execute(counting_task(&counter)); }
+        while (counter.load() < n) { this_thread::yield(); }
+        return g_numAllocations.load() - before;
+    }
+
+    /* Runs a task for each of futures with async, and waits for their results - returns the number of allocations */
+    static long asyncAndWait(thread_pool& pool, vector<light_future<int> >& futures) {
+        long before = g_numAllocations.load();
+        for (size_t i = 0; i < futures.size(); i++) { futures[i] = pool.async(boost::bind(square, (int) i)); }
+        for (size_t i = 0; i < futures.size(); i++) {
+            if (futures[i].get() != (int) (i * i)) { return -1; }
+        }
+        return g_numAllocations.load() - before;
+    }
+
+    /* A value whose copies throw, if it was made to */
+    struct copy_throwing {
+        explicit copy_throwing(bool throws) : m_throws(throws) {}
+        copy_throwing(const copy_throwing& other) : m_throws(other.m_throws) {
+            if (m_throws) { BOOST_THROW_EXCEPTION(boost_ext::exception("copy_throwing")); }
+        }
+        bool m_throws;
+    };
+
+    static void setSquare(vector<int>* pValues, int i) { (*pValues)[i] = i * i; }
+    static long toLong(int i) { return i; }
+    static long add(long a, long b) { return a + b; }
+    static void throwAt(int fail, int i) { if (i == fail) { throw std::runtime_error("failed"); } }
+
+    /* A scheduled handler which counts how often it has been called */
+    struct counting_handler {
+        counting_handler(atomic<int>* pCounter = NULL) : m_pCounter(pCounter) {}
+        void operator()(const boost::system::error_code& error) { if (!error) { (*m_pCounter)++; } }
+        atomic<int>* m_pCounter;
+    };
+
+    /* Blocks a worker until it is opened */
+    struct gate_task {
+        gate_task(atomic<bool>* pOpen, atomic<int>* pStarted = NULL) : m_pOpen(pOpen), m_pStarted(pStarted) {}
+        void operator()() {
+            if (m_pStarted) { m_pStarted->fetch_add(1); }
+            while (!m_pOpen->load()) { this_thread::yield(); }
+        }
+        atomic<bool>*   m_pOpen;
+        atomic<int>*    m_pStarted;
+    };
+
+    /* Waits for n gate_tasks to have started (so that they hold their workers) */
+    static void waitForGates(const atomic<int>& started, int n) {
+        while (started.load() < n) { this_thread::yield(); }
+    }
+
+    /* Records the order in which tasks ran */
+    struct ordered_task {
+        ordered_task(vector<int>* pOrder, mutex* pMutex, int id) : m_pOrder(pOrder), m_pMutex(pMutex), m_id(id) {}
+        void operator()() { auto_lock lock(*m_pMutex); m_pOrder->push_back(m_id); }
+        vector<int>*    m_pOrder;
+        mutex*          m_pMutex;
+        int             m_id;
+    };
+
+    /* Continuations for the light_future tests */
+    static int addOne(light_future<int> f) { return f.get() + 1; }
+    static int sumAll(light_future<vector<light_future<int> > > f) {
+        vector<light_future<int> > futures = f.get();
+        int sum = 0;
+        for (size_t i = 0; i < futures.size(); i++) { sum += futures[i].get(); }
+        return sum;
+    }
+    static int throwing() { BOOST_THROW_EXCEPTION(boost_ext::exception("failed")); }
+
+    /* Waits for a future, and then records that it woke */
+    struct waiting_task {
+        waiting_task(const light_future<int>& future, atomic<bool>* pWoke) : m_future(future), m_pWoke(pWoke) {}
+        void operator()() { m_future.wait(); m_pWoke->store(true); }
+        light_future<int>   m_future;
+        atomic<bool>*       m_pWoke;
+    };
+
+    /* Checks that strand tasks never overlap, and records their order */
+    struct serial_task {
+        serial_task(atomic<int>* pActive, atomic<int>* pOverlaps, vector<int>* pOrder, int id,
+                    serial_executor* pStrand = NULL) : m_pActive(pActive), m_pOverlaps(pOverlaps), m_pOrder(pOrder),
+                                                       m_id(id), m_pStrand(pStrand) {}
+        void operator()() {
+            if (m_pActive->fetch_add(1) != 0) { m_pOverlaps->fetch_add(1); }
+            if (m_pStrand && !m_pStrand->running_in_this_thread()) { m_pOverlaps->fetch_add(1); }
+            m_pOrder->push_back(m_id);
+            m_pActive->fetch_sub(1);
+        }
+        atomic<int>*        m_pActive;
+        atomic<int>*        m_pOverlaps;
+        vector<int>*        m_pOrder;
+        int                 m_id;
+        serial_executor*    m_pStrand;
+    };
+
+    /* Counts timers which were aborted */
+    struct aborted_handler {
+        aborted_handler(atomic<int>* pAborted = NULL) : m_pAborted(pAborted) {}
+        void operator()(const boost::system::error_code& error) {
+            if (error == boost::asio::error::operation_aborted) { (*m_pAborted)++; }
+        }
+        atomic<int>* m_pAborted;
+    };
+
+    /* Waits in a blocking region until its gate opens */
+    struct blocked_task {
+        explicit blocked_task(atomic<bool>* pOpen) : m_pOpen(pOpen) {}
+        void operator()() {
+            blocking_region region;
+            while (!m_pOpen->load()) { this_thread::sleep_for(chrono::milliseconds(1)); }
+        }
+        atomic<bool>* m_pOpen;
+    };
+
+    static int quickRegion(int i) { blocking_region region; return i; }
+
+    /* What a stand-in runs for a worker - nothing, until the worker's region ends */
+    static void idleLoop(const boost_ext::detail::blocking_compensator::predicate& covering) {
+        while (covering()) { this_thread::sleep_for(chrono::milliseconds(1)); }
+    }
+    static boost_ext::detail::blocking_compensator::loop idleLoopFor() { return &idleLoop; }
+
+    /* A worker of a compensator, which makes one blocking region and exits */
+    static void attachedWorker(boost_ext::detail::blocking_compensator* pCompensator, atomic<bool>* pOpen) {
+        pCompensator->attach();
+        blocked_task blocked(pOpen);
+        blocked();
+    }
+
+    /* Keeps the stall reports from a watchdog */
+    struct stall_recorder {
+        stall_recorder(stall_report* pLast, atomic<int>* pCount) : m_pLast(pLast), m_pCount(pCount) {}
+        void operator()(const stall_report& report) {
+            *m_pLast = report;
+            (*m_pCount)++;
+        }
+        stall_report*   m_pLast;
+        atomic<int>*    m_pCount;
+    };
+
+    /* Turns a pool's watchdog off from its own stall handler */
+    struct watchdog_disabler {
+        watchdog_disabler(thread_pool* pPool, atomic<int>* pCount) : m_pPool(pPool), m_pCount(pCount) {}
+        void operator()(const stall_report&) {
+            m_pPool->disable_watchdog();
+            (*m_pCount)++;
+        }
+        thread_pool*    m_pPool;
+        atomic<int>*    m_pCount;
+    };
+
+    /* Adds up the batches from a batcher, checking that they never overlap */
+    struct batch_sink {
+        batch_sink(atomic<long>* pSum, atomic<int>* pItems, atomic<int>* pOverlaps) : m_pSum(pSum), m_pItems(pItems),
+                                                                                     m_pOverlaps(pOverlaps),
+                                                                                     m_pActive(new atomic<int>(0)) {}
+        void operator()(vector<int>& batch) {
+            if ((*m_pActive)++ != 0) { (*m_pOverlaps)++; }
+            for (size_t i = 0; i < batch.size(); i++) { *m_pSum += batch[i]; }
+            *m_pItems += (int) batch.size();
+            (*m_pActive)--;
+        }
+        atomic<long>*                   m_pSum;
+        atomic<int>*                    m_pItems;
+        atomic<int>*                    m_pOverlaps;
+        boost::shared_ptr<atomic<int> > m_pActive;
+    };
+
+    /* Adds 1..n to a batcher */
+    static void addAll(batcher<int>* pBatcher, int n) {
+        for (int i = 1; i <= n; i++) { pBatcher->add(i); }
+    }
+
+    /* Executes n counting tasks on a pool from one of its workers - returns how many had run by the time it was done */
+    static int executeFromWorker(thread_pool* pPool, atomic<int>* pCounter, int n) {
+        for (int i = 0; i < n; i++) { pPool->execute(counting_task(pCounter)); }
+        return pCounter->load();
+    }
+
+    /* Opens a gate_task after a delay */
+    static void openAfter(atomic<bool>* pOpen, int ms) {
+        this_thread::sleep_for(chrono::milliseconds(ms));
+        pOpen->store(true);
+    }
+
+    /* Waits (for up to two seconds) until the pool has the given number of live threads */
+    static bool waitForLive(thread_pool& pool, int live) {
+        for (int i = 0; i < 2000 && pool.live_size() != live; i++) { this_thread::sleep_for(chrono::milliseconds(1)); }
+        return pool.live_size() == live;
+    }
+
+    /* Returns the CPU that a task ran on */
+    static int currentCpu() { return cpu_topology::current_cpu(); }
+
+    /* Posts children from inside a worker - these go on the worker's own deque */
+    static int fanOut(int n) {
+        vector<shared_future<int> > futures;
+        for (int i = 0; i < n; i++) {
+            boost::function<int()> fx = boost::bind(square, i);
+            futures.push_back(MyStealingPool::inst().post(fx).share());
+        }
+        int sum = 0;
+        for (size_t i = 0; i < futures.size(); i++) { sum += futures[i].get(); }
+        return sum;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(testStealingPost) {
+    BOOST_CHECK_EQUAL(MyStealingPool::inst().policy(), thread_pool::work_stealing);
+
+    vector<shared_future<int> > futures;
+    for (int i = 0; i < 100; i++) {
+        boost::function<int()> fx = boost::bind(ThreadPoolTestFx::square, i);
+        futures.push_back(MyStealingPool::inst().post(fx).share());
+    }
+    for (int i = 0; i < 100; i++) { BOOST_CHECK_EQUAL(futures[i].get(), i * i); }
+}
+
+BOOST_AUTO_TEST_CASE(testStealingFanOut) {
+    /* Fewer roots than workers, so the idle workers have to steal the children to make progress */
+    boost::function<int()> fx = boost::bind(ThreadPoolTestFx::fanOut, 10);
+    future<int> f1 = MyStealingPool::inst().post(fx);
+    future<int> f2 = MyStealingPool::inst().post(fx);
+    BOOST_CHECK_EQUAL(f1.get(), 285);
+    BOOST_CHECK_EQUAL(f2.get(), 285);
+}
+
+BOOST_AUTO_TEST_CASE(testStealingSchedule) {
+    atomic<int> counter(0);
+    MyStealingPool::inst().schedule(
+        boost::make_shared<scheduled_functor<ThreadPoolTestFx::counting_handler> >(
+            ThreadPoolTestFx::counting_handler(&counter)),
+        boost::chrono::milliseconds(100));
+    this_thread::sleep(posix_time::milliseconds(500));
+    BOOST_CHECK_EQUAL(counter.load(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(testExecuteWithoutAllocations) {
+    thread_pool shared("shared", 2, thread_pool::shared_queue);
+    thread_pool stealing("stealing", 2, thread_pool::work_stealing);
+    vector<light_future<int> > futures(1000);
+
+    /* Warm up the pools (and queues), then make sure that a smaller burst doesn't allocate at all */
+    for (int i = 0; i < 3; i++) {
+        ThreadPoolTestFx::executeAndWait(shared, 5000);
+        ThreadPoolTestFx::executeAndWait(stealing, 5000);
+        ThreadPoolTestFx::asyncAndWait(shared, futures);
+        ThreadPoolTestFx::asyncAndWait(stealing, futures);
+    }
+    BOOST_CHECK_EQUAL(ThreadPoolTestFx::executeAndWait(shared, 1000), 0);
+    BOOST_CHECK_EQUAL(ThreadPoolTestFx::executeAndWait(stealing, 1000), 0);
+    BOOST_CHECK_EQUAL(ThreadPoolTestFx::asyncAndWait(shared, futures), 0);
+    BOOST_CHECK_EQUAL(ThreadPoolTestFx::asyncAndWait(stealing, futures), 0);
+}
+
+BOOST_AUTO_TEST_CASE(testPostAnyCallable) {
+    future<int> f = MyStealingPool::inst().post(boost::bind(ThreadPoolTestFx::square, 7));
+    BOOST_CHECK_EQUAL(f.get(), 49);
+}
+
+BOOST_AUTO_TEST_CASE(testParallelFor) {
+    vector<int> values(10000, -1);
+    parallel_for(MyStealingPool::inst(), 0, 10000, boost::bind(ThreadPoolTestFx::setSquare, &values, _1), 16);
+    for (int i = 0; i < 10000; i++) { BOOST_REQUIRE_EQUAL(values[i], i * i); }
+
+    BOOST_CHECK_THROW(parallel_for(MyStealingPool::inst(), 0, 1000, boost::bind(ThreadPoolTestFx::throwAt, 500, _1)),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(testParallelTransformReduce) {
+    thread_pool pool("reduce", 3);
+    long sum = parallel_transform_reduce(pool, 0, 100000, 5L, ThreadPoolTestFx::add, ThreadPoolTestFx::toLong, 64);
+    BOOST_CHECK_EQUAL(sum, 5L + 100000L * 99999L / 2);
+    BOOST_CHECK_EQUAL(parallel_transform_reduce(pool, 0, 0, 5L, ThreadPoolTestFx::add, ThreadPoolTestFx::toLong), 5L);
+}
+
+BOOST_AUTO_TEST_CASE(testParallelSort) {
+    vector<int> values;
+    for (int i = 0; i < 100000; i++) { values.push_back((i * 7919) % 100003); }
+    vector<int> expected(values);
+    std::sort(expected.begin(), expected.end());
+
+    parallel_sort(MyStealingPool::inst(), values.begin(), values.end(), std::less<int>(), 1000);
+    BOOST_CHECK(values == expected);
+}
+
+BOOST_AUTO_TEST_CASE(testPriorityLanes) {
+    using namespace ThreadPoolTestFx;
+    thread_pool pool("", 1);
+    atomic<bool> open(false);
+    vector<int> order;
+    mutex orderMutex;
+
+    /* Hold the only worker, queue bulk work and then an urgent task, and the urgent task goes first */
+    atomic<int> started(0);
+    pool.execute(gate_task(&open, &started));
+    waitForGates(started, 1);
+    for (int i = 0; i < 50; i++) { pool.execute(ordered_task(&order, &orderMutex, 2), priority_low); }
+    for (int i = 0; i < 50; i++) { pool.execute(ordered_task(&order, &orderMutex, 0), priority_high); }
+    BOOST_CHECK_EQUAL(pool.lanes().depth(priority_low), 50u);
+    BOOST_CHECK_EQUAL(pool.lanes().depth(priority_high), 50u);
+    BOOST_CHECK_EQUAL(pool.lanes().depth(priority_normal), 0u);
+
+    shared_future<int> result = pool.post(boost::bind(square, 7), priority_normal).share();
+    open.store(true);
+    BOOST_CHECK_EQUAL(result.get(), 49);
+    for (;;) {
+        { auto_lock lock(orderMutex); if (order.size() == 100) { break; } }
+        this_thread::yield();
+    }
+
+    /* High work mostly runs first - the low lane isn't starved while the high lane drains */
+    BOOST_CHECK_EQUAL(order.front(), 0);
+    size_t firstLow = find(order.begin(), order.end(), 2) - order.begin();
+    BOOST_CHECK(firstLow <= BOOST_EXT_PRIORITY_STARVATION_LIMIT + 1);
+    BOOST_CHECK_EQUAL(pool.lanes().submitted(priority_low), 50u);
+    BOOST_CHECK_EQUAL(pool.lanes().high_water(priority_high), 50u);
+    BOOST_MESSAGE("First low priority task ran at position " << firstLow);
+}
+
+BOOST_AUTO_TEST_CASE(testPriorityOvertakesUnprioritized) {
+    using namespace ThreadPoolTestFx;
+    thread_pool pool("", 1);
+    atomic<bool> open(false);
+    vector<int> order;
+    mutex orderMutex;
+
+    /* Work posted without a priority skips the empty lanes, but urgent work posted after it still goes first */
+    pool.execute(gate_task(&open));
+    for (int i = 0; i < 50; i++) { pool.execute(ordered_task(&order, &orderMutex, 1)); }
+    pool.execute(ordered_task(&order, &orderMutex, 0), priority_high);
+    BOOST_CHECK_EQUAL(pool.lanes().depth(priority_normal), 0u);
+    open.store(true);
+    for (;;) {
+        { auto_lock lock(orderMutex); if (order.size() == 51) { break; } }
+        this_thread::yield();
+    }
+    BOOST_CHECK_EQUAL(order.front(), 0);
+
+    /* While the lanes hold work, unprioritized work queues in the normal lane - behind urgent work, ahead of low */
+    order.clear();
+    open.store(false);
+    pool.execute(gate_task(&open));
+    pool.execute(ordered_task(&order, &orderMutex, 2), priority_low);
+    for (int i = 0; i < 10; i++) { pool.execute(ordered_task(&order, &orderMutex, 1)); }
+    pool.execute(ordered_task(&order, &orderMutex, 0), priority_high);
+    BOOST_CHECK_EQUAL(pool.lanes().depth(priority_normal), 10u);
+    open.store(true);
+    for (;;) {
+        { auto_lock lock(orderMutex); if (order.size() == 12) { break; } }
+        this_thread::yield();
+    }
+    BOOST_CHECK_EQUAL(order.front(), 0);
+    BOOST_CHECK_EQUAL(order.back(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(testCpuTopology) {
+    BOOST_CHECK(cpu_topology::parse_cpu_list("") == cpu_topology::cpu_set());
+    cpu_topology::cpu_set cpus = cpu_topology::parse_cpu_list("0-2, 8,10-11\n");
+    int expected[] = { 0, 1, 2, 8, 10, 11 };
+    BOOST_CHECK_EQUAL_COLLECTIONS(cpus.begin(), cpus.end(), expected, expected + 6);
+
+    vector<cpu_topology::cpu_set> nodes;
+    nodes.push_back(cpu_topology::parse_cpu_list("0-3"));
+    nodes.push_back(cpu_topology::parse_cpu_list("4-7"));
+    cpu_topology topology(nodes);
+    BOOST_CHECK_EQUAL(topology.num_nodes(), 2u);
+    BOOST_CHECK_EQUAL(topology.node_of(5), 1u);
+    BOOST_CHECK_EQUAL(topology.cpus().size(), 8u);
+    BOOST_CHECK_EQUAL(topology.usable_cpus().size(), 8u);
+
+    /* Only the CPUs in our affinity mask are used for placement */
+    cpu_topology restricted(nodes, cpu_topology::parse_cpu_list("2,5,9"));
+    int usable[] = { 2, 5 };
+    cpus = restricted.usable_cpus();
+    BOOST_CHECK_EQUAL_COLLECTIONS(cpus.begin(), cpus.end(), usable, usable + 2);
+
+    const cpu_topology& system = cpu_topology::system();
+    BOOST_CHECK(system.num_nodes() >= 1);
+    BOOST_MESSAGE("This machine has " << system.num_nodes() << " node(s) and " << system.cpus().size() << " CPU(s)");
+}
+
+BOOST_AUTO_TEST_CASE(testPinnedPools) {
+    using namespace ThreadPoolTestFx;
+    cpu_topology::cpu_set first(1, cpu_topology::system().usable_cpus().front());
+
+    /* Every worker of a cpuset pool runs on one of the given CPUs */
+    thread_pool pinned("", 2, thread_pool::shared_queue, thread_placement::pin_cpuset(first));
+    for (int i = 0; i < 10; i++) {
+        int cpu = pinned.post(&currentCpu).get();
+        BOOST_CHECK(cpu < 0 || cpu == first.front());
+    }
+
+    thread_pool cores("", 2, thread_pool::work_stealing, thread_placement::pin_cores());
+    BOOST_CHECK_EQUAL(cores.post(boost::bind(square, 3)).get(), 9);
+
+    /* A numa pool has one sub-pool per node (as far as it has threads for them) */
+    thread_pool numa("", 4, thread_pool::shared_queue, thread_placement::per_numa_node());
+    BOOST_CHECK_EQUAL(numa.num_nodes(), std::min<size_t>(4, cpu_topology::system().num_nodes()));
+    BOOST_CHECK_EQUAL(numa.size(), 4);
+    vector<shared_future<int> > futures;
+    for (int i = 0; i < 100; i++) { futures.push_back(numa.post(boost::bind(square, i), submitter_node).share()); }
+    for (int i = 0; i < 100; i++) { BOOST_CHECK_EQUAL(futures[i].get(), i * i); }
+}
+
+BOOST_AUTO_TEST_CASE(testElasticPool) {
+    using namespace ThreadPoolTestFx;
+    thread_pool pool("", elastic_limits(0, 4, chrono::milliseconds(5), chrono::milliseconds(100)));
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+
+    /* Nothing runs until the first post */
+    BOOST_CHECK_EQUAL(pool.live_size(), 0);
+    BOOST_CHECK_EQUAL(pool.post(boost::bind(square, 4)).get(), 16);
+    BOOST_CHECK_EQUAL(pool.live_size(), 1);
+
+    /* Blocked work which is waiting on queued work makes the pool grow (up to its maximum) */
+    atomic<bool> open(false);
+    for (int i = 0; i < 6; i++) { pool.execute(gate_task(&open)); }
+    BOOST_CHECK(waitForLive(pool, 4));
+    open.store(true);
+
+    /* And once it is idle again, it shrinks back down */
+    BOOST_CHECK(waitForLive(pool, 1));
+    BOOST_CHECK_EQUAL(pool.post(boost::bind(square, 5)).get(), 25);
+
+#if !defined(BOOST_EXT_THREAD_POOL_NO_METRICS)
+    /* Regrown threads take over the retired ones' numbers, so each blocked thread has its own metrics slot */
+    vector<boost::uint64_t> before;
+    pool_stats stats = pool.stats();
+    for (size_t i = 0; i < stats.m_workers.size(); i++) { before.push_back(stats.m_workers[i].m_tasks); }
+    open.store(false);
+    for (int i = 0; i < 4; i++) { pool.execute(gate_task(&open)); }
+    BOOST_CHECK(waitForLive(pool, 4));
+    open.store(true);
+    while (pool.stats().m_completed < stats.m_completed + 4) { this_thread::yield(); }
+    stats = pool.stats();
+    BOOST_REQUIRE_EQUAL(stats.m_workers.size(), 4u);
+    for (size_t i = 0; i < stats.m_workers.size(); i++) { BOOST_CHECK_EQUAL(stats.m_workers[i].m_tasks, before[i] + 1); }
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(testCpuBudget) {
+    BOOST_CHECK_CLOSE(cpu_budget::parse_cpu_max("150000 100000\n"), 1.5, 0.001);
+    BOOST_CHECK_EQUAL(cpu_budget::parse_cpu_max("max 100000"), -1);
+    BOOST_CHECK_CLOSE(cpu_budget::parse_quota("50000\n", "100000\n"), 0.5, 0.001);
+    BOOST_CHECK_EQUAL(cpu_budget::parse_quota("-1", "100000"), -1);
+
+    /* The smallest of what was detected wins, and quotas are rounded up */
+    BOOST_CHECK_EQUAL(cpu_budget(8, 4, 1.5).threads(), 2);
+    BOOST_CHECK_EQUAL(cpu_budget(8, 4, -1).threads(), 4);
+    BOOST_CHECK_EQUAL(cpu_budget(-1, -1, 0.5).threads(), 1);
+    BOOST_CHECK_EQUAL(cpu_budget(-1, -1, -1).threads(), 1);
+
+    BOOST_CHECK(cpu_budget::system().threads() >= 1);
+    BOOST_MESSAGE("This process has a budget of " << cpu_budget::system());
+
+    /* Pools are only sized to the budget when asked */
+    BOOST_CHECK_EQUAL(thread_pool::budget_size(), cpu_budget::system().threads());
+    thread_pool budgeted("", thread_pool::budget_size());
+    BOOST_CHECK_EQUAL(budgeted.size(), cpu_budget::system().threads());
+    thread_pool defaulted;
+    BOOST_CHECK_EQUAL(defaulted.size(), 5);
+
+    /* Named pools can be resized from the environment */
+    BOOST_CHECK_EQUAL(cpu_budget::env_name("my-pool2"), "BOOST_EXT_THREAD_POOL_MY_POOL2");
+    setenv("BOOST_EXT_THREAD_POOL_ENV_POOL", "3", 1);
+    thread_pool pool("env.pool", 1);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    unsetenv("BOOST_EXT_THREAD_POOL_ENV_POOL");
+}
+
+#if !defined(BOOST_EXT_THREAD_POOL_NO_METRICS)
+BOOST_AUTO_TEST_CASE(testPoolStats) {
+    using namespace ThreadPoolTestFx;
+    thread_pool pool("statsPool", 2);
+
+    /* Hold both workers, so that the queued tasks have to wait */
+    atomic<bool> open(false);
+    pool.execute(gate_task(&open));
+    pool.execute(gate_task(&open));
+    for (int i = 0; i < 10; i++) { pool.execute(boost::bind(square, i)); }
+    this_thread::sleep_for(chrono::milliseconds(20));
+    BOOST_CHECK_EQUAL(pool.stats().m_submitted, 12u);
+    BOOST_CHECK(pool.stats().m_queued >= 10);
+    open.store(true);
+
+    while (pool.stats().m_completed < 12) { this_thread::yield(); }
+    pool_stats stats = pool.stats();
+    BOOST_CHECK_EQUAL(stats.m_name, "statsPool");
+    BOOST_CHECK_EQUAL(stats.m_threads, 2);
+    BOOST_CHECK_EQUAL(stats.m_queued, 0);
+    BOOST_CHECK_EQUAL(stats.m_wait.count(), 12u);
+    BOOST_CHECK_EQUAL(stats.m_run.count(), 12u);
+    BOOST_CHECK(stats.m_wait.max() >= chrono::milliseconds(10));
+    BOOST_CHECK(stats.m_run.percentile(100) >= chrono::milliseconds(10));
+    BOOST_CHECK_EQUAL(stats.m_workers.size(), 2u);
+    BOOST_CHECK_EQUAL(stats.m_workers[0].m_tasks + stats.m_workers[1].m_tasks, 12u);
+    BOOST_CHECK(stats.busy_ratio() > 0 && stats.busy_ratio() <= 1);
+
+    /* Scheduled tasks report how late their timers fired */
+    atomic<int> counter(0);
+    pool.schedule(boost::make_shared<scheduled_functor<counting_handler> >(counting_handler(&counter)),
+                  chrono::milliseconds(5));
+    while (counter.load() == 0) { this_thread::yield(); }
+    BOOST_CHECK_EQUAL(pool.stats().m_timerLateness.count(), 1u);
+    BOOST_MESSAGE(pool.stats());
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(testBoundedQueue) {
+    using namespace ThreadPoolTestFx;
+    thread_pool pool("boundedPool", 1);
+
+    /* Hold the only worker, and fill the queue */
+    atomic<bool> open(false);
+    atomic<int> started(0);
+    pool.execute(gate_task(&open, &started));
+    waitForGates(started, 1);
+    pool.set_queue_limit(queue_limit(2, overflow_reject));
+    shared_future<int> first = pool.post(boost::bind(square, 1)).share();
+    shared_future<int> second = pool.post(boost::bind(square, 2)).share();
+    BOOST_CHECK(!pool.try_execute(boost::bind(square, 3)));
+    BOOST_CHECK_THROW(pool.post(boost::bind(square, 3)), queue_full);
+    BOOST_CHECK_EQUAL(pool.stats().m_rejected, 2u);
+
+    /* Blocking gives up after its timeout */
+    pool.set_queue_limit(queue_limit(2, overflow_block, chrono::milliseconds(20)));
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    BOOST_CHECK(!pool.try_execute(boost::bind(square, 3), priority_high));
+    BOOST_CHECK(chrono::steady_clock::now() - start >= chrono::milliseconds(20));
+
+    /* Dropping pushes out the oldest of the least urgent tasks, which breaks its promise */
+    pool.set_queue_limit(queue_limit(2, overflow_drop_oldest));
+    shared_future<int> third = pool.post(boost::bind(square, 3), priority_high).share();
+    BOOST_CHECK_EQUAL(pool.stats().m_dropped, 1u);
+    BOOST_CHECK_THROW(first.get(), broken_promise);
+    BOOST_CHECK_EQUAL(pool.stats().m_queueHighWater, 2u);
+
+    open.store(true);
+    BOOST_CHECK_EQUAL(second.get(), 4);
+    BOOST_CHECK_EQUAL(third.get(), 9);
+
+    /* A blocked submitter gets in once a worker makes room */
+    open.store(false);
+    pool.execute(gate_task(&open, &started));
+    waitForGates(started, 2);
+    pool.set_queue_limit(queue_limit(1, overflow_block));
+    this_thread::sleep_for(chrono::milliseconds(10));
+    shared_future<int> fourth = pool.post(boost::bind(square, 4)).share();
+    boost::thread opener(boost::bind(openAfter, &open, 20));
+    shared_future<int> fifth = pool.post(boost::bind(square, 5)).share();
+    opener.join();
+    BOOST_CHECK_EQUAL(fourth.get() + fifth.get(), 41);
+
+    /* The pool's only worker can't wait for room it would have to make itself - what doesn't fit, it runs */
+    atomic<int> counter(0);
+    boost::uint64_t rejected = pool.stats().m_rejected;
+    BOOST_CHECK(pool.post(boost::bind(executeFromWorker, &pool, &counter, 10)).get() >= 9);
+    while (counter.load() < 10) { this_thread::yield(); }
+    BOOST_CHECK_EQUAL(pool.stats().m_rejected, rejected);
+    BOOST_MESSAGE(pool.stats());
+}
+
+BOOST_AUTO_TEST_CASE(testParallelForOnBoundedQueue) {
+    using namespace ThreadPoolTestFx;
+    thread_pool pool("boundedParallel", 2);
+
+    /* Hold both workers, and leave room for just one helper - the calling thread does the rest */
+    atomic<bool> open(false);
+    atomic<int> started(0);
+    pool.execute(gate_task(&open, &started));
+    pool.execute(gate_task(&open, &started));
+    waitForGates(started, 2);
+    pool.set_queue_limit(queue_limit(1, overflow_reject));
+
+    vector<int> values(1000, -1);
+    parallel_for(pool, 0, 1000, boost::bind(setSquare, &values, _1), 1);
+    for (int i = 0; i < 1000; i++) { BOOST_REQUIRE_EQUAL(values[i], i * i); }
+    BOOST_CHECK_EQUAL(pool.stats().m_rejected, 1u);
+    open.store(true);
+}
+
+BOOST_AUTO_TEST_CASE(testLightFutures) {
+    using namespace ThreadPoolTestFx;
+    thread_pool pool("futurePool", 2);
+
+    /* Continuations run on the pool, without anyone waiting in between */
+    light_future<int> chained = pool.async(boost::bind(square, 3)).then(pool, &addOne).then(pool, &addOne);
+    BOOST_CHECK_EQUAL(chained.get(), 11);
+
+    /* Attached before the value is set, the continuation runs on the thread which sets it */
+    light_promise<int> promise;
+    light_future<int> inlined = promise.get_future().then(&addOne);
+    BOOST_CHECK(!inlined.is_ready());
+    promise.set_value(1);
+    BOOST_CHECK(inlined.is_ready());
+    BOOST_CHECK_EQUAL(inlined.get(), 2);
+    BOOST_CHECK_THROW(promise.set_value(2), promise_already_satisfied);
+    BOOST_CHECK_EQUAL(make_ready_light_future(4).then(&addOne).get(), 5);
+
+    /* Exceptions and broken promises reach the future (and pass through continuations) */
+    BOOST_CHECK_THROW(pool.async(&throwing).then(pool, &addOne).get(), boost_ext::exception);
+    light_future<int> broken;
+    { light_promise<int> dropped; broken = dropped.get_future(); }
+    BOOST_CHECK_THROW(broken.get(), broken_promise);
+    BOOST_CHECK(broken.has_exception());
+    light_promise<copy_throwing> badCopy;
+    light_future<copy_throwing> badCopyFuture = badCopy.get_future();
+    badCopy.set_value(copy_throwing(true));
+    BOOST_CHECK_THROW(badCopyFuture.get(), boost_ext::exception);
+
+    /* A throwing on_ready callback throws out of set_value, but only after the waiters have been woken */
+    light_promise<int> callbackPromise;
+    atomic<bool> woke(false);
+    callbackPromise.get_future().on_ready(&throwing);
+    pool.execute(waiting_task(callbackPromise.get_future(), &woke));
+    this_thread::sleep_for(chrono::milliseconds(20));
+    BOOST_CHECK_THROW(callbackPromise.set_value(1), boost_ext::exception);
+    for (int i = 0; i < 2000 && !woke.load(); i++) { this_thread::sleep_for(chrono::milliseconds(1)); }
+    BOOST_CHECK(woke.load());
+
+    /* when_all waits for everything */
+    vector<light_future<int> > futures;
+    for (int i = 0; i < 10; i++) { futures.push_back(pool.async(boost::bind(square, i))); }
+    BOOST_CHECK_EQUAL(when_all(futures.begin(), futures.end()).then(pool, &sumAll).get(), 285);
+    BOOST_CHECK_EQUAL(when_all(futures.end(), futures.end()).get().size(), 0u);
+
+    /* when_any finishes with the first */
+    atomic<bool> open(false);
+    vector<light_future<void> > gates;
+    gates.push_back(pool.async(gate_task(&open)));
+    gates.push_back(pool.async(boost::bind(this_thread::sleep_for<boost::int64_t, boost::milli>,
+                                           chrono::milliseconds(1))));
+    when_any_result<void> any = when_any(gates.begin(), gates.end()).get();
+    BOOST_CHECK_EQUAL(any.m_index, 1u);
+    BOOST_CHECK(!any.m_futures[0].is_ready());
+    open.store(true);
+    any.m_futures[0].wait();
+}
+
+BOOST_AUTO_TEST_CASE(testStrands) {
+    using namespace ThreadPoolTestFx;
+    thread_pool pool("strandPool", 4);
+
+    /* Tasks on a strand run one at a time, in order, while other strands run alongside */
+    serial_executor strands[] = { pool.make_strand(), pool.make_strand() };
+    atomic<int> active[2], overlaps(0);
+    vector<int> order[2];
+    active[0].store(0), active[1].store(0);
+    for (int i = 0; i < 2000; i++) {
+        int s = i % 2;
+        strands[s].execute(serial_task(&active[s], &overlaps, &order[s], i / 2, &strands[s]));
+    }
+    light_promise<int> done[2];
+    for (int s = 0; s < 2; s++) {
+        strands[s].execute(boost::bind(&light_promise<int>::set_value, &done[s], s));
+    }
+    BOOST_CHECK_EQUAL(done[0].get_future().get() + done[1].get_future().get(), 1);
+    BOOST_CHECK_EQUAL(overlaps.load(), 0);
+    for (int s = 0; s < 2; s++) {
+        BOOST_CHECK_EQUAL(order[s].size(), 1000u);
+        for (size_t i = 0; i < order[s].size(); i++) { BOOST_CHECK_EQUAL(order[s][i], (int) i); }
+    }
+    BOOST_CHECK(!strands[0].running_in_this_thread());
+    BOOST_CHECK(strands[0] != strands[1]);
+
+    /* Keyed strands - the same key always gets the same strand */
+    BOOST_CHECK(pool.strand(std::string("account-1")) == pool.strand(std::string("account-1")));
+    BOOST_CHECK(pool.strand(42) == pool.strand(42));
+
+    /* Strands are executors, so continuations can run on them */
+    light_future<int> next = pool.async(boost::bind(square, 5)).then(pool.strand(7), &addOne);
+    BOOST_CHECK_EQUAL(next.get(), 26);
+}
+
+BOOST_AUTO_TEST_CASE(testCancellation) {
+    using namespace ThreadPoolTestFx;
+    thread_pool pool("cancelPool", 1);
+    BOOST_CHECK(!cancellation_token().can_be_cancelled());
+    BOOST_CHECK(!cancellation_token().is_cancelled());
+
+    /* Queued work is skipped once its token is cancelled */
+    cancellation_source source;
+    cancellation_token token = source.token();
+    atomic<bool> open(false);
+    atomic<int> counter(0), callbacks(0);
+    pool.execute(gate_task(&open));
+    shared_future<int> cancelled = pool.post(boost::bind(square, 2), token).share();
+    pool.execute(counting_task(&counter), token);
+    shared_future<int> uncancelled = pool.post(boost::bind(square, 3), cancellation_token()).share();
+    token.on_cancel(counting_task(&callbacks));
+    BOOST_CHECK(source.cancel());
+    BOOST_CHECK(!source.cancel());
+    BOOST_CHECK(token.is_cancelled());
+    BOOST_CHECK_EQUAL(callbacks.load(), 1);
+    token.on_cancel(counting_task(&callbacks));
+    BOOST_CHECK_EQUAL(callbacks.load(), 2);
+    open.store(true);
+    BOOST_CHECK_THROW(cancelled.get(), task_cancelled);
+    BOOST_CHECK_EQUAL(uncancelled.get(), 9);
+    BOOST_CHECK_EQUAL(counter.load(), 0);
+    BOOST_CHECK_THROW(token.throw_if_cancelled(), task_cancelled);
+
+    /* Timers are cancelled straight away - wheel and precise */
+    cancellation_source timers;
+    atomic<int> aborted(0);
+    pool.schedule(boost::make_shared<scheduled_functor<aborted_handler> >(aborted_handler(&aborted),
+                                                                         scheduled_task::wheel_timer),
+                  chrono::seconds(30), timers.token());
+    pool.schedule(boost::make_shared<scheduled_functor<aborted_handler> >(aborted_handler(&aborted)),
+                  chrono::seconds(30), timers.token());
+    BOOST_CHECK_EQUAL(pool.wheel().size(), 1u);
+    timers.cancel();
+    BOOST_CHECK_EQUAL(pool.wheel().size(), 0u);
+    for (int i = 0; i < 2000 && aborted.load() < 2; i++) { this_thread::sleep_for(chrono::milliseconds(1)); }
+    BOOST_CHECK_EQUAL(aborted.load(), 2);
+
+    /* Scheduling with a cancelled token aborts at once */
+    pool.schedule(boost::make_shared<scheduled_functor<aborted_handler> >(aborted_handler(&aborted),
+                                                                         scheduled_task::wheel_timer),
+                  chrono::seconds(30), timers.token());
+    BOOST_CHECK_EQUAL(pool.wheel().size(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(testBlockingRegion) {
+    using namespace ThreadPoolTestFx;
+    const thread_pool::queue_policy policies[] = { thread_pool::shared_queue, thread_pool::work_stealing };
+    for (int i = 0; i < 2; i++) {
+        /* A single worker blocks, and a stand-in runs the rest of the work meanwhile */
+        thread_pool pool("blockingPool", 1, policies[i]);
+        atomic<bool> open(false);
+        pool.execute(blocked_task(&open));
+        BOOST_CHECK_EQUAL(pool.post(boost::bind(square, 4)).get(), 16);
+        open.store(true);
+        BOOST_CHECK_EQUAL(pool.post(boost::bind(square, 5)).get(), 25);
+        pool_stats stats = pool.stats();
+        BOOST_CHECK_EQUAL(stats.m_blockingRegions, 1u);
+        BOOST_CHECK_EQUAL(stats.m_compensations, 1u);
+
+        /* A region which returns at once isn't compensated, and the next long one reuses the parked stand-in */
+        BOOST_CHECK_EQUAL(pool.post(boost::bind(quickRegion, 6)).get(), 6);
+        BOOST_CHECK_EQUAL(pool.stats().m_compensations, 1u);
+        open.store(false);
+        pool.execute(blocked_task(&open));
+        BOOST_CHECK_EQUAL(pool.post(boost::bind(square, 7)).get(), 49);
+        /* Whichever thread took the blocked task, keep it blocked until the monitor has compensated it */
+        for (int j = 0; j < 2000 && pool.stats().m_compensations < 2u; j++) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        open.store(true);
+        BOOST_CHECK_EQUAL(pool.stats().m_compensations, 2u);
+    }
+
+    /* Regions off the pool cost nothing */
+    { blocking_region region; }
+}
+
+BOOST_AUTO_TEST_CASE(testBlockingRegionCleanup) {
+    using namespace ThreadPoolTestFx;
+    typedef boost_ext::detail::blocking_compensator compensator_t;
+    compensator_t compensator(&idleLoopFor, compensator_t::callback(), compensator_t::callback(), 4, 50);
+
+    /* A worker blocks long enough to be compensated, then exits - taking its slot with it */
+    atomic<bool> open(false);
+    thread worker(boost::bind(attachedWorker, &compensator, &open));
+    for (int i = 0; i < 2000 && compensator.compensations() < 1u; i++) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    BOOST_CHECK_EQUAL(compensator.compensations(), 1u);
+    BOOST_CHECK_EQUAL(compensator.stand_ins(), 1u);
+    open.store(true);
+    worker.join();
+
+    /* And the stand-in exits once it has been parked for the idle timeout */
+    for (int i = 0; i < 2000 && compensator.stand_ins() > 0; i++) { this_thread::sleep_for(chrono::milliseconds(1)); }
+    BOOST_CHECK_EQUAL(compensator.stand_ins(), 0u);
+    BOOST_CHECK_EQUAL(compensator.slots(), 0u);
+}
+
+#if !defined(BOOST_EXT_THREAD_POOL_NO_METRICS)
+BOOST_AUTO_TEST_CASE(testStallWatchdog) {
+    using namespace ThreadPoolTestFx;
+    thread_pool pool("stallPool", 2);
+    stall_report last;
+    atomic<int> reported(0);
+    pool.enable_watchdog(chrono::milliseconds(20), stall_recorder(&last, &reported));
+
+    /* Quick tasks go unnoticed */
+    for (int i = 0; i < 100; i++) { pool.post(boost::bind(square, i), BOOST_EXT_TASK_SITE).get(); }
+    BOOST_CHECK_EQUAL(reported.load(), 0);
+
+    /* A stuck task is flagged once, along with where it was posted from */
+    atomic<bool> open(false);
+    int line = __LINE__ + 1;
+    pool.execute(gate_task(&open), BOOST_EXT_TASK_SITE);
+    for (int i = 0; i < 2000 && reported.load() == 0; i++) { this_thread::sleep_for(chrono::milliseconds(1)); }
+    this_thread::sleep_for(chrono::milliseconds(30));
+    open.store(true);
+    BOOST_REQUIRE_EQUAL(reported.load(), 1);
+    BOOST_CHECK_EQUAL(last.m_pool, "stallPool");
+    BOOST_CHECK_EQUAL(last.m_site.m_line, line);
+    BOOST_CHECK(std::string(last.m_site.m_file).find("ThreadPoolTest") != std::string::npos);
+    BOOST_CHECK(last.m_elapsed >= chrono::milliseconds(20));
+    BOOST_CHECK_EQUAL(pool.stats().m_stalls, 1u);
+
+    /* The summary has the slowest sites first */
+    atomic<bool> unsited(false);
+    pool.execute(gate_task(&unsited));
+    boost::thread opener(boost::bind(openAfter, &unsited, 100));
+    for (int i = 0; i < 2000 && reported.load() < 2; i++) { this_thread::sleep_for(chrono::milliseconds(1)); }
+    opener.join();
+    vector<site_summary> sites = pool.slowest_sites();
+    BOOST_REQUIRE_EQUAL(sites.size(), 2u);
+    BOOST_CHECK(!sites[0].m_site.known());
+    BOOST_CHECK_EQUAL(sites[1].m_site.m_line, line);
+    BOOST_CHECK_EQUAL(sites[1].m_stalls, 1u);
+    BOOST_CHECK(sites[0].m_longest >= sites[1].m_longest);
+
+    pool.disable_watchdog();
+    BOOST_CHECK(pool.slowest_sites().empty());
+
+    /* A handler may turn the watchdog off */
+    atomic<int> disabled(0);
+    pool.enable_watchdog(chrono::milliseconds(20), watchdog_disabler(&pool, &disabled));
+    atomic<bool> stuck(false);
+    pool.execute(gate_task(&stuck));
+    for (int i = 0; i < 2000 && disabled.load() == 0; i++) { this_thread::sleep_for(chrono::milliseconds(1)); }
+    stuck.store(true);
+    BOOST_CHECK_EQUAL(disabled.load(), 1);
+    BOOST_CHECK(pool.slowest_sites().empty());
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(testBatcher) {
+    using namespace ThreadPoolTestFx;
+    thread_pool pool("batchPool", 4);
+    atomic<long> sum(0);
+    atomic<int> items(0), overlaps(0);
+    batcher<int> batches(pool, batch_sink(&sum, &items, &overlaps), 100, chrono::milliseconds(20));
+    BOOST_CHECK_EQUAL(batches.max_batch(), 100u);
+
+    /* Many producers - everything arrives, in batches of up to 100, one batch at a time */
+    boost::thread_group producers;
+    for (int i = 0; i < 4; i++) { producers.create_thread(boost::bind(addAll, &batches, 10000)); }
+    producers.join_all();
+    for (int i = 0; i < 2000 && items.load() < 40000; i++) { this_thread::sleep_for(chrono::milliseconds(1)); }
+    BOOST_CHECK_EQUAL(items.load(), 40000);
+    BOOST_CHECK_EQUAL(sum.load(), 4 * 50005000L);
+    BOOST_CHECK_EQUAL(overlaps.load(), 0);
+    batcher_stats stats = batches.stats();
+    BOOST_CHECK_EQUAL(stats.m_items, 40000u);
+    BOOST_CHECK_EQUAL(stats.m_delivered, 40000u);
+    BOOST_CHECK(stats.m_batches >= 400u);
+    BOOST_CHECK(stats.m_largestBatch <= 100u);
+    BOOST_CHECK(stats.m_sizeFlushes > 0u);
+    BOOST_CHECK_EQUAL(batches.pending(), 0u);
+
+    /* A few items are flushed by the timer */
+    addAll(&batches, 5);
+    BOOST_CHECK_EQUAL(batches.pending(), 5u);
+    for (int i = 0; i < 2000 && items.load() < 40005; i++) { this_thread::sleep_for(chrono::milliseconds(1)); }
+    BOOST_CHECK_EQUAL(items.load(), 40005);
+    BOOST_CHECK(batches.stats().m_timerFlushes > 0u);
+    BOOST_CHECK(batches.stats().m_latency.max() >= chrono::milliseconds(10));
+
+    /* And a manual flush doesn't wait */
+    addAll(&batches, 3);
+    batches.flush();
+    for (int i = 0; i < 2000 && items.load() < 40008; i++) { this_thread::sleep_for(chrono::milliseconds(1)); }
+    BOOST_CHECK_EQUAL(items.load(), 40008);
+}
+
+BOOST_AUTO_TEST_SUITE_END ();